@@ -8,15 +8,14 @@
 
 using namespace cv;
 
-const int MIN_GOOD_MATCHES = 8;          // Минимальное количество совпадений
-const float MIN_MATCH_RATIO = 0.1f;      // 15% минимального совпадения
-const float GOOD_MATCH_THRESHOLD = 0.7f;  // Порог для соотношения расстояний
-
 MainWindow::MainWindow(QWidget* parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
 {
     ui->setupUi(this);
+    originalDisplay.attach(ui->originalImageLabel);
+    processedDisplay.attach(ui->processedImageLabel);
+    matchedDisplay.attach(ui->matchedImageLabel);
 
     ui->resultLabel->setText("Результат появится здесь");
 
@@ -24,19 +23,37 @@ MainWindow::MainWindow(QWidget* parent)
     ui->preprocessingLevel->setRange(1, 5);
     ui->preprocessingLevel->setValue(3);
     ui->progressBar->setVisible(false);
-
-    // Загрузка базы данных
-    if (!database.load()) {
-        QMessageBox::warning(this,
-            QString::fromUtf8(u8"Ошибка"),
-            QString::fromUtf8(u8"Не удалось загрузить базу данных!"));
-    }
+    ui->cancelButton->setEnabled(false);
+
+    // Одна задача за раз: вытесненная задача успевает завершиться по флагу отмены
+    identificationPool.setMaxThreadCount(1);
+
+    // Загрузка базы данных в фоне: окно показывается сразу, поиск до конца
+    // прогрева отвечает warming. Итог приходит из фонового потока
+    statusBar()->showMessage("Загрузка базы...");
+    database.startLoad([this](bool loaded) {
+        QMetaObject::invokeMethod(this, [this, loaded]() {
+            if (!loaded) {
+                QMessageBox::warning(this,
+                    QString::fromUtf8(u8"Ошибка"),
+                    QString::fromUtf8(u8"Не удалось загрузить базу данных!"));
+            }
+            // И без загруженной базы (её ещё нет) добавлять можно
+            databaseReady = true;
+            showDatabaseStatus();
+            }, Qt::QueuedConnection);
+        });
 
     clearResults();
 }
 
 MainWindow::~MainWindow()
 {
+    // Задача держит ссылку на базу - дожидаемся её до разрушения окна;
+    // прогрев базы сообщает о завершении этому окну - тоже
+    cancelCurrentJob();
+    identificationPool.waitForDone();
+    database.waitWarm();
     delete ui;
 }
 
@@ -49,7 +66,7 @@ void MainWindow::on_selectImageButton_clicked()
     if (!filePath.isEmpty()) {
         currentImage = imread(filePath.toStdString());
         if (!currentImage.empty()) {
-            displayImage(currentImage, ui->originalImageLabel);
+            originalDisplay.show(currentImage);
             clearResults();
         }
         else {
@@ -75,97 +92,129 @@ void MainWindow::on_processButton_clicked()
         return;
     }
 
-    enableControls(false);
+    // Новый запрос вытесняет выполняющийся
+    clearResults();
+    ui->resultLabel->setText("Обработка...");
     ui->progressBar->setVisible(true);
     ui->progressBar->setValue(0);
+    ui->progressBar->setFormat("%p%");
+    ui->cancelButton->setEnabled(true);
 
-    // Имитация прогресса (в реальном приложении замените на фактический прогресс)
-    QTimer::singleShot(100, [this]() { ui->progressBar->setValue(20); });
+    // Показ этапов - модальное окно OpenCV, поэтому только в потоке GUI
+    if (ui->showStepsCheckBox->isChecked()) {
+        ImagePreprocessor::showProcessingSteps(currentImage);
+    }
 
-    // Предобработка
-    bool showSteps = ui->showStepsCheckBox->isChecked();
-    int level = ui->preprocessingLevel->value();
+    IdentificationParams params;
+    params.preprocessing_level = ui->preprocessingLevel->value();
+    params.matched_image_side = MID_IMAGE_SIDE;
+
+    // Версия базы фиксируется до поиска: если базу изменят, пока идёт
+    // поиск, сохранённый результат сразу окажется устаревшим
+    currentCacheKey = IdentificationCache::makeKey(currentImage, params);
+    currentCacheVersion = database.version();
+    IdentificationResult cached;
+    bool nearDuplicate = false;
+    if (resultCache.lookup(currentCacheKey, currentCacheVersion, cached, &nearDuplicate)) {
+        showResult(cached, nearDuplicate ?
+            "(похожее фото уже проверялось)" : "(результат из кэша)");
+        ui->progressBar->setValue(100);
+        finishProcessing();
+        return;
+    }
 
-    QTimer::singleShot(200, [this, showSteps, level]() {
-        if (showSteps) {
-            ImagePreprocessor::showProcessingSteps(currentImage);
-        }
+    IdentificationJob* job = new IdentificationJob(currentImage, database, params, this);
+    connect(job, &IdentificationJob::progressChanged, this,
+        [this, job](int percent, const QString& stage) {
+            onIdentificationProgress(job, percent, stage);
+        });
+    connect(job, &IdentificationJob::finished, this,
+        [this, job]() { onIdentificationFinished(job); });
 
-        processedImage = ImagePreprocessor::preprocess(
-            currentImage, true, true, level);
-
-        displayImage(processedImage, ui->processedImageLabel);
-        ui->progressBar->setValue(40);
-
-        // Извлечение ключевых точек
-        currentFeatures = detectSIFTFeatures(processedImage);
-        ui->progressBar->setValue(60);
-
-        // Поиск в базе данных
-        std::vector<std::string> allSnakes = database.getAllSnakeNames();
-        float bestMatchScore = 0;
-        matchedSnakeName.clear();
-
-        if (!allSnakes.empty()) {
-            for (const auto& name : allSnakes) {
-                SnakeFeatures dbFeatures = database.getSnakeFeatures(name);
-
-                // Пропускаем пустые записи
-                if (dbFeatures.keypoints.empty() || dbFeatures.descriptors.empty()) {
-                    continue;
-                }
-
-                MatchResult match = matchFeatures(currentFeatures,
-                    { dbFeatures.keypoints, dbFeatures.descriptors },
-                    cv::NORM_L2, GOOD_MATCH_THRESHOLD);
-
-                // Рассчитываем процент совпадений относительно меньшего изображения
-                size_t minFeatures = std::min(
-                    currentFeatures.keypoints.size(),
-                    dbFeatures.keypoints.size()
-                );
-
-                float matchRatio = minFeatures > 0 ?
-                    (float)match.good_matches / minFeatures : 0;
-
-                //qDebug() << "Match with" << QString::fromStdString(name)
-                //    << ":" << match.good_matches << "matches,"
-                //    << "ratio:" << matchRatio;
-
-                // Критерии принятия решения
-                if (match.good_matches >= MIN_GOOD_MATCHES &&
-                    matchRatio >= MIN_MATCH_RATIO &&
-                    matchRatio > bestMatchScore)
-                {
-                    bestMatchScore = matchRatio;
-                    matchedSnakeName = name;
-                    matchedSnakeImage = cv::imread(dbFeatures.image_paths[0]);
-                    //drawMatches();
-                }
-            }
-        }
+    currentJob = job;
+    identificationPool.start(job);
+}
 
-        // Отображение результатов
-        if (!matchedSnakeName.empty()) {
-            ui->resultLabel->setText(
-                QString("Совпадение найдено: %1\nСовпадений: %2 (%3%)")
-                .arg(QString::fromStdString(matchedSnakeName))
-                .arg(bestMatchScore)
-                .arg(static_cast<int>(100 * bestMatchScore /
-                    std::min(currentFeatures.keypoints.size(),
-                        database.getSnakeFeatures(matchedSnakeName).keypoints.size()))));
-            displayImage(matchedSnakeImage, ui->matchedImageLabel);
-        }
-        else {
-            ui->resultLabel->setText("Совпадений не найдено\n(недостаточно хороших совпадений)");
-            ui->saveGroupBox->setEnabled(true);
-        }
+void MainWindow::on_cancelButton_clicked()
+{
+    cancelCurrentJob();
+    ui->resultLabel->setText("Поиск отменён");
+    finishProcessing();
+}
 
-        ui->progressBar->setValue(100);
-        QTimer::singleShot(500, [this]() {
+void MainWindow::cancelCurrentJob()
+{
+    if (currentJob) {
+        // Задача удалит себя сама по сигналу finished
+        currentJob->cancel();
+        currentJob = nullptr;
+    }
+}
+
+void MainWindow::onIdentificationProgress(IdentificationJob* job, int percent, const QString& stage)
+{
+    if (job != currentJob) return;
+
+    ui->progressBar->setValue(percent);
+    ui->progressBar->setFormat(stage + " (%p%)");
+}
+
+void MainWindow::onIdentificationFinished(IdentificationJob* job)
+{
+    job->deleteLater();
+
+    // Результаты вытесненных и отменённых задач игнорируем
+    if (job != currentJob || job->isCancelled()) return;
+    currentJob = nullptr;
+
+    const IdentificationResult& result = job->result();
+    if (!result.warming) {
+        resultCache.store(currentCacheKey, currentCacheVersion, result);
+    }
+    showResult(result);
+
+    ui->progressBar->setValue(100);
+    finishProcessing();
+}
+
+void MainWindow::showResult(const IdentificationResult& result, const QString& note)
+{
+    processedImage = result.processed_image;
+    currentFeatures = result.features;
+    processedDisplay.show(processedImage);
+
+    // Отображение результатов
+    QString text;
+    if (result.warming) {
+        text = "База ещё загружается - повторите поиск через несколько секунд";
+    }
+    else if (result.found) {
+        matchedSnakeName = result.name;
+        matchedSnakeImage = result.matched_image;
+        text = QString("Совпадение найдено: %1\nСовпадений: %2 (%3%)")
+            .arg(QString::fromStdString(matchedSnakeName))
+            .arg(result.good_matches)
+            .arg(static_cast<int>(100 * result.match_ratio));
+        matchedDisplay.show(matchedSnakeImage);
+    }
+    else {
+        text = "Совпадений не найдено\n(недостаточно хороших совпадений)";
+        // Сохранить можно только со своими признаками (не для похожего фото)
+        ui->saveGroupBox->setEnabled(databaseReady && !currentFeatures.descriptors.empty());
+    }
+    if (!note.isEmpty()) {
+        text += "\n" + note;
+    }
+    ui->resultLabel->setText(text);
+}
+
+void MainWindow::finishProcessing()
+{
+    ui->cancelButton->setEnabled(false);
+    QTimer::singleShot(500, this, [this]() {
+        if (!currentJob) {
             ui->progressBar->setVisible(false);
-            enableControls(true);
-            });
+        }
         });
 }
 
@@ -176,13 +225,24 @@ void MainWindow::on_saveToDbButton_clicked()
         QMessageBox::warning(this, "Ошибка", "Введите имя змеи!");
         return;
     }
+    if (!databaseReady) {
+        QMessageBox::warning(this, "Ошибка", "База ещё загружается!");
+        return;
+    }
 
     if (database.addSnake(name.toStdString(),
         currentFeatures.keypoints,
         currentFeatures.descriptors,
         currentImage)) {
-        database.save();
-        QMessageBox::information(this, "Успех", "Змея добавлена в базу данных!");
+        bool saved = database.save();
+        showDatabaseStatus();
+        if (saved) {
+            QMessageBox::information(this, "Успех", "Змея добавлена в базу данных!");
+        }
+        else {
+            QMessageBox::warning(this, "Ошибка",
+                "Змея добавлена, но базу или фото не удалось сохранить на диск!");
+        }
         ui->saveGroupBox->setEnabled(false);
     }
     else {
@@ -190,83 +250,24 @@ void MainWindow::on_saveToDbButton_clicked()
     }
 }
 
-void MainWindow::displayImage(const cv::Mat& mat, QLabel* label)
+void MainWindow::showDatabaseStatus()
 {
-    if (mat.empty() || !label) {
-        //qDebug() << "Invalid input: empty image or null label";
-        label->clear();
-        return;
-    }
-
-    try {
-        // Создаем глубокую копию данных OpenCV
-        cv::Mat matCopy = mat.clone();
-
-        // Конвертируем в QImage с явным копированием данных
-        QImage img;
-        if (matCopy.channels() == 1) {
-            img = QImage(matCopy.data, matCopy.cols, matCopy.rows,
-                static_cast<int>(matCopy.step),
-                QImage::Format_Grayscale8).copy();
-        }
-        else {
-            cv::Mat rgb;
-            cv::cvtColor(matCopy, rgb, cv::COLOR_BGR2RGB);
-            img = QImage(rgb.data, rgb.cols, rgb.rows,
-                static_cast<int>(rgb.step),
-                QImage::Format_RGB888).copy();
-        }
-
-        // Проверяем, что изображение создано успешно
-        if (img.isNull()) {
-            //qDebug() << "Failed to create QImage from OpenCV data";
-            label->clear();
-            return;
-        }
-
-        // Масштабируем и отображаем
-        QPixmap pixmap = QPixmap::fromImage(img);
-        if (pixmap.isNull()) {
-            //qDebug() << "Failed to create QPixmap from QImage";
-            label->clear();
-            return;
-        }
-
-        label->setPixmap(pixmap.scaled(
-            label->width(),
-            label->height(),
-            Qt::KeepAspectRatio,
-            Qt::SmoothTransformation
-        ));
-    }
-    catch (const cv::Exception& e) {
-       // qDebug() << "OpenCV exception:" << e.what();
-        label->clear();
-    }
-    catch (const std::exception& e) {
-        //qDebug() << "Standard exception:" << e.what();
-        label->clear();
-    }
-    catch (...) {
-        //qDebug() << "Unknown exception in displayImage";
-        label->clear();
-    }
+    DatabaseMemoryReport report = database.getMemoryReport();
+    statusBar()->showMessage(
+        QString("В базе: %1 змей, память: %2 КБ (%3 КБ на змею)")
+        .arg(report.snakes.size())
+        .arg(report.total() / 1024)
+        .arg(static_cast<int>(report.bytesPerSnake() / 1024)));
 }
 
 void MainWindow::clearResults()
 {
-    ui->processedImageLabel->clear();
-    ui->matchedImageLabel->clear();
+    cancelCurrentJob();
+    ui->cancelButton->setEnabled(false);
+    processedDisplay.clear();
+    matchedDisplay.clear();
     ui->resultLabel->setText("Результат появится здесь");
     ui->saveGroupBox->setEnabled(false);
     ui->snakeNameEdit->clear();
     matchedSnakeName.clear();
-}
-
-void MainWindow::enableControls(bool enable)
-{
-    ui->selectImageButton->setEnabled(enable);
-    ui->processButton->setEnabled(enable);
-    ui->preprocessingLevel->setEnabled(enable);
-    ui->showStepsCheckBox->setEnabled(enable);
 }
\ No newline at end of file
@@ -4,9 +4,14 @@
 #include <QMainWindow>
 #include <QImage>
 #include <QPixmap>
+#include <QStatusBar>
+#include <QThreadPool>
 #include "image_preprocessing.h"
 #include "snake_database.h"
 #include "image_comparison.h"
+#include "identification_cache.h"
+#include "identification_job.h"
+#include "mat_display.h"
 #include <qlabel.h>
 
 QT_BEGIN_NAMESPACE
@@ -25,18 +30,40 @@ private slots:
     void on_selectImageButton_clicked();
     void on_processButton_clicked();
     void on_saveToDbButton_clicked();
+    void on_cancelButton_clicked();
 
 private:
     Ui::MainWindow* ui;
     SnakeDatabase database;
+    // Прогрев базы закончен (обратный вызов startLoad): до того добавление
+    // ждало бы его на мьютексе писателей и вешало окно
+    bool databaseReady = false;
     cv::Mat currentImage;
     cv::Mat processedImage;
     FeaturePoints currentFeatures;
     std::string matchedSnakeName;
     cv::Mat matchedSnakeImage;
 
-    void displayImage(const cv::Mat& mat, QLabel* label);
+    // Поиск выполняется в отдельном пуле; новый запрос отменяет текущий
+    QThreadPool identificationPool;
+    IdentificationJob* currentJob = nullptr;
+
+    // Повторно отправленные фото берутся из кэша без поиска
+    IdentificationCache resultCache;
+    CacheKey currentCacheKey;
+    uint64_t currentCacheVersion = 0;
+
+    // Кадры держатся без копий, pixmap пересчитывается при смене размера
+    MatDisplay originalDisplay;
+    MatDisplay processedDisplay;
+    MatDisplay matchedDisplay;
+
     void clearResults();
-    void enableControls(bool enable);
+    void cancelCurrentJob();
+    void onIdentificationProgress(IdentificationJob* job, int percent, const QString& stage);
+    void onIdentificationFinished(IdentificationJob* job);
+    void showResult(const IdentificationResult& result, const QString& note = QString());
+    void finishProcessing();
+    void showDatabaseStatus();
 };
 #endif // MAINWINDOW_H
\ No newline at end of file
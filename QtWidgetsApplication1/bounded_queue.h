@@ -0,0 +1,136 @@
+﻿#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Ограниченная lock-free очередь MPMC (схема Д. Вьюкова: кольцевой буфер
+// с порядковым номером в каждой ячейке). tryPush/tryPop не блокируются;
+// push/pop ждут (spin + yield), пока не появится место/элемент или очередь
+// не закроют. Ёмкость округляется вверх до степени двойки.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity)
+        : cells_(roundUpToPowerOfTwo(capacity < 2 ? 2 : capacity))
+        , mask_(cells_.size() - 1) {
+        for (size_t i = 0; i < cells_.size(); ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    bool tryPush(T&& value) {
+        Cell* cell;
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) {
+                return false; // очередь заполнена
+            }
+            else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& value) {
+        Cell* cell;
+        size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) {
+                return false; // очередь пуста
+            }
+            else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(cell->value);
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Блокирующая вставка. false - очередь закрыта, элемент не принят.
+    bool push(T&& value) {
+        for (int spins = 0; ; ++spins) {
+            if (closed_.load(std::memory_order_acquire)) return false;
+            if (tryPush(std::move(value))) return true;
+            backoff(spins);
+        }
+    }
+
+    // Блокирующее извлечение. false - очередь закрыта и пуста.
+    bool pop(T& value) {
+        for (int spins = 0; ; ++spins) {
+            if (tryPop(value)) return true;
+            if (closed_.load(std::memory_order_acquire)) {
+                // Элемент мог появиться между tryPop и проверкой флага
+                return tryPop(value);
+            }
+            backoff(spins);
+        }
+    }
+
+    // После закрытия push отклоняется, pop дочитывает остаток
+    void close() { closed_.store(true, std::memory_order_release); }
+    bool isClosed() const { return closed_.load(std::memory_order_acquire); }
+
+    size_t capacity() const { return cells_.size(); }
+
+    // Приблизительный размер (для метрик)
+    size_t sizeApprox() const {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static size_t roundUpToPowerOfTwo(size_t v) {
+        size_t p = 1;
+        while (p < v) p <<= 1;
+        return p;
+    }
+
+    static void backoff(int spins) {
+        if (spins < 64) {
+            std::this_thread::yield();
+        }
+        else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    std::vector<Cell> cells_;
+    const size_t mask_;
+    alignas(64) std::atomic<size_t> head_{ 0 };
+    alignas(64) std::atomic<size_t> tail_{ 0 };
+    std::atomic<bool> closed_{ false };
+};
+
+#endif // BOUNDED_QUEUE_H
@@ -0,0 +1,83 @@
+﻿#include "descriptor_matcher.h"
+#include "tracing.h"
+
+using namespace cv;
+using namespace std;
+
+template <typename T, int Dim>
+static bool dispatchNorm(const Mat& query, const Mat& train, int normType, int k, DMatch* out) {
+    switch (normType) {
+    case NORM_L2: Matcher<T, Dim, DistanceNorm::L2>::knnMatch(query, train, k, out); return true;
+    case NORM_L1: Matcher<T, Dim, DistanceNorm::L1>::knnMatch(query, train, k, out); return true;
+    default: return false;
+    }
+}
+
+static bool dispatchSpecialized(const Mat& query, const Mat& train, int normType, int k, DMatch* out) {
+    if (k > MATCHER_MAX_K) return false;
+    switch (train.depth()) {
+    case CV_32F:
+        if (normType != NORM_L2) return false;
+        switch (train.cols) {
+        case SIFT_DESCRIPTOR_SIZE: SiftMatcher::knnMatch(query, train, k, out); return true;
+        case 64: Matcher<float, 64, DistanceNorm::L2>::knnMatch(query, train, k, out); return true;
+        case 32: Matcher<float, 32, DistanceNorm::L2>::knnMatch(query, train, k, out); return true;
+        default: return false;
+        }
+    case CV_8U:
+        if (normType == NORM_HAMMING && train.cols == 32) {
+            OrbMatcher::knnMatch(query, train, k, out);
+            return true;
+        }
+        return train.cols == SIFT_DESCRIPTOR_SIZE &&
+            dispatchNorm<uint8_t, SIFT_DESCRIPTOR_SIZE>(query, train, normType, k, out);
+    case CV_16F:
+        return train.cols == SIFT_DESCRIPTOR_SIZE &&
+            dispatchNorm<uint16_t, SIFT_DESCRIPTOR_SIZE>(query, train, normType, k, out);
+    default:
+        return false;
+    }
+}
+
+static void knnMatchGeneric(const Mat& query, const Mat& train, int normType, int k,
+    vector<vector<DMatch>>& matches) {
+    if (k == 2 && (train.depth() == CV_8U || train.depth() == CV_16F) &&
+        (normType == NORM_L2 || normType == NORM_L1)) {
+        knnMatchQuantized(query, train, normType, matches);
+    }
+    else {
+        BFMatcher(normType).knnMatch(query, train, matches, k);
+    }
+}
+
+bool knnMatchDescriptors(const Mat& query, const Mat& train, int normType, int k,
+    vector<DMatch>& matches) {
+    SNAKE_TRACE_SCOPE("match.knn");
+    matches.clear();
+    if (query.empty() || train.empty() || k <= 0) return false;
+    CV_Assert(query.type() == train.type() && query.cols == train.cols);
+
+    matches.resize(static_cast<size_t>(query.rows) * k);
+    if (dispatchSpecialized(query, train, normType, k, matches.data())) return true;
+
+    vector<vector<DMatch>> nested;
+    knnMatchGeneric(query, train, normType, k, nested);
+    for (int q = 0; q < query.rows; ++q) {
+        for (int i = 0; i < k; ++i) {
+            matches[static_cast<size_t>(q) * k + i] = q < static_cast<int>(nested.size()) &&
+                i < static_cast<int>(nested[q].size()) ? nested[q][i] : DMatch(q, -1, FLT_MAX);
+        }
+    }
+    return false;
+}
+
+bool knnMatchDescriptors(const Mat& query, const Mat& train, int normType, int k,
+    vector<vector<DMatch>>& matches) {
+    vector<DMatch> flat;
+    bool specialized = knnMatchDescriptors(query, train, normType, k, flat);
+    matches.assign(query.empty() || train.empty() || k <= 0 ? 0 : query.rows, vector<DMatch>());
+    for (size_t i = 0; i < flat.size(); ++i) {
+        if (flat[i].trainIdx >= 0) matches[i / k].push_back(flat[i]);
+    }
+    return specialized;
+}
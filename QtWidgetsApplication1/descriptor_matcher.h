@@ -0,0 +1,174 @@
+﻿#ifndef DESCRIPTOR_MATCHER_H
+#define DESCRIPTOR_MATCHER_H
+
+#include <opencv2/opencv.hpp>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include "descriptor_quantization.h"
+#include "global_signature.h"
+
+// Brute-force k-NN specialized at compile time per descriptor element type,
+// width and norm. The distance loops have a constexpr trip count and are
+// expanded into straight-line code (float rows accumulate into eight
+// independent lanes so the compiler can vectorize them); uint8 and fp16 rows
+// use the SIMD kernels of descriptor_quantization.h with a constant width.
+//
+// Instantiations used by the dispatch below:
+//   Matcher<float, 128, L2>        SIFT
+//   Matcher<float, 32|64, L2>      PCA-reduced SIFT (descriptor_pca.h)
+//   Matcher<uint8_t, 128, L2|L1>   quantized SIFT
+//   Matcher<uint16_t, 128, L2|L1>  fp16 SIFT
+//   Matcher<uint8_t, 32, Hamming>  ORB (256 bits)
+enum class DistanceNorm { L2, L1, Hamming };
+
+template <typename T, int Dim, DistanceNorm Norm>
+struct DistanceKernel;
+
+namespace matcher_detail {
+
+const int LANES = 8;
+
+template <typename Term, size_t... I>
+inline void accumulate(float* lanes, const Term& term, std::index_sequence<I...>) {
+    ((lanes[I % LANES] += term(I)), ...);
+}
+
+template <int Dim, typename Term>
+inline float sumUnrolled(const Term& term) {
+    float lanes[LANES] = {};
+    accumulate(lanes, term, std::make_index_sequence<Dim>());
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+        ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+template <size_t... I>
+inline uint32_t popcountWords(const uint64_t* a, const uint64_t* b, std::index_sequence<I...>) {
+    return (0u + ... + static_cast<uint32_t>(popcount64(a[I] ^ b[I])));
+}
+
+} // namespace matcher_detail
+
+// Squared L2 for float rows (the square root is taken once per match)
+template <int Dim>
+struct DistanceKernel<float, Dim, DistanceNorm::L2> {
+    static float compute(const float* a, const float* b) {
+        return matcher_detail::sumUnrolled<Dim>([&](size_t i) {
+            float d = a[i] - b[i];
+            return d * d;
+            });
+    }
+};
+
+template <int Dim>
+struct DistanceKernel<float, Dim, DistanceNorm::L1> {
+    static float compute(const float* a, const float* b) {
+        return matcher_detail::sumUnrolled<Dim>([&](size_t i) { return std::abs(a[i] - b[i]); });
+    }
+};
+
+template <int Dim>
+struct DistanceKernel<uint8_t, Dim, DistanceNorm::L2> {
+    static float compute(const uint8_t* a, const uint8_t* b) {
+        return static_cast<float>(l2SquaredU8(a, b, Dim));
+    }
+};
+
+template <int Dim>
+struct DistanceKernel<uint8_t, Dim, DistanceNorm::L1> {
+    static float compute(const uint8_t* a, const uint8_t* b) {
+        return static_cast<float>(l1DistanceU8(a, b, Dim));
+    }
+};
+
+template <int Dim>
+struct DistanceKernel<uint16_t, Dim, DistanceNorm::L2> {
+    static float compute(const uint16_t* a, const uint16_t* b) { return l2SquaredF16(a, b, Dim); }
+};
+
+template <int Dim>
+struct DistanceKernel<uint16_t, Dim, DistanceNorm::L1> {
+    static float compute(const uint16_t* a, const uint16_t* b) { return l1DistanceF16(a, b, Dim); }
+};
+
+// Dim is in bytes; rows are read as 64-bit words
+template <int Dim>
+struct DistanceKernel<uint8_t, Dim, DistanceNorm::Hamming> {
+    static_assert(Dim % 8 == 0, "binary descriptors are compared in 64-bit words");
+    static float compute(const uint8_t* a, const uint8_t* b) {
+        uint64_t wa[Dim / 8], wb[Dim / 8];
+        std::memcpy(wa, a, Dim);
+        std::memcpy(wb, b, Dim);
+        return static_cast<float>(matcher_detail::popcountWords(wa, wb,
+            std::make_index_sequence<Dim / 8>()));
+    }
+};
+
+// Largest k the matchers keep on the stack
+const int MATCHER_MAX_K = 8;
+
+template <typename T, int Dim, DistanceNorm Norm>
+struct Matcher {
+    static float distance(const T* a, const T* b) {
+        return DistanceKernel<T, Dim, Norm>::compute(a, b);
+    }
+
+    // k nearest train rows of every query row, nearest first, written to
+    // out[q * k .. q * k + k) with the distances cv::BFMatcher::knnMatch
+    // would report (plain L2, not squared). Slots beyond train.rows get
+    // trainIdx -1 and distance FLT_MAX. Allocates nothing.
+    static void knnMatch(const cv::Mat& query, const cv::Mat& train, int k, cv::DMatch* out) {
+        CV_Assert(query.cols * static_cast<int>(query.elemSize()) == Dim * static_cast<int>(sizeof(T)));
+        CV_Assert(train.cols == query.cols && train.type() == query.type());
+        CV_Assert(k > 0 && k <= MATCHER_MAX_K);
+
+        float best_distance[MATCHER_MAX_K + 1];
+        int best_index[MATCHER_MAX_K + 1];
+        for (int q = 0; q < query.rows; ++q) {
+            const T* a = query.ptr<T>(q);
+            int found = 0;
+            for (int t = 0; t < train.rows; ++t) {
+                float d = distance(a, train.ptr<T>(t));
+                if (found == k && d >= best_distance[k - 1]) continue;
+                int at = found < k ? found++ : k - 1;
+                while (at > 0 && best_distance[at - 1] > d) {
+                    best_distance[at] = best_distance[at - 1];
+                    best_index[at] = best_index[at - 1];
+                    --at;
+                }
+                best_distance[at] = d;
+                best_index[at] = t;
+            }
+
+            cv::DMatch* row = out + static_cast<size_t>(q) * k;
+            for (int i = 0; i < k; ++i) {
+                row[i] = i < found ?
+                    cv::DMatch(q, best_index[i], Norm == DistanceNorm::L2 ?
+                        std::sqrt(best_distance[i]) : best_distance[i]) :
+                    cv::DMatch(q, -1, FLT_MAX);
+            }
+        }
+    }
+};
+
+using SiftMatcher = Matcher<float, SIFT_DESCRIPTOR_SIZE, DistanceNorm::L2>;
+using SiftU8Matcher = Matcher<uint8_t, SIFT_DESCRIPTOR_SIZE, DistanceNorm::L2>;
+using OrbMatcher = Matcher<uint8_t, 32, DistanceNorm::Hamming>;
+
+// Runtime dispatch: picks the Matcher instantiation for the type, width and
+// norm of the rows (query and train must agree) and falls back to
+// knnMatchQuantized or cv::BFMatcher for anything without one. Returns
+// whether a specialized instantiation handled the call.
+// Flat form: matches is resized to query.rows * k in the layout of
+// Matcher::knnMatch and allocates nothing once its capacity suffices
+// (the fallbacks do allocate).
+bool knnMatchDescriptors(const cv::Mat& query, const cv::Mat& train, int normType, int k,
+    std::vector<cv::DMatch>& matches);
+// Nested form, as cv::DescriptorMatcher::knnMatch: missing neighbours are left out
+bool knnMatchDescriptors(const cv::Mat& query, const cv::Mat& train, int normType, int k,
+    std::vector<std::vector<cv::DMatch>>& matches);
+
+#endif // DESCRIPTOR_MATCHER_H
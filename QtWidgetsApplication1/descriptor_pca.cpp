@@ -0,0 +1,59 @@
+﻿#include "descriptor_pca.h"
+#include "tracing.h"
+
+using namespace cv;
+using namespace std;
+
+bool DescriptorProjection::train(const Mat& samples, int dims) {
+    SNAKE_TRACE_SCOPE("pca.train");
+    if (samples.empty() || dims <= 0 || dims >= samples.cols || samples.rows <= dims) {
+        return false;
+    }
+    Mat data;
+    samples.convertTo(data, CV_32F);
+    PCA pca(data, noArray(), PCA::DATA_AS_ROW, dims);
+    mean_ = pca.mean.clone();
+    components_ = pca.eigenvectors.clone();
+    return true;
+}
+
+Mat DescriptorProjection::project(const Mat& descriptors) const {
+    if (empty() || descriptors.empty()) return Mat();
+    CV_Assert(descriptors.cols == components_.cols);
+    SNAKE_TRACE_SCOPE("pca.project");
+
+    Mat centered;
+    descriptors.convertTo(centered, CV_32F);
+    for (int r = 0; r < centered.rows; ++r) {
+        float* x = centered.ptr<float>(r);
+        const float* m = mean_.ptr<float>();
+        for (int c = 0; c < centered.cols; ++c) x[c] -= m[c];
+    }
+    Mat projected;
+    gemm(centered, components_, 1.0, noArray(), 0.0, projected, GEMM_2_T);
+    return projected;
+}
+
+bool DescriptorProjection::save(const string& path) const {
+    if (empty()) return false;
+    FileStorage fs(path, FileStorage::WRITE);
+    if (!fs.isOpened()) return false;
+    fs << "mean" << mean_;
+    fs << "components" << components_;
+    return true;
+}
+
+bool DescriptorProjection::load(const string& path) {
+    FileStorage fs(path, FileStorage::READ);
+    if (!fs.isOpened()) return false;
+    Mat mean, components;
+    fs["mean"] >> mean;
+    fs["components"] >> components;
+    if (mean.empty() || components.empty() || mean.cols != components.cols ||
+        mean.type() != CV_32F || components.type() != CV_32F) {
+        return false;
+    }
+    mean_ = mean;
+    components_ = components;
+    return true;
+}
@@ -0,0 +1,29 @@
+﻿#ifndef DESCRIPTOR_PCA_H
+#define DESCRIPTOR_PCA_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+
+// PCA-SIFT style reduction: SIFT descriptors projected onto the leading
+// principal components of the enrolled database (32 or 64 of 128). Nearest
+// neighbour search runs on the short vectors; the full descriptors stay
+// with the features and decide the ratio test (see matchFeatures).
+class DescriptorProjection {
+public:
+    // Learns the projection from CV_32F SIFT rows; needs more rows than dims
+    bool train(const cv::Mat& samples, int dims);
+    bool empty() const { return components_.empty(); }
+    int dims() const { return components_.rows; }
+
+    // SIFT rows of any depth -> CV_32F rows of dims() columns
+    cv::Mat project(const cv::Mat& descriptors) const;
+
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+
+private:
+    cv::Mat mean_;          // 1 x 128
+    cv::Mat components_;    // dims x 128, one principal axis per row
+};
+
+#endif // DESCRIPTOR_PCA_H
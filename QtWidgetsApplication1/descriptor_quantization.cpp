@@ -0,0 +1,354 @@
+﻿#include "descriptor_quantization.h"
+#include "tracing.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SNAKE_SIMD_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define SNAKE_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+#if defined(__AVX2__) || defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+string descriptorFormatName(const DescriptorFormat& format) {
+    string name;
+    switch (format.storage) {
+    case DescriptorStorage::Float32: name = "f32"; break;
+    case DescriptorStorage::UInt8: name = "u8"; break;
+    case DescriptorStorage::Float16: name = "f16"; break;
+    }
+    return format.root_sift ? name + "-root" : name;
+}
+
+bool parseDescriptorFormat(const string& name, DescriptorFormat& format) {
+    const string suffix = "-root";
+    string storage = name;
+    format.root_sift = false;
+    if (storage.size() > suffix.size() &&
+        storage.compare(storage.size() - suffix.size(), suffix.size(), suffix) == 0) {
+        format.root_sift = true;
+        storage.resize(storage.size() - suffix.size());
+    }
+    if (storage == "f32") format.storage = DescriptorStorage::Float32;
+    else if (storage == "u8") format.storage = DescriptorStorage::UInt8;
+    else if (storage == "f16") format.storage = DescriptorStorage::Float16;
+    else return false;
+    return true;
+}
+
+int descriptorDepth(DescriptorStorage storage) {
+    switch (storage) {
+    case DescriptorStorage::UInt8: return CV_8U;
+    case DescriptorStorage::Float16: return CV_16F;
+    default: return CV_32F;
+    }
+}
+
+Mat encodeDescriptors(const Mat& descriptors, const DescriptorFormat& format) {
+    Mat encoded;
+    encodeDescriptors(descriptors, format, encoded);
+    return encoded;
+}
+
+void encodeDescriptors(const Mat& descriptors, const DescriptorFormat& format, Mat& encoded) {
+    if (descriptors.empty()) {
+        encoded.release();
+        return;
+    }
+    // convertTo rounds and saturates for CV_8U
+    if (!format.root_sift) {
+        descriptors.convertTo(encoded, descriptorDepth(format.storage));
+        return;
+    }
+
+    Mat rows;
+    descriptors.convertTo(rows, CV_32F);
+    for (int r = 0; r < rows.rows; ++r) {
+        float* d = rows.ptr<float>(r);
+        double l1 = 0;
+        for (int c = 0; c < rows.cols; ++c) l1 += std::abs(d[c]);
+        if (l1 <= 0) continue;
+        for (int c = 0; c < rows.cols; ++c) {
+            d[c] = static_cast<float>(std::sqrt(std::abs(d[c]) / l1) * ROOT_SIFT_SCALE);
+        }
+    }
+    rows.convertTo(encoded, descriptorDepth(format.storage));
+}
+
+Mat decodeDescriptors(const Mat& descriptors, const DescriptorFormat& format) {
+    if (descriptors.empty()) return Mat();
+
+    Mat rows;
+    descriptors.convertTo(rows, CV_32F);
+    if (format.root_sift) {
+        for (int r = 0; r < rows.rows; ++r) {
+            float* d = rows.ptr<float>(r);
+            double l2 = 0;
+            for (int c = 0; c < rows.cols; ++c) {
+                float x = d[c] / ROOT_SIFT_SCALE;
+                d[c] = x * x;
+                l2 += static_cast<double>(d[c]) * d[c];
+            }
+            if (l2 <= 0) continue;
+            float scale = static_cast<float>(ROOT_SIFT_SCALE / std::sqrt(l2));
+            for (int c = 0; c < rows.cols; ++c) d[c] *= scale;
+        }
+    }
+    return rows;
+}
+
+// ---- uint8 kernels -------------------------------------------------------
+
+#if defined(SNAKE_SIMD_SSE2)
+static inline uint32_t sumLanes(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(v));
+}
+#endif
+
+uint32_t l2SquaredU8(const uint8_t* a, const uint8_t* b, int n) {
+    int i = 0;
+    uint32_t sum = 0;
+#if defined(__AVX2__)
+    {
+        // |a - b| from two saturating subtractions, widened to 16 bits and
+        // squared-and-summed in pairs by madd
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i acc = _mm256_setzero_si256();
+        for (; i + 32 <= n; i += 32) {
+            __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+            __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+            __m256i d = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+            __m256i lo = _mm256_unpacklo_epi8(d, zero);
+            __m256i hi = _mm256_unpackhi_epi8(d, zero);
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(lo, lo));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(hi, hi));
+        }
+        sum += sumLanes(_mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)));
+    }
+#endif
+#if defined(SNAKE_SIMD_SSE2)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc = _mm_setzero_si128();
+        for (; i + 16 <= n; i += 16) {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+            __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            __m128i lo = _mm_unpacklo_epi8(d, zero);
+            __m128i hi = _mm_unpackhi_epi8(d, zero);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+        }
+        sum += sumLanes(acc);
+    }
+#elif defined(SNAKE_SIMD_NEON)
+    {
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (; i + 16 <= n; i += 16) {
+            uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+            acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(d), vget_low_u8(d)));
+            acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(d), vget_high_u8(d)));
+        }
+        sum += vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) +
+            vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+    }
+#endif
+    for (; i < n; ++i) {
+        int d = static_cast<int>(a[i]) - static_cast<int>(b[i]);
+        sum += static_cast<uint32_t>(d * d);
+    }
+    return sum;
+}
+
+uint32_t l1DistanceU8(const uint8_t* a, const uint8_t* b, int n) {
+    int i = 0;
+    uint32_t sum = 0;
+#if defined(__AVX2__)
+    {
+        // sad sums absolute differences of 8 bytes into each 64-bit lane
+        __m256i acc = _mm256_setzero_si256();
+        for (; i + 32 <= n; i += 32) {
+            __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+            __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(va, vb));
+        }
+        __m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        sum += static_cast<uint32_t>(_mm_cvtsi128_si32(half) +
+            _mm_cvtsi128_si32(_mm_srli_si128(half, 8)));
+    }
+#endif
+#if defined(SNAKE_SIMD_SSE2)
+    {
+        __m128i acc = _mm_setzero_si128();
+        for (; i + 16 <= n; i += 16) {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+        }
+        sum += static_cast<uint32_t>(_mm_cvtsi128_si32(acc) +
+            _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+    }
+#elif defined(SNAKE_SIMD_NEON)
+    {
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (; i + 16 <= n; i += 16) {
+            uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+            acc = vpadalq_u16(acc, vpaddlq_u8(d));
+        }
+        sum += vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) +
+            vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+    }
+#endif
+    for (; i < n; ++i) {
+        sum += static_cast<uint32_t>(std::abs(static_cast<int>(a[i]) - static_cast<int>(b[i])));
+    }
+    return sum;
+}
+
+// ---- fp16 kernels --------------------------------------------------------
+
+static inline float halfToFloat(uint16_t h) {
+    uint32_t sign = static_cast<uint32_t>(h & 0x8000u) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ffu;
+    uint32_t bits;
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        }
+        else {
+            // Subnormal: normalize the mantissa
+            exponent = 127 - 15 + 1;
+            while (!(mantissa & 0x400u)) {
+                mantissa <<= 1;
+                --exponent;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+        }
+    }
+    else if (exponent == 31) {
+        bits = sign | 0x7f800000u | (mantissa << 13);
+    }
+    else {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+#if defined(__F16C__)
+static inline float sumLanes(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+#endif
+
+float l2SquaredF16(const uint16_t* a, const uint16_t* b, int n) {
+    int i = 0;
+    float sum = 0;
+#if defined(__F16C__)
+    {
+        __m256 acc = _mm256_setzero_ps();
+        for (; i + 8 <= n; i += 8) {
+            __m256 va = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+            __m256 vb = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+            __m256 d = _mm256_sub_ps(va, vb);
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(d, d));
+        }
+        sum += sumLanes(acc);
+    }
+#endif
+    for (; i < n; ++i) {
+        float d = halfToFloat(a[i]) - halfToFloat(b[i]);
+        sum += d * d;
+    }
+    return sum;
+}
+
+float l1DistanceF16(const uint16_t* a, const uint16_t* b, int n) {
+    int i = 0;
+    float sum = 0;
+#if defined(__F16C__)
+    {
+        const __m256 sign = _mm256_set1_ps(-0.0f);
+        __m256 acc = _mm256_setzero_ps();
+        for (; i + 8 <= n; i += 8) {
+            __m256 va = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+            __m256 vb = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+            acc = _mm256_add_ps(acc, _mm256_andnot_ps(sign, _mm256_sub_ps(va, vb)));
+        }
+        sum += sumLanes(acc);
+    }
+#endif
+    for (; i < n; ++i) {
+        sum += std::abs(halfToFloat(a[i]) - halfToFloat(b[i]));
+    }
+    return sum;
+}
+
+// ---- brute-force 2-NN ----------------------------------------------------
+
+// Train rows are walked in the inner loop: one record's descriptors are
+// 128 KB per thousand keypoints as uint8, small enough to stay in L2 while
+// every query row is compared against them.
+template <typename T, typename Distance>
+static void knnRows(const Mat& query, const Mat& train, const Distance& distance,
+    bool squared, vector<vector<DMatch>>& matches) {
+    const int n = query.cols;
+    matches.assign(query.rows, vector<DMatch>());
+    for (int q = 0; q < query.rows; ++q) {
+        const T* qd = query.ptr<T>(q);
+        float best = numeric_limits<float>::max(), second = best;
+        int best_index = -1, second_index = -1;
+        for (int t = 0; t < train.rows; ++t) {
+            float d = static_cast<float>(distance(qd, train.ptr<T>(t), n));
+            if (d < best) {
+                second = best;
+                second_index = best_index;
+                best = d;
+                best_index = t;
+            }
+            else if (d < second) {
+                second = d;
+                second_index = t;
+            }
+        }
+
+        vector<DMatch>& row = matches[q];
+        if (best_index >= 0) row.emplace_back(q, best_index, squared ? std::sqrt(best) : best);
+        if (second_index >= 0) row.emplace_back(q, second_index, squared ? std::sqrt(second) : second);
+    }
+}
+
+void knnMatchQuantized(const Mat& query, const Mat& train, int normType,
+    vector<vector<DMatch>>& matches) {
+    SNAKE_TRACE_SCOPE("match.knn_quantized");
+    matches.clear();
+    if (query.empty() || train.empty()) return;
+    CV_Assert(query.type() == train.type() && query.cols == train.cols);
+    CV_Assert(normType == NORM_L2 || normType == NORM_L1);
+
+    bool l1 = normType == NORM_L1;
+    if (train.depth() == CV_8U) {
+        if (l1) knnRows<uint8_t>(query, train, l1DistanceU8, false, matches);
+        else knnRows<uint8_t>(query, train, l2SquaredU8, true, matches);
+    }
+    else {
+        CV_Assert(train.depth() == CV_16F);
+        if (l1) knnRows<uint16_t>(query, train, l1DistanceF16, false, matches);
+        else knnRows<uint16_t>(query, train, l2SquaredF16, true, matches);
+    }
+}
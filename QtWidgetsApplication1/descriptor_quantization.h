@@ -0,0 +1,71 @@
+﻿#ifndef DESCRIPTOR_QUANTIZATION_H
+#define DESCRIPTOR_QUANTIZATION_H
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+const int SIFT_DESCRIPTOR_SIZE = 128;
+
+// Storage formats for SIFT descriptors. OpenCV's SIFT produces floats that
+// already lie in 0..255 (the descriptor is scaled to norm 512 and clamped),
+// so rounding to uint8 costs almost nothing and cuts memory and disk 4x.
+// fp16 keeps the fractional part at half the size.
+enum class DescriptorStorage {
+    Float32,    // CV_32F, as extracted
+    UInt8,      // CV_8U, rounded and saturated
+    Float16     // CV_16F
+};
+
+// RootSIFT: each descriptor is L1-normalized and square-rooted, so that L2
+// distance between them behaves like the Hellinger kernel on the original
+// histograms. Rows are scaled by ROOT_SIFT_SCALE to keep the L2 norm of a
+// SIFT descriptor (512), which keeps distance thresholds comparable and
+// lets uint8 hold the values.
+const float ROOT_SIFT_SCALE = 512.0f;
+
+struct DescriptorFormat {
+    DescriptorStorage storage = DescriptorStorage::Float32;
+    bool root_sift = false;
+
+    bool isDefault() const { return storage == DescriptorStorage::Float32 && !root_sift; }
+    bool operator==(const DescriptorFormat& other) const {
+        return storage == other.storage && root_sift == other.root_sift;
+    }
+    bool operator!=(const DescriptorFormat& other) const { return !(*this == other); }
+};
+
+// "f32", "u8", "f16", with a "-root" suffix for RootSIFT
+std::string descriptorFormatName(const DescriptorFormat& format);
+bool parseDescriptorFormat(const std::string& name, DescriptorFormat& format);
+int descriptorDepth(DescriptorStorage storage);
+
+// Float SIFT descriptors (any depth accepted) -> stored format
+cv::Mat encodeDescriptors(const cv::Mat& descriptors, const DescriptorFormat& format);
+// Same into encoded, reusing its buffer when the size and type already
+// match (per-query scratch such as MatchContext::query)
+void encodeDescriptors(const cv::Mat& descriptors, const DescriptorFormat& format,
+    cv::Mat& encoded);
+// Stored format -> CV_32F SIFT. RootSIFT is undone by squaring and rescaling
+// each row back to norm 512; the per-row L1 scale is not kept, but SIFT rows
+// all share the norm, so the result is close to what was extracted.
+cv::Mat decodeDescriptors(const cv::Mat& descriptors, const DescriptorFormat& format);
+
+// Distance kernels over n-element descriptors. The uint8 ones use SSE2/AVX2
+// (x86) or NEON (ARM) integer arithmetic; the fp16 ones convert with F16C
+// when the compiler enables it. Squared L2 is returned to avoid the sqrt in
+// the inner loop.
+uint32_t l2SquaredU8(const uint8_t* a, const uint8_t* b, int n);
+uint32_t l1DistanceU8(const uint8_t* a, const uint8_t* b, int n);
+float l2SquaredF16(const uint16_t* a, const uint16_t* b, int n);
+float l1DistanceF16(const uint16_t* a, const uint16_t* b, int n);
+
+// Exact two nearest neighbours of every query row among train rows, for
+// CV_8U or CV_16F descriptors of the same depth and width (normType is
+// NORM_L2 or NORM_L1). Output matches BFMatcher::knnMatch(k = 2): distances
+// are plain (not squared) L2 or L1, trainIdx are row numbers of train.
+void knnMatchQuantized(const cv::Mat& query, const cv::Mat& train, int normType,
+    std::vector<std::vector<cv::DMatch>>& matches);
+
+#endif // DESCRIPTOR_QUANTIZATION_H
@@ -0,0 +1,99 @@
+﻿#include "feature_slab.h"
+#include "tracing.h"
+#include <algorithm>
+#include <map>
+#include <utility>
+
+PointSet::PointSet(const std::vector<cv::KeyPoint>& keypoints) {
+    std::vector<float> x, y;
+    x.reserve(keypoints.size());
+    y.reserve(keypoints.size());
+    for (const auto& kp : keypoints) {
+        x.push_back(kp.pt.x);
+        y.push_back(kp.pt.y);
+    }
+    *this = PointSet(x, y);
+}
+
+PointSet::PointSet(const std::vector<float>& x, const std::vector<float>& y) {
+    CV_Assert(x.size() == y.size());
+    if (x.empty()) return;
+    auto storage = std::make_shared<std::vector<float>>(x);
+    storage->insert(storage->end(), y.begin(), y.end());
+    size_ = x.size();
+    x_ = storage->data();
+    y_ = storage->data() + size_;
+    storage_bytes_ = storage->size() * sizeof(float);
+    storage_ = std::move(storage);
+}
+
+PointSet::PointSet(std::shared_ptr<const void> owner, size_t owner_bytes,
+    const float* x, const float* y, size_t size)
+    : storage_(std::move(owner))
+    , storage_bytes_(owner_bytes)
+    , x_(x)
+    , y_(y)
+    , size_(size) {
+}
+
+PointSet PointSet::appended(const std::vector<cv::KeyPoint>& keypoints,
+    const std::vector<bool>& keep) const {
+    std::vector<float> x(x_, x_ + size_), y(y_, y_ + size_);
+    for (size_t i = 0; i < keypoints.size(); ++i) {
+        if (i < keep.size() && !keep[i]) continue;
+        x.push_back(keypoints[i].pt.x);
+        y.push_back(keypoints[i].pt.y);
+    }
+    return PointSet(x, y);
+}
+
+// Матрицы записей одного типа и ширины - подряд в одну; каждая получает
+// заголовок на свои строки (общий счётчик ссылок держит блок живым)
+static void packMats(const std::vector<cv::Mat*>& mats) {
+    std::map<std::pair<int, int>, std::vector<cv::Mat*>> groups;
+    for (cv::Mat* mat : mats) {
+        if (!mat->empty()) groups[{ mat->type(), mat->cols }].push_back(mat);
+    }
+    for (auto& [key, members] : groups) {
+        int rows = 0;
+        for (const cv::Mat* mat : members) rows += mat->rows;
+        cv::Mat slab(rows, key.second, key.first);
+        int row = 0;
+        for (cv::Mat* mat : members) {
+            cv::Mat target = slab.rowRange(row, row + mat->rows);
+            mat->copyTo(target);
+            *mat = target;
+            row += target.rows;
+        }
+    }
+}
+
+void packFeatures(std::vector<PackedFeatures>& records) {
+    SNAKE_TRACE_SCOPE("db.pack_features");
+    std::vector<cv::Mat*> descriptors, projected;
+    size_t points = 0;
+    for (const PackedFeatures& record : records) {
+        if (record.descriptors) descriptors.push_back(record.descriptors);
+        if (record.projected) projected.push_back(record.projected);
+        if (record.points) points += record.points->size();
+    }
+    packMats(descriptors);
+    packMats(projected);
+
+    if (points == 0) return;
+    auto storage = std::make_shared<std::vector<float>>(2 * points);
+    float* x = storage->data();
+    float* y = storage->data() + points;
+    for (const PackedFeatures& record : records) {
+        if (!record.points || record.points->empty()) continue;
+        PointSet& set = *record.points;
+        std::copy(set.x_, set.x_ + set.size_, x);
+        std::copy(set.y_, set.y_ + set.size_, y);
+        set.x_ = x;
+        set.y_ = y;
+        set.storage_ = storage;
+        set.storage_bytes_ = storage->size() * sizeof(float);
+        x += set.size_;
+        y += set.size_;
+    }
+}
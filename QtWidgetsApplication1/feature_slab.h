@@ -0,0 +1,87 @@
+﻿#ifndef FEATURE_SLAB_H
+#define FEATURE_SLAB_H
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Непрерывный массив без владения - замена std::span (проект на C++17).
+// Действителен, пока жив владелец данных
+template <typename T>
+class ArrayView {
+public:
+    ArrayView() = default;
+    ArrayView(const T* data, size_t size) : data_(data), size_(size) {}
+    ArrayView(const std::vector<T>& values) : data_(values.data()), size_(values.size()) {}
+
+    const T* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const T& operator[](size_t i) const { return data_[i]; }
+    const T* begin() const { return data_; }
+    const T* end() const { return data_ + size_; }
+
+private:
+    const T* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+struct PackedFeatures;
+void packFeatures(std::vector<PackedFeatures>& records);
+
+// Координаты ключевых точек записи базы, структурой массивов: для проверки
+// совпадений (RANSAC) нужны только x и y, остальные поля cv::KeyPoint
+// (размер, угол, отклик, октава) база не хранит. Массивы лежат в общем
+// блоке, который делят записи одной загрузки (packFeatures); копирование
+// PointSet копирует только указатели. Неизменяем, как и сама запись
+class PointSet {
+public:
+    PointSet() = default;
+    explicit PointSet(const std::vector<cv::KeyPoint>& keypoints);
+    PointSet(const std::vector<float>& x, const std::vector<float>& y);
+    // Набор поверх чужой памяти (отображённого файла снимка базы) без
+    // копирования; owner держит её живой, owner_bytes - её размер для учёта
+    PointSet(std::shared_ptr<const void> owner, size_t owner_bytes,
+        const float* x, const float* y, size_t size);
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    ArrayView<float> x() const { return { x_, size_ }; }
+    ArrayView<float> y() const { return { y_, size_ }; }
+    cv::Point2f operator[](size_t i) const { return { x_[i], y_[i] }; }
+
+    // Новый набор: эти точки, затем keypoints[i], для которых keep[i]
+    PointSet appended(const std::vector<cv::KeyPoint>& keypoints,
+        const std::vector<bool>& keep) const;
+
+    // Блок данных, общий с другими наборами (для учёта памяти)
+    const void* storage() const { return storage_.get(); }
+    size_t storageBytes() const { return storage_bytes_; }
+
+private:
+    friend void packFeatures(std::vector<PackedFeatures>& records);
+
+    std::shared_ptr<const void> storage_;
+    size_t storage_bytes_ = 0;
+    const float* x_ = nullptr;
+    const float* y_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Ссылки на поля одной записи для packFeatures; nullptr - поле не
+// переупаковывается (уже лежит в общем блоке)
+struct PackedFeatures {
+    PointSet* points;
+    cv::Mat* descriptors;
+    cv::Mat* projected;
+};
+
+// Переупаковка записей в общие блоки: дескрипторы одного типа и ширины -
+// в одну матрицу, каждая запись получает заголовок на свой диапазон строк;
+// укороченные дескрипторы - так же; координаты точек всех записей - в один
+// массив (сначала все x, затем все y). Просмотр базы тогда идёт по
+// непрерывной памяти, а не по отдельным выделениям каждой записи
+void packFeatures(std::vector<PackedFeatures>& records);
+
+#endif // FEATURE_SLAB_H
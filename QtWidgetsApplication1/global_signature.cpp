@@ -0,0 +1,104 @@
+﻿#include "global_signature.h"
+#include "tracing.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace cv;
+using namespace std;
+
+// pHash: 32x32 grayscale, DCT, sign of the 8x8 low-frequency block
+// (without the DC term) relative to its median.
+uint64_t computePerceptualHash(const Mat& image) {
+    if (image.empty()) return 0;
+
+    Mat gray;
+    if (image.channels() == 3) cvtColor(image, gray, COLOR_BGR2GRAY);
+    else if (image.channels() == 4) cvtColor(image, gray, COLOR_BGRA2GRAY);
+    else gray = image;
+
+    Mat small, small32, freq;
+    resize(gray, small, Size(32, 32), 0, 0, INTER_AREA);
+    small.convertTo(small32, CV_32F);
+    dct(small32, freq);
+
+    vector<float> coeffs;
+    coeffs.reserve(64);
+    for (int y = 0; y < 8; ++y) {
+        for (int x = 0; x < 8; ++x) {
+            coeffs.push_back(freq.at<float>(y, x));
+        }
+    }
+    vector<float> sorted(coeffs.begin() + 1, coeffs.end());
+    nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+    float median = sorted[sorted.size() / 2];
+
+    uint64_t hash = 0;
+    for (int i = 1; i < 64; ++i) {
+        if (coeffs[i] > median) hash |= uint64_t(1) << i;
+    }
+    // Bit 0 marks the hash as computed (a flat image would hash to 0 otherwise)
+    return hash | 1;
+}
+
+PooledSignature computePooledSignature(const Mat& descriptors) {
+    PooledSignature bits{};
+    if (descriptors.empty() || descriptors.cols != 64 * POOLED_SIGNATURE_WORDS) return bits;
+
+    // Mean RootSIFT: L1-normalize each descriptor, take the square root
+    Mat rows;
+    descriptors.convertTo(rows, CV_32F);
+    vector<double> values(rows.cols, 0.0);
+    for (int r = 0; r < rows.rows; ++r) {
+        const float* d = rows.ptr<float>(r);
+        double l1 = 0;
+        for (int c = 0; c < rows.cols; ++c) l1 += std::abs(d[c]);
+        if (l1 <= 0) continue;
+        for (int c = 0; c < rows.cols; ++c) values[c] += std::sqrt(std::abs(d[c]) / l1);
+    }
+
+    vector<double> sorted = values;
+    nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+    double median = sorted[sorted.size() / 2];
+
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (values[i] > median) bits[i / 64] |= uint64_t(1) << (i % 64);
+    }
+    return bits;
+}
+
+GlobalSignature computeGlobalSignature(const Mat& image, const Mat& descriptors) {
+    SNAKE_TRACE_SCOPE("signature.compute");
+    GlobalSignature signature;
+    signature.phash = computePerceptualHash(image);
+    signature.pooled = computePooledSignature(descriptors);
+    return signature;
+}
+
+// The inner loop is a straight XOR + popcount over contiguous words; with
+// POPCNT enabled (-mpopcnt / x64 MSVC) it is a handful of instructions per
+// signature and the compiler unrolls it across signatures.
+void scanSignatures(const uint64_t* words, size_t count,
+    const PooledSignature& query, int* distances) {
+    const uint64_t q0 = query[0], q1 = query[1];
+    for (size_t i = 0; i < count; ++i) {
+        distances[i] = popcount64(words[2 * i] ^ q0) + popcount64(words[2 * i + 1] ^ q1);
+    }
+}
+
+vector<size_t> selectNearest(const vector<int>& distances, size_t k) {
+    vector<size_t> selected, ranked;
+    ranked.reserve(distances.size());
+    for (size_t i = 0; i < distances.size(); ++i) {
+        if (distances[i] == SIGNATURE_UNRANKED) selected.push_back(i);
+        else if (distances[i] != SIGNATURE_SKIP) ranked.push_back(i);
+    }
+    if (k > 0 && ranked.size() > k) {
+        nth_element(ranked.begin(), ranked.begin() + k, ranked.end(), [&](size_t a, size_t b) {
+            return distances[a] != distances[b] ? distances[a] < distances[b] : a < b;
+            });
+        ranked.resize(k);
+    }
+    selected.insert(selected.end(), ranked.begin(), ranked.end());
+    sort(selected.begin(), selected.end());
+    return selected;
+}
@@ -0,0 +1,65 @@
+﻿#ifndef GLOBAL_SIGNATURE_H
+#define GLOBAL_SIGNATURE_H
+
+#include <opencv2/opencv.hpp>
+#include <array>
+#include <cstdint>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Compact whole-image signature stored with every enrolled snake and used
+// to shortlist candidates before local feature matching.
+//  - pooled: mean RootSIFT descriptor of the image, binarized against its
+//    median (128 bits). Orderless and built from rotation-normalized
+//    descriptors, so it tolerates pose changes; this is what the prefilter
+//    ranks by.
+//  - phash: DCT perceptual hash of the photo (64 bits). Only stable for the
+//    same or re-cropped photo, so it is kept for near-duplicate detection.
+const int POOLED_SIGNATURE_WORDS = 2;
+using PooledSignature = std::array<uint64_t, POOLED_SIGNATURE_WORDS>;
+
+struct GlobalSignature {
+    uint64_t phash = 0;     // 0 - not computed (databases saved before signatures)
+    PooledSignature pooled{};
+
+    bool hasPooled() const { return pooled[0] != 0 || pooled[1] != 0; }
+};
+
+uint64_t computePerceptualHash(const cv::Mat& image);
+PooledSignature computePooledSignature(const cv::Mat& descriptors);
+GlobalSignature computeGlobalSignature(const cv::Mat& image, const cv::Mat& descriptors);
+
+inline int popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    return static_cast<int>(__popcnt64(x));
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<int>((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+inline int hammingDistance(uint64_t a, uint64_t b) {
+    return popcount64(a ^ b);
+}
+
+// Hamming distance from query to count signatures packed contiguously
+// (POOLED_SIGNATURE_WORDS words each), written to distances[0..count)
+void scanSignatures(const uint64_t* words, size_t count,
+    const PooledSignature& query, int* distances);
+
+// Special distance values understood by selectNearest
+const int SIGNATURE_SKIP = -1;      // not a candidate at all (deleted record)
+const int SIGNATURE_UNRANKED = -2;  // no signature to rank by: always kept
+
+// Indices of the k smallest distances plus every SIGNATURE_UNRANKED entry,
+// in ascending index order (so callers keep their tie-breaking order).
+// k == 0 keeps every entry that is not SIGNATURE_SKIP.
+std::vector<size_t> selectNearest(const std::vector<int>& distances, size_t k);
+
+#endif // GLOBAL_SIGNATURE_H
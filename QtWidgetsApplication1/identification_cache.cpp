@@ -0,0 +1,192 @@
+﻿#include "identification_cache.h"
+#include "global_signature.h"
+#include "tracing.h"
+
+using namespace cv;
+
+// FNV-1a, 64 бита
+static uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 1469598103934665603ULL) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+template <typename T>
+static uint64_t mixValue(uint64_t hash, const T& value) {
+    return fnv1a(&value, sizeof(value), hash);
+}
+
+static uint64_t paramsHash(const IdentificationParams& p) {
+    uint64_t hash = 1469598103934665603ULL;
+    hash = mixValue(hash, p.enhance_scales);
+    hash = mixValue(hash, p.remove_background);
+    hash = mixValue(hash, p.preprocessing_level);
+    hash = mixValue(hash, p.min_good_matches);
+    hash = mixValue(hash, p.min_match_ratio);
+    hash = mixValue(hash, p.good_match_threshold);
+    hash = mixValue(hash, p.use_homography);
+    hash = mixValue(hash, p.ransac_threshold);
+    hash = mixValue(hash, p.prefilter_candidates);
+    hash = mixValue(hash, p.pq_candidates);
+    hash = mixValue(hash, p.pq_probes);
+    hash = mixValue(hash, p.pq_neighbours);
+    hash = mixValue(hash, p.matched_image_side);
+    return hash;
+}
+
+// Хеш пикселей построчно (строки Mat могут быть с выравниванием)
+static uint64_t contentHash(const Mat& image) {
+    uint64_t hash = 1469598103934665603ULL;
+    hash = mixValue(hash, image.rows);
+    hash = mixValue(hash, image.cols);
+    hash = mixValue(hash, image.type());
+    const size_t row_bytes = image.cols * image.elemSize();
+    for (int y = 0; y < image.rows; ++y) {
+        hash = fnv1a(image.ptr(y), row_bytes, hash);
+    }
+    return hash;
+}
+
+static size_t matBytes(const Mat& m) {
+    return m.empty() ? 0 : m.total() * m.elemSize();
+}
+
+static size_t resultBytes(const IdentificationResult& r) {
+    return matBytes(r.processed_image) + matBytes(r.matched_image) +
+        matBytes(r.features.descriptors) + r.features.keypoints.size() * sizeof(KeyPoint);
+}
+
+IdentificationCache::IdentificationCache(const CacheConfig& config)
+    : config_(config) {
+}
+
+CacheKey IdentificationCache::makeKey(const Mat& image, const IdentificationParams& params) {
+    SNAKE_TRACE_SCOPE("cache.key");
+    CacheKey key;
+    key.params_hash = paramsHash(params);
+    key.content_hash = contentHash(image) ^ key.params_hash;
+    key.phash = computePerceptualHash(image);
+    return key;
+}
+
+bool IdentificationCache::lookup(const CacheKey& key, uint64_t db_version,
+    IdentificationResult& result, bool* near_duplicate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dropStale(db_version, Clock::now(), true);
+    if (near_duplicate) *near_duplicate = false;
+
+    auto exact = exact_.find(key.content_hash);
+    if (exact != exact_.end()) {
+        entries_.splice(entries_.begin(), entries_, exact->second);
+        result = exact->second->result;
+        ++stats_.hits;
+        return true;
+    }
+
+    if (config_.max_phash_distance >= 0 && key.phash != 0) {
+        auto best = entries_.end();
+        int best_distance = config_.max_phash_distance + 1;
+        for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+            if (it->key.params_hash != key.params_hash || !it->result.found || it->key.phash == 0) {
+                continue;
+            }
+            int distance = hammingDistance(it->key.phash, key.phash);
+            if (distance < best_distance) {
+                best_distance = distance;
+                best = it;
+            }
+        }
+        if (best != entries_.end()) {
+            entries_.splice(entries_.begin(), entries_, best);
+            // Только идентификация: признаки и обработка - от другого снимка
+            result = IdentificationResult();
+            result.found = true;
+            result.name = best->result.name;
+            result.good_matches = best->result.good_matches;
+            result.match_ratio = best->result.match_ratio;
+            result.matched_image_path = best->result.matched_image_path;
+            result.matched_image = best->result.matched_image;
+            ++stats_.near_hits;
+            if (near_duplicate) *near_duplicate = true;
+            return true;
+        }
+    }
+
+    ++stats_.misses;
+    return false;
+}
+
+void IdentificationCache::store(const CacheKey& key, uint64_t db_version,
+    const IdentificationResult& result) {
+    if (result.cancelled || config_.max_entries == 0) return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Поиск мог идти, пока базу меняли: более новые записи не трогаем,
+    // а эта устареет при следующем lookup
+    dropStale(db_version, Clock::now(), false);
+
+    auto existing = exact_.find(key.content_hash);
+    if (existing != exact_.end()) erase(existing->second);
+
+    Entry entry;
+    entry.key = key;
+    entry.db_version = db_version;
+    entry.result = result;
+    entry.bytes = resultBytes(result);
+    entry.stored = Clock::now();
+
+    entries_.push_front(std::move(entry));
+    exact_[key.content_hash] = entries_.begin();
+    stats_.bytes += entries_.front().bytes;
+    enforceLimits();
+}
+
+void IdentificationCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    exact_.clear();
+    stats_.bytes = 0;
+}
+
+CacheStats IdentificationCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CacheStats stats = stats_;
+    stats.entries = entries_.size();
+    return stats;
+}
+
+// Записи старше TTL и устаревшие по версии базы: при поиске годится только
+// текущая версия (exact_version), при сохранении удаляются более старые
+void IdentificationCache::dropStale(uint64_t db_version, Clock::time_point now, bool exact_version) {
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        auto next = std::next(it);
+        bool outdated = exact_version ? it->db_version != db_version : it->db_version < db_version;
+        if (outdated) {
+            erase(it);
+            ++stats_.invalidations;
+        }
+        else if (std::chrono::duration<double>(now - it->stored).count() > config_.ttl_seconds) {
+            erase(it);
+            ++stats_.evictions;
+        }
+        it = next;
+    }
+}
+
+void IdentificationCache::erase(EntryList::iterator it) {
+    stats_.bytes -= it->bytes;
+    exact_.erase(it->key.content_hash);
+    entries_.erase(it);
+}
+
+void IdentificationCache::enforceLimits() {
+    // Последняя запись остаётся, даже если одна превышает лимит байтов
+    while (entries_.size() > 1 &&
+        (entries_.size() > config_.max_entries || stats_.bytes > config_.max_bytes)) {
+        erase(std::prev(entries_.end()));
+        ++stats_.evictions;
+    }
+}
@@ -0,0 +1,88 @@
+﻿#ifndef IDENTIFICATION_CACHE_H
+#define IDENTIFICATION_CACHE_H
+
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "snake_identifier.h"
+
+// Кэш результатов идентификации для повторно отправленных фото.
+//
+// Два уровня:
+//  - точный: хеш содержимого (пиксели, размер, тип) + параметры поиска;
+//  - близкий: pHash (global_signature.h) в пределах max_phash_distance -
+//    та же фотография, пересжатая или немного обрезанная. Отдаётся только
+//    найденная змея: признаки и обработанное изображение принадлежат
+//    другому снимку, и сохранять их в базу под новым фото нельзя.
+//
+// Запись действительна только для той версии базы, с которой получен
+// результат (SnakeDatabase::version()): любое изменение базы делает все
+// записи устаревшими. Размер ограничен числом записей и байтами
+// изображений, возраст - ttl_seconds; вытесняется давно не использованная.
+struct CacheConfig {
+    size_t max_entries = 32;
+    size_t max_bytes = 256 * 1024 * 1024;
+    double ttl_seconds = 600;
+    int max_phash_distance = 4;     // < 0 - без близкого уровня
+};
+
+struct CacheKey {
+    uint64_t content_hash = 0;
+    uint64_t phash = 0;
+    uint64_t params_hash = 0;
+};
+
+struct CacheStats {
+    size_t hits = 0;
+    size_t near_hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;       // по размеру и TTL
+    size_t invalidations = 0;   // из-за изменения базы
+    size_t entries = 0;
+    size_t bytes = 0;
+};
+
+class IdentificationCache {
+public:
+    explicit IdentificationCache(const CacheConfig& config = CacheConfig());
+
+    // Ключ считается один раз и используется для lookup и store
+    static CacheKey makeKey(const cv::Mat& image, const IdentificationParams& params);
+
+    // true - результат найден; near_duplicate - найден по pHash
+    bool lookup(const CacheKey& key, uint64_t db_version,
+        IdentificationResult& result, bool* near_duplicate = nullptr);
+
+    // db_version - версия базы на момент начала поиска
+    void store(const CacheKey& key, uint64_t db_version, const IdentificationResult& result);
+
+    void clear();
+    CacheStats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        CacheKey key;
+        uint64_t db_version = 0;
+        IdentificationResult result;
+        size_t bytes = 0;
+        Clock::time_point stored;
+    };
+    using EntryList = std::list<Entry>;
+
+    void dropStale(uint64_t db_version, Clock::time_point now, bool exact_version);
+    void erase(EntryList::iterator it);
+    void enforceLimits();
+
+    CacheConfig config_;
+    mutable std::mutex mutex_;
+    EntryList entries_;     // в начале - последние использованные
+    std::unordered_map<uint64_t, EntryList::iterator> exact_;
+    CacheStats stats_;
+};
+
+#endif // IDENTIFICATION_CACHE_H
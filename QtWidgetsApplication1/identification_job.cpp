@@ -0,0 +1,70 @@
+﻿#pragma execution_character_set("utf-8")
+#include "identification_job.h"
+
+IdentificationJob::IdentificationJob(const cv::Mat& image,
+    const SnakeDatabase& database,
+    const IdentificationParams& params,
+    QObject* parent)
+    : QObject(parent)
+    , image_(image)
+    , database_(database)
+    , params_(params)
+{
+    // Временем жизни управляет MainWindow (deleteLater после finished)
+    setAutoDelete(false);
+}
+
+void IdentificationJob::run()
+{
+    result_ = SnakeIdentifier::identify(image_, database_, params_,
+        [this](IdentificationStage stage, size_t done, size_t total) {
+            reportProgress(stage, done, total);
+        },
+        &cancel_requested_);
+
+    if (cancel_requested_) {
+        result_.cancelled = true;
+    }
+
+    emit finished();
+}
+
+void IdentificationJob::cancel()
+{
+    cancel_requested_ = true;
+}
+
+bool IdentificationJob::isCancelled() const
+{
+    return cancel_requested_;
+}
+
+const IdentificationResult& IdentificationJob::result() const
+{
+    return result_;
+}
+
+void IdentificationJob::reportProgress(IdentificationStage stage, size_t done, size_t total)
+{
+    // Доли этапов в общей шкале: предобработка 0-40, SIFT 40-60, поиск 60-100
+    switch (stage) {
+    case IdentificationStage::Preprocessing:
+        emit progressChanged(0, QString::fromUtf8(u8"Предобработка"));
+        break;
+    case IdentificationStage::Extraction:
+        emit progressChanged(40, QString::fromUtf8(u8"Извлечение ключевых точек"));
+        break;
+    case IdentificationStage::Matching: {
+        int percent = 60 + (total > 0 ? static_cast<int>(40 * done / total) : 40);
+        // Не засыпаем очередь событий GUI сигналом на каждую змею
+        if (percent == last_percent_) break;
+        last_percent_ = percent;
+        emit progressChanged(percent,
+            QString::fromUtf8(u8"Поиск в базе: %1 из %2").arg(done).arg(total));
+        break;
+    }
+    case IdentificationStage::Done:
+        emit progressChanged(100, QString::fromUtf8(u8"Готово"));
+        break;
+    }
+}
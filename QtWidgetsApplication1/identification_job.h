@@ -0,0 +1,46 @@
+﻿#ifndef IDENTIFICATION_JOB_H
+#define IDENTIFICATION_JOB_H
+
+#include <QObject>
+#include <QRunnable>
+#include <QString>
+#include <atomic>
+#include "snake_identifier.h"
+
+// Фоновая задача поиска змеи. Выполняется в QThreadPool, о ходе работы
+// сообщает сигналами (доставляются в поток GUI через очередь событий).
+class IdentificationJob : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    IdentificationJob(const cv::Mat& image,
+        const SnakeDatabase& database,
+        const IdentificationParams& params,
+        QObject* parent = nullptr);
+
+    void run() override;
+
+    // Можно вызывать из любого потока; задача завершится на ближайшей проверке
+    void cancel();
+    bool isCancelled() const;
+
+    // Действителен после сигнала finished()
+    const IdentificationResult& result() const;
+
+signals:
+    void progressChanged(int percent, const QString& stage);
+    void finished();
+
+private:
+    cv::Mat image_;
+    const SnakeDatabase& database_;
+    IdentificationParams params_;
+    IdentificationResult result_;
+    std::atomic<bool> cancel_requested_{ false };
+    int last_percent_ = -1;
+
+    void reportProgress(IdentificationStage stage, size_t done, size_t total);
+};
+
+#endif // IDENTIFICATION_JOB_H
@@ -0,0 +1,205 @@
+﻿#include "identification_pipeline.h"
+#include "file_utils.h"
+#include <chrono>
+#include <thread>
+
+using namespace cv;
+using Clock = std::chrono::steady_clock;
+
+static double secondsBetween(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double>(to - from).count();
+}
+
+IdentificationPipeline::IdentificationPipeline(const SnakeDatabase& database,
+    const PipelineConfig& config)
+    : database_(database)
+    , config_(config) {
+}
+
+void IdentificationPipeline::runDirectory(const std::string& directory,
+    const ResultCallback& on_result) {
+    run(FileUtils::findImageFiles(directory), on_result);
+}
+
+void IdentificationPipeline::cancel() {
+    cancel_requested_ = true;
+}
+
+std::vector<StageMetrics> IdentificationPipeline::metrics() const {
+    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    return metrics_;
+}
+
+double IdentificationPipeline::wallSeconds() const {
+    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    return wall_seconds_;
+}
+
+void IdentificationPipeline::run(const std::vector<std::string>& files,
+    const ResultCallback& on_result) {
+    cancel_requested_ = false;
+
+    BoundedQueue<Item> decoded(config_.queue_capacity);
+    BoundedQueue<Item> preprocessed(config_.queue_capacity);
+    BoundedQueue<Item> extracted(config_.queue_capacity);
+
+    std::vector<StageMetrics> stages(4);
+    stages[0].name = "decode";
+    stages[0].workers = std::max(1, config_.decode_workers);
+    stages[1].name = "preprocess";
+    stages[1].workers = std::max(1, config_.preprocess_workers);
+    stages[2].name = "extract";
+    stages[2].workers = std::max(1, config_.extract_workers);
+    stages[3].name = "match";
+    stages[3].workers = std::max(1, config_.match_workers);
+
+    std::mutex stages_mutex;
+    std::mutex callback_mutex;
+    std::atomic<size_t> next_file{ 0 };
+    std::atomic<int> remaining[4];
+    for (int i = 0; i < 4; ++i) remaining[i] = stages[i].workers;
+
+    // При отмене закрываются все очереди: иначе поток, ждущий в push места
+    // в заполненной очереди, ждал бы вечно - этап ниже уже вышел и её не разбирает
+    auto closeAll = [&]() {
+        decoded.close();
+        preprocessed.close();
+        extracted.close();
+    };
+
+    auto emitResult = [&](const PipelineItemResult& r) {
+        if (!on_result) return;
+        std::lock_guard<std::mutex> lock(callback_mutex);
+        on_result(r);
+    };
+
+    // Общий цикл потока этапа. fetch - получить следующий элемент,
+    // process - обработать (false - элемент дальше не передаётся).
+    auto worker = [&](int stage_index,
+        BoundedQueue<Item>* out,
+        const std::function<bool(Item&)>& fetch,
+        const std::function<bool(Item&)>& process) {
+        StageMetrics local;
+        Item item;
+
+        for (;;) {
+            auto t0 = Clock::now();
+            if (!fetch(item)) break;
+            auto t1 = Clock::now();
+            local.starved_seconds += secondsBetween(t0, t1);
+
+            if (cancel_requested_) {
+                closeAll();
+                break;
+            }
+
+            bool forward = process(item);
+            auto t2 = Clock::now();
+            local.busy_seconds += secondsBetween(t1, t2);
+            local.items++;
+
+            if (out && forward) {
+                // Выход закрыт только при отмене - разблокируем и этапы выше
+                if (!out->push(std::move(item))) {
+                    closeAll();
+                    break;
+                }
+                local.blocked_seconds += secondsBetween(t2, Clock::now());
+                local.max_queue_depth = std::max(local.max_queue_depth, out->sizeApprox());
+            }
+            item = Item();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(stages_mutex);
+            StageMetrics& stage = stages[stage_index];
+            stage.items += local.items;
+            stage.busy_seconds += local.busy_seconds;
+            stage.starved_seconds += local.starved_seconds;
+            stage.blocked_seconds += local.blocked_seconds;
+            stage.max_queue_depth = std::max(stage.max_queue_depth, local.max_queue_depth);
+        }
+
+        // Последний поток этапа закрывает выходную очередь
+        if (--remaining[stage_index] == 0 && out) {
+            out->close();
+        }
+    };
+
+    auto fetchFile = [&](Item& item) {
+        size_t index = next_file.fetch_add(1);
+        if (index >= files.size()) return false;
+        item.index = index;
+        item.path = files[index];
+        return true;
+    };
+
+    auto decode = [&](Item& item) {
+        item.image = imread(item.path);
+        if (item.image.empty()) {
+            PipelineItemResult r;
+            r.index = item.index;
+            r.path = item.path;
+            emitResult(r);
+            return false;
+        }
+        return true;
+    };
+
+    const IdentificationParams& params = config_.params;
+
+    auto preprocess = [&](Item& item) {
+        item.image = ImagePreprocessor::preprocess(item.image,
+            params.enhance_scales, params.remove_background,
+            params.preprocessing_level, &item.mask);
+        return true;
+    };
+
+    auto extract = [&](Item& item) {
+        item.features = detectSIFTFeatures(item.image, item.mask);
+        // Дальше нужны только признаки
+        item.image.release();
+        item.mask.release();
+        return true;
+    };
+
+    auto match = [&](Item& item) {
+        PipelineItemResult r;
+        r.index = item.index;
+        r.path = item.path;
+        r.decoded = true;
+        r.keypoints = item.features.keypoints.size();
+        // Фото найденной змеи конвейеру не нужно - не декодируем его
+        r.result = SnakeIdentifier::match(item.features, database_, params,
+            nullptr, &cancel_requested_, false);
+        r.result.features = std::move(item.features);
+        if (!r.result.cancelled) {
+            emitResult(r);
+        }
+        return false;
+    };
+
+    auto popFrom = [](BoundedQueue<Item>& queue) {
+        return [&queue](Item& item) { return queue.pop(item); };
+    };
+
+    auto start = Clock::now();
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < stages[0].workers; ++i)
+        threads.emplace_back(worker, 0, &decoded, fetchFile, decode);
+    for (int i = 0; i < stages[1].workers; ++i)
+        threads.emplace_back(worker, 1, &preprocessed, popFrom(decoded), preprocess);
+    for (int i = 0; i < stages[2].workers; ++i)
+        threads.emplace_back(worker, 2, &extracted, popFrom(preprocessed), extract);
+    for (int i = 0; i < stages[3].workers; ++i)
+        threads.emplace_back(worker, 3, nullptr, popFrom(extracted), match);
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    metrics_ = stages;
+    wall_seconds_ = secondsBetween(start, Clock::now());
+}
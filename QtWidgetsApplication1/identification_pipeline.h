@@ -0,0 +1,90 @@
+﻿#ifndef IDENTIFICATION_PIPELINE_H
+#define IDENTIFICATION_PIPELINE_H
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "bounded_queue.h"
+#include "snake_identifier.h"
+
+// Конвейер для пакетной идентификации папки:
+// чтение -> предобработка -> SIFT -> поиск в базе.
+// Этапы работают одновременно, каждый со своим числом потоков, и связаны
+// ограниченными очередями: быстрый этап упирается в заполненную очередь
+// (backpressure) вместо того, чтобы копить изображения в памяти.
+struct PipelineConfig {
+    int decode_workers = 2;
+    int preprocess_workers = 4;
+    int extract_workers = 4;
+    int match_workers = 2;
+    size_t queue_capacity = 16;
+    IdentificationParams params;
+};
+
+struct PipelineItemResult {
+    size_t index = 0;           // номер файла во входном списке
+    std::string path;
+    bool decoded = false;
+    size_t keypoints = 0;
+    IdentificationResult result;    // без matched_image: фото не читается
+};
+
+struct StageMetrics {
+    std::string name;
+    int workers = 0;
+    size_t items = 0;
+    double busy_seconds = 0;        // полезная работа, сумма по потокам
+    double starved_seconds = 0;     // ожидание входа (этап простаивает)
+    double blocked_seconds = 0;     // ожидание места в выходной очереди (backpressure)
+    size_t max_queue_depth = 0;     // максимум заполнения выходной очереди
+
+    // Доля времени потоков этапа, занятая работой
+    double utilization(double wall_seconds) const {
+        return (workers > 0 && wall_seconds > 0) ?
+            busy_seconds / (workers * wall_seconds) : 0;
+    }
+};
+
+class IdentificationPipeline {
+public:
+    // Вызывается из потоков этапа поиска, вызовы сериализованы
+    using ResultCallback = std::function<void(const PipelineItemResult&)>;
+
+    IdentificationPipeline(const SnakeDatabase& database,
+        const PipelineConfig& config = PipelineConfig());
+
+    // Обрабатывает файлы и возвращает, когда конвейер опустеет.
+    // Результаты приходят в порядке готовности, а не в порядке файлов.
+    void run(const std::vector<std::string>& files, const ResultCallback& on_result);
+
+    // Все изображения папки (FileUtils::findImageFiles)
+    void runDirectory(const std::string& directory, const ResultCallback& on_result);
+
+    // Можно вызывать из любого потока
+    void cancel();
+
+    // Метрики последнего запуска: decode, preprocess, extract, match
+    std::vector<StageMetrics> metrics() const;
+    double wallSeconds() const;
+
+private:
+    struct Item {
+        size_t index = 0;
+        std::string path;
+        cv::Mat image;
+        cv::Mat mask;
+        FeaturePoints features;
+    };
+
+    const SnakeDatabase& database_;
+    PipelineConfig config_;
+    std::atomic<bool> cancel_requested_{ false };
+    std::vector<StageMetrics> metrics_;
+    double wall_seconds_ = 0;
+    mutable std::mutex metrics_mutex_;
+};
+
+#endif // IDENTIFICATION_PIPELINE_H
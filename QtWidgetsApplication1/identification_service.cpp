@@ -0,0 +1,187 @@
+﻿#include "identification_service.h"
+#include "parallel_for.h"
+#include "tracing.h"
+
+using namespace cv;
+
+static double millisecondsBetween(std::chrono::steady_clock::time_point from,
+    std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+const char* serviceStatusName(ServiceStatus status) {
+    switch (status) {
+    case ServiceStatus::Ok: return "ok";
+    case ServiceStatus::Overloaded: return "overloaded";
+    case ServiceStatus::Expired: return "expired";
+    case ServiceStatus::Error: return "error";
+    case ServiceStatus::Warming: return "warming";
+    case ServiceStatus::ShuttingDown: return "shutting_down";
+    }
+    return "unknown";
+}
+
+IdentificationService::IdentificationService(const SnakeDatabase& database,
+    const ServiceConfig& config)
+    : database_(database)
+    , config_(config) {
+    config_.max_batch = std::max<size_t>(1, config_.max_batch);
+    worker_ = std::thread(&IdentificationService::loop, this);
+}
+
+IdentificationService::~IdentificationService() {
+    stop();
+}
+
+bool IdentificationService::submit(const std::string& image_path, Callback done) {
+    ServiceResponse rejected;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            rejected.status = ServiceStatus::ShuttingDown;
+        }
+        else if (pending_.size() >= config_.max_pending) {
+            rejected.status = ServiceStatus::Overloaded;
+            ++stats_.rejected;
+        }
+        else {
+            pending_.push_back({ image_path, std::move(done), Clock::now() });
+            ++stats_.accepted;
+            ready_.notify_one();
+            return true;
+        }
+    }
+    SNAKE_TRACE_COUNTER("service.rejected", 1);
+    if (done) done(rejected);
+    return false;
+}
+
+void IdentificationService::stop() {
+    std::deque<Request> abandoned;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) return;
+        stopping_ = true;
+        abandoned.swap(pending_);
+        ready_.notify_all();
+    }
+    if (worker_.joinable()) worker_.join();
+
+    ServiceResponse response;
+    response.status = ServiceStatus::ShuttingDown;
+    for (auto& request : abandoned) {
+        if (request.done) request.done(response);
+    }
+}
+
+ServiceStats IdentificationService::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ServiceStats stats = stats_;
+    stats.pending = pending_.size();
+    return stats;
+}
+
+void IdentificationService::loop() {
+    std::vector<Request> batch;
+    while (nextBatch(batch)) {
+        // Весь пакет мог оказаться просроченным
+        if (!batch.empty()) process(batch);
+    }
+}
+
+// Ждёт первый запрос, затем добирает пакет до max_batch не дольше
+// batch_window_ms. При небольшой нагрузке запрос ждёт не больше окна,
+// при большой пакет набирается сразу из очереди. false - сервис остановлен.
+bool IdentificationService::nextBatch(std::vector<Request>& batch) {
+    batch.clear();
+    std::unique_lock<std::mutex> lock(mutex_);
+    ready_.wait(lock, [this]() { return stopping_ || !pending_.empty(); });
+    if (stopping_) return false;
+
+    auto window_end = pending_.front().received +
+        std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double, std::milli>(config_.batch_window_ms));
+    ready_.wait_until(lock, window_end, [this]() {
+        return stopping_ || pending_.size() >= config_.max_batch;
+        });
+    if (stopping_) return false;
+
+    auto now = Clock::now();
+    std::vector<Request> expired;
+    while (!pending_.empty() && batch.size() < config_.max_batch) {
+        Request request = std::move(pending_.front());
+        pending_.pop_front();
+        if (millisecondsBetween(request.received, now) > config_.max_queue_ms) {
+            expired.push_back(std::move(request));
+        }
+        else {
+            batch.push_back(std::move(request));
+        }
+    }
+    stats_.expired += expired.size();
+    lock.unlock();
+
+    for (auto& request : expired) {
+        ServiceResponse response;
+        response.status = ServiceStatus::Expired;
+        response.queue_ms = millisecondsBetween(request.received, now);
+        response.total_ms = response.queue_ms;
+        if (request.done) request.done(response);
+    }
+    SNAKE_TRACE_COUNTER("service.expired", expired.size());
+    return true;
+}
+
+void IdentificationService::process(std::vector<Request>& batch) {
+    SNAKE_TRACE_SCOPE("service.batch");
+    SNAKE_TRACE_COUNTER("service.batch_size", batch.size());
+    auto started = Clock::now();
+    const IdentificationParams& params = config_.params;
+
+    // Чтение, предобработка и SIFT - по запросу на поток
+    std::vector<FeaturePoints> queries(batch.size());
+    std::vector<std::string> errors(batch.size());
+    parallelFor(batch.size(), config_.threads, [&](size_t i) {
+        Mat image = imread(batch[i].path);
+        if (image.empty()) {
+            errors[i] = "cannot read image: " + batch[i].path;
+            return;
+        }
+        Mat mask;
+        Mat processed = ImagePreprocessor::preprocess(image,
+            params.enhance_scales, params.remove_background,
+            params.preprocessing_level, &mask);
+        queries[i] = detectSIFTFeatures(processed, mask);
+        });
+
+    std::vector<IdentificationResult> results = SnakeIdentifier::matchBatch(
+        queries, database_, params, config_.threads, false);
+
+    auto finished = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.completed += batch.size();
+        ++stats_.batches;
+    }
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        ServiceResponse response;
+        if (!errors[i].empty()) {
+            response.status = ServiceStatus::Error;
+            response.error = errors[i];
+        }
+        else if (results[i].warming) {
+            response.status = ServiceStatus::Warming;
+        }
+        response.found = results[i].found;
+        response.name = results[i].name;
+        response.image_path = results[i].matched_image_path;
+        response.good_matches = results[i].good_matches;
+        response.match_ratio = results[i].match_ratio;
+        response.keypoints = queries[i].keypoints.size();
+        response.batch_size = batch.size();
+        response.queue_ms = millisecondsBetween(batch[i].received, started);
+        response.total_ms = millisecondsBetween(batch[i].received, finished);
+        if (batch[i].done) batch[i].done(response);
+    }
+}
@@ -0,0 +1,116 @@
+﻿#ifndef IDENTIFICATION_SERVICE_H
+#define IDENTIFICATION_SERVICE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "snake_identifier.h"
+
+// Резидентный сервис идентификации: база загружена один раз, запросы
+// от разных клиентов собираются в микро-пакеты и ищутся за один проход
+// по снимку базы (SnakeIdentifier::matchBatch).
+//
+// Хвост задержки ограничивается двумя правилами приёма:
+//  - очередь не длиннее max_pending: лишний запрос сразу получает Overloaded;
+//  - запрос, прождавший в очереди дольше max_queue_ms, получает Expired
+//    без обработки - клиент всё равно уже не дождётся полезного ответа.
+struct ServiceConfig {
+    size_t max_batch = 8;           // запросов в одном пакете
+    double batch_window_ms = 5;     // ожидание добора пакета после первого запроса
+    size_t max_pending = 64;        // длина очереди ожидания
+    double max_queue_ms = 2000;     // предельное ожидание в очереди
+    int threads = 0;                // потоки обработки пакета, <= 0 - все ядра
+    IdentificationParams params;
+};
+
+enum class ServiceStatus {
+    Ok,
+    Overloaded,     // отказ при приёме: очередь полна
+    Expired,        // слишком долго ждал в очереди
+    Error,          // не удалось прочитать изображение
+    Warming,        // база ещё прогревается (SnakeDatabase::startLoad)
+    ShuttingDown
+};
+
+const char* serviceStatusName(ServiceStatus status);
+
+struct ServiceResponse {
+    ServiceStatus status = ServiceStatus::Ok;
+    std::string error;
+    bool found = false;
+    std::string name;
+    std::string image_path;     // снимок записи, давший лучшее совпадение
+    int good_matches = 0;
+    float match_ratio = 0;
+    size_t keypoints = 0;
+    size_t batch_size = 0;      // размер пакета, в котором обработан запрос
+    double queue_ms = 0;        // ожидание до начала обработки
+    double total_ms = 0;        // от приёма до ответа
+};
+
+struct ServiceStats {
+    size_t accepted = 0;
+    size_t rejected = 0;        // Overloaded
+    size_t expired = 0;
+    size_t completed = 0;       // Ok, Error и Warming
+    size_t batches = 0;
+    size_t pending = 0;         // сейчас в очереди
+
+    double meanBatchSize() const {
+        return batches > 0 ? static_cast<double>(completed) / batches : 0;
+    }
+};
+
+class IdentificationService {
+public:
+    // Вызывается из потока сервиса; не должен надолго блокироваться
+    using Callback = std::function<void(const ServiceResponse&)>;
+
+    IdentificationService(const SnakeDatabase& database,
+        const ServiceConfig& config = ServiceConfig());
+    ~IdentificationService();
+
+    IdentificationService(const IdentificationService&) = delete;
+    IdentificationService& operator=(const IdentificationService&) = delete;
+
+    // Ставит изображение в очередь. false - запрос не принят, done уже
+    // вызван с Overloaded или ShuttingDown. Можно вызывать из любого потока.
+    bool submit(const std::string& image_path, Callback done);
+
+    // Дожидается текущего пакета; запросы в очереди получают ShuttingDown
+    void stop();
+
+    ServiceStats stats() const;
+    const ServiceConfig& config() const { return config_; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Request {
+        std::string path;
+        Callback done;
+        Clock::time_point received;
+    };
+
+    void loop();
+    bool nextBatch(std::vector<Request>& batch);
+    void process(std::vector<Request>& batch);
+
+    const SnakeDatabase& database_;
+    ServiceConfig config_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<Request> pending_;
+    bool stopping_ = false;
+    ServiceStats stats_;
+
+    std::thread worker_;
+};
+
+#endif // IDENTIFICATION_SERVICE_H
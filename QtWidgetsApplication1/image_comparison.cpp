@@ -1,5 +1,9 @@
 ﻿#include "image_comparison.h"
+#include "descriptor_matcher.h"
+#include "parallel_for.h"
+#include "tracing.h"
 #include <chrono>
+#include <cmath>
 
 using namespace cv;
 using namespace std;
@@ -7,20 +11,47 @@ using namespace chrono;
 
 vector<ComparisonResult> results;
 
-FeaturePoints detectSIFTFeatures(const Mat& image) {
+FeaturePoints detectSIFTFeatures(const Mat& image, const Mat& mask) {
+    SNAKE_TRACE_SCOPE("extract.sift");
     FeaturePoints result;
     Ptr<SIFT> detector = SIFT::create();
 
     auto start = high_resolution_clock::now();
-    detector->detectAndCompute(image, noArray(),
-        result.keypoints, result.descriptors);
+    if (mask.empty()) {
+        detector->detectAndCompute(image, noArray(),
+            result.keypoints, result.descriptors);
+    }
+    else {
+        // SIFT применяет маску только после построения пирамиды, поэтому
+        // обрезаем изображение по рамке переднего плана: меньше область -
+        // меньше октав и меньше работы на фоне
+        Mat coarse = coarsenMask(mask);
+        Rect roi = boundingRect(coarse);
+        if (!roi.empty()) {
+            // Запас вокруг рамки, чтобы дескрипторы у края считались по тем же пикселям
+            const int margin = MASK_CELL_SIZE;
+            roi = Rect(roi.x - margin, roi.y - margin,
+                roi.width + 2 * margin, roi.height + 2 * margin)
+                & Rect(0, 0, image.cols, image.rows);
+
+            detector->detectAndCompute(image(roi), coarse(roi),
+                result.keypoints, result.descriptors);
+
+            for (auto& kp : result.keypoints) {
+                kp.pt.x += roi.x;
+                kp.pt.y += roi.y;
+            }
+        }
+    }
     auto stop = high_resolution_clock::now();
+    SNAKE_TRACE_COUNTER("extract.sift_keypoints", result.keypoints.size());
 
     result.processing_time = duration_cast<milliseconds>(stop - start).count() / 1000.0;
     return result;
 }
 
 FeaturePoints detectORBFeatures(const Mat& image) {
+    SNAKE_TRACE_SCOPE("extract.orb");
     FeaturePoints result;
     Ptr<ORB> detector = ORB::create(1000);
 
@@ -33,59 +64,165 @@ FeaturePoints detectORBFeatures(const Mat& image) {
     return result;
 }
 
-MatchResult matchFeatures(const FeaturePoints& featuresA,
-    const FeaturePoints& featuresB,
+static bool isQuantizedDescriptors(const Mat& descriptors, int normType) {
+    return (normType == NORM_L2 || normType == NORM_L1) &&
+        (descriptors.depth() == CV_8U || descriptors.depth() == CV_16F);
+}
+
+static DescriptorStorage storageOfDepth(int depth) {
+    return depth == CV_8U ? DescriptorStorage::UInt8 : DescriptorStorage::Float16;
+}
+
+// Расстояние между строками полных дескрипторов одной глубины
+static float rowDistance(const Mat& a, int row_a, const Mat& b, int row_b, int normType) {
+    switch (a.depth()) {
+    case CV_8U:
+        return normType == NORM_L1 ?
+            static_cast<float>(l1DistanceU8(a.ptr<uint8_t>(row_a), b.ptr<uint8_t>(row_b), a.cols)) :
+            std::sqrt(static_cast<float>(l2SquaredU8(a.ptr<uint8_t>(row_a), b.ptr<uint8_t>(row_b), a.cols)));
+    case CV_16F:
+        return normType == NORM_L1 ?
+            l1DistanceF16(a.ptr<uint16_t>(row_a), b.ptr<uint16_t>(row_b), a.cols) :
+            std::sqrt(l2SquaredF16(a.ptr<uint16_t>(row_a), b.ptr<uint16_t>(row_b), a.cols));
+    default:
+        return static_cast<float>(norm(a.row(row_a), b.row(row_b), normType));
+    }
+}
+
+// Два ближайших по укороченным (PCA) дескрипторам: поиск среди
+// REDUCED_CANDIDATES соседей в проекции, порядок и расстояния - по полным
+// дескрипторам. Результат - в context.neighbours по REDUCED_CANDIDATES на
+// строку, первые два - ближайшие; trainIdx - номера строк внутри [row_begin, row_end)
+static void knnMatchReduced(const FeaturePoints& featuresA, const FeatureView& featuresB,
+    int row_begin, int row_end, int normType, MatchContext& context) {
+    SNAKE_TRACE_SCOPE("match.knn_reduced");
+    Mat train_full = featuresB.descriptors.rowRange(row_begin, row_end);
+    Mat query_full = featuresA.descriptors;
+    if (query_full.depth() != train_full.depth()) {
+        if (train_full.depth() == CV_32F) query_full.convertTo(context.query, CV_32F);
+        else encodeDescriptors(query_full, { storageOfDepth(train_full.depth()), false }, context.query);
+        query_full = context.query;
+    }
+
+    // Кандидаты по коротким векторам переранжируются на месте: первые
+    // два в каждой строке - ближайшие по полному расстоянию
+    knnMatchDescriptors(featuresA.projected, featuresB.projected.rowRange(row_begin, row_end),
+        NORM_L2, REDUCED_CANDIDATES, context.neighbours);
+    context.stride = REDUCED_CANDIDATES;
+    for (size_t row = 0; row < context.neighbours.size(); row += REDUCED_CANDIDATES) {
+        cv::DMatch* first = context.neighbours.data() + row;
+        cv::DMatch* last = first + REDUCED_CANDIDATES;
+        for (cv::DMatch* m = first; m != last; ++m) {
+            if (m->trainIdx >= 0) {
+                m->distance = rowDistance(query_full, m->queryIdx, train_full, m->trainIdx, normType);
+            }
+        }
+        std::sort(first, last,
+            [](const cv::DMatch& a, const cv::DMatch& b) { return a.distance < b.distance; });
+    }
+}
+
+MatchContext& MatchContext::local() {
+    thread_local MatchContext context;
+    return context;
+}
+
+// RANSAC по context.good, выжившие - в context.inliers
+static void filterInliers(const vector<KeyPoint>& kp1, const FeatureView& features2,
+    double ransacThreshold, MatchContext& context) {
+    const vector<DMatch>& matches = context.good;
+    context.inliers.clear();
+    if (matches.size() < 4) {
+        context.inliers.insert(context.inliers.end(), matches.begin(), matches.end());
+        return;
+    }
+    SNAKE_TRACE_SCOPE("match.ransac");
+
+    context.points_a.clear();
+    context.points_b.clear();
+    for (const auto& m : matches) {
+        context.points_a.push_back(kp1[m.queryIdx].pt);
+        context.points_b.push_back(features2.point(m.trainIdx));
+    }
+
+    context.mask.clear();
+    findHomography(context.points_a, context.points_b, RANSAC, ransacThreshold, context.mask);
+
+    bool masked = context.mask.size() == matches.size();
+    for (size_t i = 0; i < matches.size(); i++) {
+        if (!masked || context.mask[i]) {
+            context.inliers.push_back(matches[i]);
+        }
+    }
+}
+
+// Сопоставление A со строками [row_begin, row_end) дескрипторов B;
+// trainIdx совпадений - номера строк во всём B
+static MatchResult matchRows(MatchContext& context,
+    const FeaturePoints& featuresA,
+    const FeatureView& featuresB,
+    int row_begin,
+    int row_end,
     int normType,
-    float ratio_threshold)
+    float ratio_threshold,
+    bool use_homography,
+    double ransac_threshold)
 {
+    SNAKE_TRACE_SCOPE("match.features");
     MatchResult result;
     result.total_matches = 0;
     result.good_matches = 0;
     result.avg_distance = 0;
     result.is_match = false;
+    result.matching_time = 0;
 
+    auto start = high_resolution_clock::now();
     try {
-        if (featuresA.descriptors.empty() || featuresB.descriptors.empty()) {
+        if (featuresA.descriptors.empty() || row_end <= row_begin) {
             return result;
         }
 
-        // Используем FlannBasedMatcher для SIFT/SURF
-        cv::Ptr<cv::DescriptorMatcher> matcher;
-        if (normType == cv::NORM_L2) {
-            matcher = cv::FlannBasedMatcher::create();
+        Mat train = featuresB.descriptors.rowRange(row_begin, row_end);
+        bool reduced = !featuresA.projected.empty() && !featuresB.projected.empty() &&
+            featuresA.projected.cols == featuresB.projected.cols &&
+            featuresB.projected.rows == featuresB.descriptors.rows;
+        if (reduced) {
+            knnMatchReduced(featuresA, featuresB, row_begin, row_end, normType, context);
         }
         else {
-            matcher = cv::BFMatcher::create(normType);
+            // Точный перебор, специализированный по типу и ширине строк
+            // (descriptor_matcher.h); квантованный B - запрос приводится к его формату
+            Mat query = featuresA.descriptors;
+            if (isQuantizedDescriptors(train, normType) && query.depth() != train.depth()) {
+                encodeDescriptors(query, { storageOfDepth(train.depth()), false }, context.query);
+                query = context.query;
+            }
+            knnMatchDescriptors(query, train, normType, 2, context.neighbours);
+            context.stride = 2;
         }
 
-        std::vector<std::vector<cv::DMatch>> knn_matches;
-        matcher->knnMatch(
-            featuresA.descriptors,
-            featuresB.descriptors,
-            knn_matches,
-            2
-        );
-
-        // Фильтр по соотношению расстояний
-        std::vector<cv::DMatch> good_matches;
-        for (size_t i = 0; i < knn_matches.size(); i++) {
-            if (knn_matches[i].size() < 2) continue;
-
-            if (knn_matches[i][0].distance <
-                ratio_threshold * knn_matches[i][1].distance) {
-                good_matches.push_back(knn_matches[i][0]);
+        // Фильтр по соотношению расстояний; у строки без второго соседа
+        // trainIdx второго равен -1
+        context.good.clear();
+        for (size_t i = 0; i < context.neighbours.size(); i += context.stride) {
+            const cv::DMatch& first = context.neighbours[i];
+            const cv::DMatch& second = context.neighbours[i + 1];
+            if (second.trainIdx < 0) continue;
+
+            if (first.distance < ratio_threshold * second.distance) {
+                context.good.push_back(first);
+                context.good.back().trainIdx += row_begin;
             }
         }
 
         // Фильтр по гомографии
-        std::vector<cv::DMatch> inliers = filterMatchesWithHomography(
-            featuresA.keypoints,
-            featuresB.keypoints,
-            good_matches
-        );
+        if (use_homography) {
+            filterInliers(featuresA.keypoints, featuresB, ransac_threshold, context);
+        }
+        const vector<DMatch>& inliers = use_homography ? context.inliers : context.good;
 
         // Заполняем результат
-        result.total_matches = good_matches.size();
+        result.total_matches = context.good.size();
         result.good_matches = inliers.size();
 
         if (!inliers.empty()) {
@@ -97,39 +234,103 @@ MatchResult matchFeatures(const FeaturePoints& featuresA,
         }
 
         result.is_match = !inliers.empty();
+        SNAKE_TRACE_COUNTER("match.good_matches", result.good_matches);
     }
     catch (...) {
         // В случае ошибки возвращаем пустой результат
     }
+    auto stop = high_resolution_clock::now();
 
+    result.matching_time = duration_cast<microseconds>(stop - start).count() / 1e6;
     return result;
 }
 
-vector<DMatch> filterMatchesWithHomography(
-    const vector<KeyPoint>& kp1,
-    const vector<KeyPoint>& kp2,
-    const vector<DMatch>& matches,
-    double ransacThreshold) {
+MatchResult matchFeatures(MatchContext& context,
+    const FeaturePoints& featuresA,
+    const FeatureView& featuresB,
+    int normType,
+    float ratio_threshold,
+    bool use_homography,
+    double ransac_threshold)
+{
+    return matchRows(context, featuresA, featuresB, 0, featuresB.descriptors.rows,
+        normType, ratio_threshold, use_homography, ransac_threshold);
+}
 
-    if (matches.size() < 4) return matches;
+MatchResult matchFeatures(const FeaturePoints& featuresA,
+    const FeatureView& featuresB,
+    int normType,
+    float ratio_threshold,
+    bool use_homography,
+    double ransac_threshold)
+{
+    return matchFeatures(MatchContext::local(), featuresA, featuresB,
+        normType, ratio_threshold, use_homography, ransac_threshold);
+}
 
-    vector<Point2f> pts1, pts2;
-    for (const auto& m : matches) {
-        pts1.push_back(kp1[m.queryIdx].pt);
-        pts2.push_back(kp2[m.trainIdx].pt);
+MatchResult matchFeaturesGrouped(MatchContext& context,
+    const FeaturePoints& featuresA,
+    const FeatureView& featuresB,
+    const vector<int>& group_starts,
+    int normType,
+    float ratio_threshold,
+    bool use_homography,
+    double ransac_threshold,
+    int* best_group)
+{
+    if (best_group) *best_group = -1;
+    if (group_starts.size() <= 1) {
+        MatchResult result = matchFeatures(context, featuresA, featuresB, normType,
+            ratio_threshold, use_homography, ransac_threshold);
+        if (best_group && !featuresB.descriptors.empty()) *best_group = 0;
+        return result;
     }
 
-    Mat mask;
-    findHomography(pts1, pts2, RANSAC, ransacThreshold, mask);
-
-    vector<DMatch> inliers;
-    for (size_t i = 0; i < matches.size(); i++) {
-        if (mask.empty() || mask.at<uchar>(i)) {
-            inliers.push_back(matches[i]);
+    MatchResult best = matchRows(context, featuresA, featuresB, 0, 0,
+        normType, ratio_threshold, use_homography, ransac_threshold);
+    int chosen = -1;
+    double total_time = 0;
+    for (size_t g = 0; g < group_starts.size(); ++g) {
+        int begin = group_starts[g];
+        int end = g + 1 < group_starts.size() ? group_starts[g + 1] : featuresB.descriptors.rows;
+        // Группа, целиком слитая с прежними снимками, строк не имеет
+        if (end <= begin) continue;
+
+        MatchResult result = matchRows(context, featuresA, featuresB, begin, end,
+            normType, ratio_threshold, use_homography, ransac_threshold);
+        total_time += result.matching_time;
+        if (chosen < 0 || result.good_matches > best.good_matches) {
+            best = result;
+            chosen = static_cast<int>(g);
         }
     }
+    best.matching_time = total_time;
+    if (best_group) *best_group = chosen;
+    return best;
+}
+
+MatchResult matchFeaturesGrouped(const FeaturePoints& featuresA,
+    const FeatureView& featuresB,
+    const vector<int>& group_starts,
+    int normType,
+    float ratio_threshold,
+    bool use_homography,
+    double ransac_threshold,
+    int* best_group)
+{
+    return matchFeaturesGrouped(MatchContext::local(), featuresA, featuresB, group_starts,
+        normType, ratio_threshold, use_homography, ransac_threshold, best_group);
+}
 
-    return inliers;
+vector<DMatch> filterMatchesWithHomography(
+    const vector<KeyPoint>& kp1,
+    const vector<KeyPoint>& kp2,
+    const vector<DMatch>& matches,
+    double ransacThreshold) {
+    MatchContext context;
+    context.good = matches;
+    filterInliers(kp1, FeatureView(kp2), ransacThreshold, context);
+    return context.inliers;
 }
 
 void compareImages(const Mat& imgA, const Mat& imgB,
@@ -144,12 +345,102 @@ void compareImages(const Mat& imgA, const Mat& imgB,
     result.orbB = detectORBFeatures(imgB);
 
     // Match features
-    result.sift_match = matchFeatures(result.siftA, result.siftB, NORM_L2, 0.7);
-    result.orb_match = matchFeatures(result.orbA, result.orbB, NORM_HAMMING, 0.6);
+    result.sift_match = matchFeatures(result.siftA, result.siftB, NORM_L2, SIFT_RATIO_THRESHOLD);
+    result.orb_match = matchFeatures(result.orbA, result.orbB, NORM_HAMMING, ORB_RATIO_THRESHOLD);
+
+    result.sift_kpA = result.siftA.keypoints.size();
+    result.sift_kpB = result.siftB.keypoints.size();
+    result.orb_kpA = result.orbA.keypoints.size();
+    result.orb_kpB = result.orbB.keypoints.size();
+    result.sift_detect_time = result.siftA.processing_time + result.siftB.processing_time;
+    result.orb_detect_time = result.orbA.processing_time + result.orbB.processing_time;
 
     results.push_back(result);
 }
 
+vector<ExtractedImage> extractAll(const vector<string>& image_paths, int threads) {
+    vector<ExtractedImage> images(image_paths.size());
+
+    parallelFor(image_paths.size(), threads, [&](size_t i) {
+        ExtractedImage& image = images[i];
+        image.path = image_paths[i];
+
+        Mat img = imread(image.path);
+        if (img.empty()) return;
+
+        image.loaded = true;
+        image.sift = detectSIFTFeatures(img);
+        image.orb = detectORBFeatures(img);
+        });
+
+    return images;
+}
+
+ComparisonResult comparePair(const ExtractedImage& a, const ExtractedImage& b) {
+    ComparisonResult result;
+    initResult(result, a.path, b.path);
+
+    result.sift_match = matchFeatures(a.sift, b.sift, NORM_L2, SIFT_RATIO_THRESHOLD);
+    result.orb_match = matchFeatures(a.orb, b.orb, NORM_HAMMING, ORB_RATIO_THRESHOLD);
+
+    // Сами признаки не копируем - в N^2 строк они не поместятся в памяти
+    result.sift_kpA = a.sift.keypoints.size();
+    result.sift_kpB = b.sift.keypoints.size();
+    result.orb_kpA = a.orb.keypoints.size();
+    result.orb_kpB = b.orb.keypoints.size();
+    result.sift_detect_time = a.sift.processing_time + b.sift.processing_time;
+    result.orb_detect_time = a.orb.processing_time + b.orb.processing_time;
+
+    return result;
+}
+
+vector<ComparisonResult> evaluateAllPairs(const vector<string>& image_paths, int threads) {
+    vector<ExtractedImage> images = extractAll(image_paths, threads);
+
+    vector<size_t> loaded;
+    for (size_t i = 0; i < images.size(); ++i) {
+        if (images[i].loaded) {
+            loaded.push_back(i);
+        }
+        else {
+            cerr << "Failed to load image: " << images[i].path << endl;
+        }
+    }
+
+    // Упорядоченные пары (A, B), A != B. Каждый поток пишет только в свои
+    // ячейки заранее выделенного вектора, поэтому блокировки не нужны.
+    size_t n = loaded.size();
+    size_t pairs = n > 1 ? n * (n - 1) : 0;
+    vector<ComparisonResult> pair_results(pairs);
+
+    parallelFor(pairs, threads, [&](size_t p) {
+        size_t a = p / (n - 1);
+        size_t b = p % (n - 1);
+        if (b >= a) ++b;
+        pair_results[p] = comparePair(images[loaded[a]], images[loaded[b]]);
+        });
+
+    return pair_results;
+}
+
+Mat coarsenMask(const Mat& mask, int cell_size) {
+    if (mask.empty() || cell_size <= 1) return mask;
+
+    // Доля переднего плана в каждой клетке
+    Mat cells;
+    resize(mask, cells,
+        Size(max(1, mask.cols / cell_size), max(1, mask.rows / cell_size)),
+        0, 0, INTER_AREA);
+
+    // Отбрасываем клетки с редкими пятнами шума, соседей оставляем для контекста
+    threshold(cells, cells, 64, 255, THRESH_BINARY);
+    dilate(cells, cells, getStructuringElement(MORPH_RECT, Size(3, 3)));
+
+    Mat coarse;
+    resize(cells, coarse, mask.size(), 0, 0, INTER_NEAREST);
+    return coarse;
+}
+
 void initResult(ComparisonResult& result,
     const string& imgA_path, const string& imgB_path) {
     result.imageA = FileUtils::getJustFileName(imgA_path);
@@ -158,6 +449,11 @@ void initResult(ComparisonResult& result,
 }
 
 void saveResultsToCSV(const string& filename) {
+    saveResultsToCSV(filename, results);
+}
+
+void saveResultsToCSV(const string& filename,
+    const vector<ComparisonResult>& results) {
     vector<vector<string>> data;
     vector<string> headers = {
         "ImageA", "ImageB", "IsSameSource",
@@ -172,10 +468,10 @@ void saveResultsToCSV(const string& filename) {
             result.imageA,
             result.imageB,
             result.is_same_source ? "YES" : "NO",
-            to_string(result.siftA.keypoints.size()),
-            to_string(result.siftB.keypoints.size()),
-            to_string(result.orbA.keypoints.size()),
-            to_string(result.orbB.keypoints.size()),
+            to_string(result.sift_kpA),
+            to_string(result.sift_kpB),
+            to_string(result.orb_kpA),
+            to_string(result.orb_kpB),
             to_string(result.sift_match.total_matches),
             to_string(result.sift_match.good_matches),
             to_string(result.sift_match.avg_distance),
@@ -184,8 +480,8 @@ void saveResultsToCSV(const string& filename) {
             to_string(result.orb_match.good_matches),
             to_string(result.orb_match.avg_distance),
             result.orb_match.is_match ? "YES" : "NO",
-            to_string(result.siftA.processing_time + result.siftB.processing_time),
-            to_string(result.orbA.processing_time + result.orbB.processing_time),
+            to_string(result.sift_detect_time),
+            to_string(result.orb_detect_time),
             to_string(result.sift_match.matching_time),
             to_string(result.orb_match.matching_time)
             });
@@ -2,16 +2,55 @@
 #define IMAGE_COMPARISON_H
 
 #include <opencv2/opencv.hpp>
-#include <opencv2/xfeatures2d.hpp>
+#include <opencv2/features2d.hpp>
 #include <vector>
 #include <string>
 #include <chrono>
+#include "descriptor_quantization.h"
+#include "feature_slab.h"
 #include "file_utils.h"
 
 struct FeaturePoints {
     std::vector<cv::KeyPoint> keypoints;
     cv::Mat descriptors;
     double processing_time;
+    // Optional PCA-reduced copy of descriptors (descriptor_pca.h)
+    cv::Mat projected;
+};
+
+// Train side of a match, viewed without copying: either the keypoints of a
+// FeaturePoints or the x/y arrays of a database record (feature_slab.h).
+// Only point coordinates are read (for RANSAC); the descriptor headers share
+// data with their owner, which must outlive the view.
+struct FeatureView {
+    FeatureView(const FeaturePoints& features)
+        : keypoints(features.keypoints.data())
+        , count(features.keypoints.size())
+        , descriptors(features.descriptors)
+        , projected(features.projected) {
+    }
+    explicit FeatureView(const std::vector<cv::KeyPoint>& points)
+        : keypoints(points.data())
+        , count(points.size()) {
+    }
+    FeatureView(const PointSet& points, const cv::Mat& descriptors, const cv::Mat& projected)
+        : x(points.x().data())
+        , y(points.y().data())
+        , count(points.size())
+        , descriptors(descriptors)
+        , projected(projected) {
+    }
+
+    cv::Point2f point(size_t i) const {
+        return keypoints ? keypoints[i].pt : cv::Point2f(x[i], y[i]);
+    }
+
+    const cv::KeyPoint* keypoints = nullptr;
+    const float* x = nullptr;
+    const float* y = nullptr;
+    size_t count = 0;
+    cv::Mat descriptors;
+    cv::Mat projected;
 };
 
 struct MatchResult {
@@ -32,32 +71,134 @@ struct ComparisonResult {
 
     MatchResult sift_match;
     MatchResult orb_match;
+
+    // Summary used for CSV output; filled even when the feature sets
+    // themselves are not kept (see evaluateAllPairs)
+    int sift_kpA = 0, sift_kpB = 0;
+    int orb_kpA = 0, orb_kpB = 0;
+    double sift_detect_time = 0;
+    double orb_detect_time = 0;
+};
+
+// Features of one image, extracted once for all pairs it takes part in
+struct ExtractedImage {
+    std::string path;
+    bool loaded = false;
+    FeaturePoints sift;
+    FeaturePoints orb;
 };
 
 // Feature Detection
-FeaturePoints detectSIFTFeatures(const cv::Mat& image);
+// mask - optional foreground mask (CV_8U, same size as image). It is coarsened
+// to MASK_CELL_SIZE blocks and SIFT runs only inside its bounding box, so the
+// background costs neither pyramid octaves nor keypoints.
+const int MASK_CELL_SIZE = 16;
+FeaturePoints detectSIFTFeatures(const cv::Mat& image, const cv::Mat& mask = cv::Mat());
 FeaturePoints detectORBFeatures(const cv::Mat& image);
 
 // Feature Matching
+// Lowe ratio thresholds used by compareImages / evaluateAllPairs
+const float SIFT_RATIO_THRESHOLD = 0.7f;
+const float ORB_RATIO_THRESHOLD = 0.6f;
+const double RANSAC_THRESHOLD = 3.0;
+
+// use_homography = false skips the RANSAC inlier filter (ratio test only).
+// Nearest neighbours are exact, found by the matcher specialized for the
+// descriptor type and width (descriptor_matcher.h). For quantized SIFT
+// descriptors (CV_8U or CV_16F with NORM_L2/NORM_L1, see
+// descriptor_quantization.h) a float query is encoded to the stored depth.
+// When both sides carry projected descriptors of the same width, neighbours
+// are searched among the short vectors and REDUCED_CANDIDATES of them per
+// row are re-ranked by full-descriptor distance before the ratio test.
+const int REDUCED_CANDIDATES = 4;
+
+// Reusable matching buffers, one per thread. Neighbours are a flat array of
+// `stride` entries per query row, nearest first (a missing neighbour has
+// trainIdx -1); the rest hold ratio-test survivors, RANSAC points and mask,
+// and the inliers. Buffers only grow, so once a context has seen the largest
+// feature sets, matching through it does no heap allocation of its own
+// (cv::findHomography still allocates inside RANSAC, and a query whose
+// depth differs from the train side is converted into `query`).
+struct MatchContext {
+    std::vector<cv::DMatch> neighbours;
+    int stride = 2;
+    std::vector<cv::DMatch> good;
+    std::vector<cv::Point2f> points_a;
+    std::vector<cv::Point2f> points_b;
+    std::vector<uchar> mask;
+    std::vector<cv::DMatch> inliers;
+    cv::Mat query;
+
+    // Context of the calling thread, used by the overloads without one
+    static MatchContext& local();
+};
+
+MatchResult matchFeatures(MatchContext& context,
+    const FeaturePoints& featuresA,
+    const FeatureView& featuresB,
+    int normType,
+    float ratio_threshold,
+    bool use_homography = true,
+    double ransac_threshold = RANSAC_THRESHOLD);
 MatchResult matchFeatures(const FeaturePoints& featuresA,
-    const FeaturePoints& featuresB,
+    const FeatureView& featuresB,
     int normType,
-    float ratio_threshold);
+    float ratio_threshold,
+    bool use_homography = true,
+    double ransac_threshold = RANSAC_THRESHOLD);
+
+// Matching against several photos stored as one feature set: rows of
+// featuresB are split into consecutive groups, group g covering rows
+// [group_starts[g], group_starts[g + 1]) and the last one running to the
+// end. Each row is matched once, inside its own group, and RANSAC runs per
+// group because keypoints of different photos share no geometry. Returns
+// the group with the most good matches; its index goes to best_group
+// (-1 when no group has rows). Fewer than two groups is plain matchFeatures.
+MatchResult matchFeaturesGrouped(MatchContext& context,
+    const FeaturePoints& featuresA,
+    const FeatureView& featuresB,
+    const std::vector<int>& group_starts,
+    int normType,
+    float ratio_threshold,
+    bool use_homography = true,
+    double ransac_threshold = RANSAC_THRESHOLD,
+    int* best_group = nullptr);
+MatchResult matchFeaturesGrouped(const FeaturePoints& featuresA,
+    const FeatureView& featuresB,
+    const std::vector<int>& group_starts,
+    int normType,
+    float ratio_threshold,
+    bool use_homography = true,
+    double ransac_threshold = RANSAC_THRESHOLD,
+    int* best_group = nullptr);
 
 // Main comparison function
 void compareImages(const cv::Mat& imgA, const cv::Mat& imgB,
     const std::string& imgA_path, const std::string& imgB_path);
 
+// All-pairs evaluation: every image is decoded and its SIFT/ORB features are
+// extracted exactly once, then all ordered pairs (A, B), A != B, are matched
+// in parallel. threads <= 0 means std::thread::hardware_concurrency().
+// Results are in (A, B) order, the same rows compareImages would produce.
+std::vector<ExtractedImage> extractAll(const std::vector<std::string>& image_paths,
+    int threads = 0);
+std::vector<ComparisonResult> evaluateAllPairs(const std::vector<std::string>& image_paths,
+    int threads = 0);
+ComparisonResult comparePair(const ExtractedImage& a, const ExtractedImage& b);
+
 // Helper functions
+cv::Mat coarsenMask(const cv::Mat& mask, int cell_size = MASK_CELL_SIZE);
 void initResult(ComparisonResult& result,
     const std::string& imgA_path, const std::string& imgB_path);
 std::vector<cv::DMatch> filterMatchesWithHomography(
     const std::vector<cv::KeyPoint>& kp1,
     const std::vector<cv::KeyPoint>& kp2,
     const std::vector<cv::DMatch>& matches,
-    double ransacThreshold = 3.0);
+    double ransacThreshold = RANSAC_THRESHOLD);
 
 // Results handling
 void saveResultsToCSV(const std::string& filename);
+void saveResultsToCSV(const std::string& filename,
+    const std::vector<ComparisonResult>& results);
 
 #endif // IMAGE_COMPARISON_H
\ No newline at end of file
@@ -0,0 +1,251 @@
+﻿#include "image_io_service.h"
+#include "tracing.h"
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <filesystem>
+
+static size_t imageBytes(const cv::Mat& image) {
+    return image.total() * image.elemSize();
+}
+
+// Уменьшение до max_side по большей стороне; меньшее - без изменений
+static cv::Mat fitImage(const cv::Mat& image, int max_side) {
+    int side = std::max(image.cols, image.rows);
+    if (max_side <= 0 || side <= max_side) return image;
+    double scale = static_cast<double>(max_side) / side;
+    cv::Mat scaled;
+    cv::resize(image, scaled, cv::Size(), scale, scale, cv::INTER_AREA);
+    return scaled;
+}
+
+// Запись во временный файл и переименование: читатель, открывший путь, не
+// увидит недописанный JPEG (он декодируется в непустое, но битое фото)
+static bool writeReplacing(const std::string& path, const cv::Mat& image,
+    const std::vector<int>& params) {
+    std::string temporary = path + ".tmp.jpg";
+    std::error_code ec;
+    if (!cv::imwrite(temporary, image, params)) {
+        std::filesystem::remove(temporary, ec);
+        return false;
+    }
+    std::filesystem::rename(temporary, path, ec);
+    if (ec) {
+        std::filesystem::remove(temporary, ec);
+        return false;
+    }
+    return true;
+}
+
+ImageIOService::ImageIOService(const ImageIOConfig& config)
+    : config_(config)
+    , writer_(&ImageIOService::writerLoop, this)
+    , reader_(&ImageIOService::readerLoop, this) {
+}
+
+ImageIOService::~ImageIOService() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        reads_.clear();
+    }
+    write_ready_.notify_all();
+    read_ready_.notify_all();
+    writer_.join();
+    reader_.join();
+}
+
+void ImageIOService::write(const std::string& path, const cv::Mat& image,
+    const std::string& file_path, const std::vector<ScaledCopy>& scaled) {
+    // Копия: вызывающий может изменить изображение, пока оно ждёт в очереди
+    cv::Mat owned = image.clone();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.insert(path);
+        for (const auto& copy : scaled) pending_.insert(copy.path);
+        insert(path, owned);
+        writes_.push_back({ path, file_path.empty() ? path : file_path, owned, scaled });
+    }
+    write_ready_.notify_one();
+}
+
+cv::Mat ImageIOService::read(const std::string& path) {
+    SNAKE_TRACE_SCOPE("io.read");
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // Путь, ещё стоящий в очереди чтения, читается здесь же - иначе
+        // пришлось бы ждать и все пути перед ним. Начатая предзагрузка
+        // дочитывает файл быстрее, чем чтение заново
+        auto queued = std::find(reads_.begin(), reads_.end(), path);
+        if (queued != reads_.end()) {
+            reads_.erase(queued);
+            loading_.erase(path);
+        }
+        loaded_.wait(lock, [&]() { return loading_.count(path) == 0; });
+        cv::Mat cached;
+        if (lookup(path, cached)) {
+            ++stats_.hits;
+            return cached;
+        }
+        ++stats_.misses;
+    }
+
+    cv::Mat image = cv::imread(path);
+    if (!image.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        insert(path, image);
+    }
+    return image;
+}
+
+void ImageIOService::prefetch(const std::vector<std::string>& paths) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& path : paths) {
+            if (path.empty() || cache_index_.count(path) || loading_.count(path)) continue;
+            loading_.insert(path);
+            reads_.push_back(path);
+        }
+    }
+    read_ready_.notify_one();
+}
+
+bool ImageIOService::flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    written_.wait(lock, [&]() { return writes_.empty() && writing_ == 0; });
+    return failed_.empty();
+}
+
+std::vector<std::string> ImageIOService::failedWrites() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return { failed_.begin(), failed_.end() };
+}
+
+void ImageIOService::forget(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_.erase(path);
+    auto it = cache_index_.find(path);
+    if (it == cache_index_.end()) return;
+    cache_bytes_ -= imageBytes(it->second->image);
+    cache_.erase(it->second);
+    cache_index_.erase(it);
+}
+
+bool ImageIOService::pending(const std::string& path) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_.count(path) > 0;
+}
+
+ImageIOStats ImageIOService::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ImageIOStats stats = stats_;
+    stats.pending_writes = writes_.size() + writing_;
+    stats.cache_entries = cache_.size();
+    stats.cache_bytes = cache_bytes_;
+    return stats;
+}
+
+void ImageIOService::writerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        write_ready_.wait(lock, [this]() { return stopping_ || !writes_.empty(); });
+        if (writes_.empty()) return;    // остановка после записи всей очереди
+
+        WriteTask task = std::move(writes_.front());
+        writes_.pop_front();
+        ++writing_;
+        lock.unlock();
+
+        bool ok;
+        size_t failed_copies = 0;
+        {
+            SNAKE_TRACE_SCOPE("io.write");
+            std::vector<int> params = { cv::IMWRITE_JPEG_QUALITY, config_.jpeg_quality };
+            ok = cv::imwrite(task.file_path, task.image, params);
+            for (const auto& copy : task.scaled) {
+                if (!writeReplacing(copy.path, fitImage(task.image, copy.max_side), params)) {
+                    ++failed_copies;
+                }
+            }
+        }
+
+        lock.lock();
+        --writing_;
+        stats_.failed_writes += failed_copies;
+        if (ok) {
+            ++stats_.writes;
+            failed_.erase(task.path);
+        }
+        else {
+            ++stats_.failed_writes;
+            failed_.insert(task.path);
+        }
+        // Тот же путь мог встать в очередь ещё раз - снимается одна отметка
+        pending_.erase(pending_.find(task.path));
+        for (const auto& copy : task.scaled) pending_.erase(pending_.find(copy.path));
+        enforceLimit();
+        if (writes_.empty() && writing_ == 0) written_.notify_all();
+    }
+}
+
+void ImageIOService::readerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        read_ready_.wait(lock, [this]() { return stopping_ || !reads_.empty(); });
+        if (stopping_) {
+            loading_.clear();
+            loaded_.notify_all();
+            return;
+        }
+
+        std::string path = std::move(reads_.front());
+        reads_.pop_front();
+        lock.unlock();
+
+        cv::Mat image;
+        {
+            SNAKE_TRACE_SCOPE("io.prefetch");
+            image = cv::imread(path);
+        }
+
+        lock.lock();
+        if (!image.empty() && !cache_index_.count(path)) {
+            insert(path, image);
+            ++stats_.prefetched;
+        }
+        loading_.erase(path);
+        loaded_.notify_all();
+    }
+}
+
+bool ImageIOService::lookup(const std::string& path, cv::Mat& image) {
+    auto it = cache_index_.find(path);
+    if (it == cache_index_.end()) return false;
+    cache_.splice(cache_.begin(), cache_, it->second);
+    image = it->second->image;
+    return true;
+}
+
+void ImageIOService::insert(const std::string& path, const cv::Mat& image) {
+    auto it = cache_index_.find(path);
+    if (it != cache_index_.end()) {
+        cache_bytes_ -= imageBytes(it->second->image);
+        cache_.erase(it->second);
+    }
+    cache_.push_front({ path, image });
+    cache_index_[path] = cache_.begin();
+    cache_bytes_ += imageBytes(image);
+    enforceLimit();
+}
+
+// Самые давние - с конца списка; ещё не записанные остаются, иначе
+// read() до окончания записи не нашёл бы изображения нигде
+void ImageIOService::enforceLimit() {
+    auto it = cache_.end();
+    while (cache_bytes_ > config_.max_cache_bytes && it != cache_.begin()) {
+        --it;
+        if (pending_.count(it->path)) continue;
+        cache_bytes_ -= imageBytes(it->image);
+        cache_index_.erase(it->path);
+        it = cache_.erase(it);
+    }
+}
@@ -0,0 +1,123 @@
+﻿#ifndef IMAGE_IO_SERVICE_H
+#define IMAGE_IO_SERVICE_H
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct ImageIOConfig {
+    size_t max_cache_bytes = 128 * 1024 * 1024;    // декодированные изображения
+    int jpeg_quality = 95;
+};
+
+// Уменьшенная копия, которую поток записи сохраняет вместе с оригиналом:
+// большая сторона не больше max_side (меньшее фото - как есть)
+struct ScaledCopy {
+    std::string path;
+    int max_side = 0;
+};
+
+struct ImageIOStats {
+    size_t hits = 0;            // read() из кэша
+    size_t misses = 0;          // read() с декодированием в вызывающем потоке
+    size_t prefetched = 0;      // декодировано фоновым потоком
+    size_t writes = 0;          // записано на диск
+    size_t failed_writes = 0;
+    size_t pending_writes = 0;
+    size_t cache_entries = 0;
+    size_t cache_bytes = 0;
+};
+
+// Фоновый ввод-вывод фото базы. write() кладёт изображение в кэш и в
+// очередь записи и сразу возвращается: JPEG кодирует поток записи. read()
+// отдаёт декодированное изображение из кэша (в том числе ещё не записанное),
+// иначе ждёт уже начатую предзагрузку или читает файл сам (путь, ещё
+// стоящий в очереди чтения, из неё снимается). prefetch() ставит
+// пути в очередь чтения - для кандидатов, чьё фото скорее всего покажут.
+// Кэш ограничен байтами, вытесняется давно не использованное; изображения
+// в очереди записи не вытесняются. Путь - ключ кэша; file_path в write() -
+// имя файла на диске, если оно отличается (кодировка имени в Windows).
+// Отданные read() изображения общие с кэшем - их не изменяют
+class ImageIOService {
+public:
+    explicit ImageIOService(const ImageIOConfig& config = ImageIOConfig());
+    // Дописывает очередь записи: принятые фото не теряются
+    ~ImageIOService();
+    ImageIOService(const ImageIOService&) = delete;
+    ImageIOService& operator=(const ImageIOService&) = delete;
+
+    // Копии scaled в кэш не попадают, читаются с диска после записи; файл
+    // копии появляется под своим именем только записанным целиком
+    void write(const std::string& path, const cv::Mat& image,
+        const std::string& file_path = std::string(),
+        const std::vector<ScaledCopy>& scaled = std::vector<ScaledCopy>());
+    cv::Mat read(const std::string& path);
+    void prefetch(const std::vector<std::string>& paths);
+
+    // Ждёт записи всех принятых фото; false - есть фото, которые не
+    // записались. Неудача помнится, пока путь не запишут заново или не
+    // забудут (forget): meta.json не должен ссылаться на несуществующий
+    // файл. Неудачи уменьшенных копий только считаются - вместо копии
+    // читается оригинал
+    bool flush();
+    // Незаписанные фото (пути write())
+    std::vector<std::string> failedWrites() const;
+    // Убирает путь из кэша и из незаписанных (файл удалён или заменён)
+    void forget(const std::string& path);
+    // Путь в очереди записи или пишется
+    bool pending(const std::string& path) const;
+
+    ImageIOStats stats() const;
+
+private:
+    struct WriteTask {
+        std::string path;
+        std::string file_path;
+        cv::Mat image;
+        std::vector<ScaledCopy> scaled;
+    };
+    struct CacheEntry {
+        std::string path;
+        cv::Mat image;
+    };
+    using CacheList = std::list<CacheEntry>;
+
+    void writerLoop();
+    void readerLoop();
+    // Под mutex_
+    bool lookup(const std::string& path, cv::Mat& image);
+    void insert(const std::string& path, const cv::Mat& image);
+    void enforceLimit();
+
+    ImageIOConfig config_;
+    mutable std::mutex mutex_;
+    std::condition_variable write_ready_;
+    std::condition_variable read_ready_;
+    std::condition_variable written_;       // очередь записи опустела
+    std::condition_variable loaded_;        // предзагрузка пути завершена
+    std::deque<WriteTask> writes_;
+    std::deque<std::string> reads_;
+    std::unordered_multiset<std::string> pending_;  // в очереди записи или пишется
+    std::unordered_set<std::string> loading_;   // в очереди чтения или читается
+    size_t writing_ = 0;
+    std::unordered_set<std::string> failed_;    // незаписанные оригиналы
+    bool stopping_ = false;
+
+    CacheList cache_;       // в начале - недавно использованные
+    std::unordered_map<std::string, CacheList::iterator> cache_index_;
+    size_t cache_bytes_ = 0;
+    ImageIOStats stats_;
+
+    std::thread writer_;
+    std::thread reader_;
+};
+
+#endif // IMAGE_IO_SERVICE_H
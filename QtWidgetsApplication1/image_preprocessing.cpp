@@ -1,12 +1,16 @@
 ﻿#include "image_preprocessing.h"
-#include <opencv2/ximgproc.hpp>
+#include "tracing.h"
+#include <opencv2/photo.hpp>
 
 using namespace cv;
 
 Mat ImagePreprocessor::preprocess(const Mat& input,
     bool enhance_scales,
     bool remove_background,
-    int scale_enhancement_level) {
+    int scale_enhancement_level,
+    Mat* foreground_mask) {
+    SNAKE_TRACE_SCOPE("preprocess.total");
+    if (foreground_mask) foreground_mask->release();
     if (input.empty()) return input;
 
     Mat processed = input.clone();
@@ -19,9 +23,10 @@ Mat ImagePreprocessor::preprocess(const Mat& input,
     // Нормализация освещения
     processed = normalizeLighting(processed);
 
-    // Удаление фона (если требуется)
-    if (remove_background) {
-        processed = removeBackground(processed);
+    // Маска переднего плана (если требуется). Пиксели фона не обнуляем:
+    // маска передаётся детектору, чтобы он не искал точки на фоне
+    if (remove_background && foreground_mask) {
+        *foreground_mask = computeForegroundMask(processed);
     }
 
     // Улучшение контраста
@@ -42,6 +47,7 @@ Mat ImagePreprocessor::preprocess(const Mat& input,
 }
 
 Mat ImagePreprocessor::removeNoise(const Mat& input) {
+    SNAKE_TRACE_SCOPE("preprocess.remove_noise");
     Mat denoised;
 
     // Нелинейное подавление шума (хорошо для сохранения границ)
@@ -57,6 +63,7 @@ Mat ImagePreprocessor::removeNoise(const Mat& input) {
 }
 
 Mat ImagePreprocessor::enhanceContrast(const Mat& input) {
+    SNAKE_TRACE_SCOPE("preprocess.enhance_contrast");
     Mat enhanced;
 
     // CLAHE (Contrast Limited Adaptive Histogram Equalization)
@@ -68,6 +75,7 @@ Mat ImagePreprocessor::enhanceContrast(const Mat& input) {
 }
 
 Mat ImagePreprocessor::normalizeLighting(const Mat& input) {
+    SNAKE_TRACE_SCOPE("preprocess.normalize_lighting");
     Mat normalized;
 
     // Вычитание размытой версии для нормализации освещения
@@ -79,6 +87,7 @@ Mat ImagePreprocessor::normalizeLighting(const Mat& input) {
 }
 
 Mat ImagePreprocessor::enhanceScales(const Mat& input, int level) {
+    SNAKE_TRACE_SCOPE("preprocess.enhance_scales");
     Mat scales_enhanced;
 
     // Используем фильтр разностки Гауссианов (DoG) для выделения чешуи
@@ -96,7 +105,8 @@ Mat ImagePreprocessor::enhanceScales(const Mat& input, int level) {
     return scales_enhanced;
 }
 
-Mat ImagePreprocessor::removeBackground(const Mat& input) {
+Mat ImagePreprocessor::computeForegroundMask(const Mat& input) {
+    SNAKE_TRACE_SCOPE("preprocess.foreground_mask");
     Mat foreground;
 
     // Используем адаптивный порог
@@ -111,14 +121,11 @@ Mat ImagePreprocessor::removeBackground(const Mat& input) {
     morphologyEx(foreground, foreground, MORPH_CLOSE, kernel);
     morphologyEx(foreground, foreground, MORPH_OPEN, kernel);
 
-    // Применяем маску
-    Mat result;
-    input.copyTo(result, foreground);
-
-    return result;
+    return foreground;
 }
 
 Mat ImagePreprocessor::sharpenImage(const Mat& input) {
+    SNAKE_TRACE_SCOPE("preprocess.sharpen");
     Mat sharpened;
 
     // Ядро для повышения резкости
@@ -143,7 +150,12 @@ void ImagePreprocessor::showProcessingSteps(const cv::Mat& input, const std::str
     cv::Mat after_contrast = enhanceContrast(after_denoise.clone());
     cv::Mat after_scales = enhanceScales(after_contrast.clone(), 2);
     cv::Mat after_sharpen = sharpenImage(after_scales.clone());
-    cv::Mat final = preprocess(input.clone());
+    // Фон, на котором детектор не ищет точки, показывается чёрным
+    cv::Mat foreground;
+    cv::Mat final = preprocess(input.clone(), true, true, 2, &foreground);
+    if (!foreground.empty()) {
+        final.setTo(cv::Scalar::all(0), foreground == 0);
+    }
 
     // Подписываем этапы
     auto addLabel = [](cv::Mat& img, const std::string& label) {
@@ -7,22 +7,25 @@
 
 class ImagePreprocessor {
 public:
-    // Основной метод для предварительной обработки
+    // Основной метод для предварительной обработки. remove_background -
+    // маска переднего плана в foreground_mask (для детектора, пиксели фона
+    // не меняются); без foreground_mask её некуда вернуть, и флаг ничего
+    // не делает - такие вызовы передают false
     static cv::Mat preprocess(const cv::Mat& input,
         bool enhance_scales = true,
         bool remove_background = false,
-        int scale_enhancement_level = 2);
+        int scale_enhancement_level = 2,
+        cv::Mat* foreground_mask = nullptr);
 
     static void showProcessingSteps(const cv::Mat& input, 
                 const std::string& window_name = "Processing Steps");
 
-private:
-    // Методы для конкретных этапов обработки
+    // Методы для конкретных этапов обработки (открыты для бенчмарков)
     static cv::Mat removeNoise(const cv::Mat& input);
     static cv::Mat enhanceContrast(const cv::Mat& input);
     static cv::Mat normalizeLighting(const cv::Mat& input);
     static cv::Mat enhanceScales(const cv::Mat& input, int level);
-    static cv::Mat removeBackground(const cv::Mat& input);
+    static cv::Mat computeForegroundMask(const cv::Mat& input);
     static cv::Mat sharpenImage(const cv::Mat& input);
 };
 
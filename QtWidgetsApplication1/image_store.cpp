@@ -0,0 +1,108 @@
+﻿#include "image_store.h"
+#include "tracing.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+static const char* THUMBNAIL_SUFFIX = "_thumb.jpg";
+static const char* MID_IMAGE_SUFFIX = "_mid.jpg";
+
+ImageStore::ImageStore(const std::string& root, ImageIOService& io)
+    : root_(root)
+    , io_(io) {
+}
+
+// Перемешивание по 8 байт (как splitmix64): для фото в десятки мегабайт
+// побайтовый FNV заметно медленнее. Строки читаются по отдельности -
+// матрица может быть не непрерывной
+uint64_t ImageStore::contentHash(const cv::Mat& image) {
+    auto mix = [](uint64_t hash, uint64_t value) {
+        hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+        hash ^= hash >> 31;
+        hash *= 0xbf58476d1ce4e5b9ULL;
+        return hash ^ (hash >> 29);
+    };
+    uint64_t hash = mix(mix(mix(0, image.rows), image.cols), image.type());
+    size_t row_bytes = image.cols * image.elemSize();
+    for (int r = 0; r < image.rows; ++r) {
+        const uint8_t* row = image.ptr<uint8_t>(r);
+        size_t i = 0;
+        for (; i + 8 <= row_bytes; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, row + i, 8);
+            hash = mix(hash, word);
+        }
+        uint64_t tail = 0;
+        std::memcpy(&tail, row + i, row_bytes - i);
+        hash = mix(hash, tail);
+    }
+    return hash;
+}
+
+std::string ImageStore::put(const cv::Mat& image) {
+    SNAKE_TRACE_SCOPE("store.put");
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx",
+        static_cast<unsigned long long>(contentHash(image)));
+    std::string dir = root_ + "/" + std::string(name, 2);
+    std::string base = dir + "/" + name;
+    std::string path = base + ".jpg";
+
+    if (io_.pending(path) || fs::exists(path)) {
+        SNAKE_TRACE_COUNTER("store.deduplicated", 1);
+        return path;
+    }
+    fs::create_directories(dir);
+    io_.write(path, image, std::string(), {
+        { base + THUMBNAIL_SUFFIX, THUMBNAIL_SIDE },
+        { base + MID_IMAGE_SUFFIX, MID_IMAGE_SIDE } });
+    return path;
+}
+
+bool ImageStore::contains(const std::string& path) const {
+    return path.size() > root_.size() + 1 && path.compare(0, root_.size(), root_) == 0 &&
+        path[root_.size()] == '/';
+}
+
+std::string ImageStore::variantPath(const std::string& path, int max_side) const {
+    const std::string extension = ".jpg";
+    if (max_side <= 0 || max_side > MID_IMAGE_SIDE || !contains(path) ||
+        path.size() < extension.size() ||
+        path.compare(path.size() - extension.size(), extension.size(), extension) != 0) {
+        return path;
+    }
+    return path.substr(0, path.size() - extension.size()) +
+        (max_side <= THUMBNAIL_SIDE ? THUMBNAIL_SUFFIX : MID_IMAGE_SUFFIX);
+}
+
+// Копия, которую поток записи ещё пишет, не читается: вместо неё - оригинал
+// (он до конца записи в кэше)
+cv::Mat ImageStore::read(const std::string& path, int max_side) {
+    std::string variant = variantPath(path, max_side);
+    if (variant != path && !io_.pending(variant)) {
+        cv::Mat image = io_.read(variant);
+        if (!image.empty()) return image;
+    }
+    return io_.read(path);
+}
+
+void ImageStore::prefetch(const std::vector<std::string>& paths, int max_side) {
+    std::vector<std::string> variants;
+    variants.reserve(paths.size());
+    for (const auto& path : paths) {
+        std::string variant = variantPath(path, max_side);
+        variants.push_back(io_.pending(variant) ? path : variant);
+    }
+    io_.prefetch(variants);
+}
+
+void ImageStore::remove(const std::string& path) {
+    std::error_code ec;
+    for (int side : { 0, THUMBNAIL_SIDE, MID_IMAGE_SIDE }) {
+        std::string file = variantPath(path, side);
+        fs::remove(file, ec);
+        io_.forget(file);
+    }
+}
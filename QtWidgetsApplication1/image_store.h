@@ -0,0 +1,46 @@
+﻿#ifndef IMAGE_STORE_H
+#define IMAGE_STORE_H
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+#include "image_io_service.h"
+
+// Размеры уменьшенных копий фото (большая сторона, пиксели)
+const int THUMBNAIL_SIDE = 256;
+const int MID_IMAGE_SIDE = 1024;
+
+// Фото базы по содержимому: путь - хеш пикселей, одинаковые загрузки
+// хранятся один раз. Рядом с оригиналом <hash>.jpg поток записи сохраняет
+// уменьшенные копии <hash>_thumb.jpg и <hash>_mid.jpg; показ читает
+// наименьшую подходящую. Имена файлов - только ASCII (без перекодировки
+// имён змей в CP1251). Фото старых баз (data/images/<имя змеи>/) читаются
+// как раньше, уменьшенных копий у них нет
+class ImageStore {
+public:
+    ImageStore(const std::string& root, ImageIOService& io);
+
+    // Путь оригинала; запись - в фоне. Повтор уже сохранённого фото
+    // ничего не пишет
+    std::string put(const cv::Mat& image);
+
+    // Фото, у которого большая сторона не меньше max_side, или оригинал
+    // (max_side <= 0). Уменьшенная копия, которую ещё не записали (или
+    // пишут), заменяется оригиналом из кэша
+    cv::Mat read(const std::string& path, int max_side = 0);
+    void prefetch(const std::vector<std::string>& paths, int max_side = 0);
+
+    bool contains(const std::string& path) const;
+    // Оригинал и копии с диска и из кэша (после flush() сервиса)
+    void remove(const std::string& path);
+
+    static uint64_t contentHash(const cv::Mat& image);
+
+private:
+    std::string variantPath(const std::string& path, int max_side) const;
+
+    std::string root_;
+    ImageIOService& io_;
+};
+
+#endif // IMAGE_STORE_H
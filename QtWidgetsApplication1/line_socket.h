@@ -0,0 +1,31 @@
+﻿#ifndef LINE_SOCKET_H
+#define LINE_SOCKET_H
+
+#include <string>
+
+// Обмен строками по Unix-сокету (только POSIX): протокол сервиса -
+// один JSON-объект на строку в обе стороны.
+
+// Слушающий сокет по пути path (старый файл сокета удаляется). -1 - ошибка
+int listenUnixSocket(const std::string& path, int backlog = 64);
+
+// Подключение к сокету сервиса. -1 - ошибка
+int connectUnixSocket(const std::string& path);
+
+// Пишет строку целиком и добавляет '\n'
+bool writeLine(int fd, const std::string& line);
+
+// Буферизованное чтение строк из сокета
+class LineReader {
+public:
+    explicit LineReader(int fd) : fd_(fd) {}
+
+    // false - соединение закрыто или ошибка чтения
+    bool readLine(std::string& line);
+
+private:
+    int fd_;
+    std::string buffer_;
+};
+
+#endif // LINE_SOCKET_H
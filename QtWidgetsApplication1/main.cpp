@@ -1,4 +1,6 @@
 ﻿#include "QtWidgetsApplication1.h"  
+#include "tracing.h"
+#include <cstdlib>
 #include <QtWidgets/QApplication>  
 #include <QTextCodec>   
 
@@ -13,8 +15,19 @@ int main(int argc, char *argv[])
         QTextCodec::setCodecForLocale(codec); // Set codec for locale  
     }  
 
+    // SNAKE_TRACE=<file.json> - записать Chrome trace сеанса (сборка с SNAKE_TRACING)
+    const char* trace_path = std::getenv("SNAKE_TRACE");
+    if (trace_path) {
+        Tracer::setRecording(true);
+    }
+
     QApplication a(argc, argv);  
     MainWindow w;  
     w.show();  
-    return a.exec();  
+    int code = a.exec();
+
+    if (trace_path) {
+        Tracer::writeChromeTrace(trace_path);
+    }
+    return code;
 }
@@ -0,0 +1,86 @@
+﻿#include "mapped_file.h"
+#include <filesystem>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const size_t PAGE_SIZE_BYTES = 4096;
+
+#ifdef _WIN32
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string& path) {
+    std::wstring wide_path = std::filesystem::path(path).wstring();
+    HANDLE file = CreateFileW(wide_path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return nullptr;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return nullptr;
+    }
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(file);
+        return nullptr;
+    }
+    void* data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (!data) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return nullptr;
+    }
+
+    std::shared_ptr<MappedFile> mapped(new MappedFile());
+    mapped->data_ = static_cast<const uint8_t*>(data);
+    mapped->size_ = static_cast<size_t>(size.QuadPart);
+    mapped->file_ = file;
+    mapped->mapping_ = mapping;
+    return mapped;
+}
+
+MappedFile::~MappedFile() {
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_) CloseHandle(file_);
+}
+#else
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    // Отображение держит файл само
+    ::close(fd);
+    if (data == MAP_FAILED) return nullptr;
+    // Ядро начинает читать файл сразу, не дожидаясь обращений
+    madvise(data, size, MADV_WILLNEED);
+
+    std::shared_ptr<MappedFile> mapped(new MappedFile());
+    mapped->data_ = static_cast<const uint8_t*>(data);
+    mapped->size_ = size;
+    return mapped;
+}
+
+MappedFile::~MappedFile() {
+    if (data_) munmap(const_cast<uint8_t*>(data_), size_);
+}
+#endif
+
+uint64_t MappedFile::touch() const {
+    uint64_t sum = 0;
+    for (size_t offset = 0; offset < size_; offset += PAGE_SIZE_BYTES) {
+        sum += data_[offset];
+    }
+    return sum;
+}
@@ -0,0 +1,40 @@
+﻿#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Файл, отображённый в память целиком. Отображение копируемое при записи:
+// страницы общие с кэшем файловой системы, случайная запись в них файл не
+// меняет. Открытие не читает данные - страницы подгружаются при первом
+// обращении (или заранее, touch())
+class MappedFile {
+public:
+    // nullptr - файла нет, он пуст или не отображается
+    static std::shared_ptr<const MappedFile> open(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    // Читает по байту с каждой страницы, чтобы последующие обращения не
+    // ждали диска. Возвращает сумму байтов (чтобы чтение не выбросил
+    // оптимизатор)
+    uint64_t touch() const;
+
+private:
+    MappedFile() = default;
+
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,106 @@
+﻿#pragma execution_character_set("utf-8")
+#include "mat_display.h"
+#include <algorithm>
+#include <cstdint>
+
+static void releaseMat(void* info) {
+    delete static_cast<cv::Mat*>(info);
+}
+
+QImage wrapMat(const cv::Mat& mat) {
+    if (mat.empty() || mat.depth() != CV_8U) return QImage();
+
+    cv::Mat source = mat;
+    QImage::Format format;
+    switch (mat.channels()) {
+    case 1:
+        format = QImage::Format_Grayscale8;
+        break;
+    case 3:
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+        format = QImage::Format_BGR888;
+#else
+        cv::cvtColor(mat, source, cv::COLOR_BGR2RGB);
+        format = QImage::Format_RGB888;
+#endif
+        break;
+    case 4:
+        format = QImage::Format_ARGB32;     // BGRA в памяти little-endian
+        break;
+    default:
+        return QImage();
+    }
+    // QImage требует выравнивания данных на 4 байта (бывает не так у ROI)
+    if (reinterpret_cast<uintptr_t>(source.data) % 4 != 0) {
+        source = source.clone();
+    }
+
+    const uchar* data = source.data;
+    return QImage(data, source.cols, source.rows, static_cast<int>(source.step),
+        format, releaseMat, new cv::Mat(source));
+}
+
+void MatDisplay::attach(QLabel* label) {
+    if (label_) label_->removeEventFilter(this);
+    label_ = label;
+    if (label_) label_->installEventFilter(this);
+}
+
+bool MatDisplay::eventFilter(QObject* watched, QEvent* event) {
+    if (watched == label_ && event->type() == QEvent::Resize) {
+        refresh();
+    }
+    return QObject::eventFilter(watched, event);
+}
+
+void MatDisplay::show(const cv::Mat& image) {
+    image_ = image;
+    cached_size_ = QSize();
+    refresh();
+}
+
+void MatDisplay::clear() {
+    image_.release();
+    cached_size_ = QSize();
+    cached_ = QPixmap();
+    if (label_) label_->clear();
+}
+
+void MatDisplay::refresh() {
+    if (!label_) return;
+    if (image_.empty()) {
+        label_->clear();
+        return;
+    }
+
+    // Рамка метки занимает часть её размера
+    QSize size = label_->contentsRect().size();
+    if (size == cached_size_ && !cached_.isNull()) return;
+    if (size.isEmpty()) return;
+
+    try {
+        // Масштаб с сохранением пропорций считается здесь, а не в
+        // QPixmap::scaled: в QPixmap переводится уже уменьшенный кадр
+        double scale = std::min(static_cast<double>(size.width()) / image_.cols,
+            static_cast<double>(size.height()) / image_.rows);
+        cv::Mat fitted = image_;
+        cv::Size target(std::max(1, static_cast<int>(image_.cols * scale + 0.5)),
+            std::max(1, static_cast<int>(image_.rows * scale + 0.5)));
+        if (target != image_.size()) {
+            cv::resize(image_, fitted, target, 0, 0,
+                scale < 1 ? cv::INTER_AREA : cv::INTER_LINEAR);
+        }
+
+        QImage image = wrapMat(fitted);
+        if (image.isNull()) {
+            clear();
+            return;
+        }
+        cached_ = QPixmap::fromImage(image);
+        cached_size_ = size;
+        label_->setPixmap(cached_);
+    }
+    catch (const cv::Exception&) {
+        clear();
+    }
+}
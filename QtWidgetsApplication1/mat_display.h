@@ -0,0 +1,43 @@
+﻿#ifndef MAT_DISPLAY_H
+#define MAT_DISPLAY_H
+
+#include <QEvent>
+#include <QImage>
+#include <QLabel>
+#include <QObject>
+#include <QPixmap>
+#include <QSize>
+#include <opencv2/opencv.hpp>
+
+// QImage поверх памяти cv::Mat без копирования: QImage держит ссылку на
+// матрицу и отпускает её при разрушении. 8UC1, 8UC3 (BGR) и 8UC4 (BGRA);
+// BGR без перестановки каналов - начиная с Qt 5.14 (Format_BGR888), в более
+// старых Qt каналы переставляются в копию
+QImage wrapMat(const cv::Mat& mat);
+
+// Показ кадра OpenCV в QLabel. Кадр не копируется (общие данные Mat),
+// до размера метки уменьшается в OpenCV (INTER_AREA) и только затем
+// переводится в QPixmap. Pixmap хранится для последнего размера метки:
+// повторный показ и перерисовка без изменения размера кадр не обрабатывают.
+// Размер метки отслеживается фильтром событий: она меняется и без
+// изменения окна (перестроение раскладки, соседние виджеты)
+class MatDisplay : public QObject {
+public:
+    void attach(QLabel* label);
+
+    void show(const cv::Mat& image);
+    void clear();
+    void refresh();
+
+protected:
+    // QEvent::Resize метки - refresh()
+    bool eventFilter(QObject* watched, QEvent* event) override;
+
+private:
+    QLabel* label_ = nullptr;
+    cv::Mat image_;
+    QSize cached_size_;
+    QPixmap cached_;
+};
+
+#endif // MAT_DISPLAY_H
@@ -0,0 +1,40 @@
+﻿#ifndef PARALLEL_FOR_H
+#define PARALLEL_FOR_H
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Runs body(i) for i in [0, count) on a pool of threads pulling indices from
+// a shared counter. threads <= 0 means std::thread::hardware_concurrency().
+// OpenCV's own parallelism is disabled meanwhile so the pool does not
+// oversubscribe the cores.
+template <typename Body>
+void parallelFor(size_t count, int threads, const Body& body) {
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = static_cast<int>(std::min<size_t>(threads, std::max<size_t>(count, 1)));
+
+    int cv_threads = cv::getNumThreads();
+    cv::setNumThreads(1);
+
+    std::atomic<size_t> next{ 0 };
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; ++t) {
+        pool.emplace_back([&]() {
+            for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+                body(i);
+            }
+            });
+    }
+    for (auto& th : pool) {
+        th.join();
+    }
+
+    cv::setNumThreads(cv_threads);
+}
+
+#endif // PARALLEL_FOR_H
@@ -0,0 +1,409 @@
+﻿#include "pq_index.h"
+#include "tracing.h"
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+static const uint32_t PQ_FILE_MAGIC = 0x51504E53;   // "SNPQ"
+static const uint32_t PQ_FILE_VERSION = 2;     // 2: owner stamps
+
+bool PQIndex::train(const Mat& samples, const PQIndexParams& params) {
+    SNAKE_TRACE_SCOPE("pq.train");
+    if (samples.empty() || samples.rows < CENTROIDS ||
+        (params.code_bytes != 8 && params.code_bytes != 16) ||
+        samples.cols % params.code_bytes != 0) {
+        return false;
+    }
+
+    // Fixed-seed subsample, so rebuilding the same database gives the same index
+    Mat data;
+    if (samples.rows > params.train_samples && params.train_samples >= CENTROIDS) {
+        vector<int> rows(samples.rows);
+        iota(rows.begin(), rows.end(), 0);
+        RNG rng(12345);
+        for (int i = 0; i < params.train_samples; ++i) {
+            swap(rows[i], rows[i + rng.uniform(0, samples.rows - i)]);
+        }
+        data.create(params.train_samples, samples.cols, CV_32F);
+        for (int i = 0; i < params.train_samples; ++i) {
+            Mat row = data.row(i);
+            samples.row(rows[i]).convertTo(row, CV_32F);
+        }
+    }
+    else {
+        samples.convertTo(data, CV_32F);
+    }
+
+    // k-means needs a few dozen points per centroid to place them sensibly
+    const int lists = max(1, min(params.lists, data.rows / 40));
+    const int code_bytes = params.code_bytes;
+    const int sub = data.cols / code_bytes;
+    TermCriteria criteria(TermCriteria::COUNT + TermCriteria::EPS, params.kmeans_iterations, 1e-3);
+
+    Mat labels, coarse;
+    kmeans(data, lists, labels, criteria, 1, KMEANS_PP_CENTERS, coarse);
+
+    Mat residuals = data.clone();
+    for (int r = 0; r < residuals.rows; ++r) {
+        float* x = residuals.ptr<float>(r);
+        const float* c = coarse.ptr<float>(labels.at<int>(r));
+        for (int d = 0; d < residuals.cols; ++d) x[d] -= c[d];
+    }
+
+    Mat codebooks(code_bytes * CENTROIDS, sub, CV_32F);
+    for (int m = 0; m < code_bytes; ++m) {
+        Mat part = residuals.colRange(m * sub, (m + 1) * sub).clone();
+        Mat part_labels, centers;
+        kmeans(part, CENTROIDS, part_labels, criteria, 1, KMEANS_PP_CENTERS, centers);
+        Mat block = codebooks.rowRange(m * CENTROIDS, (m + 1) * CENTROIDS);
+        centers.copyTo(block);
+    }
+
+    params_ = params;
+    params_.lists = lists;
+    coarse_ = coarse;
+    codebooks_ = codebooks;
+    lists_.assign(lists, InvertedList());
+    owner_names_.clear();
+    owner_sizes_.clear();
+    owner_stamps_.clear();
+    size_ = 0;
+    return true;
+}
+
+void PQIndex::add(uint32_t owner, const string& name, uint64_t stamp, const Mat& descriptors) {
+    CV_Assert(trained() && owner != NO_OWNER && stamp != 0);
+    if (owner >= owner_names_.size()) {
+        owner_names_.resize(owner + 1);
+        owner_sizes_.resize(owner + 1, 0);
+        owner_stamps_.resize(owner + 1, 0);
+    }
+    owner_names_[owner] = name;
+    owner_stamps_[owner] = stamp;
+    if (descriptors.empty()) return;
+    CV_Assert(descriptors.cols == coarse_.cols);
+
+    Mat data;
+    descriptors.convertTo(data, CV_32F);
+
+    // Nearest coarse centroid of every row, then residuals to it
+    Mat distances, cells;
+    batchDistance(data, coarse_, distances, CV_32F, cells, NORM_L2SQR, 1);
+    Mat residuals(data.size(), CV_32F);
+    for (int r = 0; r < data.rows; ++r) {
+        const float* x = data.ptr<float>(r);
+        const float* c = coarse_.ptr<float>(cells.at<int>(r));
+        float* out = residuals.ptr<float>(r);
+        for (int d = 0; d < data.cols; ++d) out[d] = x[d] - c[d];
+    }
+
+    // Nearest sub-centroid of every residual sub-vector
+    const int code_bytes = params_.code_bytes;
+    const int sub = subDims();
+    Mat codes(data.rows, code_bytes, CV_8U);
+    for (int m = 0; m < code_bytes; ++m) {
+        Mat nearest;
+        batchDistance(residuals.colRange(m * sub, (m + 1) * sub),
+            codebooks_.rowRange(m * CENTROIDS, (m + 1) * CENTROIDS),
+            distances, CV_32F, nearest, NORM_L2SQR, 1);
+        for (int r = 0; r < data.rows; ++r) {
+            codes.at<uint8_t>(r, m) = static_cast<uint8_t>(nearest.at<int>(r));
+        }
+    }
+
+    for (int r = 0; r < data.rows; ++r) {
+        InvertedList& list = lists_[cells.at<int>(r)];
+        const uint8_t* code = codes.ptr<uint8_t>(r);
+        list.codes.insert(list.codes.end(), code, code + code_bytes);
+        list.owners.push_back(owner);
+    }
+    owner_sizes_[owner] += data.rows;
+    size_ += data.rows;
+}
+
+void PQIndex::renumber(const vector<uint32_t>& ids) {
+    CV_Assert(ids.size() == owner_names_.size());
+    uint32_t count = 0;
+    for (uint32_t id : ids) {
+        if (id != NO_OWNER) count = std::max(count, id + 1);
+    }
+    vector<string> names(count);
+    vector<size_t> sizes(count, 0);
+    vector<uint64_t> stamps(count, 0);
+    for (size_t old = 0; old < ids.size(); ++old) {
+        if (ids[old] == NO_OWNER) continue;
+        names[ids[old]] = std::move(owner_names_[old]);
+        sizes[ids[old]] = owner_sizes_[old];
+        stamps[ids[old]] = owner_stamps_[old];
+    }
+
+    const int code_bytes = params_.code_bytes;
+    size_ = 0;
+    for (auto& list : lists_) {
+        size_t kept = 0;
+        for (size_t i = 0; i < list.owners.size(); ++i) {
+            uint32_t id = ids[list.owners[i]];
+            if (id == NO_OWNER) continue;
+            if (kept != i) {
+                std::copy_n(&list.codes[i * code_bytes], code_bytes, &list.codes[kept * code_bytes]);
+            }
+            list.owners[kept++] = id;
+        }
+        list.owners.resize(kept);
+        list.codes.resize(kept * code_bytes);
+        size_ += kept;
+    }
+    owner_names_ = std::move(names);
+    owner_sizes_ = std::move(sizes);
+    owner_stamps_ = std::move(stamps);
+}
+
+void PQIndex::distanceTable(const float* residual, float* table) const {
+    const int sub = subDims();
+    for (int m = 0; m < params_.code_bytes; ++m) {
+        const float* r = residual + m * sub;
+        for (int j = 0; j < CENTROIDS; ++j) {
+            const float* c = codebooks_.ptr<float>(m * CENTROIDS + j);
+            float d = 0;
+            for (int t = 0; t < sub; ++t) {
+                float diff = r[t] - c[t];
+                d += diff * diff;
+            }
+            table[m * CENTROIDS + j] = d;
+        }
+    }
+}
+
+// Keeps best sorted by distance and at most k long
+static void insertNeighbour(vector<PQNeighbour>& best, size_t k, const PQNeighbour& candidate) {
+    if (best.size() >= k && candidate.distance >= best.back().distance) return;
+    auto at = upper_bound(best.begin(), best.end(), candidate,
+        [](const PQNeighbour& a, const PQNeighbour& b) { return a.distance < b.distance; });
+    best.insert(at, candidate);
+    if (best.size() > k) best.pop_back();
+}
+
+void PQIndex::search(const Mat& query, int k, int probes,
+    vector<vector<PQNeighbour>>& neighbours) const {
+    neighbours.assign(query.rows, {});
+    if (!trained() || query.empty() || k <= 0) return;
+    SNAKE_TRACE_SCOPE("pq.search");
+    CV_Assert(query.cols == coarse_.cols);
+
+    Mat data;
+    query.convertTo(data, CV_32F);
+    probes = max(1, min(probes, coarse_.rows));
+
+    Mat coarse_distances;
+    batchDistance(data, coarse_, coarse_distances, CV_32F, noArray(), NORM_L2SQR);
+
+    vector<int> cells(coarse_.rows);
+    vector<float> residual(data.cols);
+    vector<float> table(params_.code_bytes * CENTROIDS);
+    vector<float> distances;
+    for (int q = 0; q < data.rows; ++q) {
+        const float* x = data.ptr<float>(q);
+        const float* to_cell = coarse_distances.ptr<float>(q);
+        iota(cells.begin(), cells.end(), 0);
+        partial_sort(cells.begin(), cells.begin() + probes, cells.end(),
+            [&](int a, int b) { return to_cell[a] < to_cell[b]; });
+
+        vector<PQNeighbour>& best = neighbours[q];
+        for (int p = 0; p < probes; ++p) {
+            const InvertedList& list = lists_[cells[p]];
+            if (list.owners.empty()) continue;
+
+            const float* c = coarse_.ptr<float>(cells[p]);
+            for (int d = 0; d < data.cols; ++d) residual[d] = x[d] - c[d];
+            distanceTable(residual.data(), table.data());
+
+            distances.resize(list.owners.size());
+            scanCodes(list.codes.data(), list.owners.size(), params_.code_bytes,
+                table.data(), distances.data());
+            for (size_t i = 0; i < distances.size(); ++i) {
+                insertNeighbour(best, k, { distances[i], list.owners[i] });
+            }
+        }
+    }
+}
+
+vector<uint32_t> PQIndex::vote(const Mat& query, int k, int probes) const {
+    vector<uint32_t> votes(owner_names_.size(), 0);
+    vector<vector<PQNeighbour>> neighbours;
+    search(query, k, probes, neighbours);
+    for (const auto& row : neighbours) {
+        for (size_t i = 0; i < row.size(); ++i) {
+            bool repeated = false;
+            for (size_t j = 0; j < i && !repeated; ++j) {
+                repeated = row[j].owner == row[i].owner;
+            }
+            if (!repeated) votes[row[i].owner]++;
+        }
+    }
+    return votes;
+}
+
+size_t PQIndex::memoryBytes() const {
+    size_t bytes = coarse_.total() * coarse_.elemSize() + codebooks_.total() * codebooks_.elemSize();
+    for (const auto& list : lists_) {
+        bytes += sizeof(InvertedList) + list.codes.capacity() +
+            list.owners.capacity() * sizeof(uint32_t);
+    }
+    for (const auto& name : owner_names_) {
+        // Name (kept for save()), its size and its stamp
+        bytes += sizeof(string) + name.capacity() + sizeof(size_t) + sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+template <typename T>
+static void writeValue(ofstream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static bool readValue(ifstream& in, T& value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+static void writeBytes(ofstream& out, const void* data, size_t bytes) {
+    out.write(static_cast<const char*>(data), static_cast<streamsize>(bytes));
+}
+
+static bool readBytes(ifstream& in, void* data, size_t bytes) {
+    return static_cast<bool>(in.read(static_cast<char*>(data), static_cast<streamsize>(bytes)));
+}
+
+bool PQIndex::save(const string& path) const {
+    if (!trained()) return false;
+    ofstream out(path, ios::binary);
+    if (!out.is_open()) return false;
+
+    writeValue(out, PQ_FILE_MAGIC);
+    writeValue(out, PQ_FILE_VERSION);
+    writeValue(out, static_cast<int32_t>(params_.lists));
+    writeValue(out, static_cast<int32_t>(params_.code_bytes));
+    writeValue(out, static_cast<int32_t>(coarse_.cols));
+    writeBytes(out, coarse_.data, coarse_.total() * coarse_.elemSize());
+    writeBytes(out, codebooks_.data, codebooks_.total() * codebooks_.elemSize());
+
+    writeValue(out, static_cast<uint64_t>(owner_names_.size()));
+    for (size_t i = 0; i < owner_names_.size(); ++i) {
+        writeValue(out, static_cast<uint32_t>(owner_names_[i].size()));
+        writeBytes(out, owner_names_[i].data(), owner_names_[i].size());
+        writeValue(out, static_cast<uint64_t>(owner_sizes_[i]));
+        writeValue(out, owner_stamps_[i]);
+    }
+    for (const auto& list : lists_) {
+        writeValue(out, static_cast<uint64_t>(list.owners.size()));
+        writeBytes(out, list.codes.data(), list.codes.size());
+        writeBytes(out, list.owners.data(), list.owners.size() * sizeof(uint32_t));
+    }
+    return static_cast<bool>(out);
+}
+
+bool PQIndex::load(const string& path) {
+    SNAKE_TRACE_SCOPE("pq.load");
+    ifstream in(path, ios::binary);
+    if (!in.is_open()) return false;
+
+    uint32_t magic = 0, version = 0;
+    int32_t lists = 0, code_bytes = 0, cols = 0;
+    if (!readValue(in, magic) || magic != PQ_FILE_MAGIC ||
+        !readValue(in, version) || version != PQ_FILE_VERSION ||
+        !readValue(in, lists) || !readValue(in, code_bytes) || !readValue(in, cols) ||
+        lists <= 0 || (code_bytes != 8 && code_bytes != 16) || cols <= 0 || cols % code_bytes != 0) {
+        return false;
+    }
+
+    PQIndex loaded;
+    loaded.params_.lists = lists;
+    loaded.params_.code_bytes = code_bytes;
+    loaded.coarse_.create(lists, cols, CV_32F);
+    loaded.codebooks_.create(code_bytes * CENTROIDS, cols / code_bytes, CV_32F);
+    if (!readBytes(in, loaded.coarse_.data, loaded.coarse_.total() * sizeof(float)) ||
+        !readBytes(in, loaded.codebooks_.data, loaded.codebooks_.total() * sizeof(float))) {
+        return false;
+    }
+
+    uint64_t owners = 0;
+    if (!readValue(in, owners)) return false;
+    for (uint64_t i = 0; i < owners; ++i) {
+        uint32_t length = 0;
+        uint64_t count = 0, stamp = 0;
+        if (!readValue(in, length)) return false;
+        string name(length, '\0');
+        if (!readBytes(in, &name[0], length) || !readValue(in, count) ||
+            !readValue(in, stamp)) return false;
+        loaded.owner_names_.push_back(std::move(name));
+        loaded.owner_sizes_.push_back(static_cast<size_t>(count));
+        loaded.owner_stamps_.push_back(stamp);
+    }
+
+    loaded.lists_.resize(lists);
+    for (auto& list : loaded.lists_) {
+        uint64_t count = 0;
+        if (!readValue(in, count)) return false;
+        list.codes.resize(count * code_bytes);
+        list.owners.resize(count);
+        if (!readBytes(in, list.codes.data(), list.codes.size()) ||
+            !readBytes(in, list.owners.data(), list.owners.size() * sizeof(uint32_t))) {
+            return false;
+        }
+        for (uint32_t owner : list.owners) {
+            if (owner >= owners) return false;
+        }
+        loaded.size_ += count;
+    }
+
+    *this = std::move(loaded);
+    return true;
+}
+
+#if defined(__AVX2__)
+static inline float sumLanes(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+#endif
+
+void scanCodes(const uint8_t* codes, size_t count, int code_bytes,
+    const float* table, float* distances) {
+    const int centroids = PQIndex::CENTROIDS;
+#if defined(__AVX2__)
+    // Eight sub-quantizers per gather: code byte m of the descriptor indexes
+    // row m of the table
+    if (code_bytes % 8 == 0) {
+        const __m256i rows = _mm256_setr_epi32(0, centroids, 2 * centroids, 3 * centroids,
+            4 * centroids, 5 * centroids, 6 * centroids, 7 * centroids);
+        for (size_t i = 0; i < count; ++i) {
+            const uint8_t* code = codes + i * code_bytes;
+            __m256 sum = _mm256_setzero_ps();
+            for (int m = 0; m < code_bytes; m += 8) {
+                __m256i index = _mm256_add_epi32(rows, _mm256_cvtepu8_epi32(
+                    _mm_loadl_epi64(reinterpret_cast<const __m128i*>(code + m))));
+                sum = _mm256_add_ps(sum, _mm256_i32gather_ps(table + m * centroids, index, 4));
+            }
+            distances[i] = sumLanes(sum);
+        }
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t* code = codes + i * code_bytes;
+        float sum = 0;
+        for (int m = 0; m < code_bytes; ++m) {
+            sum += table[m * centroids + code[m]];
+        }
+        distances[i] = sum;
+    }
+}
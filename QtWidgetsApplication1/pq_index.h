@@ -0,0 +1,110 @@
+﻿#ifndef PQ_INDEX_H
+#define PQ_INDEX_H
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// IVF-PQ index over the local descriptors of the whole database, for
+// databases whose descriptors no longer fit in memory. A coarse k-means
+// quantizer splits descriptor space into inverted lists; inside a list
+// each descriptor is stored as its residual to the list centroid, product
+// quantized to code_bytes one-byte codes (code_bytes sub-vectors of
+// 128 / code_bytes dimensions, 256 centroids each). A descriptor costs
+// code_bytes plus a 4-byte owner id instead of 512 bytes of floats.
+//
+// Search is asymmetric: the query stays in float, and for every probed
+// list a table of squared distances from the query residual to all
+// sub-centroids turns the distance to a code into code_bytes lookups.
+// Distances are approximate, so the index only ranks records (owners) by
+// votes; the shortlist is then verified with exact descriptors.
+struct PQIndexParams {
+    int lists = 1024;           // coarse cells; capped by the training set size
+    int code_bytes = 16;        // 8 or 16 (must divide SIFT_DESCRIPTOR_SIZE)
+    int train_samples = 65536;  // descriptors sampled for k-means
+    int kmeans_iterations = 12;
+};
+
+struct PQNeighbour {
+    float distance;             // approximate squared L2
+    uint32_t owner;
+};
+
+class PQIndex {
+public:
+    static const int CENTROIDS = 256;
+    static const uint32_t NO_OWNER = UINT32_MAX;
+
+    // Learns the coarse quantizer and the sub-quantizer codebooks from
+    // CV_32F SIFT rows. Fails (and stays untrained) with fewer than
+    // CENTROIDS samples or an unsupported code size.
+    bool train(const cv::Mat& samples, const PQIndexParams& params);
+    bool trained() const { return !coarse_.empty(); }
+
+    // Encodes all rows of descriptors (CV_32F SIFT) under owner, a dense id
+    // chosen by the caller (SnakeId). Adding the same owner again appends
+    // rows. The name is only kept for save(): ids do not survive a restart.
+    // stamp (non-zero) identifies the content the codes were made from
+    // (recordStamp): callers compare it with the live record and ignore
+    // the codes of owners that were removed or changed since
+    void add(uint32_t owner, const std::string& name, uint64_t stamp,
+        const cv::Mat& descriptors);
+    // After load(): maps owner ids of the saving process to this one's,
+    // ids[old] = new id or NO_OWNER to drop the owner's codes
+    void renumber(const std::vector<uint32_t>& ids);
+
+    // k approximate nearest neighbours of every query row, nearest first,
+    // scanning the probes lists with the closest centroids
+    void search(const cv::Mat& query, int k, int probes,
+        std::vector<std::vector<PQNeighbour>>& neighbours) const;
+    // Votes per owner id: every query row votes once for each distinct
+    // owner among its k nearest neighbours
+    std::vector<uint32_t> vote(const cv::Mat& query, int k, int probes) const;
+
+    // Owner ids run from 0 to ownerCount() - 1; ids never added are empty
+    const std::string& ownerName(uint32_t owner) const { return owner_names_[owner]; }
+    size_t ownerDescriptors(uint32_t owner) const {
+        return owner < owner_sizes_.size() ? owner_sizes_[owner] : 0;
+    }
+    // 0 if the owner was never added
+    uint64_t ownerStamp(uint32_t owner) const {
+        return owner < owner_stamps_.size() ? owner_stamps_[owner] : 0;
+    }
+    size_t ownerCount() const { return owner_names_.size(); }
+    size_t size() const { return size_; }      // indexed descriptors
+    int codeBytes() const { return params_.code_bytes; }
+    const PQIndexParams& params() const { return params_; }
+    size_t memoryBytes() const;
+
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+
+private:
+    struct InvertedList {
+        std::vector<uint8_t> codes;     // code_bytes per descriptor
+        std::vector<uint32_t> owners;
+    };
+
+    int subDims() const { return coarse_.cols / params_.code_bytes; }
+    // Squared distances from residual sub-vectors to every sub-centroid,
+    // code_bytes x CENTROIDS, row-major
+    void distanceTable(const float* residual, float* table) const;
+
+    PQIndexParams params_;
+    cv::Mat coarse_;            // lists x 128
+    cv::Mat codebooks_;         // (code_bytes * CENTROIDS) x subDims()
+    std::vector<InvertedList> lists_;
+    std::vector<std::string> owner_names_;
+    std::vector<size_t> owner_sizes_;
+    std::vector<uint64_t> owner_stamps_;
+    size_t size_ = 0;
+};
+
+// Asymmetric distances of count codes (code_bytes each, contiguous) through
+// a code_bytes x PQIndex::CENTROIDS table. Uses AVX2 gathers when the
+// compiler enables them.
+void scanCodes(const uint8_t* codes, size_t count, int code_bytes,
+    const float* table, float* distances);
+
+#endif // PQ_INDEX_H
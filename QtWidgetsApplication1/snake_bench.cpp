@@ -0,0 +1,1181 @@
+﻿// Бенчмарки этапов на синтетических изображениях чешуи.
+//
+//   snake_bench [--output bench.jsonl] [--iterations N] [--filter substr] [--quick]
+//
+// Каждая строка вывода - JSON-объект с именем бенчмарка, параметрами и
+// статистикой времени в миллисекундах; первая строка - описание окружения.
+// Формат стабилен, чтобы сравнивать результаты между версиями.
+// --trace <file.json> (сборка с SNAKE_TRACING) сохраняет Chrome trace прогона.
+// --max-bytes-per-snake N: прогон завершается с кодом 3, если база
+// занимает в памяти больше N байт на змею (бюджет памяти).
+// db.concurrent.* - поиск из нескольких потоков при параллельном пополнении
+// базы; несогласованный снимок также даёт код 3.
+// match.alloc.* - выделения памяти на запрос при сопоставлении через
+// MatchContext; ненулевое число без RANSAC также даёт код 3.
+// pipeline.cancel - отмена конвейера с заполненными очередями; если run()
+// не вернулся за отведённое время, код 3.
+#include "descriptor_matcher.h"
+#include "descriptor_pca.h"
+#include "global_signature.h"
+#include "identification_cache.h"
+#include "identification_pipeline.h"
+#include "image_comparison.h"
+#include "image_io_service.h"
+#include "image_preprocessing.h"
+#include "parallel_for.h"
+#include "pq_index.h"
+#include "snake_database.h"
+#include "snake_identifier.h"
+#include "synthetic_dataset.h"
+#include "tracing.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <set>
+#include <thread>
+
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+// Счётчик выделений памяти текущего потока (match.alloc.*): потоки
+// OpenCV и tracing-а в замер не попадают
+static thread_local size_t g_thread_allocations = 0;
+
+void* operator new(std::size_t size) {
+    ++g_thread_allocations;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+// Буферы cv::Mat выделяет cv::fastMalloc, мимо operator new: на время
+// match.alloc.* аллокатор по умолчанию считает их в тот же счётчик.
+// Заголовок буфера OpenCV создаёт через new, поэтому там, где библиотека
+// видит наш operator new, буфер считается дважды - значение имеет ноль
+class CountingMatAllocator : public cv::MatAllocator {
+public:
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+        cv::AccessFlag flags, cv::UMatUsageFlags usage) const override {
+        if (!data) ++g_thread_allocations;
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage);
+    }
+    bool allocate(cv::UMatData* data, cv::AccessFlag flags, cv::UMatUsageFlags usage) const override {
+        return cv::Mat::getStdAllocator()->allocate(data, flags, usage);
+    }
+    void deallocate(cv::UMatData* data) const override {
+        cv::Mat::getStdAllocator()->deallocate(data);
+    }
+};
+
+namespace {
+
+struct BenchOptions {
+    std::string output;
+    std::string filter;
+    std::string trace_path;
+    int iterations = 5;
+    bool quick = false;
+    double max_bytes_per_snake = 0;
+};
+
+class BenchRunner {
+public:
+    BenchRunner(std::ostream& out, const BenchOptions& options)
+        : out_(out), options_(options) {
+    }
+
+    bool enabled(const std::string& name) const {
+        return options_.filter.empty() || name.find(options_.filter) != std::string::npos;
+    }
+
+    // Один прогон для прогрева, затем iterations замеров.
+    // extra - дополнительные поля результата (число точек, размер и т.п.)
+    template <typename Body>
+    void run(const std::string& name, const json& params, const Body& body,
+        const json& extra = json::object()) {
+        if (!enabled(name)) return;
+
+        body();
+
+        std::vector<double> samples;
+        for (int i = 0; i < options_.iterations; ++i) {
+            auto start = Clock::now();
+            body();
+            samples.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        }
+        emit(name, params, samples, extra);
+    }
+
+    void emit(const std::string& name, const json& params,
+        std::vector<double> samples, const json& extra = json::object()) {
+        std::sort(samples.begin(), samples.end());
+        double sum = 0;
+        for (double s : samples) sum += s;
+
+        json row = {
+            {"benchmark", name},
+            {"params", params},
+            {"iterations", samples.size()},
+            {"mean_ms", samples.empty() ? 0 : sum / samples.size()},
+            {"median_ms", percentile(samples, 0.5)},
+            {"p90_ms", percentile(samples, 0.9)},
+            {"min_ms", samples.empty() ? 0 : samples.front()},
+            {"max_ms", samples.empty() ? 0 : samples.back()}
+        };
+        for (const auto& [key, value] : extra.items()) {
+            row[key] = value;
+        }
+        out_ << row.dump() << std::endl;
+    }
+
+    const BenchOptions& options() const { return options_; }
+
+    // Нарушение бюджета: прогон продолжается, но завершается с ошибкой
+    void fail(const std::string& reason) {
+        std::cerr << "FAILED: " << reason << std::endl;
+        failed_ = true;
+    }
+    bool failed() const { return failed_; }
+
+private:
+    static double percentile(const std::vector<double>& sorted, double q) {
+        if (sorted.empty()) return 0;
+        size_t index = static_cast<size_t>(q * (sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+    std::ostream& out_;
+    BenchOptions options_;
+    bool failed_ = false;
+};
+
+cv::Mat toGray(const cv::Mat& image) {
+    cv::Mat gray;
+    cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+    return gray;
+}
+
+std::vector<cv::Size> resolutions(const BenchOptions& options) {
+    std::vector<cv::Size> sizes = { {640, 480}, {1280, 960} };
+    if (!options.quick) sizes.push_back({ 2560, 1920 });
+    return sizes;
+}
+
+json sizeParams(const cv::Size& size) {
+    return { {"width", size.width}, {"height", size.height} };
+}
+
+void benchPreprocessing(BenchRunner& bench) {
+    for (const cv::Size& size : resolutions(bench.options())) {
+        cv::Mat gray = toGray(SyntheticDataset::generateScaleTexture(size.width, size.height, 1));
+        json params = sizeParams(size);
+
+        bench.run("preprocess.normalize_lighting", params,
+            [&]() { ImagePreprocessor::normalizeLighting(gray); });
+        bench.run("preprocess.foreground_mask", params,
+            [&]() { ImagePreprocessor::computeForegroundMask(gray); });
+        bench.run("preprocess.enhance_contrast", params,
+            [&]() { ImagePreprocessor::enhanceContrast(gray); });
+        bench.run("preprocess.remove_noise", params,
+            [&]() { ImagePreprocessor::removeNoise(gray); });
+        bench.run("preprocess.enhance_scales", params,
+            [&]() { ImagePreprocessor::enhanceScales(gray, 3); });
+        bench.run("preprocess.sharpen", params,
+            [&]() { ImagePreprocessor::sharpenImage(gray); });
+        cv::Mat mask;
+        bench.run("preprocess.full", params,
+            [&]() { ImagePreprocessor::preprocess(gray, true, true, 3, &mask); });
+    }
+}
+
+void benchExtraction(BenchRunner& bench) {
+    for (const cv::Size& size : resolutions(bench.options())) {
+        cv::Mat image = SyntheticDataset::generateScaleTexture(size.width, size.height, 2);
+        cv::Mat mask;
+        cv::Mat processed = ImagePreprocessor::preprocess(image, true, true, 3, &mask);
+        json params = sizeParams(size);
+
+        // Число точек сохраняется в результат - по нему видно, сколько
+        // мусорных точек фона отсекает маска
+        bench.run("extract.sift", params,
+            [&]() { detectSIFTFeatures(processed); },
+            { {"keypoints", detectSIFTFeatures(processed).keypoints.size()} });
+        bench.run("extract.sift_masked", params,
+            [&]() { detectSIFTFeatures(processed, mask); },
+            { {"keypoints", detectSIFTFeatures(processed, mask).keypoints.size()} });
+        bench.run("extract.orb", params,
+            [&]() { detectORBFeatures(processed); },
+            { {"keypoints", detectORBFeatures(processed).keypoints.size()} });
+    }
+}
+
+void benchMatching(BenchRunner& bench) {
+    cv::Mat base = SyntheticDataset::generateScaleTexture(640, 480, 3);
+    cv::Mat shot = SyntheticDataset::perturb(base, 4);
+    cv::Mat a = ImagePreprocessor::preprocess(base, true, false, 3);
+    cv::Mat b = ImagePreprocessor::preprocess(shot, true, false, 3);
+
+    FeaturePoints siftA = detectSIFTFeatures(a), siftB = detectSIFTFeatures(b);
+    FeaturePoints orbA = detectORBFeatures(a), orbB = detectORBFeatures(b);
+    json params = { {"sift_keypoints", siftA.keypoints.size()}, {"orb_keypoints", orbA.keypoints.size()} };
+
+    for (bool homography : { false, true }) {
+        std::string suffix = homography ? "_homography" : "_ratio_only";
+        bench.run("match.sift" + suffix, params,
+            [&]() { matchFeatures(siftA, siftB, cv::NORM_L2, 0.7f, homography); },
+            { {"good_matches", matchFeatures(siftA, siftB, cv::NORM_L2, 0.7f, homography).good_matches} });
+        bench.run("match.orb" + suffix, params,
+            [&]() { matchFeatures(orbA, orbB, cv::NORM_HAMMING, 0.6f, homography); },
+            { {"good_matches", matchFeatures(orbA, orbB, cv::NORM_HAMMING, 0.6f, homography).good_matches} });
+    }
+
+    // 2-NN отдельно: специализированные Matcher против обобщённых
+    // матчеров OpenCV на тех же строках
+    if (siftA.descriptors.empty() || orbA.descriptors.empty()) return;
+    cv::Mat u8A = encodeDescriptors(siftA.descriptors, { DescriptorStorage::UInt8, false });
+    cv::Mat u8B = encodeDescriptors(siftB.descriptors, { DescriptorStorage::UInt8, false });
+    std::vector<std::vector<cv::DMatch>> knn;
+    struct KnnCase {
+        const char* name;
+        const cv::Mat& query;
+        const cv::Mat& train;
+        int norm;
+    };
+    for (const KnnCase& c : {
+        KnnCase{ "f32_128", siftA.descriptors, siftB.descriptors, cv::NORM_L2 },
+        KnnCase{ "u8_128", u8A, u8B, cv::NORM_L2 },
+        KnnCase{ "orb_256", orbA.descriptors, orbB.descriptors, cv::NORM_HAMMING } }) {
+        json knn_params = { {"query_rows", c.query.rows}, {"train_rows", c.train.rows} };
+        std::string prefix = std::string("match.knn.") + c.name;
+        bench.run(prefix + ".specialized", knn_params,
+            [&]() { knnMatchDescriptors(c.query, c.train, c.norm, 2, knn); });
+        bench.run(prefix + ".opencv_bf", knn_params,
+            [&]() { cv::BFMatcher(c.norm).knnMatch(c.query, c.train, knn, 2); });
+        if (c.norm == cv::NORM_L2 && c.query.depth() == CV_32F) {
+            bench.run(prefix + ".opencv_flann", knn_params,
+                [&]() { cv::FlannBasedMatcher().knnMatch(c.query, c.train, knn, 2); });
+        }
+    }
+}
+
+// Пары Lowe-теста (запрос -> строка базы) точным перебором: float через
+// BFMatcher, квантованные - через knnMatchQuantized
+std::set<std::pair<int, int>> ratioPairs(const cv::Mat& query, const cv::Mat& train, float ratio) {
+    std::vector<std::vector<cv::DMatch>> knn;
+    if (train.depth() == CV_32F) cv::BFMatcher(cv::NORM_L2).knnMatch(query, train, knn, 2);
+    else knnMatchQuantized(query, train, cv::NORM_L2, knn);
+
+    std::set<std::pair<int, int>> pairs;
+    for (const auto& m : knn) {
+        if (m.size() == 2 && m[0].distance < ratio * m[1].distance) {
+            pairs.insert({ m[0].queryIdx, m[0].trainIdx });
+        }
+    }
+    return pairs;
+}
+
+// Форматы хранения дескрипторов: время точного 2-NN, объём и полнота
+// относительно float - доля float-пар Lowe-теста, найденных и в формате
+void benchQuantizedMatching(BenchRunner& bench) {
+    if (!bench.enabled("match.quantized")) return;
+
+    cv::Mat base = SyntheticDataset::generateScaleTexture(640, 480, 3);
+    cv::Mat shot = SyntheticDataset::perturb(base, 4);
+    FeaturePoints a = detectSIFTFeatures(ImagePreprocessor::preprocess(base, true, false, 3));
+    FeaturePoints b = detectSIFTFeatures(ImagePreprocessor::preprocess(shot, true, false, 3));
+    if (a.descriptors.empty() || b.descriptors.empty()) return;
+
+    std::set<std::pair<int, int>> reference[2] = {
+        ratioPairs(a.descriptors, b.descriptors, SIFT_RATIO_THRESHOLD),
+        ratioPairs(encodeDescriptors(a.descriptors, { DescriptorStorage::Float32, true }),
+            encodeDescriptors(b.descriptors, { DescriptorStorage::Float32, true }), SIFT_RATIO_THRESHOLD)
+    };
+
+    for (const char* name : { "f32", "u8", "f16", "f32-root", "u8-root", "f16-root" }) {
+        DescriptorFormat format;
+        parseDescriptorFormat(name, format);
+        cv::Mat qa = encodeDescriptors(a.descriptors, format);
+        cv::Mat qb = encodeDescriptors(b.descriptors, format);
+
+        // Полнота - против float той же нормализации (SIFT или RootSIFT)
+        const std::set<std::pair<int, int>>& expected = reference[format.root_sift ? 1 : 0];
+        std::set<std::pair<int, int>> found = ratioPairs(qa, qb, SIFT_RATIO_THRESHOLD);
+        size_t agreed = 0;
+        for (const auto& pair : found) agreed += expected.count(pair);
+
+        json params = { {"format", name}, {"query_rows", qa.rows}, {"train_rows", qb.rows} };
+        bench.run(std::string("match.quantized.") + name, params,
+            [&]() { ratioPairs(qa, qb, SIFT_RATIO_THRESHOLD); }, {
+                {"bytes_per_descriptor", qb.cols * qb.elemSize()},
+                {"ratio_pairs", found.size()},
+                {"recall_vs_float", expected.empty() ? 1.0 : double(agreed) / expected.size()},
+                {"precision_vs_float", found.empty() ? 1.0 : double(agreed) / found.size()}
+            });
+    }
+
+    // Ядро расстояния отдельно: одна пара 128-мерных дескрипторов
+    cv::Mat u8a = encodeDescriptors(a.descriptors.row(0), { DescriptorStorage::UInt8, false });
+    cv::Mat u8b = encodeDescriptors(b.descriptors.row(0), { DescriptorStorage::UInt8, false });
+    cv::Mat f16a = encodeDescriptors(a.descriptors.row(0), { DescriptorStorage::Float16, false });
+    cv::Mat f16b = encodeDescriptors(b.descriptors.row(0), { DescriptorStorage::Float16, false });
+    const uint8_t* pa = u8a.ptr<uint8_t>();
+    const uint8_t* pb = u8b.ptr<uint8_t>();
+    const uint16_t* ha = f16a.ptr<uint16_t>();
+    const uint16_t* hb = f16b.ptr<uint16_t>();
+    const cv::Mat fa = a.descriptors.row(0), fb = b.descriptors.row(0);
+    const int calls = 100000;
+    const int n = SIFT_DESCRIPTOR_SIZE;
+    volatile double sink = 0;
+    json kernel_params = { {"dims", n}, {"calls", calls} };
+    bench.run("match.quantized.kernel_l2_f32", kernel_params, [&]() {
+        for (int i = 0; i < calls; ++i) sink = sink + cv::norm(fa, fb, cv::NORM_L2SQR);
+        });
+    bench.run("match.quantized.kernel_l2_u8", kernel_params, [&]() {
+        for (int i = 0; i < calls; ++i) sink = sink + l2SquaredU8(pa, pb, n);
+        });
+    bench.run("match.quantized.kernel_l1_u8", kernel_params, [&]() {
+        for (int i = 0; i < calls; ++i) sink = sink + l1DistanceU8(pa, pb, n);
+        });
+    bench.run("match.quantized.kernel_l2_f16", kernel_params, [&]() {
+        for (int i = 0; i < calls; ++i) sink = sink + l2SquaredF16(ha, hb, n);
+        });
+}
+
+// Сопоставление пары по укороченным PCA-дескрипторам против полных:
+// проекция обучена на других текстурах, как на снимках базы
+void benchProjection(BenchRunner& bench) {
+    if (!bench.enabled("match.pca")) return;
+
+    std::vector<cv::Mat> samples;
+    for (int seed = 10; seed < 16; ++seed) {
+        cv::Mat texture = SyntheticDataset::generateScaleTexture(640, 480, seed);
+        FeaturePoints features = detectSIFTFeatures(ImagePreprocessor::preprocess(texture, true, false, 3));
+        if (!features.descriptors.empty()) samples.push_back(features.descriptors);
+    }
+    cv::Mat base = SyntheticDataset::generateScaleTexture(640, 480, 3);
+    cv::Mat shot = SyntheticDataset::perturb(base, 4);
+    FeaturePoints a = detectSIFTFeatures(ImagePreprocessor::preprocess(base, true, false, 3));
+    FeaturePoints b = detectSIFTFeatures(ImagePreprocessor::preprocess(shot, true, false, 3));
+    if (samples.empty() || a.descriptors.empty() || b.descriptors.empty()) return;
+    cv::Mat training;
+    cv::vconcat(samples, training);
+
+    json params = { {"query_rows", a.descriptors.rows}, {"train_rows", b.descriptors.rows} };
+    MatchResult full = matchFeatures(a, b, cv::NORM_L2, SIFT_RATIO_THRESHOLD);
+    bench.run("match.pca.full", params, [&]() {
+        matchFeatures(a, b, cv::NORM_L2, SIFT_RATIO_THRESHOLD);
+        }, { {"good_matches", full.good_matches}, {"ratio_matches", full.total_matches} });
+
+    for (int dims : { 32, 64 }) {
+        DescriptorProjection projection;
+        if (!projection.train(training, dims)) continue;
+        FeaturePoints pa = a, pb = b;
+        pa.projected = projection.project(a.descriptors);
+        pb.projected = projection.project(b.descriptors);
+
+        // Время без обучения, но с проекцией запроса - как при поиске
+        MatchResult reduced = matchFeatures(pa, pb, cv::NORM_L2, SIFT_RATIO_THRESHOLD);
+        json dims_params = params;
+        dims_params["dims"] = dims;
+        bench.run("match.pca." + std::to_string(dims), dims_params, [&]() {
+            pa.projected = projection.project(a.descriptors);
+            matchFeatures(pa, pb, cv::NORM_L2, SIFT_RATIO_THRESHOLD);
+            }, {
+                {"good_matches", reduced.good_matches},
+                {"ratio_matches", reduced.total_matches},
+                {"good_matches_vs_full", full.good_matches > 0 ?
+                    double(reduced.good_matches) / full.good_matches : 1.0},
+                {"training_rows", training.rows}
+            });
+    }
+}
+
+// Общий набор признаков для баз разного размера: извлекать SIFT для каждой
+// записи слишком долго, поэтому записи циклически повторяют несколько особей
+struct SyntheticSnake {
+    cv::Mat image;
+    FeaturePoints features;
+};
+
+std::vector<SyntheticSnake> makeSnakes(int count) {
+    std::vector<SyntheticSnake> snakes(count);
+    for (int i = 0; i < count; ++i) {
+        snakes[i].image = SyntheticDataset::generateScaleTexture(640, 480, 100 + i);
+        cv::Mat mask;
+        cv::Mat processed = ImagePreprocessor::preprocess(snakes[i].image, true, true, 3, &mask);
+        snakes[i].features = detectSIFTFeatures(processed, mask);
+    }
+    return snakes;
+}
+
+void fillDatabase(SnakeDatabase& database, const std::vector<SyntheticSnake>& snakes, int size) {
+    for (int i = 0; i < size; ++i) {
+        const SyntheticSnake& snake = snakes[i % snakes.size()];
+        database.addSnake("snake_" + std::to_string(i),
+            snake.features.keypoints, snake.features.descriptors, snake.image);
+    }
+}
+
+// Снимок согласован, если каждая запись цела (на каждую ключевую точку
+// есть строка дескрипторов), имена не повторяются и живых записей столько,
+// сколько заявлено
+bool snapshotConsistent(const SnakeSnapshot& snapshot) {
+    size_t visited = 0;
+    bool consistent = true;
+    std::set<std::string> names;
+    snapshot.forEach([&](size_t, const SnakeFeatures& record) {
+        ++visited;
+        if (record.descriptors.rows != static_cast<int>(record.points.size()) ||
+            !names.insert(record.name).second) {
+            consistent = false;
+        }
+        });
+    return consistent && visited == snapshot.size();
+}
+
+struct ConcurrentRun {
+    std::vector<double> query_ms;   // латентность каждого поиска
+    size_t writes = 0;
+    size_t inconsistent = 0;
+    double seconds = 0;
+};
+
+// readers потоков непрерывно ищут в базе; при with_writer ещё один поток
+// всё это время добавляет, обновляет и удаляет записи
+ConcurrentRun runConcurrent(SnakeDatabase& database, const std::vector<SyntheticSnake>& snakes,
+    const FeaturePoints& query, int readers, bool with_writer, double seconds) {
+    ConcurrentRun run;
+    std::vector<std::vector<double>> latencies(readers);
+    std::atomic<size_t> writes{ 0 };
+    std::atomic<size_t> inconsistent{ 0 };
+    auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(seconds));
+
+    auto start = Clock::now();
+    parallelFor(readers + 1, readers + 1, [&](size_t t) {
+        if (t == 0) {
+            // Писатель: полный цикл жизни временной записи
+            for (size_t k = 0; with_writer && Clock::now() < deadline; ++k) {
+                const SyntheticSnake& snake = snakes[k % snakes.size()];
+                std::string name = "stress_" + std::to_string(k);
+                database.addSnake(name, snake.features.keypoints, snake.features.descriptors, snake.image);
+                database.updateSnake(name, snake.features.keypoints, snake.features.descriptors, snake.image);
+                database.removeSnake(name);
+                writes += 3;
+            }
+            return;
+        }
+        std::vector<double>& samples = latencies[t - 1];
+        while (Clock::now() < deadline) {
+            auto query_start = Clock::now();
+            if (!snapshotConsistent(*database.snapshot())) ++inconsistent;
+            std::string found;
+            database.findSnake(query.descriptors, found);
+            samples.push_back(std::chrono::duration<double, std::milli>(Clock::now() - query_start).count());
+        }
+        });
+    run.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for (const auto& samples : latencies) {
+        run.query_ms.insert(run.query_ms.end(), samples.begin(), samples.end());
+    }
+    run.writes = writes;
+    run.inconsistent = inconsistent;
+    return run;
+}
+
+// Пропускная способность поиска без писателя и во время пополнения базы
+void benchConcurrentAccess(BenchRunner& bench, const fs::path& work_dir,
+    const std::vector<SyntheticSnake>& snakes, const FeaturePoints& query) {
+    if (!bench.enabled("db.concurrent")) return;
+
+    const int size = 50;
+    const int readers = std::max(2, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    const double seconds = bench.options().quick ? 0.5 : 3.0;
+
+    SnakeDatabase database((work_dir / "db_concurrent").string());
+    fillDatabase(database, snakes, size);
+
+    double baseline_qps = 0;
+    for (bool with_writer : { false, true }) {
+        ConcurrentRun run = runConcurrent(database, snakes, query, readers, with_writer, seconds);
+        double qps = run.seconds > 0 ? run.query_ms.size() / run.seconds : 0;
+        if (!with_writer) baseline_qps = qps;
+
+        json params = { {"snakes", size}, {"readers", readers}, {"writer", with_writer} };
+        bench.emit(with_writer ? "db.concurrent.read_write" : "db.concurrent.read_only",
+            params, run.query_ms, {
+                {"queries", run.query_ms.size()},
+                {"queries_per_second", qps},
+                {"throughput_vs_read_only", baseline_qps > 0 ? qps / baseline_qps : 0},
+                {"writes", run.writes},
+                {"writes_per_second", run.seconds > 0 ? run.writes / run.seconds : 0},
+                {"inconsistent_snapshots", run.inconsistent}
+            });
+        if (run.inconsistent > 0) {
+            bench.fail("db.concurrent: " + std::to_string(run.inconsistent) +
+                " inconsistent snapshots observed");
+        }
+    }
+    if (database.count() != static_cast<size_t>(size)) {
+        bench.fail("db.concurrent: expected " + std::to_string(size) + " snakes after stress, got " +
+            std::to_string(database.count()));
+    }
+}
+
+// Выделения памяти на запрос в установившемся режиме: контекст прогрет
+// первым вызовом, дальше сопоставление не должно выделять ничего.
+// С RANSAC считается только для справки - cv::findHomography выделяет сам
+void benchMatchAllocations(BenchRunner& bench) {
+    if (!bench.enabled("match.alloc")) return;
+
+    cv::Mat base = SyntheticDataset::generateScaleTexture(640, 480, 3);
+    cv::Mat shot = SyntheticDataset::perturb(base, 4);
+    cv::Mat a = ImagePreprocessor::preprocess(base, true, false, 3);
+    cv::Mat b = ImagePreprocessor::preprocess(shot, true, false, 3);
+    FeaturePoints siftA = detectSIFTFeatures(a), siftB = detectSIFTFeatures(b);
+    FeaturePoints orbA = detectORBFeatures(a), orbB = detectORBFeatures(b);
+    if (siftA.descriptors.empty() || siftB.descriptors.empty() || orbA.descriptors.empty()) return;
+
+    FeaturePoints u8A = siftA, u8B = siftB;
+    u8A.descriptors = encodeDescriptors(siftA.descriptors, { DescriptorStorage::UInt8, false });
+    u8B.descriptors = encodeDescriptors(siftB.descriptors, { DescriptorStorage::UInt8, false });
+    FeaturePoints pcaA = siftA, pcaB = siftB;
+    DescriptorProjection projection;
+    if (projection.train(siftB.descriptors, 32)) {
+        pcaA.projected = projection.project(siftA.descriptors);
+        pcaB.projected = projection.project(siftB.descriptors);
+    }
+
+    CountingMatAllocator counting;
+    cv::MatAllocator* previous = cv::Mat::getDefaultAllocator();
+    cv::Mat::setDefaultAllocator(&counting);
+
+    struct AllocCase {
+        const char* name;
+        const FeaturePoints& a;
+        const FeaturePoints& b;
+        int norm;
+        float ratio;
+    };
+    for (bool homography : { false, true }) {
+        for (const AllocCase& c : {
+            AllocCase{ "sift", siftA, siftB, cv::NORM_L2, SIFT_RATIO_THRESHOLD },
+            AllocCase{ "sift_u8", u8A, u8B, cv::NORM_L2, SIFT_RATIO_THRESHOLD },
+            AllocCase{ "sift_pca32", pcaA, pcaB, cv::NORM_L2, SIFT_RATIO_THRESHOLD },
+            AllocCase{ "orb", orbA, orbB, cv::NORM_HAMMING, ORB_RATIO_THRESHOLD } }) {
+            if (c.a.projected.empty() != c.b.projected.empty()) continue;
+            std::string name = std::string("match.alloc.") + c.name +
+                (homography ? "_homography" : "_ratio_only");
+            if (!bench.enabled(name)) continue;
+
+            MatchContext context;
+            MatchResult warm = matchFeatures(context, c.a, c.b, c.norm, c.ratio, homography);
+
+            std::vector<double> samples;
+            samples.reserve(bench.options().iterations);
+            size_t allocations = 0;
+            for (int i = 0; i < bench.options().iterations; ++i) {
+                size_t before = g_thread_allocations;
+                auto start = Clock::now();
+                matchFeatures(context, c.a, c.b, c.norm, c.ratio, homography);
+                double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+                allocations += g_thread_allocations - before;
+                samples.push_back(ms);
+            }
+            double per_query = bench.options().iterations > 0 ?
+                static_cast<double>(allocations) / bench.options().iterations : 0;
+            bench.emit(name, { {"query_rows", c.a.descriptors.rows}, {"train_rows", c.b.descriptors.rows} },
+                samples, { {"allocations_per_query", per_query}, {"good_matches", warm.good_matches} });
+            if (!homography && allocations > 0) {
+                bench.fail(name + ": " + std::to_string(per_query) + " heap allocations per query");
+            }
+        }
+    }
+    cv::Mat::setDefaultAllocator(previous);
+}
+
+// Просмотр сигнатур без базы: случайные слова, время отбора k кандидатов
+void benchPrefilter(BenchRunner& bench) {
+    if (!bench.enabled("prefilter.")) return;
+
+    cv::RNG rng(42);
+    auto randomWord = [&]() {
+        return (static_cast<uint64_t>(rng.next()) << 32) | rng.next();
+    };
+
+    std::vector<size_t> sizes = { 1000, 100000 };
+    if (!bench.options().quick) sizes.push_back(1000000);
+    for (size_t size : sizes) {
+        std::vector<uint64_t> words(size * POOLED_SIGNATURE_WORDS);
+        for (auto& word : words) word = randomWord();
+        PooledSignature query = { randomWord(), randomWord() };
+
+        json params = { {"signatures", size} };
+        std::vector<int> distances(size);
+        bench.run("prefilter.scan", params, [&]() {
+            scanSignatures(words.data(), size, query, distances.data());
+            }, { {"bytes_scanned", words.size() * sizeof(uint64_t)} });
+        bench.run("prefilter.shortlist_32", params, [&]() {
+            scanSignatures(words.data(), size, query, distances.data());
+            selectNearest(distances, 32);
+            });
+    }
+}
+
+// SIFT-подобные дескрипторы записи owner: шумные копии центров кластеров,
+// так что у запроса есть настоящий ближайший сосед. Строятся заново по
+// номеру записи, чтобы не держать в памяти все дескрипторы базы
+cv::Mat syntheticDescriptors(const cv::Mat& centers, int owner, int rows) {
+    cv::RNG rng(1000 + owner);
+    cv::Mat descriptors(rows, SIFT_DESCRIPTOR_SIZE, CV_32F);
+    for (int r = 0; r < rows; ++r) {
+        const float* center = centers.ptr<float>(rng.uniform(0, centers.rows));
+        float* d = descriptors.ptr<float>(r);
+        for (int c = 0; c < SIFT_DESCRIPTOR_SIZE; ++c) {
+            d[c] = std::max(0.0f, center[c] + static_cast<float>(rng.gaussian(12)));
+        }
+    }
+    return descriptors;
+}
+
+// Индекс PQ на 100 тыс. и 1 млн дескрипторов: память против float и
+// задержка поиска; полнота - попадает ли запись точного ближайшего соседа
+// запроса в 10 приближённых
+void benchPQ(BenchRunner& bench) {
+    if (!bench.enabled("pq.")) return;
+
+    const int per_owner = 1000;
+    const int queries = 20;
+    const int k = 10;
+    cv::RNG rng(3);
+    cv::Mat centers(4096, SIFT_DESCRIPTOR_SIZE, CV_32F);
+    rng.fill(centers, cv::RNG::UNIFORM, 0.0, 64.0);
+
+    std::vector<int> sizes = { 100000 };
+    if (!bench.options().quick) sizes.push_back(1000000);
+    for (int size : sizes) {
+        const int owners = size / per_owner;
+
+        // Запросы - зашумлённые дескрипторы разных записей; ответ - точный
+        // ближайший сосед полным перебором
+        cv::Mat query(queries, SIFT_DESCRIPTOR_SIZE, CV_32F);
+        for (int q = 0; q < queries; ++q) {
+            cv::Mat source = syntheticDescriptors(centers, q * owners / queries, per_owner);
+            const float* s = source.ptr<float>(q);
+            float* d = query.ptr<float>(q);
+            for (int c = 0; c < SIFT_DESCRIPTOR_SIZE; ++c) {
+                d[c] = std::max(0.0f, s[c] + static_cast<float>(rng.gaussian(6)));
+            }
+        }
+        std::vector<float> exact_distance(queries, FLT_MAX);
+        std::vector<int> exact_owner(queries, -1);
+        for (int o = 0; o < owners; ++o) {
+            cv::Mat distances, nearest;
+            cv::batchDistance(query, syntheticDescriptors(centers, o, per_owner),
+                distances, CV_32F, nearest, cv::NORM_L2SQR, 1);
+            for (int q = 0; q < queries; ++q) {
+                if (distances.at<float>(q) < exact_distance[q]) {
+                    exact_distance[q] = distances.at<float>(q);
+                    exact_owner[q] = o;
+                }
+            }
+        }
+
+        for (int code_bytes : { 8, 16 }) {
+            PQIndexParams params;
+            params.lists = 256;
+            params.code_bytes = code_bytes;
+            json bench_params = { {"descriptors", size}, {"code_bytes", code_bytes}, {"lists", params.lists} };
+
+            std::vector<cv::Mat> samples;
+            int stride = std::max(1, owners * per_owner / params.train_samples);
+            for (int o = 0; o < owners; o += stride) {
+                samples.push_back(syntheticDescriptors(centers, o, per_owner));
+            }
+            cv::Mat training;
+            cv::vconcat(samples, training);
+
+            PQIndex index;
+            auto start = Clock::now();
+            if (!index.train(training, params)) continue;
+            double train_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            if (bench.enabled("pq.train")) bench.emit("pq.train", bench_params, { train_ms },
+                { {"training_rows", training.rows} });
+
+            start = Clock::now();
+            for (int o = 0; o < owners; ++o) {
+                index.add(o, "snake_" + std::to_string(o), o + 1, syntheticDescriptors(centers, o, per_owner));
+            }
+            double build_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            if (bench.enabled("pq.build")) bench.emit("pq.build", bench_params, { build_ms });
+
+            std::vector<std::vector<PQNeighbour>> neighbours;
+            index.search(query, k, 8, neighbours);
+            int hits = 0;
+            for (int q = 0; q < queries; ++q) {
+                for (const PQNeighbour& n : neighbours[q]) {
+                    if (static_cast<int>(n.owner) == exact_owner[q]) {
+                        hits++;
+                        break;
+                    }
+                }
+            }
+
+            // Время - на пакет из queries дескрипторов
+            bench.run("pq.search", bench_params, [&]() { index.search(query, k, 8, neighbours); }, {
+                {"queries", queries},
+                {"probes", 8},
+                {"recall_owner_at_10", double(hits) / queries},
+                {"memory_bytes", index.memoryBytes()},
+                {"bytes_per_descriptor", double(index.memoryBytes()) / index.size()},
+                {"float_bytes", static_cast<size_t>(size) * SIFT_DESCRIPTOR_SIZE * sizeof(float)}
+                });
+        }
+    }
+
+    // Ядро просмотра списка: таблица расстояний и 4096 кодов
+    const size_t codes_count = 4096;
+    std::vector<float> table(16 * PQIndex::CENTROIDS);
+    std::vector<uint8_t> codes(codes_count * 16);
+    for (auto& t : table) t = rng.uniform(0.0f, 100.0f);
+    for (auto& c : codes) c = static_cast<uint8_t>(rng.next());
+    std::vector<float> distances(codes_count);
+    for (int code_bytes : { 8, 16 }) {
+        bench.run("pq.scan", { {"codes", codes_count}, {"code_bytes", code_bytes} }, [&]() {
+            scanCodes(codes.data(), codes_count, code_bytes, table.data(), distances.data());
+            });
+    }
+}
+
+// Изменение индекса без файлов и изображений: добавление и удаление не
+// должны зависеть от размера базы, уплотнение линейно
+void benchIndex(BenchRunner& bench) {
+    if (!bench.enabled("index.")) return;
+
+    cv::RNG rng(7);
+    auto makeRecord = [&](size_t i) {
+        auto record = std::make_shared<SnakeFeatures>();
+        record->name = "snake_" + std::to_string(i);
+        record->signature.pooled = { (static_cast<uint64_t>(rng.next()) << 32) | rng.next(), 1 };
+        return std::shared_ptr<const SnakeFeatures>(std::move(record));
+    };
+
+    std::vector<size_t> sizes = { 1000, 10000 };
+    if (!bench.options().quick) sizes.push_back(100000);
+    for (size_t size : sizes) {
+        std::vector<std::shared_ptr<const SnakeFeatures>> records;
+        for (size_t i = 0; i < size; ++i) records.push_back(makeRecord(i));
+        SnakeIndex index;
+        index.reset(records);
+
+        json params = { {"snakes", size} };
+        size_t next = size;
+        bench.run("index.put", params, [&]() { index.put(makeRecord(next++)); });
+        size_t victim = 0;
+        bench.run("index.remove", params, [&]() {
+            index.remove("snake_" + std::to_string(victim++));
+            });
+        PooledSignature query = makeRecord(0)->signature.pooled;
+        bench.run("index.shortlist_32", params, [&]() {
+            index.snapshot()->shortlist(query, 32);
+            });
+        // Поиск записи в снимке: по плотному номеру и по имени
+        std::string last_name = "snake_" + std::to_string(size - 1);
+        SnakeId last_id = index.intern(last_name);
+        bench.run("index.find_id", params, [&]() { index.snapshot()->find(last_id); });
+        bench.run("index.find_name", params, [&]() { index.snapshot()->find(last_name); });
+
+        // Четверть записей удалена - порог фонового уплотнения по умолчанию
+        while (index.tombstoneRatio() < 0.25) {
+            index.remove("snake_" + std::to_string(victim++));
+        }
+        json extra = { {"slots", index.slotCount()}, {"tombstone_ratio", index.tombstoneRatio()} };
+        bench.run("index.compact", params, [&]() { index.compact(); }, extra);
+    }
+}
+
+// Цена ключа кэша (хеш пикселей + pHash) против полного поиска, который он заменяет
+void benchCache(BenchRunner& bench) {
+    if (!bench.enabled("cache.")) return;
+
+    IdentificationParams params;
+    for (const cv::Size& size : resolutions(bench.options())) {
+        cv::Mat image = SyntheticDataset::generateScaleTexture(size.width, size.height, 7);
+        json p = { {"width", size.width}, {"height", size.height} };
+
+        bench.run("cache.key", p, [&]() { IdentificationCache::makeKey(image, params); });
+
+        IdentificationCache cache;
+        CacheKey key = IdentificationCache::makeKey(image, params);
+        IdentificationResult result;
+        result.found = true;
+        result.name = "snake_0";
+        cache.store(key, 1, result);
+        bench.run("cache.lookup_hit", p, [&]() {
+            IdentificationResult cached;
+            cache.lookup(key, 1, cached);
+            });
+    }
+}
+
+// Время от создания базы до первого ответа поиска: разбор meta.json и
+// файлов точек (load() без файла быстрого запуска) против отображения
+// snapshot.bin с прогревом в фоне. Файлы в кэше ОС - сравнивается разбор,
+// а не чтение с диска. startup.snapshot_open - возврат из startLoad, то
+// есть задержка до показа окна
+void benchStartup(BenchRunner& bench, const std::string& db_path,
+    const FeaturePoints& query, const json& params) {
+    if (!bench.enabled("db.startup")) return;
+
+    std::string snapshot_path = db_path + "/snapshot.bin";
+    std::string aside_path = snapshot_path + ".aside";
+    std::error_code ec;
+    fs::rename(snapshot_path, aside_path, ec);
+    if (ec) {
+        bench.fail("db.startup: save() wrote no " + snapshot_path);
+        return;
+    }
+    std::string json_found;
+    bench.run("db.startup.json_first_query", params, [&]() {
+        SnakeDatabase database(db_path);
+        database.load();
+        json_found = SnakeIdentifier::match(query, database).name;
+        });
+    fs::rename(aside_path, snapshot_path, ec);
+
+    std::vector<double> open_ms, first_query_ms;
+    std::string snapshot_found;
+    size_t snapshot_snakes = 0;
+    for (int i = 0; i <= bench.options().iterations; ++i) {
+        auto start = Clock::now();
+        SnakeDatabase database(db_path);
+        database.startLoad();
+        auto opened = Clock::now();
+        database.waitWarm();
+        snapshot_found = SnakeIdentifier::match(query, database).name;
+        auto answered = Clock::now();
+        snapshot_snakes = database.count();
+        // Первый прогон - прогрев, как в BenchRunner::run
+        if (i == 0) continue;
+        open_ms.push_back(std::chrono::duration<double, std::milli>(opened - start).count());
+        first_query_ms.push_back(std::chrono::duration<double, std::milli>(answered - start).count());
+    }
+    bench.emit("db.startup.snapshot_open", params, open_ms);
+    bench.emit("db.startup.snapshot_first_query", params, first_query_ms,
+        { {"snakes", snapshot_snakes}, {"snapshot_bytes", fs::file_size(snapshot_path, ec)} });
+
+    if (snapshot_found != json_found) {
+        bench.fail("db.startup: snapshot load found \"" + snapshot_found +
+            "\", meta.json load found \"" + json_found + "\"");
+    }
+}
+
+void benchDatabase(BenchRunner& bench, const fs::path& work_dir) {
+    if (!bench.enabled("db.")) return;
+
+    std::vector<SyntheticSnake> snakes = makeSnakes(bench.options().quick ? 4 : 12);
+
+    cv::Mat query_image = SyntheticDataset::perturb(snakes[0].image, 5);
+    cv::Mat query_mask;
+    cv::Mat query_processed = ImagePreprocessor::preprocess(query_image, true, true, 3, &query_mask);
+    FeaturePoints query = detectSIFTFeatures(query_processed, query_mask);
+
+    std::vector<int> sizes = { 10, 50 };
+    if (!bench.options().quick) sizes.push_back(200);
+
+    for (int size : sizes) {
+        std::string db_path = (work_dir / ("db_" + std::to_string(size))).string();
+        SnakeDatabase database(db_path);
+        fillDatabase(database, snakes, size);
+        json params = { {"snakes", size}, {"query_keypoints", query.keypoints.size()} };
+
+        DatabaseMemoryReport memory = database.getMemoryReport();
+        if (bench.enabled("db.memory")) bench.emit("db.memory", params, {}, {
+            {"total_bytes", memory.total()},
+            {"bytes_per_snake", memory.bytesPerSnake()},
+            {"keypoints_bytes", memory.keypoints},
+            {"descriptors_bytes", memory.descriptors},
+            {"paths_bytes", memory.image_paths},
+            {"indices_bytes", memory.indices},
+            {"container_overhead_bytes", memory.container_overhead},
+            {"allocator_overhead_bytes", memory.allocator_overhead}
+            });
+        double budget = bench.options().max_bytes_per_snake;
+        if (budget > 0 && memory.bytesPerSnake() > budget) {
+            bench.fail("db.memory: " + std::to_string(memory.bytesPerSnake()) +
+                " bytes per snake exceeds budget " + std::to_string(budget) +
+                " at " + std::to_string(size) + " snakes");
+        }
+
+        bench.run("db.find_snake", params, [&]() {
+            std::string found;
+            database.findSnake(query.descriptors, found);
+            });
+        bench.run("db.identifier_match", params, [&]() {
+            SnakeIdentifier::match(query, database);
+            });
+        IdentificationParams prefiltered;
+        prefiltered.prefilter_candidates = 32;
+        bench.run("db.identifier_match_prefilter_32", params, [&]() {
+            SnakeIdentifier::match(query, database, prefiltered);
+            });
+        // Добавление включает запись фото на диск; без перестройки индекса
+        // оно не должно расти с размером базы
+        int enrolled = size;
+        bench.run("db.enroll", params, [&]() {
+            const SyntheticSnake& snake = snakes[enrolled % snakes.size()];
+            database.addSnake("snake_" + std::to_string(enrolled++),
+                snake.features.keypoints, snake.features.descriptors, snake.image);
+            });
+        for (int i = size; i < enrolled; ++i) {
+            database.removeSnake("snake_" + std::to_string(i));
+        }
+        bench.run("db.save", params, [&]() { database.save(); });
+        bench.run("db.load", params, [&]() {
+            SnakeDatabase loaded(db_path);
+            loaded.load();
+            });
+        benchStartup(bench, db_path, query, params);
+    }
+
+    // Накопление снимков одной особи: сколько строк остаётся после слияния
+    // почти совпадающих дескрипторов и во что обходится поиск по всем снимкам
+    if (bench.enabled("db.multi_image")) {
+        SnakeDatabase database((work_dir / "db_multi_image").string());
+        database.addSnake("snake_0", snakes[0].features.keypoints,
+            snakes[0].features.descriptors, snakes[0].image);
+        size_t input_rows = snakes[0].features.descriptors.rows;
+        const int shots = 4;
+        for (int shot = 1; shot <= shots; ++shot) {
+            cv::Mat image = SyntheticDataset::perturb(snakes[0].image, 20 + shot);
+            cv::Mat mask;
+            cv::Mat processed = ImagePreprocessor::preprocess(image, true, true, 3, &mask);
+            FeaturePoints features = detectSIFTFeatures(processed, mask);
+            input_rows += features.descriptors.rows;
+            database.updateSnake("snake_0", features.keypoints, features.descriptors, image);
+        }
+        // Повтор уже добавленного снимка должен слиться целиком
+        database.updateSnake("snake_0", snakes[0].features.keypoints,
+            snakes[0].features.descriptors, snakes[0].image);
+        input_rows += snakes[0].features.descriptors.rows;
+
+        std::shared_ptr<const SnakeFeatures> record = database.getSnakeFeatures("snake_0");
+        size_t stored_rows = record ? record->descriptors.rows : 0;
+        json params = { {"images", record ? record->image_starts.size() : 0} };
+        IdentificationResult result = SnakeIdentifier::match(query, database);
+        bench.run("db.multi_image.match", params, [&]() {
+            SnakeIdentifier::match(query, database);
+            }, {
+                {"input_rows", input_rows},
+                {"stored_rows", stored_rows},
+                {"merged_fraction", input_rows > 0 ? 1.0 - double(stored_rows) / input_rows : 0},
+                {"found", result.found},
+                {"matched_image", result.matched_image_path}
+            });
+    }
+
+    benchConcurrentAccess(bench, work_dir, snakes, query);
+}
+
+// Фото базы: возврат из write() против записи до конца и чтение из кэша
+// против декодирования файла
+void benchImageIO(BenchRunner& bench, const fs::path& work_dir) {
+    if (!bench.enabled("io.")) return;
+
+    cv::Mat image = SyntheticDataset::generateScaleTexture(1280, 960, 5);
+    fs::path dir = work_dir / "io";
+    fs::create_directories(dir);
+    json params = { {"width", image.cols}, {"height", image.rows} };
+
+    ImageIOService service;
+    int written = 0;
+    auto nextPath = [&]() { return (dir / ("photo_" + std::to_string(written++) + ".jpg")).string(); };
+    bench.run("io.write_return", params, [&]() { service.write(nextPath(), image); });
+    service.flush();
+    bench.run("io.write_flushed", params, [&]() {
+        service.write(nextPath(), image);
+        service.flush();
+        });
+
+    std::string path = nextPath();
+    cv::imwrite(path, image);
+    bench.run("io.read_disk", params, [&]() { cv::imread(path); });
+    service.read(path);
+    bench.run("io.read_cached", params, [&]() { service.read(path); });
+}
+
+// Отмена, когда поиск - узкое место: обработчик результата медленный,
+// все очереди конвейера заполнены и этапы выше стоят в push. run() должен
+// вернуться; зависший прогон оставляем в фоне (состояние живёт в shared_ptr)
+// и завершаемся с ошибкой
+void benchPipelineCancel(BenchRunner& bench, const fs::path& work_dir) {
+    if (!bench.enabled("pipeline.cancel")) return;
+
+    const int file_count = 64;
+    const auto timeout = std::chrono::seconds(30);
+    fs::path dir = work_dir / "pipeline";
+    fs::create_directories(dir);
+    std::vector<std::string> files;
+    for (int i = 0; i < file_count; ++i) {
+        files.push_back((dir / ("query_" + std::to_string(i) + ".jpg")).string());
+        cv::imwrite(files.back(), SyntheticDataset::generateScaleTexture(320, 240, 200 + i));
+    }
+
+    PipelineConfig config;
+    config.decode_workers = 2;
+    config.preprocess_workers = 2;
+    config.extract_workers = 2;
+    config.match_workers = 1;
+    config.queue_capacity = 2;
+
+    struct CancelRun {
+        SnakeDatabase database;
+        IdentificationPipeline pipeline;
+        size_t results = 0;
+        CancelRun(const std::string& db_path, const PipelineConfig& config)
+            : database(db_path), pipeline(database, config) {
+        }
+    };
+    auto state = std::make_shared<CancelRun>((work_dir / "db_pipeline").string(), config);
+
+    std::vector<double> samples;
+    bool finished = true;
+    for (int i = 0; i < bench.options().iterations && finished; ++i) {
+        std::promise<void> done;
+        std::future<void> returned = done.get_future();
+        auto cancel_at = std::make_shared<Clock::time_point>();
+        std::thread runner([state, files, cancel_at, done = std::move(done)]() mutable {
+            state->pipeline.run(files, [&](const PipelineItemResult&) {
+                // Первый результат держим, пока верхние этапы не упрутся
+                // в заполненные очереди, затем отменяем
+                if (state->results++ == 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                    *cancel_at = Clock::now();
+                    state->pipeline.cancel();
+                }
+                });
+            done.set_value();
+            });
+        finished = returned.wait_for(timeout) == std::future_status::ready;
+        if (!finished) {
+            runner.detach();
+            bench.fail("pipeline.cancel: run() did not return within " +
+                std::to_string(timeout.count()) + " s after cancel()");
+            break;
+        }
+        runner.join();
+        if (state->results > 0) {
+            samples.push_back(std::chrono::duration<double, std::milli>(
+                Clock::now() - *cancel_at).count());
+        }
+        state->results = 0;
+    }
+    if (finished) {
+        bench.emit("pipeline.cancel", { {"files", file_count},
+            {"queue_capacity", config.queue_capacity}, {"match_workers", config.match_workers} },
+            samples);
+    }
+}
+
+bool parseArgs(int argc, char* argv[], BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::invalid_argument("missing value for " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--output") options.output = next();
+        else if (arg == "--filter") options.filter = next();
+        else if (arg == "--iterations") options.iterations = std::max(1, std::stoi(next()));
+        else if (arg == "--quick") options.quick = true;
+        else if (arg == "--trace") options.trace_path = next();
+        else if (arg == "--max-bytes-per-snake") options.max_bytes_per_snake = std::stod(next());
+        else if (arg == "--help" || arg == "-h") return false;
+        else throw std::invalid_argument("unknown option " + arg);
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    try {
+        if (!parseArgs(argc, argv, options)) {
+            std::cerr << "Usage: snake_bench [--output <file>] [--iterations N] "
+                "[--filter <substr>] [--quick] [--trace <file.json>]\n"
+                "                   [--max-bytes-per-snake N]\n";
+            return 0;
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+
+    std::ofstream file_out;
+    if (!options.output.empty()) {
+        file_out.open(options.output);
+        if (!file_out.is_open()) {
+            std::cerr << "Error opening file: " << options.output << "\n";
+            return 1;
+        }
+    }
+    std::ostream& out = file_out.is_open() ? file_out : std::cout;
+
+    out << json({ {"meta", {
+        {"opencv", CV_VERSION},
+        {"cv_threads", cv::getNumThreads()},
+        {"iterations", options.iterations},
+        {"quick", options.quick}
+    }} }).dump() << std::endl;
+
+    fs::path work_dir = fs::temp_directory_path() /
+        ("snake_bench_" + std::to_string(Clock::now().time_since_epoch().count()));
+    fs::create_directories(work_dir);
+
+    if (!options.trace_path.empty()) {
+        Tracer::setRecording(true);
+    }
+
+    BenchRunner bench(out, options);
+    benchPreprocessing(bench);
+    benchExtraction(bench);
+    benchMatching(bench);
+    benchQuantizedMatching(bench);
+    benchProjection(bench);
+    benchMatchAllocations(bench);
+    benchPrefilter(bench);
+    benchPQ(bench);
+    benchIndex(bench);
+    benchCache(bench);
+    benchDatabase(bench, work_dir);
+    benchImageIO(bench, work_dir);
+    benchPipelineCancel(bench, work_dir);
+
+    std::error_code ec;
+    fs::remove_all(work_dir, ec);
+
+    if (!options.trace_path.empty()) {
+        Tracer::writeChromeTrace(options.trace_path);
+    }
+    return bench.failed() ? 3 : 0;
+}
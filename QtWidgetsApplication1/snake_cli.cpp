@@ -0,0 +1,358 @@
+﻿// Консольная пакетная идентификация без GUI.
+//
+//   snake_cli --db snake_database --input photos/ [--format csv|jsonl]
+//             [--output results.csv] [--threads N]
+//             [--decode-workers N] [--preprocess-workers N]
+//             [--extract-workers N] [--match-workers N] [--queue N]
+//
+// Каждое изображение папки ищется в базе; строки результата пишутся
+// по мере готовности, статистика этапов конвейера - в stderr. --threads
+// делится между этапами; --*-workers задают этап явно, в любом порядке.
+//
+//   snake_cli --evaluate photos/ [--output comparison.csv] [--threads N]
+//
+// Оценка SIFT/ORB на всех парах изображений папки (evaluateAllPairs),
+// CSV в формате saveResultsToCSV.
+//
+//   snake_cli --convert-descriptors u8|f16|f32[-root] [--db snake_database]
+//
+// Перекодирует дескрипторы всех записей базы (descriptor_quantization.h)
+// и сохраняет её; отчёт о памяти до и после - в stderr.
+//
+//   snake_cli --build-pq [--pq-bytes 8|16] [--pq-lists N] [--db snake_database]
+//
+// Строит индекс PQ по дескрипторам базы (pq_index.h) и сохраняет его рядом
+// с meta.json; дальше поиск отбирает кандидатов по нему. С --lazy-descriptors
+// дескрипторы записей не загружаются в память, а читаются с диска только
+// для отобранных кандидатов.
+//
+//   snake_cli --train-pca 32|64|0 [--db snake_database]
+//
+// Обучает проекцию PCA дескрипторов базы (descriptor_pca.h) и сохраняет её
+// рядом с meta.json: ближайшие соседи ищутся по укороченным дескрипторам,
+// полные остаются для проверки. 0 - убрать проекцию.
+//
+// В сборке с SNAKE_TRACING: --trace <file.json> пишет Chrome trace,
+// --trace-summary <sec> периодически печатает сводку задержек в stderr.
+#include "identification_pipeline.h"
+#include "file_utils.h"
+#include "tracing.h"
+#include <nlohmann/json.hpp>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+using json = nlohmann::json;
+
+namespace {
+
+struct CliOptions {
+    std::string db_path = "snake_database";
+    std::string input;
+    std::string evaluate;
+    std::string output;
+    int threads = 0;
+    std::string format = "csv";
+    std::string trace_path;
+    double trace_summary_seconds = 0;
+    bool memory_report = false;
+    std::string convert_descriptors;
+    bool build_pq = false;
+    PQIndexParams pq;
+    bool lazy_descriptors = false;
+    int train_pca = -1;     // -1 - не менять проекцию
+    PipelineConfig pipeline;
+};
+
+void printUsage() {
+    std::cerr <<
+        "Usage: snake_cli --input <dir> [--db <path>] [--format csv|jsonl]\n"
+        "                 [--output <file>] [--threads N]\n"
+        "                 [--decode-workers N] [--preprocess-workers N]\n"
+        "                 [--extract-workers N] [--match-workers N] [--queue N]\n"
+        "                 [--level 1-5] [--no-background-mask] [--lazy-descriptors]\n"
+        "       snake_cli --memory-report [--db <path>]\n"
+        "       snake_cli --convert-descriptors u8|f16|f32[-root] [--db <path>]\n"
+        "       snake_cli --build-pq [--pq-bytes 8|16] [--pq-lists N] [--db <path>]\n"
+        "       snake_cli --train-pca 32|64|0 [--db <path>]\n"
+        "       snake_cli --evaluate <dir> [--output <file>] [--threads N]\n"
+        "Tracing builds: [--trace <file.json>] [--trace-summary <seconds>]\n";
+}
+
+bool parseArgs(int argc, char* argv[], CliOptions& options) {
+    // Этапы, число потоков которых задано явно: --threads их не трогает
+    bool decode_set = false, preprocess_set = false, extract_set = false, match_set = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::invalid_argument("missing value for " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--db") options.db_path = next();
+        else if (arg == "--input") options.input = next();
+        else if (arg == "--evaluate") options.evaluate = next();
+        else if (arg == "--output") options.output = next();
+        else if (arg == "--format") options.format = next();
+        else if (arg == "--threads") options.threads = std::max(1, std::stoi(next()));
+        else if (arg == "--decode-workers") {
+            options.pipeline.decode_workers = std::stoi(next());
+            decode_set = true;
+        }
+        else if (arg == "--preprocess-workers") {
+            options.pipeline.preprocess_workers = std::stoi(next());
+            preprocess_set = true;
+        }
+        else if (arg == "--extract-workers") {
+            options.pipeline.extract_workers = std::stoi(next());
+            extract_set = true;
+        }
+        else if (arg == "--match-workers") {
+            options.pipeline.match_workers = std::stoi(next());
+            match_set = true;
+        }
+        else if (arg == "--queue") options.pipeline.queue_capacity = std::stoul(next());
+        else if (arg == "--level") options.pipeline.params.preprocessing_level = std::stoi(next());
+        else if (arg == "--no-background-mask") options.pipeline.params.remove_background = false;
+        else if (arg == "--memory-report") options.memory_report = true;
+        else if (arg == "--convert-descriptors") options.convert_descriptors = next();
+        else if (arg == "--build-pq") options.build_pq = true;
+        else if (arg == "--pq-bytes") options.pq.code_bytes = std::stoi(next());
+        else if (arg == "--pq-lists") options.pq.lists = std::stoi(next());
+        else if (arg == "--lazy-descriptors") options.lazy_descriptors = true;
+        else if (arg == "--train-pca") options.train_pca = std::stoi(next());
+        else if (arg == "--trace") options.trace_path = next();
+        else if (arg == "--trace-summary") options.trace_summary_seconds = std::stod(next());
+        else if (arg == "--help" || arg == "-h") return false;
+        else throw std::invalid_argument("unknown option " + arg);
+    }
+
+    // Распределяем потоки по этапам пропорционально их стоимости - после
+    // разбора, чтобы результат не зависел от порядка аргументов
+    if (options.threads > 0) {
+        int n = options.threads;
+        if (!decode_set) options.pipeline.decode_workers = std::max(1, n / 8);
+        if (!preprocess_set) options.pipeline.preprocess_workers = std::max(1, n * 3 / 8);
+        if (!extract_set) options.pipeline.extract_workers = std::max(1, n * 3 / 8);
+        if (!match_set) options.pipeline.match_workers = std::max(1, n / 4);
+    }
+
+    if (options.input.empty() && options.evaluate.empty() && !options.memory_report &&
+        options.convert_descriptors.empty() && !options.build_pq && options.train_pca < 0) {
+        throw std::invalid_argument("--input, --evaluate, --memory-report, "
+            "--convert-descriptors, --build-pq or --train-pca is required");
+    }
+    if (options.train_pca >= SIFT_DESCRIPTOR_SIZE) {
+        throw std::invalid_argument("--train-pca must be below the descriptor size");
+    }
+    if (options.pq.code_bytes != 8 && options.pq.code_bytes != 16) {
+        throw std::invalid_argument("--pq-bytes must be 8 or 16");
+    }
+    if (options.pq.lists < 1) {
+        throw std::invalid_argument("--pq-lists must be positive");
+    }
+    DescriptorFormat format;
+    if (!options.convert_descriptors.empty() &&
+        !parseDescriptorFormat(options.convert_descriptors, format)) {
+        throw std::invalid_argument("--convert-descriptors must be u8, f16 or f32, optionally with -root");
+    }
+    if (options.format != "csv" && options.format != "jsonl") {
+        throw std::invalid_argument("--format must be csv or jsonl");
+    }
+    return true;
+}
+
+std::string csvEscape(const std::string& value) {
+    if (value.find_first_of(",\"\n") == std::string::npos) return value;
+    std::string escaped = "\"";
+    for (char c : value) {
+        if (c == '"') escaped += '"';
+        escaped += c;
+    }
+    return escaped + "\"";
+}
+
+void writeCsvRow(std::ostream& out, const PipelineItemResult& r) {
+    out << r.index << ","
+        << csvEscape(r.path) << ","
+        << (r.decoded ? "YES" : "NO") << ","
+        << r.keypoints << ","
+        << (r.result.found ? "YES" : "NO") << ","
+        << csvEscape(r.result.name) << ","
+        << r.result.good_matches << ","
+        << r.result.match_ratio << "\n";
+}
+
+void writeJsonRow(std::ostream& out, const PipelineItemResult& r) {
+    json row = {
+        {"index", r.index},
+        {"path", r.path},
+        {"decoded", r.decoded},
+        {"keypoints", r.keypoints},
+        {"found", r.result.found},
+        {"name", r.result.name},
+        {"good_matches", r.result.good_matches},
+        {"match_ratio", r.result.match_ratio}
+    };
+    out << row.dump() << "\n";
+}
+
+void printMetrics(const IdentificationPipeline& pipeline, size_t files) {
+    double wall = pipeline.wallSeconds();
+    std::cerr << "Processed " << files << " images in " << wall << " s";
+    if (wall > 0) std::cerr << " (" << files / wall << " img/s)";
+    std::cerr << "\n";
+
+    for (const auto& stage : pipeline.metrics()) {
+        std::cerr << "  " << stage.name
+            << ": workers=" << stage.workers
+            << " items=" << stage.items
+            << " utilization=" << static_cast<int>(100 * stage.utilization(wall)) << "%"
+            << " starved=" << stage.starved_seconds << "s"
+            << " blocked=" << stage.blocked_seconds << "s"
+            << " max_queue=" << stage.max_queue_depth << "\n";
+    }
+}
+
+void startTracing(const CliOptions& options) {
+    if (options.trace_path.empty() && options.trace_summary_seconds <= 0) return;
+    if (!Tracer::compiledIn()) {
+        std::cerr << "Warning: tracing is not compiled in (build with SNAKE_ENABLE_TRACING)\n";
+        return;
+    }
+    Tracer::setRecording(!options.trace_path.empty());
+    Tracer::startPeriodicSummary(std::cerr, options.trace_summary_seconds);
+}
+
+void finishTracing(const CliOptions& options) {
+    if (!Tracer::compiledIn()) return;
+    Tracer::stopPeriodicSummary();
+    if (!options.trace_path.empty()) {
+        Tracer::writeChromeTrace(options.trace_path);
+    }
+    if (options.trace_summary_seconds > 0) {
+        Tracer::printSummary(std::cerr);
+    }
+}
+
+int runEvaluation(const CliOptions& options) {
+    std::vector<std::string> files = FileUtils::findImageFiles(options.evaluate);
+    if (files.size() < 2) {
+        std::cerr << "Need at least two images in " << options.evaluate << "\n";
+        return 1;
+    }
+
+    std::vector<ComparisonResult> results = evaluateAllPairs(files, options.threads);
+    saveResultsToCSV(options.output.empty() ? "comparison_results.csv" : options.output, results);
+    return 0;
+}
+
+// Всё, кроме --evaluate: загрузка базы, обслуживание и идентификация
+int runWithDatabase(const CliOptions& options) {
+    SnakeDatabase database(options.db_path);
+    database.setResidentDescriptors(!options.lazy_descriptors);
+    if (!database.load()) {
+        std::cerr << "Failed to load database: " << options.db_path << "\n";
+        return 1;
+    }
+
+    if (!options.convert_descriptors.empty()) {
+        DescriptorFormat format;
+        parseDescriptorFormat(options.convert_descriptors, format);
+        std::cerr << "Before:\n" << database.getMemoryReport().summary();
+        database.convertDescriptors(format);
+        if (!database.save()) {
+            std::cerr << "Failed to save database: " << options.db_path << "\n";
+            return 1;
+        }
+        std::cerr << "After (" << descriptorFormatName(format) << "):\n"
+            << database.getMemoryReport().summary();
+        if (options.input.empty()) return 0;
+    }
+
+    if (options.train_pca >= 0) {
+        if (!database.trainProjection(options.train_pca) || !database.save()) {
+            std::cerr << "Failed to train PCA projection: " << options.db_path << "\n";
+            return 1;
+        }
+        std::cerr << (options.train_pca > 0 ?
+            "PCA projection: " + std::to_string(options.train_pca) + " dims\n" :
+            std::string("PCA projection removed\n"));
+        if (options.input.empty() && !options.build_pq && !options.memory_report) return 0;
+    }
+
+    if (options.build_pq) {
+        auto start = std::chrono::steady_clock::now();
+        if (!database.buildPQIndex(options.pq) || !database.save()) {
+            std::cerr << "Failed to build PQ index: " << options.db_path << "\n";
+            return 1;
+        }
+        std::shared_ptr<const PQIndex> pq = database.pqIndex();
+        std::cerr << "PQ index: " << pq->size() << " descriptors, "
+            << pq->params().lists << " lists, " << pq->codeBytes() << " bytes/code, "
+            << pq->memoryBytes() / 1024 << " KB, built in "
+            << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s\n";
+        if (options.input.empty() && !options.memory_report) return 0;
+    }
+
+    // Отчёт о памяти - в stderr, чтобы не смешивать с потоком результатов
+    if (options.memory_report) {
+        std::cerr << database.getMemoryReport().summary();
+        if (options.input.empty()) return 0;
+    }
+
+    std::vector<std::string> files = FileUtils::findImageFiles(options.input);
+    if (files.empty()) {
+        std::cerr << "No images found in " << options.input << "\n";
+        return 1;
+    }
+
+    std::ofstream file_out;
+    if (!options.output.empty()) {
+        file_out.open(options.output);
+        if (!file_out.is_open()) {
+            std::cerr << "Error opening file: " << options.output << "\n";
+            return 1;
+        }
+    }
+    std::ostream& out = file_out.is_open() ? file_out : std::cout;
+
+    bool csv = options.format == "csv";
+    if (csv) {
+        out << "Index,Path,Decoded,Keypoints,Found,Name,GoodMatches,MatchRatio\n";
+    }
+
+    IdentificationPipeline pipeline(database, options.pipeline);
+    pipeline.run(files, [&](const PipelineItemResult& r) {
+        if (csv) writeCsvRow(out, r);
+        else writeJsonRow(out, r);
+        out.flush();
+        });
+
+    printMetrics(pipeline, files.size());
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    CliOptions options;
+    try {
+        if (!parseArgs(argc, argv, options)) {
+            printUsage();
+            return 0;
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        printUsage();
+        return 2;
+    }
+
+    // Каждый режим завершается здесь: trace пишется при любом исходе
+    startTracing(options);
+    int code = options.evaluate.empty() ? runWithDatabase(options) : runEvaluation(options);
+    finishTracing(options);
+    return code;
+}
@@ -0,0 +1,275 @@
+﻿// Резидентный сервис идентификации на Unix-сокете (только POSIX).
+//
+//   snake_daemon [--db snake_database] [--socket /tmp/snake_eater.sock]
+//                [--max-batch N] [--batch-window-ms MS]
+//                [--max-pending N] [--max-queue-ms MS] [--threads N]
+//                [--level 1-5] [--no-background-mask]
+//
+// База загружается один раз и остаётся в памяти; сокет открывается сразу,
+// а пока база прогревается (SnakeDatabase::startLoad), поиск отвечает
+// status "warming". Протокол - JSON-объект на
+// строку в обе стороны, на одном соединении можно отправлять запросы не
+// дожидаясь ответов (ответы приходят в порядке готовности, по полю id):
+//
+//   {"id": 1, "path": "/photos/a.jpg"}  -> {"id": 1, "status": "ok", "found": true, "name": ...}
+//   {"cmd": "stats"}                     -> счётчики сервиса
+//   {"cmd": "reload"}                    -> перечитать базу с диска
+//   {"cmd": "ping"}
+//
+// status: ok, overloaded, expired, error, warming, shutting_down (identification_service.h).
+// Ответы пишутся из потока сервиса: клиент должен читать их, иначе
+// заполненный буфер сокета задержит остальные ответы пакета.
+#include "identification_service.h"
+#include "line_socket.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+namespace {
+
+struct DaemonOptions {
+    std::string db_path = "snake_database";
+    std::string socket_path = "/tmp/snake_eater.sock";
+    ServiceConfig service;
+};
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+void onSignal(int) {
+    stop_requested = 1;
+}
+
+void printUsage() {
+    std::cerr <<
+        "Usage: snake_daemon [--db <path>] [--socket <path>]\n"
+        "                    [--max-batch N] [--batch-window-ms MS]\n"
+        "                    [--max-pending N] [--max-queue-ms MS] [--threads N]\n"
+        "                    [--level 1-5] [--no-background-mask]\n";
+}
+
+bool parseArgs(int argc, char* argv[], DaemonOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::invalid_argument("missing value for " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--db") options.db_path = next();
+        else if (arg == "--socket") options.socket_path = next();
+        else if (arg == "--max-batch") options.service.max_batch = std::stoul(next());
+        else if (arg == "--batch-window-ms") options.service.batch_window_ms = std::stod(next());
+        else if (arg == "--max-pending") options.service.max_pending = std::stoul(next());
+        else if (arg == "--max-queue-ms") options.service.max_queue_ms = std::stod(next());
+        else if (arg == "--threads") options.service.threads = std::stoi(next());
+        else if (arg == "--level") options.service.params.preprocessing_level = std::stoi(next());
+        else if (arg == "--no-background-mask") options.service.params.remove_background = false;
+        else if (arg == "--help" || arg == "-h") return false;
+        else throw std::invalid_argument("unknown option " + arg);
+    }
+    return true;
+}
+
+// Соединение живёт, пока на него ссылаются поток чтения или
+// ещё не отправленные ответы сервиса
+struct Connection {
+    explicit Connection(int fd) : fd(fd) {}
+    ~Connection() { close(fd); }
+
+    void send(const json& response) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        writeLine(fd, response.dump());
+    }
+
+    int fd;
+    std::mutex write_mutex;
+};
+
+json responseToJson(const json& id, const ServiceResponse& r) {
+    json j = {
+        {"id", id},
+        {"status", serviceStatusName(r.status)},
+        {"queue_ms", r.queue_ms},
+        {"total_ms", r.total_ms}
+    };
+    if (r.status == ServiceStatus::Ok) {
+        j["found"] = r.found;
+        j["name"] = r.name;
+        j["image"] = r.image_path;
+        j["good_matches"] = r.good_matches;
+        j["match_ratio"] = r.match_ratio;
+        j["keypoints"] = r.keypoints;
+        j["batch_size"] = r.batch_size;
+    }
+    if (!r.error.empty()) j["error"] = r.error;
+    return j;
+}
+
+json statsToJson(const IdentificationService& service, const SnakeDatabase& database) {
+    ServiceStats stats = service.stats();
+    return {
+        {"status", "ok"},
+        {"snakes", database.count()},
+        {"warming", database.warming()},
+        {"accepted", stats.accepted},
+        {"rejected", stats.rejected},
+        {"expired", stats.expired},
+        {"completed", stats.completed},
+        {"batches", stats.batches},
+        {"mean_batch_size", stats.meanBatchSize()},
+        {"pending", stats.pending}
+    };
+}
+
+void serveConnection(std::shared_ptr<Connection> connection,
+    IdentificationService& service, SnakeDatabase& database) {
+    LineReader reader(connection->fd);
+    std::string line;
+    while (reader.readLine(line)) {
+        if (line.empty()) continue;
+
+        json request;
+        try {
+            request = json::parse(line);
+        }
+        catch (const json::exception& e) {
+            connection->send({ {"status", "error"}, {"error", e.what()} });
+            continue;
+        }
+
+        // Неверный тип поля - ответ с ошибкой, а не исключение в потоке
+        // соединения (оно завершило бы весь сервис)
+        if (!request.is_object()) {
+            connection->send({ {"status", "error"}, {"error", "request must be a JSON object"} });
+            continue;
+        }
+        json id = request.value("id", json());
+        if (request.contains("path") && !request["path"].is_string()) {
+            connection->send({ {"id", id}, {"status", "error"}, {"error", "\"path\" must be a string"} });
+            continue;
+        }
+        if (request.contains("cmd") && !request["cmd"].is_string()) {
+            connection->send({ {"id", id}, {"status", "error"}, {"error", "\"cmd\" must be a string"} });
+            continue;
+        }
+
+        std::string cmd = request.value("cmd", std::string());
+        if (request.contains("path")) {
+            service.submit(request["path"].get<std::string>(),
+                [connection, id](const ServiceResponse& r) {
+                    connection->send(responseToJson(id, r));
+                });
+        }
+        else if (cmd == "stats") {
+            json response = statsToJson(service, database);
+            response["id"] = id;
+            connection->send(response);
+        }
+        else if (cmd == "reload") {
+            // Поиски продолжаются по старому снимку до публикации нового
+            bool loaded = database.load();
+            connection->send({ {"id", id}, {"status", loaded ? "ok" : "error"},
+                {"snakes", database.count()} });
+        }
+        else if (cmd == "ping") {
+            connection->send({ {"id", id}, {"status", "ok"} });
+        }
+        else {
+            connection->send({ {"id", id}, {"status", "error"},
+                {"error", "expected \"path\" or \"cmd\": stats|reload|ping"} });
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    DaemonOptions options;
+    try {
+        if (!parseArgs(argc, argv, options)) {
+            printUsage();
+            return 0;
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        printUsage();
+        return 2;
+    }
+
+    SnakeDatabase database(options.db_path);
+    std::atomic<bool> load_failed{ false };
+    database.startLoad([&database, &options, &load_failed](bool loaded) {
+        if (!loaded) {
+            std::cerr << "Failed to load database: " << options.db_path << "\n";
+            load_failed = true;
+            stop_requested = 1;
+            return;
+        }
+        std::cerr << "Loaded " << database.count() << " snakes\n"
+            << database.getMemoryReport().summary();
+        });
+
+    int listen_fd = listenUnixSocket(options.socket_path);
+    if (listen_fd < 0) {
+        std::cerr << "Cannot listen on " << options.socket_path << "\n";
+        return 1;
+    }
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    IdentificationService service(database, options.service);
+    std::cerr << "Serving on " << options.socket_path << "\n";
+
+    // Поток на соединение; при остановке ждём, пока все они завершатся
+    std::mutex connections_mutex;
+    std::condition_variable connections_done;
+    std::vector<std::weak_ptr<Connection>> connections;
+    int active = 0;
+
+    // poll с таймаутом, чтобы сигнал остановки проверялся и без клиентов
+    while (!stop_requested) {
+        pollfd pfd = { listen_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 200) <= 0) continue;
+
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) continue;
+
+        auto connection = std::make_shared<Connection>(fd);
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex);
+            connections.erase(std::remove_if(connections.begin(), connections.end(),
+                [](const std::weak_ptr<Connection>& c) { return c.expired(); }),
+                connections.end());
+            connections.push_back(connection);
+            ++active;
+        }
+        std::thread([&, connection]() {
+            serveConnection(connection, service, database);
+            std::lock_guard<std::mutex> lock(connections_mutex);
+            if (--active == 0) connections_done.notify_all();
+            }).detach();
+    }
+
+    std::cerr << "Shutting down\n";
+    close(listen_fd);
+    unlink(options.socket_path.c_str());
+
+    // Ответить на запросы в очереди, затем разбудить потоки чтения
+    service.stop();
+    std::unique_lock<std::mutex> lock(connections_mutex);
+    for (auto& weak : connections) {
+        if (auto connection = weak.lock()) shutdown(connection->fd, SHUT_RDWR);
+    }
+    connections_done.wait(lock, [&]() { return active == 0; });
+    return load_failed ? 1 : 0;
+}
@@ -1,18 +1,39 @@
 ﻿#pragma execution_character_set("utf-8")
 #include "snake_database.h"
+#include "tracing.h"
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
+#include <future>
+#include <iomanip>
+#include <set>
+#include <sstream>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/features2d.hpp>
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
 namespace fs = std::filesystem;
 
-SnakeDatabase::SnakeDatabase(const std::string& db_path) : db_path_(db_path) {
+SnakeDatabase::SnakeDatabase(const std::string& db_path)
+    : db_path_(db_path)
+    , store_(db_path + "/data/images/store", images_) {
     fs::create_directories(db_path_ + "/data/points");
     fs::create_directories(db_path_ + "/data/images");
 }
 
+SnakeDatabase::~SnakeDatabase() {
+    if (warmer_.joinable()) warmer_.join();
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        stopping_ = true;
+        compact_cv_.notify_all();
+    }
+    if (compactor_.joinable()) compactor_.join();
+}
+
+#ifdef _WIN32
 std::string utf8_to_cp1251(const std::string& utf8_str) {
     if (utf8_str.empty()) return {};
 
@@ -32,6 +53,41 @@ std::string utf8_to_cp1251(const std::string& utf8_str) {
 
     return cp1251_str;
 }
+#else
+// На Linux пути в файловой системе уже в UTF-8
+std::string utf8_to_cp1251(const std::string& utf8_str) {
+    return utf8_str;
+}
+#endif
+
+// Сырые байты дескрипторов (как пишет featuresToJson) -> матрица формата
+// format с SIFT_DESCRIPTOR_SIZE столбцами; пустая при несовпадении размера
+static cv::Mat descriptorsFromBytes(const std::vector<uint8_t>& bytes,
+    const DescriptorFormat& format) {
+    int depth = descriptorDepth(format.storage);
+    size_t row_bytes = SIFT_DESCRIPTOR_SIZE * CV_ELEM_SIZE1(depth);
+    if (bytes.empty() || bytes.size() % row_bytes != 0) {
+        return cv::Mat();
+    }
+    cv::Mat descriptors(static_cast<int>(bytes.size() / row_bytes), SIFT_DESCRIPTOR_SIZE, depth);
+    std::memcpy(descriptors.data, bytes.data(), bytes.size());
+    return descriptors;
+}
+
+// Координаты точек из массива {"x", "y", ...}; остальные поля
+// cv::KeyPoint в старых файлах пропускаются
+static PointSet pointsFromJson(const json& keypoints) {
+    std::vector<float> x, y;
+    if (keypoints.is_array()) {
+        x.reserve(keypoints.size());
+        y.reserve(keypoints.size());
+        for (const auto& kp_json : keypoints) {
+            x.push_back(kp_json["x"].get<float>());
+            y.push_back(kp_json["y"].get<float>());
+        }
+    }
+    return PointSet(x, y);
+}
 
 bool SnakeDatabase::addSnake(const std::string& name,
     const std::vector<cv::KeyPoint>& keypoints,
@@ -41,99 +97,195 @@ bool SnakeDatabase::addSnake(const std::string& name,
         return false;
     }
 
-    // Проверяем, есть ли уже такая змея
-    if (snakes_.find(name) != snakes_.end()) {
-        return false;
-    }
-
-    // Сохраняем изображение
-    std::string img_dir = db_path_ + "/data/images/" + name;
-	std::string img_dir_cp1251 = utf8_to_cp1251(img_dir);
-    fs::create_directories(img_dir_cp1251);
+    std::lock_guard<std::mutex> lock(write_mutex_);
 
-    std::string img_path = img_dir + "/photo_0.jpg";
-    std::string img_path_cp1251 = utf8_to_cp1251(img_path);
-    if (!saveImage(image, img_path_cp1251)) {
+    // Проверяем, есть ли уже такая змея
+    if (index_.find(name)) {
         return false;
     }
 
-    // Создаем запись
-    SnakeFeatures features;
-    features.name = name;
-    features.keypoints = keypoints;
-    features.descriptors = descriptors;
-    features.image_paths.push_back(img_path);
-
-    snakes_[name] = features;
+    // Сохраняем изображение в хранилище по содержимому; кодирование и
+    // запись - в фоне, до конца записи фото читается из кэша
+    std::string img_path = store_.put(image);
+
+    // Создаем запись; сигнатура - по исходным float-дескрипторам
+    auto features = std::make_shared<SnakeFeatures>();
+    features->name = name;
+    features->points = PointSet(keypoints);
+    features->descriptor_format = descriptor_format_;
+    features->descriptors = descriptor_format_.isDefault() ?
+        descriptors : encodeDescriptors(descriptors, descriptor_format_);
+    features->image_starts.push_back(0);
+    features->image_paths.push_back(img_path);
+    features->signature = computeGlobalSignature(image, descriptors);
+    project(*features);
+
+    index_.put(std::move(features));
     return true;
 }
 
 bool SnakeDatabase::removeSnake(const std::string& name) {
-    auto it = snakes_.find(name);
-    if (it == snakes_.end()) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    std::shared_ptr<const SnakeFeatures> record = index_.find(name);
+    if (!record) {
         return false;
     }
 
-    // Удаляем связанные изображения
-    for (const auto& img_path : it->second.image_paths) {
-        fs::remove(img_path);
+    // Удаляем связанные изображения - после записи ещё стоящих в очереди,
+    // иначе фоновая запись вернула бы файл. Фото из хранилища может
+    // принадлежать и другим змеям (одинаковые загрузки) - тогда остаётся.
+    // Неудачная запись фото других записей здесь не сбрасывается: о ней
+    // сообщит save(); фото удаляемой записи забываются вместе с неудачей
+    if (!images_.flush()) {
+        std::cerr << "Some snake photos were not written; save() will report it" << std::endl;
+    }
+    std::set<std::string> shared;
+    snapshot()->forEach([&](size_t, const SnakeFeatures& other) {
+        if (other.name == name) return;
+        shared.insert(other.image_paths.begin(), other.image_paths.end());
+        });
+    for (const auto& img_path : record->image_paths) {
+        if (store_.contains(img_path)) {
+            if (!shared.count(img_path)) store_.remove(img_path);
+        }
+        else {
+            fs::remove(img_path);
+            images_.forget(img_path);
+        }
     }
 
-    // Удаляем папку с изображениями
-    std::string img_dir = db_path_ + "/data/images/" + name;
+    // Удаляем папку с изображениями (базы до хранилища по содержимому)
+    std::string img_dir = utf8_to_cp1251(db_path_ + "/data/images/" + name);
     if (fs::exists(img_dir)) {
         fs::remove_all(img_dir);
     }
 
     // Удаляем файл с ключевыми точками
-    std::string points_path = db_path_ + "/data/points/" + name + ".json";
-    fs::remove(points_path);
+    fs::remove(pointsPath(name));
 
-    // Удаляем из памяти
-    snakes_.erase(it);
+    // Удаляем из памяти. Читатели со старым снимком продолжают работать
+    // с записью, пока не отпустят снимок
+    index_.remove(name);
+    requestCompactionIfNeeded();
     return true;
 }
 
+// Дописывает признаки нового снимка к записи. Дескриптор, для которого в
+// записи уже есть почти такой же, не добавляется: повторные снимки той же
+// змеи не раздувают запись и не сканируются дважды при поиске.
+// Матрица собирается заново - старая может принадлежать опубликованной записи.
+// descriptors - float SIFT, кодируются в формат записи
+static void appendImageFeatures(SnakeFeatures& record,
+    const std::vector<cv::KeyPoint>& keypoints,
+    const cv::Mat& sift_descriptors,
+    float merge_distance) {
+    SNAKE_TRACE_SCOPE("db.append_image");
+    if (record.image_starts.empty() && !record.descriptors.empty()) {
+        record.image_starts.push_back(0);   // запись из базы до накопления снимков
+    }
+    record.image_starts.push_back(record.descriptors.rows);
+    cv::Mat descriptors = record.descriptor_format.isDefault() ?
+        sift_descriptors : encodeDescriptors(sift_descriptors, record.descriptor_format);
+
+    std::vector<bool> keep(descriptors.rows, true);
+    if (!record.descriptors.empty() && !descriptors.empty() && merge_distance > 0) {
+        std::vector<std::vector<cv::DMatch>> nearest;
+        if (descriptors.depth() == CV_32F) {
+            cv::BFMatcher(cv::NORM_L2).knnMatch(descriptors, record.descriptors, nearest, 1);
+        }
+        else {
+            knnMatchQuantized(descriptors, record.descriptors, cv::NORM_L2, nearest);
+        }
+        for (const auto& row : nearest) {
+            if (!row.empty() && row[0].distance < merge_distance) keep[row[0].queryIdx] = false;
+        }
+    }
+
+    std::vector<cv::Mat> rows;
+    if (!record.descriptors.empty()) rows.push_back(record.descriptors);
+    for (int i = 0; i < descriptors.rows; ++i) {
+        if (!keep[i]) continue;
+        rows.push_back(descriptors.row(i));
+    }
+    record.points = record.points.appended(keypoints, keep);
+    SNAKE_TRACE_COUNTER("db.descriptors_merged",
+        std::count(keep.begin(), keep.end(), false));
+
+    cv::Mat combined;
+    if (!rows.empty()) cv::vconcat(rows, combined);
+    record.descriptors = combined;
+}
+
 bool SnakeDatabase::updateSnake(const std::string& name,
     const std::vector<cv::KeyPoint>& new_keypoints,
     const cv::Mat& new_descriptors,
     const cv::Mat& new_image) {
-    auto it = snakes_.find(name);
-    if (it == snakes_.end()) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    std::shared_ptr<const SnakeFeatures> current = index_.find(name);
+    if (!current) {
         return false;
     }
 
-    // Обновляем ключевые точки и дескрипторы
-    it->second.keypoints = new_keypoints;
-    it->second.descriptors = new_descriptors;
-
-    // Добавляем новое изображение
-    std::string img_path = generateImagePath(name, it->second.image_paths.size());
-    if (!saveImage(new_image, img_path)) {
+    if (new_keypoints.size() != static_cast<size_t>(new_descriptors.rows) || new_image.empty()) {
         return false;
     }
-    it->second.image_paths.push_back(img_path);
 
+    // Опубликованные записи неизменяемы - обновление создаёт новую
+    auto features = std::make_shared<SnakeFeatures>(*withDescriptors(current));
+    appendImageFeatures(*features, new_keypoints, new_descriptors, DESCRIPTOR_MERGE_DISTANCE);
+    // Сигнатура по признакам всех снимков, pHash - по последнему
+    features->signature = computeGlobalSignature(new_image,
+        decodeDescriptors(features->descriptors, features->descriptor_format));
+    project(*features);
+
+    // Добавляем новое изображение (запись - в фоне)
+    features->image_paths.push_back(store_.put(new_image));
+
+    index_.put(std::move(features));
+    requestCompactionIfNeeded();
     return true;
 }
 
 bool SnakeDatabase::findSnake(const cv::Mat& query_descriptors,
     std::string& found_name,
     double min_match_ratio) const {
-    if (query_descriptors.empty() || snakes_.empty()) {
+    SNAKE_TRACE_SCOPE("db.find_snake");
+    SnakeSnapshotPtr snakes = snapshot();
+    if (query_descriptors.empty() || snakes->empty()) {
         return false;
     }
 
     double best_match_score = 0;
     std::string best_match_name;
 
-    for (const auto& [name, features] : snakes_) {
-        if (features.descriptors.empty()) continue;
-
-        // Сопоставление дескрипторов
+    // С проекцией ближайшие ищутся по укороченным дескрипторам
+    std::shared_ptr<const DescriptorProjection> reduction = projection();
+    cv::Mat query_projected = reduction ? reduction->project(query_descriptors) : cv::Mat();
+    cv::Mat query_full;
+    query_descriptors.convertTo(query_full, CV_32F);
+
+    snakes->forEach([&](size_t slot, const SnakeFeatures&) {
+        std::shared_ptr<const SnakeFeatures> record = withDescriptors(snakes->record(slot));
+        const SnakeFeatures& features = *record;
+        if (features.descriptors.empty()) return;
+
+        // Сопоставление дескрипторов (квантованные - в float)
+        cv::Mat train = features.descriptor_format.isDefault() ?
+            features.descriptors :
+            decodeDescriptors(features.descriptors, features.descriptor_format);
         cv::BFMatcher matcher(cv::NORM_L2);
         std::vector<cv::DMatch> matches;
-        matcher.match(query_descriptors, features.descriptors, matches);
+        if (!query_projected.empty() && features.projected.rows == train.rows) {
+            // Пары - по проекции, расстояния - по полным дескрипторам
+            matcher.match(query_projected, features.projected, matches);
+            for (auto& m : matches) {
+                m.distance = static_cast<float>(cv::norm(query_full.row(m.queryIdx),
+                    train.row(m.trainIdx), cv::NORM_L2));
+            }
+        }
+        else {
+            matcher.match(query_full, train, matches);
+        }
 
         // Фильтрация хороших совпадений
         double min_dist = DBL_MAX;
@@ -153,9 +305,9 @@ bool SnakeDatabase::findSnake(const cv::Mat& query_descriptors,
         double match_score = static_cast<double>(good_matches) / matches.size();
         if (match_score > best_match_score) {
             best_match_score = match_score;
-            best_match_name = name;
+            best_match_name = features.name;
         }
-    }
+        });
 
     if (best_match_score >= min_match_ratio) {
         found_name = best_match_name;
@@ -165,72 +317,423 @@ bool SnakeDatabase::findSnake(const cv::Mat& query_descriptors,
     return false;
 }
 
+SnakeSnapshotPtr SnakeDatabase::snapshot() const {
+    return index_.snapshot();
+}
+
+uint64_t SnakeDatabase::version() const {
+    return snapshot()->version();
+}
+
+void SnakeDatabase::setCompactionThreshold(double ratio, size_t min_slots) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    compaction_ratio_ = ratio;
+    compaction_min_slots_ = min_slots;
+    requestCompactionIfNeeded();
+}
+
+void SnakeDatabase::compact() {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    compactLocked();
+}
+
+// Данные ещё не опубликованных записей - в общие блоки (feature_slab.h).
+// mapped - точки и дескрипторы уже подряд в отображённом файле быстрого
+// запуска и остаются там; упаковывается только проекция
+static std::vector<std::shared_ptr<const SnakeFeatures>> packRecords(
+    const std::vector<std::shared_ptr<SnakeFeatures>>& records, bool mapped = false) {
+    std::vector<PackedFeatures> fields;
+    fields.reserve(records.size());
+    for (const auto& record : records) {
+        fields.push_back({ mapped ? nullptr : &record->points,
+            mapped ? nullptr : &record->descriptors, &record->projected });
+    }
+    packFeatures(fields);
+    // Точки и дескрипторы скопированы в общие блоки - отображение не нужно
+    if (!mapped) {
+        for (const auto& record : records) record->mapping.reset();
+    }
+    return { records.begin(), records.end() };
+}
+
+// Живые записи переписываются в новые сегменты и заново упаковываются:
+// блоки загрузки держат данные удалённых и заменённых записей, а
+// добавленные после загрузки лежат каждая отдельно
+void SnakeDatabase::compactLocked() {
+    SNAKE_TRACE_SCOPE("db.compact");
+    SnakeSnapshotPtr current = snapshot();
+    std::vector<std::shared_ptr<SnakeFeatures>> live;
+    live.reserve(current->size());
+    current->forEach([&](size_t, const SnakeFeatures& record) {
+        live.push_back(std::make_shared<SnakeFeatures>(record));
+        });
+    index_.relayout(packRecords(live));
+}
+
+double SnakeDatabase::tombstoneRatio() const {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return index_.tombstoneRatio();
+}
+
+void SnakeDatabase::setDescriptorFormat(const DescriptorFormat& format) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    descriptor_format_ = format;
+}
+
+DescriptorFormat SnakeDatabase::descriptorFormat() const {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return descriptor_format_;
+}
+
+void SnakeDatabase::convertDescriptors(const DescriptorFormat& format) {
+    SNAKE_TRACE_SCOPE("db.convert_descriptors");
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    descriptor_format_ = format;
+
+    SnakeSnapshotPtr current = snapshot();
+    std::vector<std::shared_ptr<const SnakeFeatures>> records;
+    current->forEach([&](size_t slot, const SnakeFeatures& stored) {
+        if (stored.descriptor_format == format) {
+            records.push_back(current->record(slot));
+            return;
+        }
+        std::shared_ptr<const SnakeFeatures> record = withDescriptors(current->record(slot));
+        const SnakeFeatures& features = *record;
+        auto converted = std::make_shared<SnakeFeatures>(features);
+        converted->descriptors = encodeDescriptors(
+            decodeDescriptors(features.descriptors, features.descriptor_format), format);
+        converted->descriptor_format = format;
+        records.push_back(std::move(converted));
+        });
+    index_.reset(records);
+}
+
+void SnakeDatabase::setResidentDescriptors(bool resident) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    resident_descriptors_ = resident;
+}
+
+void SnakeDatabase::setDescriptorCacheBytes(size_t bytes) {
+    std::lock_guard<std::mutex> lock(descriptor_cache_mutex_);
+    max_descriptor_cache_bytes_ = bytes;
+    cacheDescriptors(nullptr, nullptr);
+}
+
+static size_t descriptorBytes(const SnakeFeatures& record) {
+    return record.descriptors.total() * record.descriptors.elemSize();
+}
+
+// Под descriptor_cache_mutex_. Без записи - только вытеснение до предела
+void SnakeDatabase::cacheDescriptors(const std::shared_ptr<const SnakeFeatures>& record,
+    const std::shared_ptr<const SnakeFeatures>& loaded) const {
+    if (record) {
+        auto it = descriptor_cache_index_.find(record.get());
+        if (it != descriptor_cache_index_.end()) {
+            descriptor_cache_bytes_ -= descriptorBytes(*it->second->loaded);
+            descriptor_cache_.erase(it->second);
+        }
+        descriptor_cache_.push_front({ record.get(), record, loaded });
+        descriptor_cache_index_[record.get()] = descriptor_cache_.begin();
+        descriptor_cache_bytes_ += descriptorBytes(*loaded);
+    }
+    while (descriptor_cache_bytes_ > max_descriptor_cache_bytes_ && !descriptor_cache_.empty()) {
+        const DescriptorCacheEntry& oldest = descriptor_cache_.back();
+        descriptor_cache_bytes_ -= descriptorBytes(*oldest.loaded);
+        descriptor_cache_index_.erase(oldest.key);
+        descriptor_cache_.pop_back();
+    }
+}
+
+std::shared_ptr<const SnakeFeatures> SnakeDatabase::withDescriptors(
+    const std::shared_ptr<const SnakeFeatures>& record) const {
+    if (!record || !record->descriptors_on_disk) {
+        return record;
+    }
+    {
+        std::lock_guard<std::mutex> lock(descriptor_cache_mutex_);
+        auto it = descriptor_cache_index_.find(record.get());
+        if (it != descriptor_cache_index_.end() && it->second->source.lock() == record) {
+            descriptor_cache_.splice(descriptor_cache_.begin(), descriptor_cache_, it->second);
+            return it->second->loaded;
+        }
+    }
+
+    SNAKE_TRACE_SCOPE("db.read_descriptors");
+    std::ifstream points_file(pointsPath(record->name));
+    json points_json;
+    try {
+        points_file >> points_json;
+    }
+    catch (...) {
+        return record;
+    }
+
+    // Остальные поля записи уже в памяти - из файла берутся только дескрипторы
+    SnakeFeatures stored = jsonToFeatures(points_json);
+    if (stored.descriptors.rows != static_cast<int>(record->points.size())) {
+        return record;
+    }
+    auto loaded = std::make_shared<SnakeFeatures>(*record);
+    loaded->descriptors = stored.descriptors;
+    loaded->descriptor_format = stored.descriptor_format;
+    loaded->descriptors_on_disk = false;
+    std::lock_guard<std::mutex> lock(descriptor_cache_mutex_);
+    cacheDescriptors(record, loaded);
+    return loaded;
+}
+
+bool SnakeDatabase::buildPQIndex(const PQIndexParams& params) {
+    SNAKE_TRACE_SCOPE("db.build_pq_index");
+    // Строится по снимку без блокировки писателей: записи, изменённые
+    // за время построения, просто окажутся непокрытыми
+    SnakeSnapshotPtr current = snapshot();
+    std::vector<size_t> slots;
+    current->forEach([&](size_t slot, const SnakeFeatures&) {
+        slots.push_back(slot);
+        });
+    cv::Mat training = sampleDescriptors(*current, params.train_samples);
+    if (training.empty()) {
+        return false;
+    }
+
+    auto index = std::make_shared<PQIndex>();
+    if (!index->train(training, params)) {
+        return false;
+    }
+    for (size_t slot : slots) {
+        std::shared_ptr<const SnakeFeatures> record = withDescriptors(current->record(slot));
+        index->add(current->id(slot), record->name, current->stamp(slot),
+            decodeDescriptors(record->descriptors, record->descriptor_format));
+    }
+
+    // Индекс - до новой версии: поиск, увидевший новую версию, идёт уже
+    // с ним, а результаты по старому набору кандидатов кэш отбросит
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    std::atomic_store(&pq_index_, std::shared_ptr<const PQIndex>(std::move(index)));
+    index_.bumpVersion();
+    return true;
+}
+
+std::shared_ptr<const PQIndex> SnakeDatabase::pqIndex() const {
+    return std::atomic_load(&pq_index_);
+}
+
+cv::Mat SnakeDatabase::sampleDescriptors(const SnakeSnapshot& snakes, int max_samples) const {
+    size_t total = 0;
+    snakes.forEach([&](size_t, const SnakeFeatures& features) {
+        total += features.points.size();
+        });
+    size_t stride = std::max<size_t>(1, total / std::max(max_samples, 1));
+
+    std::vector<cv::Mat> samples;
+    size_t seen = 0;
+    snakes.forEach([&](size_t slot, const SnakeFeatures&) {
+        std::shared_ptr<const SnakeFeatures> record = withDescriptors(snakes.record(slot));
+        cv::Mat descriptors = decodeDescriptors(record->descriptors, record->descriptor_format);
+        for (int r = 0; r < descriptors.rows; ++r, ++seen) {
+            if (seen % stride == 0) samples.push_back(descriptors.row(r));
+        }
+        });
+
+    cv::Mat sampled;
+    if (!samples.empty()) cv::vconcat(samples, sampled);
+    return sampled;
+}
+
+bool SnakeDatabase::trainProjection(int dims, int max_samples) {
+    SNAKE_TRACE_SCOPE("db.train_projection");
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    SnakeSnapshotPtr current = snapshot();
+
+    std::shared_ptr<DescriptorProjection> trained;
+    if (dims > 0) {
+        trained = std::make_shared<DescriptorProjection>();
+        if (!trained->train(sampleDescriptors(*current, max_samples), dims)) {
+            return false;
+        }
+    }
+    std::atomic_store(&projection_, std::shared_ptr<const DescriptorProjection>(std::move(trained)));
+
+    // Укороченные дескрипторы всех записей - новым снимком, как при смене
+    // формата; записи с дескрипторами на диске остаются такими
+    std::vector<std::shared_ptr<const SnakeFeatures>> records;
+    current->forEach([&](size_t slot, const SnakeFeatures& stored) {
+        auto updated = std::make_shared<SnakeFeatures>(*withDescriptors(current->record(slot)));
+        project(*updated);
+        if (stored.descriptors_on_disk) {
+            updated->descriptors.release();
+            updated->descriptors_on_disk = true;
+        }
+        records.push_back(std::move(updated));
+        });
+    index_.reset(records);
+    return true;
+}
+
+std::shared_ptr<const DescriptorProjection> SnakeDatabase::projection() const {
+    return std::atomic_load(&projection_);
+}
+
+void SnakeDatabase::project(SnakeFeatures& features) const {
+    std::shared_ptr<const DescriptorProjection> current = projection();
+    features.projected = current && !features.descriptors.empty() ?
+        current->project(decodeDescriptors(features.descriptors, features.descriptor_format)) :
+        cv::Mat();
+}
+
+// Уплотнение переупаковывает данные всех живых записей - при большой
+// базе заметная пауза, поэтому не в потоке того, кто удалил запись
+void SnakeDatabase::requestCompactionIfNeeded() {
+    if (index_.slotCount() < compaction_min_slots_ ||
+        index_.tombstoneRatio() <= compaction_ratio_) {
+        return;
+    }
+    compact_requested_ = true;
+    if (!compactor_.joinable()) {
+        compactor_ = std::thread(&SnakeDatabase::compactionLoop, this);
+    }
+    compact_cv_.notify_one();
+}
+
+// Писатели ждут уплотнения на write_mutex_, читатели работают со своими
+// снимками и его не замечают
+void SnakeDatabase::compactionLoop() {
+    std::unique_lock<std::mutex> lock(write_mutex_);
+    while (true) {
+        compact_cv_.wait(lock, [this]() { return stopping_ || compact_requested_; });
+        if (stopping_) return;
+        compact_requested_ = false;
+        compactLocked();
+    }
+}
+
 std::vector<std::string> SnakeDatabase::getAllSnakeNames() const {
     std::vector<std::string> names;
-    for (const auto& [name, _] : snakes_) {
-        names.push_back(name);
-    }
+    snapshot()->forEach([&](size_t, const SnakeFeatures& features) {
+        names.push_back(features.name);
+        });
+    std::sort(names.begin(), names.end());
     return names;
 }
 
-SnakeFeatures SnakeDatabase::getSnakeFeatures(const std::string& name) const {
-    auto it = snakes_.find(name);
-    if (it != snakes_.end()) {
-        return it->second;
-    }
-    return SnakeFeatures();
+std::shared_ptr<const SnakeFeatures> SnakeDatabase::getSnakeFeatures(const std::string& name) const {
+    return withDescriptors(snapshot()->find(name));
 }
 
-cv::Mat SnakeDatabase::getSnakeImage(const std::string& name, int index) const {
-    auto it = snakes_.find(name);
-    if (it != snakes_.end() && index < it->second.image_paths.size()) {
-        return cv::imread(it->second.image_paths[index]);
+cv::Mat SnakeDatabase::getSnakeImage(const std::string& name, int index, int max_side) const {
+    SNAKE_TRACE_SCOPE("db.read_image");
+    std::shared_ptr<const SnakeFeatures> record = snapshot()->find(name);
+    if (record && index < record->image_paths.size()) {
+        return store_.read(record->image_paths[index], max_side);
     }
     return cv::Mat();
 }
 
+cv::Mat SnakeDatabase::readImage(const std::string& path, int max_side) const {
+    return path.empty() ? cv::Mat() : store_.read(path, max_side);
+}
+
+void SnakeDatabase::prefetchImages(const std::vector<std::string>& paths, int max_side) const {
+    store_.prefetch(paths, max_side);
+}
+
+bool SnakeDatabase::flushImages() const {
+    return images_.flush();
+}
+
+ImageIOStats SnakeDatabase::imageStats() const {
+    return images_.stats();
+}
+
 bool SnakeDatabase::save() const {
+    SNAKE_TRACE_SCOPE("db.save");
+    // Блокируем писателей, чтобы удаление не шло параллельно с записью файлов
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    // Фото, на которые сошлётся meta.json, должны быть на диске
+    bool images_written = images_.flush();
     json meta;
-    for (const auto& [name, features] : snakes_) {
-        // Сохраняем ключевые точки
-        std::string points_path = db_path_ + "/data/points/" + name + ".json";
-        std::ofstream points_file(points_path);
-        if (!points_file.is_open()) {
-            return false;
+    bool written = true;
+    snapshot()->forEach([&](size_t, const SnakeFeatures& features) {
+        if (!written) return;
+        const std::string& name = features.name;
+        // Сохраняем ключевые точки; файл записи с дескрипторами на диске
+        // не менялся с загрузки
+        std::string points_path = pointsPath(name);
+        if (!features.descriptors_on_disk) {
+            std::ofstream points_file(points_path);
+            if (!points_file.is_open()) {
+                written = false;
+                return;
+            }
+            points_file << featuresToJson(features);
         }
-        points_file << featuresToJson(features);
 
         // Добавляем в мета-информацию
         meta[name] = {
             {"points", points_path},
             {"images", features.image_paths}
         };
+        });
+    if (!written) {
+        return false;
     }
 
-    std::ofstream meta_file(db_path_ + "/meta.json");
-    if (!meta_file.is_open()) {
-        return false;
+    {
+        std::ofstream meta_file(db_path_ + "/meta.json");
+        if (!meta_file.is_open()) {
+            return false;
+        }
+        meta_file << meta.dump(4);
+    }
+    // После закрытия meta.json: файл быстрого запуска помечается его
+    // окончательным размером и временем изменения
+    writeStartupSnapshotLocked();
+
+    // Проекция без файла - значит, её убрали
+    std::string projection_path = db_path_ + "/descriptor_pca.yml";
+    std::shared_ptr<const DescriptorProjection> reduction = projection();
+    if (reduction) {
+        if (!reduction->save(projection_path)) return false;
+    }
+    else {
+        std::error_code ec;
+        fs::remove(projection_path, ec);
     }
-    meta_file << meta.dump(4);
 
-    return true;
+    std::shared_ptr<const PQIndex> pq = pqIndex();
+    return (!pq || pq->save(db_path_ + "/pq_index.bin")) && images_written;
 }
 
-bool SnakeDatabase::load() {
-    std::ifstream meta_file(db_path_ + "/meta.json");
-    if (!meta_file.is_open()) {
-        return false;
-    }
+std::shared_ptr<const StartupSnapshot> SnakeDatabase::openStartupSnapshot() const {
+    return StartupSnapshot::open(db_path_ + "/snapshot.bin", metaStamp(db_path_ + "/meta.json"));
+}
 
+bool SnakeDatabase::readRecords(const std::shared_ptr<const StartupSnapshot>& startup,
+    std::vector<std::shared_ptr<SnakeFeatures>>& records, bool& from_startup,
+    std::shared_ptr<PQIndex>& pq) {
+    // Повреждённый файл быстрого запуска - не ошибка: читается meta.json
+    from_startup = startup && startup->readRecords(records);
     json meta;
-    try {
-        meta_file >> meta;
-    }
-    catch (...) {
-        return false;
+    if (!from_startup) {
+        records.clear();
+        std::ifstream meta_file(db_path_ + "/meta.json");
+        if (!meta_file.is_open()) {
+            return false;
+        }
+        try {
+            meta_file >> meta;
+        }
+        catch (...) {
+            return false;
+        }
     }
 
-    snakes_.clear();
+    // Проекция нужна до записей: укороченные дескрипторы считаются при чтении
+    auto reduction = std::make_shared<DescriptorProjection>();
+    std::atomic_store(&projection_, reduction->load(db_path_ + "/descriptor_pca.yml") ?
+        std::shared_ptr<const DescriptorProjection>(std::move(reduction)) :
+        std::shared_ptr<const DescriptorProjection>());
+
     for (const auto& [name, data] : meta.items()) {
         std::ifstream points_file(data["points"].get<std::string>());
         if (!points_file.is_open()) {
@@ -245,23 +748,167 @@ bool SnakeDatabase::load() {
             continue;
         }
 
-        SnakeFeatures features = jsonToFeatures(points_json);
-        features.image_paths = data["images"].get<std::vector<std::string>>();
-        snakes_[name] = features;
+        auto features = std::make_shared<SnakeFeatures>(jsonToFeatures(points_json));
+        features->image_paths = data["images"].get<std::vector<std::string>>();
+        features->name = name;
+        records.push_back(std::move(features));
+    }
+    for (const auto& features : records) {
+        project(*features);
+        if (!resident_descriptors_ && !features->descriptors.empty()) {
+            features->descriptors.release();
+            features->descriptors_on_disk = true;
+        }
     }
 
+    // Индекс PQ необязателен: без него поиск отбирает кандидатов по сигнатурам
+    pq = std::make_shared<PQIndex>();
+    if (!pq->load(db_path_ + "/pq_index.bin")) pq.reset();
+    return true;
+}
+
+// Индекс строится один раз - по записям, упакованным в общие блоки
+void SnakeDatabase::publishLocked(const std::vector<std::shared_ptr<SnakeFeatures>>& records,
+    bool mapped, std::shared_ptr<PQIndex> pq) {
+    std::vector<std::shared_ptr<const SnakeFeatures>> packed = packRecords(records, mapped);
+    index_.reset(packed);
+
+    // Владельцы в файле PQ - номера сохранившего процесса; здесь номера
+    // даёт индекс по именам, имена вне базы из индекса PQ выбрасываются
+    if (pq) {
+        std::vector<uint32_t> ids(pq->ownerCount(), PQIndex::NO_OWNER);
+        for (uint32_t owner = 0; owner < ids.size(); ++owner) {
+            SnakeId id = index_.id(pq->ownerName(owner));
+            if (id != NO_SNAKE && pq->ownerDescriptors(owner) > 0) ids[owner] = id;
+        }
+        pq->renumber(ids);
+    }
+    std::atomic_store(&pq_index_, std::shared_ptr<const PQIndex>(std::move(pq)));
+
+    // Новые записи - в формате загруженной базы, если он у всех записей один
+    bool uniform = !records.empty() && std::all_of(records.begin(), records.end(),
+        [&](const std::shared_ptr<SnakeFeatures>& record) {
+            return record->descriptor_format == records.front()->descriptor_format;
+        });
+    if (uniform) {
+        descriptor_format_ = records.front()->descriptor_format;
+    }
+}
+
+bool SnakeDatabase::load() {
+    SNAKE_TRACE_SCOPE("db.load");
+    std::shared_ptr<const StartupSnapshot> startup = openStartupSnapshot();
+    // Файлы читаются без блокировки писателей
+    std::vector<std::shared_ptr<SnakeFeatures>> records;
+    bool from_startup = false;
+    std::shared_ptr<PQIndex> pq;
+    if (!readRecords(startup, records, from_startup, pq)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    publishLocked(records, from_startup, std::move(pq));
+    return true;
+}
+
+void SnakeDatabase::startLoad(std::function<void(bool)> done) {
+    waitWarm();
+    if (warmer_.joinable()) warmer_.join();
+
+    // Здесь только отображение и проверка заголовка - O(1)
+    std::shared_ptr<const StartupSnapshot> startup = openStartupSnapshot();
+    warming_ = true;
+    // Поток берёт мьютекс писателей до возврата отсюда, иначе изменение,
+    // успевшее раньше него, пропало бы при публикации загруженных записей
+    std::promise<void> locked;
+    std::future<void> started = locked.get_future();
+    warmer_ = std::thread([this, startup, done, &locked]() {
+        SNAKE_TRACE_SCOPE("db.warm");
+        bool ok;
+        {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            locked.set_value();
+            std::vector<std::shared_ptr<SnakeFeatures>> records;
+            bool from_startup = false;
+            std::shared_ptr<PQIndex> pq;
+            ok = readRecords(startup, records, from_startup, pq);
+            if (ok && from_startup) {
+                // Страницы файла читаются сейчас, а не первым поиском
+                startup->file()->touch();
+            }
+            if (ok) {
+                publishLocked(records, from_startup, std::move(pq));
+                // Следующий запуск - уже без разбора JSON
+                if (!from_startup) writeStartupSnapshotLocked();
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(warm_mutex_);
+            warm_ok_ = ok;
+            warming_ = false;
+        }
+        warm_cv_.notify_all();
+        if (done) done(ok);
+        });
+    started.wait();
+}
+
+bool SnakeDatabase::warming() const {
+    return warming_;
+}
+
+bool SnakeDatabase::waitWarm() const {
+    std::unique_lock<std::mutex> lock(warm_mutex_);
+    warm_cv_.wait(lock, [this]() { return !warming_; });
+    return warm_ok_;
+}
+
+// Кэш, а не данные базы: неудачная запись не делает сохранение неудачным,
+// устаревший файл отвергается при чтении по отметке meta.json. Пишется во
+// временный файл и заменяет прежний целиком - прежний может быть отображён.
+// В Windows отображённый файл заменить нельзя: он остаётся устаревшим, и
+// следующий запуск после обычной загрузки пишет его заново
+bool SnakeDatabase::writeStartupSnapshotLocked() const {
+    std::string path = db_path_ + "/snapshot.bin";
+    std::vector<const SnakeFeatures*> records;
+    bool resident = true;
+    SnakeSnapshotPtr current = snapshot();
+    current->forEach([&](size_t, const SnakeFeatures& record) {
+        records.push_back(&record);
+        resident = resident && !record.descriptors_on_disk;
+        });
+    std::error_code ec;
+    // Без дескрипторов в памяти файл не собрать - база читается по-старому
+    if (!resident) {
+        fs::remove(path, ec);
+        return false;
+    }
+    std::string temporary = path + ".tmp";
+    if (!writeStartupSnapshot(temporary, records, metaStamp(db_path_ + "/meta.json"))) {
+        fs::remove(temporary, ec);
+        return false;
+    }
+    fs::rename(temporary, path, ec);
+    if (ec) {
+        fs::remove(temporary, ec);
+        return false;
+    }
     return true;
 }
 
 bool SnakeDatabase::exportTo(const std::string& file_path) const {
     json export_data;
-    for (const auto& [name, features] : snakes_) {
-        export_data[name] = {
+    SnakeSnapshotPtr snakes = snapshot();
+    snakes->forEach([&](size_t slot, const SnakeFeatures&) {
+        std::shared_ptr<const SnakeFeatures> record = withDescriptors(snakes->record(slot));
+        const SnakeFeatures& features = *record;
+        export_data[features.name] = {
             {"keypoints", featuresToJson(features)["keypoints"]},
             {"descriptors", featuresToJson(features)["descriptors"]},
+            {"descriptor_format", descriptorFormatName(features.descriptor_format)},
+            {"image_starts", features.image_starts},
             {"images", features.image_paths}
         };
-    }
+        });
 
     std::ofstream out_file(file_path);
     if (!out_file.is_open()) {
@@ -285,71 +932,175 @@ bool SnakeDatabase::importFrom(const std::string& file_path) {
         return false;
     }
 
+    std::lock_guard<std::mutex> lock(write_mutex_);
     for (const auto& [name, data] : import_data.items()) {
         SnakeFeatures features;
         features.name = name;
 
         // Восстанавливаем ключевые точки
-        for (const auto& kp_json : data["keypoints"]) {
-            cv::KeyPoint kp;
-            kp.pt.x = kp_json["x"].get<float>();
-            kp.pt.y = kp_json["y"].get<float>();
-            kp.size = kp_json["size"].get<float>();
-            kp.angle = kp_json["angle"].get<float>();
-            kp.response = kp_json["response"].get<float>();
-            kp.octave = kp_json["octave"].get<int>();
-            kp.class_id = kp_json["class_id"].get<int>();
-            features.keypoints.push_back(kp);
-        }
+        features.points = pointsFromJson(data["keypoints"]);
 
         // Восстанавливаем дескрипторы
-        auto descriptors_vec = data["descriptors"].get<std::vector<uint8_t>>();
-        if (!descriptors_vec.empty()) {
-            features.descriptors = cv::Mat(
-                descriptors_vec.size() / 128, 128, CV_32F,
-                const_cast<uint8_t*>(descriptors_vec.data())).clone();
+        if (!parseDescriptorFormat(data.value("descriptor_format", std::string("f32")),
+            features.descriptor_format)) {
+            continue;
+        }
+        features.descriptors = descriptorsFromBytes(
+            data["descriptors"].get<std::vector<uint8_t>>(), features.descriptor_format);
+        if (features.descriptors.rows != static_cast<int>(features.points.size())) {
+            continue;
         }
 
         // Восстанавливаем пути к изображениям
         features.image_paths = data["images"].get<std::vector<std::string>>();
+        features.image_starts = data.value("image_starts", std::vector<int>{ 0 });
+        features.signature.pooled = computePooledSignature(
+            decodeDescriptors(features.descriptors, features.descriptor_format));
+        project(features);
 
-        snakes_[name] = features;
+        index_.put(std::make_shared<const SnakeFeatures>(std::move(features)));
     }
 
+    requestCompactionIfNeeded();
     return true;
 }
 
 size_t SnakeDatabase::count() const {
-    return snakes_.size();
+    return snapshot()->size();
 }
 
 std::map<std::string, size_t> SnakeDatabase::getStatistics() const {
     std::map<std::string, size_t> stats;
-    for (const auto& [name, features] : snakes_) {
-        stats[name] = features.keypoints.size();
-    }
+    snapshot()->forEach([&](size_t, const SnakeFeatures& features) {
+        stats[features.name] = features.points.size();
+        });
     return stats;
 }
 
+// Оценки для учёта памяти: служебные байты malloc на одно выделение,
+// счётчики ссылок блока make_shared и запас cv::fastMalloc на
+// выравнивание буфера Mat
+static const size_t MALLOC_OVERHEAD = 16;
+static const size_t SHARED_CONTROL_BLOCK = 16;
+static const size_t MAT_ALIGN_OVERHEAD = 64;
+
+// Байты строки в куче (0 для короткой строки, хранящейся внутри объекта)
+static size_t heapStringBytes(const std::string& s) {
+    return s.capacity() > std::string().capacity() ? s.capacity() + 1 : 0;
+}
+
+DatabaseMemoryReport SnakeDatabase::getMemoryReport() const {
+    DatabaseMemoryReport report;
+
+    // Общие блоки (feature_slab.h) учитываются один раз - у первой записи
+    std::set<const void*> blocks;
+    SnakeSnapshotPtr snakes = snapshot();
+    snakes->forEach([&](size_t, const SnakeFeatures& features) {
+        SnakeMemoryUsage usage;
+        usage.name = features.name;
+        // Запись с блоком счётчиков ссылок (одно выделение); слот в
+        // сегменте учитывается в indices
+        size_t container = SHARED_CONTROL_BLOCK + sizeof(SnakeFeatures);
+        size_t allocator = MALLOC_OVERHEAD;
+
+        // Координаты точек; блок - вектор в make_shared
+        usage.keypoints = 2 * features.points.size() * sizeof(float);
+        if (features.points.storage() && blocks.insert(features.points.storage()).second) {
+            container += SHARED_CONTROL_BLOCK + sizeof(std::vector<float>);
+            allocator += 2 * MALLOC_OVERHEAD;
+        }
+
+        // Дескрипторы (полные и укороченные): данные + UMatData со счётчиком ссылок
+        for (const cv::Mat* data : { &features.descriptors, &features.projected }) {
+            if (data->empty()) continue;
+            usage.descriptors += data->total() * data->elemSize();
+            if (data->u && blocks.insert(data->u).second) {
+                container += sizeof(cv::UMatData);
+                allocator += 2 * MALLOC_OVERHEAD + MAT_ALIGN_OVERHEAD;
+            }
+        }
+
+        // Имя и пути к изображениям
+        usage.image_paths = heapStringBytes(features.name);
+        for (const auto& path : features.image_paths) {
+            size_t bytes = heapStringBytes(path);
+            usage.image_paths += bytes;
+            if (bytes > 0) allocator += MALLOC_OVERHEAD;
+        }
+        if (heapStringBytes(features.name) > 0) allocator += MALLOC_OVERHEAD;
+        if (features.image_paths.capacity() > 0) {
+            container += features.image_paths.capacity() * sizeof(std::string);
+            allocator += MALLOC_OVERHEAD;
+        }
+        if (features.image_starts.capacity() > 0) {
+            container += features.image_starts.capacity() * sizeof(int);
+            allocator += MALLOC_OVERHEAD;
+        }
+
+        usage.overhead = container + allocator;
+
+        report.keypoints += usage.keypoints;
+        report.descriptors += usage.descriptors;
+        report.image_paths += usage.image_paths;
+        report.container_overhead += container;
+        report.allocator_overhead += allocator;
+        report.snakes.push_back(usage);
+        });
+
+    // Сегменты: сигнатуры, ссылки на записи и надгробия - в том числе
+    // слоты удалённых записей до ближайшего уплотнения; таблицы номеров
+    // и имён - все когда-либо виденные имена
+    report.indices += snakes->memoryBytes();
+    report.container_overhead += SHARED_CONTROL_BLOCK + sizeof(SnakeSnapshot);
+    report.allocator_overhead += (snakes->slotCount() / IndexSegment::CAPACITY + 2) * MALLOC_OVERHEAD;
+
+    if (std::shared_ptr<const PQIndex> pq = pqIndex()) {
+        report.pq_index = pq->memoryBytes();
+    }
+
+    return report;
+}
+
+static std::string formatBytes(double bytes) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    if (bytes >= 1024.0 * 1024.0) out << bytes / (1024.0 * 1024.0) << " MB";
+    else if (bytes >= 1024.0) out << bytes / 1024.0 << " KB";
+    else out << std::setprecision(0) << bytes << " B";
+    return out.str();
+}
+
+std::string DatabaseMemoryReport::summary() const {
+    std::ostringstream out;
+    out << "Snakes: " << snakes.size() << "\n"
+        << "Keypoints: " << formatBytes(keypoints) << "\n"
+        << "Descriptors: " << formatBytes(descriptors) << "\n"
+        << "Names and image paths: " << formatBytes(image_paths) << "\n"
+        << "Indices: " << formatBytes(indices) << "\n"
+        << "PQ index: " << formatBytes(pq_index) << "\n"
+        << "Container overhead: " << formatBytes(container_overhead) << "\n"
+        << "Allocator overhead (estimate): " << formatBytes(allocator_overhead) << "\n"
+        << "Total: " << formatBytes(total())
+        << " (" << formatBytes(bytesPerSnake()) << " per snake)\n";
+    return out.str();
+}
+
 // Вспомогательные методы
-std::string SnakeDatabase::generateImagePath(const std::string& snake_name, int index) const {
-    return db_path_ + "/data/images/" + snake_name + "/photo_" + std::to_string(index) + ".jpg";
+
+std::string SnakeDatabase::pointsPath(const std::string& snake_name) const {
+    return db_path_ + "/data/points/" + snake_name + ".json";
 }
 
 json SnakeDatabase::featuresToJson(const SnakeFeatures& features) const {
     json j;
     j["name"] = features.name;
 
-    // Сохраняем ключевые точки
-    for (const auto& kp : features.keypoints) {
+    // Сохраняем координаты ключевых точек
+    j["keypoints"] = json::array();
+    for (size_t i = 0; i < features.points.size(); ++i) {
         j["keypoints"].push_back({
-            {"x", kp.pt.x},
-            {"y", kp.pt.y},
-            {"size", kp.size},
-            {"angle", kp.angle},
-            {"response", kp.response},
-            {"octave", kp.octave},
-            {"class_id", kp.class_id}
+            {"x", features.points.x()[i]},
+            {"y", features.points.y()[i]}
             });
     }
 
@@ -362,6 +1113,13 @@ json SnakeDatabase::featuresToJson(const SnakeFeatures& features) const {
         );
     }
     j["descriptors"] = descriptors_vec;
+    j["descriptor_format"] = descriptorFormatName(features.descriptor_format);
+    j["image_starts"] = features.image_starts;
+
+    j["signature"] = {
+        {"phash", features.signature.phash},
+        {"pooled", features.signature.pooled}
+    };
 
     return j;
 }
@@ -380,46 +1138,46 @@ SnakeFeatures SnakeDatabase::jsonToFeatures(const json& j) const
         features.name = j["name"].get<std::string>();
 
         // Чтение ключевых точек
-        if (j["keypoints"].is_array()) {
-            features.keypoints.clear();
-            for (const auto& kp_json : j["keypoints"]) {
-                cv::KeyPoint kp;
-                kp.pt.x = kp_json["x"].get<float>();
-                kp.pt.y = kp_json["y"].get<float>();
-                kp.size = kp_json["size"].get<float>();
-                kp.angle = kp_json["angle"].get<float>();
-                kp.response = kp_json["response"].get<float>();
-                kp.octave = kp_json["octave"].get<int>();
-                kp.class_id = kp_json["class_id"].get<int>();
-                features.keypoints.push_back(kp);
-            }
+        features.points = pointsFromJson(j["keypoints"]);
+
+        // Формат дескрипторов; в старых базах - float
+        std::string format_name = j.value("descriptor_format", std::string("f32"));
+        if (!parseDescriptorFormat(format_name, features.descriptor_format)) {
+            throw std::runtime_error("Unknown descriptor format: " + format_name);
         }
 
-        // Безопасное чтение дескрипторов
-        if (j["descriptors"].is_array()) {
-            auto descriptors_vec = j["descriptors"].get<std::vector<uint8_t>>();
-
-            // Проверяем размер дескрипторов (для SIFT обычно 128 элементов на ключевую точку)
-            if (!descriptors_vec.empty() && !features.keypoints.empty() &&
-                descriptors_vec.size() == features.keypoints.size() * 128)
-            {
-                features.descriptors = cv::Mat(
-                    features.keypoints.size(), // строки = количество ключевых точек
-                    128,                      // колонки = размер дескриптора (128 для SIFT)
-                    CV_32F,                   // тип данных
-                    cv::Scalar(0));           // инициализация нулями
-
-                // Копируем данные с проверкой
-                if (descriptors_vec.size() == features.descriptors.total() * features.descriptors.elemSize()) {
-                    std::memcpy(features.descriptors.data,
-                        descriptors_vec.data(),
-                        descriptors_vec.size());
-                }
-                else {
-                    throw std::runtime_error("Descriptor size mismatch");
-                }
+        // Безопасное чтение дескрипторов: по 128 элементов на ключевую точку
+        if (j["descriptors"].is_array() && !features.points.empty()) {
+            features.descriptors = descriptorsFromBytes(
+                j["descriptors"].get<std::vector<uint8_t>>(), features.descriptor_format);
+            if (!features.descriptors.empty() &&
+                features.descriptors.rows != static_cast<int>(features.points.size())) {
+                throw std::runtime_error("Descriptor size mismatch");
             }
         }
+
+        // Границы снимков; в старых базах признаки одного снимка
+        if (j.contains("image_starts")) {
+            features.image_starts = j["image_starts"].get<std::vector<int>>();
+        }
+        bool starts_valid = !features.image_starts.empty() && features.image_starts[0] == 0 &&
+            std::is_sorted(features.image_starts.begin(), features.image_starts.end()) &&
+            features.image_starts.back() <= features.descriptors.rows;
+        if (!starts_valid) {
+            features.image_starts.assign(1, 0);
+        }
+
+        // Базы, сохранённые до появления сигнатур: pooled восстанавливается
+        // из дескрипторов, pHash без изображения остаётся пустым
+        if (j.contains("signature")) {
+            features.signature.phash = j["signature"].value("phash", uint64_t(0));
+            features.signature.pooled =
+                j["signature"]["pooled"].get<std::array<uint64_t, POOLED_SIGNATURE_WORDS>>();
+        }
+        else {
+            features.signature.pooled = computePooledSignature(
+                decodeDescriptors(features.descriptors, features.descriptor_format));
+        }
     }
     catch (const json::exception& e) {
         std::cerr << "JSON error: " << e.what() << std::endl;
@@ -432,15 +1190,3 @@ SnakeFeatures SnakeDatabase::jsonToFeatures(const json& j) const
 
     return features;
 }
-
-bool SnakeDatabase::saveImage(const cv::Mat& image, const std::string& path) const {
-    if (image.empty()) {
-        return false;
-    }
-
-    std::vector<int> compression_params;
-    compression_params.push_back(cv::IMWRITE_JPEG_QUALITY);
-    compression_params.push_back(95);
-
-    return cv::imwrite(path, image, compression_params);
-}
\ No newline at end of file
@@ -2,23 +2,157 @@
 #define SNAKE_DATABASE_H
 
 #include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <vector>
+#include <condition_variable>
+#include <functional>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <nlohmann/json.hpp>
+#include "descriptor_pca.h"
+#include "descriptor_quantization.h"
+#include "feature_slab.h"
+#include "global_signature.h"
+#include "image_comparison.h"
+#include "image_io_service.h"
+#include "image_store.h"
+#include "pq_index.h"
+#include "snake_index.h"
+#include "startup_snapshot.h"
 
 using json = nlohmann::json;
 
+//    ( L2  ) 
+//        
+const float DESCRIPTOR_MERGE_DISTANCE = 80.0f;
+
 struct SnakeFeatures {
     std::string name;
-    std::vector<cv::KeyPoint> keypoints;
-    cv::Mat descriptors;
+    //    :  g  
+    // [image_starts[g], image_starts[g + 1]),  -  .
+    //  -  ;    ,  
+    // ,     (feature_slab.h)
+    PointSet points;
+    cv::Mat descriptors;            //   descriptor_format
+    DescriptorFormat descriptor_format;
+    //    PCA  (CV_32F,    ); ,
+    //   .     
+    cv::Mat projected;
+    std::vector<int> image_starts;
     std::vector<std::string> image_paths;
+    GlobalSignature signature;      //    
+    //      (descriptors ):  
+    //    , . SnakeDatabase::withDescriptors
+    bool descriptors_on_disk = false;
+    //  ,     descriptors (
+    //  ,   ): cv::Mat   
+    //    .  -    
+    std::shared_ptr<const void> mapping;
+
+    //    (matchFeatures)  
+    FeatureView view() const { return FeatureView(points, descriptors, projected); }
+
+    //      image_paths:  ,
+    //    ,    
+    std::string imagePath(int group) const {
+        size_t groups = std::max<size_t>(image_starts.size(), 1);
+        if (group < 0 || static_cast<size_t>(group) >= groups || image_paths.size() < groups) {
+            return image_paths.empty() ? std::string() : image_paths.back();
+        }
+        return image_paths[image_paths.size() - groups + group];
+    }
+};
+
+// ,    ()
+struct SnakeMemoryUsage {
+    std::string name;
+    size_t keypoints = 0;       //   
+    size_t descriptors = 0;     //  
+    size_t image_paths = 0;     //    
+    size_t overhead = 0;        //  ,  /Mat,  ,
+                                //    ()
+    size_t total() const { return keypoints + descriptors + image_paths + overhead; }
+};
+
+//     
+struct DatabaseMemoryReport {
+    std::vector<SnakeMemoryUsage> snakes;
+
+    //   
+    size_t keypoints = 0;
+    size_t descriptors = 0;
+    size_t image_paths = 0;
+    size_t indices = 0;             //  SnakeIndex   
+    size_t pq_index = 0;            //  PQ,  
+    size_t container_overhead = 0;  //    
+    size_t allocator_overhead = 0;  //      malloc ()
+
+    size_t total() const {
+        return keypoints + descriptors + image_paths + indices + pq_index +
+            container_overhead + allocator_overhead;
+    }
+    double bytesPerSnake() const {
+        return snakes.empty() ? 0.0 : static_cast<double>(total()) / snakes.size();
+    }
+
+    //     
+    std::string summary() const;
 };
 
+//          ;
+//        
+//   . ,  ,  
+//   ,      .
+//     (SnakeIndex):   
+// ,   .    
+// ,    .
 class SnakeDatabase {
 public:
     SnakeDatabase(const std::string& db_path = "snake_database");
+    ~SnakeDatabase();
+    SnakeDatabase(const SnakeDatabase&) = delete;
+    SnakeDatabase& operator=(const SnakeDatabase&) = delete;
+
+    //     : float ,  load(),
+    //    .    float
+    // SIFT    ;   -    
+    void setDescriptorFormat(const DescriptorFormat& format);
+    DescriptorFormat descriptorFormat() const;
+    //     format (  )
+    void convertDescriptors(const DescriptorFormat& format);
+
+    // false - load()      :  
+    //      .  ,  
+    //    ;     PQ
+    void setResidentDescriptors(bool resident);
+    //     :       ,
+    //     (   -  ).
+    //   :  ,  
+    // setDescriptorCacheBytes  
+    void setDescriptorCacheBytes(size_t bytes);
+    std::shared_ptr<const SnakeFeatures> withDescriptors(
+        const std::shared_ptr<const SnakeFeatures>& record) const;
+
+    //  PQ     (pq_index.h).  ,
+    //    meta.json     . ,
+    //     ,    -
+    //    ,    .  
+    //       ( recordStamp)
+    bool buildPQIndex(const PQIndexParams& params = PQIndexParams());
+    std::shared_ptr<const PQIndex> pqIndex() const;
+
+    //  PCA (descriptor_pca.h)  dims ,  
+    //  .    meta.json;   ,
+    //      ,   
+    //   . dims <= 0 -  
+    bool trainProjection(int dims, int max_samples = 65536);
+    std::shared_ptr<const DescriptorProjection> projection() const;
 
     //  
     bool addSnake(const std::string& name,
@@ -27,6 +161,8 @@ public:
         const cv::Mat& image);
 
     bool removeSnake(const std::string& name);
+    //    :     
+    //  ,    
     bool updateSnake(const std::string& name,
         const std::vector<cv::KeyPoint>& new_keypoints,
         const cv::Mat& new_descriptors,
@@ -38,29 +174,125 @@ public:
         double min_match_ratio = 0.3) const;
 
     //  
+    SnakeSnapshotPtr snapshot() const;
+    //  :     (, ,
+    // , , ,   PQ,  ).
+    //    ;      
+    //  
+    uint64_t version() const;
     std::vector<std::string> getAllSnakeNames() const;
-    SnakeFeatures getSnakeFeatures(const std::string& name) const;
-    cv::Mat getSnakeImage(const std::string& name, int index = 0) const;
+    //      (nullptr,   );
+    //    ,   withDescriptors
+    std::shared_ptr<const SnakeFeatures> getSnakeFeatures(const std::string& name) const;
+    // max_side > 0 -      : 
+    //     (image_store.h)
+    cv::Mat getSnakeImage(const std::string& name, int index = 0, int max_side = 0) const;
+
+    //   (image_paths)    (ImageStore) 
+    //     ImageIOService: addSnake/updateSnake
+    //     JPEG,  -  
+    //  
+    cv::Mat readImage(const std::string& path, int max_side = 0) const;
+    void prefetchImages(const std::vector<std::string>& paths, int max_side = 0) const;
+    //    ; false - -   ( 
+    //    ). addSnake/updateSnake     :
+    //    flushImages()  save()
+    bool flushImages() const;
+    ImageIOStats imageStats() const;
 
-    //   
+    //   . save()      snapshot.bin
+    // (startup_snapshot.h); load()  ,    
+    // meta.json,   meta.json   
     bool save() const;
     bool load();
+
+    //   :      
+    // ,    ,  ,  
+    //  PQ    .    
+    //         .
+    //   , warming() == true    : 
+    //  warming (SnakeIdentifier),     
+    //  . done(ok)    
+    void startLoad(std::function<void(bool)> done = nullptr);
+    bool warming() const;
+    //   ; false -   
+    bool waitWarm() const;
     bool exportTo(const std::string& file_path) const;
     bool importFrom(const std::string& file_path);
 
     // 
     size_t count() const;
     std::map<std::string, size_t> getStatistics() const;
+    DatabaseMemoryReport getMemoryReport() const;
+
+    //  :   ,  
+    //  ratio        min_slots
+    void setCompactionThreshold(double ratio, size_t min_slots = 256);
+    void compact();     // ,   
+    double tombstoneRatio() const;
 
 private:
     std::string db_path_;
-    std::map<std::string, SnakeFeatures> snakes_;
+    SnakeIndex index_;              //    write_mutex_
+    mutable std::mutex write_mutex_;
+    DescriptorFormat descriptor_format_;
+    bool resident_descriptors_ = true;
+
+    //  withDescriptors.  -   ; weak_ptr 
+    //    ,     
+    struct DescriptorCacheEntry {
+        const SnakeFeatures* key;
+        std::weak_ptr<const SnakeFeatures> source;
+        std::shared_ptr<const SnakeFeatures> loaded;
+    };
+    using DescriptorCacheList = std::list<DescriptorCacheEntry>;
+    mutable std::mutex descriptor_cache_mutex_;
+    mutable DescriptorCacheList descriptor_cache_;     //   -  
+    mutable std::unordered_map<const SnakeFeatures*, DescriptorCacheList::iterator> descriptor_cache_index_;
+    mutable size_t descriptor_cache_bytes_ = 0;
+    size_t max_descriptor_cache_bytes_ = 64 * 1024 * 1024;
+    std::shared_ptr<const PQIndex> pq_index_;   //   std::atomic_load/atomic_store
+    std::shared_ptr<const DescriptorProjection> projection_;    //  
+    mutable ImageIOService images_;
+    mutable ImageStore store_;          //   images_
+
+    //   startLoad
+    std::thread warmer_;
+    std::atomic<bool> warming_{ false };
+    bool warm_ok_ = true;
+    mutable std::mutex warm_mutex_;
+    mutable std::condition_variable warm_cv_;
+
+    //   (    )
+    std::thread compactor_;
+    std::condition_variable compact_cv_;
+    bool compact_requested_ = false;
+    bool stopping_ = false;
+    double compaction_ratio_ = 0.25;
+    size_t compaction_min_slots_ = 256;
 
     //  
-    std::string generateImagePath(const std::string& snake_name, int index) const;
+    void requestCompactionIfNeeded();   //  write_mutex_
+    void cacheDescriptors(const std::shared_ptr<const SnakeFeatures>& record,
+        const std::shared_ptr<const SnakeFeatures>& loaded) const;
+    void compactionLoop();
+    void compactLocked();               //  write_mutex_
+    //      (     )  
+    // meta.json;    ,  PQ   pq -
+    // publishLocked()       
+    bool readRecords(const std::shared_ptr<const StartupSnapshot>& startup,
+        std::vector<std::shared_ptr<SnakeFeatures>>& records, bool& from_startup,
+        std::shared_ptr<PQIndex>& pq);
+    void publishLocked(const std::vector<std::shared_ptr<SnakeFeatures>>& records, bool mapped,
+        std::shared_ptr<PQIndex> pq);
+    bool writeStartupSnapshotLocked() const;
+    std::shared_ptr<const StartupSnapshot> openStartupSnapshot() const;
+    std::string pointsPath(const std::string& snake_name) const;
+    void project(SnakeFeatures& features) const;
+    //  n-  ( float)  ,   max_samples
+    cv::Mat sampleDescriptors(const SnakeSnapshot& snakes, int max_samples) const;
     json featuresToJson(const SnakeFeatures& features) const;
     SnakeFeatures jsonToFeatures(const json& j) const;
-    bool saveImage(const cv::Mat& image, const std::string& path) const;
 };
 
 #endif // SNAKE_DATABASE_H
\ No newline at end of file
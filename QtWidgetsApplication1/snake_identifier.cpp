@@ -0,0 +1,318 @@
+﻿#include "snake_identifier.h"
+#include "parallel_for.h"
+#include "tracing.h"
+#include <deque>
+
+using namespace cv;
+
+static bool isCancelled(const std::atomic<bool>* cancel) {
+    return cancel && cancel->load(std::memory_order_relaxed);
+}
+
+static void report(const IdentificationProgress& progress,
+    IdentificationStage stage, size_t done, size_t total) {
+    if (progress) {
+        progress(stage, done, total);
+    }
+}
+
+// Сравнение запроса с одной записью базы - с лучшим из её снимков.
+// Доля совпадений считается относительно меньшего изображения
+struct CandidateScore {
+    int good_matches = 0;
+    float match_ratio = 0;
+    int image = -1;             // группа признаков лучшего снимка
+};
+
+static CandidateScore scoreCandidate(const FeaturePoints& query,
+    const SnakeFeatures& record, const IdentificationParams& params) {
+    SNAKE_TRACE_COUNTER("identify.snakes_scanned", 1);
+    CandidateScore score;
+    if (record.descriptors.empty()) return score;   // не прочитались с диска
+    MatchResult match = matchFeaturesGrouped(query, record.view(), record.image_starts,
+        cv::NORM_L2, params.good_match_threshold,
+        params.use_homography, params.ransac_threshold, &score.image);
+    if (score.image < 0) return score;
+
+    size_t begin = record.image_starts.empty() ? 0 : record.image_starts[score.image];
+    size_t end = static_cast<size_t>(score.image) + 1 < record.image_starts.size() ?
+        record.image_starts[score.image + 1] : record.points.size();
+    size_t minFeatures = std::min(query.keypoints.size(), end - begin);
+
+    score.good_matches = match.good_matches;
+    score.match_ratio = minFeatures > 0 ? (float)match.good_matches / minFeatures : 0;
+    return score;
+}
+
+// Критерии принятия решения: кандидат проходит пороги и лучше текущего
+static void considerCandidate(IdentificationResult& result, const SnakeFeatures& record,
+    const CandidateScore& score, const IdentificationParams& params) {
+    if (score.good_matches >= params.min_good_matches &&
+        score.match_ratio >= params.min_match_ratio &&
+        score.match_ratio > result.match_ratio)
+    {
+        result.found = true;
+        result.name = record.name;
+        result.matched_image_path = record.imagePath(score.image);
+        result.good_matches = score.good_matches;
+        result.match_ratio = score.match_ratio;
+    }
+}
+
+static bool hasFeatures(const SnakeFeatures& record) {
+    return !record.points.empty() &&
+        (!record.descriptors.empty() || record.descriptors_on_disk);
+}
+
+// Запрос в форматах хранения записей базы (descriptor_quantization.h):
+// кодируется один раз на встреченный формат. get() для нового формата
+// меняет объект, поэтому перед параллельным проходом форматы готовятся
+// в одном потоке, а потоки потом только читают
+class QueryEncodings {
+public:
+    explicit QueryEncodings(const FeaturePoints& query) : query_(&query) {}
+
+    const FeaturePoints& get(const DescriptorFormat& format) {
+        if (format.isDefault()) return *query_;
+        for (const auto& variant : variants_) {
+            if (variant.first == format) return variant.second;
+        }
+        SNAKE_TRACE_SCOPE("identify.encode_query");
+        FeaturePoints encoded;
+        encoded.keypoints = query_->keypoints;
+        encoded.descriptors = encodeDescriptors(query_->descriptors, format);
+        encoded.processing_time = query_->processing_time;
+        encoded.projected = query_->projected;
+        variants_.emplace_back(format, std::move(encoded));
+        return variants_.back().second;
+    }
+
+private:
+    const FeaturePoints* query_;
+    std::deque<std::pair<DescriptorFormat, FeaturePoints>> variants_;   // ссылки не переезжают
+};
+
+// Запрос с укороченными дескрипторами, если у базы есть проекция PCA
+static FeaturePoints withProjection(const FeaturePoints& query, const SnakeDatabase& database) {
+    FeaturePoints projected = query;
+    if (std::shared_ptr<const DescriptorProjection> reduction = database.projection()) {
+        projected.projected = reduction->project(query.descriptors);
+    }
+    return projected;
+}
+
+
+// Кандидаты по голосам индекса PQ: pq_candidates записей с наибольшим
+// числом голосов и все записи, которых индекс не покрывает (добавлены или
+// изменены после его построения). Голоса в счёт только у записей снимка,
+// покрытых в нынешнем виде: коды удалённых и прежних записей (владелец PQ -
+// номер змеи, SnakeId, отпечаток - recordStamp) места не занимают.
+// Слоты - в порядке снимка
+static std::vector<size_t> selectByVotes(const SnakeSnapshot& snapshot, const PQIndex& pq,
+    const FeaturePoints& query, const IdentificationParams& params) {
+    SNAKE_TRACE_SCOPE("identify.pq_vote");
+    std::vector<uint32_t> votes = pq.vote(query.descriptors, params.pq_neighbours, params.pq_probes);
+
+    std::vector<size_t> slots;
+    std::vector<size_t> covered;
+    snapshot.forEach([&](size_t slot, const SnakeFeatures&) {
+        SnakeId owner = snapshot.id(slot);
+        if (owner < votes.size() && pq.ownerStamp(owner) == snapshot.stamp(slot)) {
+            covered.push_back(slot);
+        }
+        else {
+            slots.push_back(slot);
+        }
+        });
+
+    auto votesOf = [&](size_t slot) { return votes[snapshot.id(slot)]; };
+    size_t k = std::min(params.pq_candidates, covered.size());
+    std::partial_sort(covered.begin(), covered.begin() + k, covered.end(), [&](size_t a, size_t b) {
+        return votesOf(a) != votesOf(b) ? votesOf(a) > votesOf(b) : a < b;
+        });
+    for (size_t i = 0; i < k && votesOf(covered[i]) > 0; ++i) {
+        slots.push_back(covered[i]);
+    }
+    std::sort(slots.begin(), slots.end());
+    return slots;
+}
+
+// Кандидаты для полного сопоставления: по голосам индекса PQ, если он
+// есть, иначе ближайшие по глобальной сигнатуре (params.prefilter_candidates)
+// или все записи, если отбор выключен
+static std::vector<size_t> selectCandidates(const SnakeSnapshot& snapshot, const PQIndex* pq,
+    const FeaturePoints& query, const IdentificationParams& params) {
+    if (pq && params.pq_candidates > 0 && snapshot.size() > params.pq_candidates) {
+        return selectByVotes(snapshot, *pq, query, params);
+    }
+    if (params.prefilter_candidates == 0 || snapshot.size() <= params.prefilter_candidates) {
+        return snapshot.shortlist({}, 0);
+    }
+    SNAKE_TRACE_SCOPE("identify.prefilter");
+    return snapshot.shortlist(computePooledSignature(query.descriptors), params.prefilter_candidates);
+}
+
+IdentificationResult SnakeIdentifier::identify(const Mat& image,
+    const SnakeDatabase& database,
+    const IdentificationParams& params,
+    const IdentificationProgress& progress,
+    const std::atomic<bool>* cancel) {
+    SNAKE_TRACE_SCOPE("identify.total");
+    IdentificationResult result;
+
+    // Предобработка
+    report(progress, IdentificationStage::Preprocessing, 0, 1);
+    Mat foregroundMask;
+    Mat processed = ImagePreprocessor::preprocess(image,
+        params.enhance_scales, params.remove_background,
+        params.preprocessing_level, &foregroundMask);
+    if (isCancelled(cancel)) {
+        result.cancelled = true;
+        return result;
+    }
+
+    // Извлечение ключевых точек (только на переднем плане)
+    report(progress, IdentificationStage::Extraction, 0, 1);
+    FeaturePoints features = detectSIFTFeatures(processed, foregroundMask);
+    if (isCancelled(cancel)) {
+        result.cancelled = true;
+        return result;
+    }
+
+    // Поиск в базе данных
+    result = match(features, database, params, progress, cancel);
+    result.processed_image = processed;
+    result.features = features;
+    return result;
+}
+
+IdentificationResult SnakeIdentifier::match(const FeaturePoints& query,
+    const SnakeDatabase& database,
+    const IdentificationParams& params,
+    const IdentificationProgress& progress,
+    const std::atomic<bool>* cancel,
+    bool read_matched_image) {
+    SNAKE_TRACE_SCOPE("identify.match");
+    IdentificationResult result;
+    if (database.warming()) {
+        result.warming = true;
+        return result;
+    }
+
+    // Весь поиск идёт по одному снимку: параллельное пополнение базы
+    // не меняет набор кандидатов посреди прохода
+    SnakeSnapshotPtr snapshot = database.snapshot();
+    std::shared_ptr<const PQIndex> pq = database.pqIndex();
+    std::vector<size_t> candidates = selectCandidates(*snapshot, pq.get(), query, params);
+    report(progress, IdentificationStage::Matching, 0, candidates.size());
+
+    FeaturePoints projected_query = withProjection(query, database);
+    QueryEncodings encodings(projected_query);
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (isCancelled(cancel)) {
+            result.cancelled = true;
+            return result;
+        }
+
+        const SnakeFeatures& stored = *snapshot->record(candidates[i]);
+
+        // Пропускаем пустые записи; дескрипторы кандидата - с диска, если
+        // база держит их там
+        if (hasFeatures(stored)) {
+            std::shared_ptr<const SnakeFeatures> record = database.withDescriptors(snapshot->record(candidates[i]));
+            const SnakeFeatures& dbFeatures = *record;
+            considerCandidate(result, dbFeatures, scoreCandidate(
+                encodings.get(dbFeatures.descriptor_format), dbFeatures, params), params);
+        }
+
+        report(progress, IdentificationStage::Matching, i + 1, candidates.size());
+    }
+
+    // Изображение читаем один раз - только лучший снимок лучшего кандидата,
+    // когда он окончательно известен (предзагрузка промежуточных лидеров
+    // декодировала бы фото, которые потом выбрасываются)
+    if (read_matched_image) {
+        SNAKE_TRACE_SCOPE("db.read_image");
+        result.matched_image = database.readImage(result.matched_image_path,
+            params.matched_image_side);
+    }
+
+    report(progress, IdentificationStage::Done, 1, 1);
+    return result;
+}
+
+std::vector<IdentificationResult> SnakeIdentifier::matchBatch(
+    const std::vector<FeaturePoints>& queries,
+    const SnakeDatabase& database,
+    const IdentificationParams& params,
+    int threads,
+    bool read_matched_images) {
+    SNAKE_TRACE_SCOPE("identify.match_batch");
+    std::vector<IdentificationResult> results(queries.size());
+    if (queries.empty()) return results;
+    if (database.warming()) {
+        for (auto& result : results) result.warming = true;
+        return results;
+    }
+
+    SnakeSnapshotPtr snapshot = database.snapshot();
+    std::shared_ptr<const PQIndex> pq = database.pqIndex();
+    const size_t slot_count = snapshot->slotCount();
+
+    // Для каждого слота - запросы пакета, в чей список кандидатов он попал
+    const size_t batch = queries.size();
+    std::vector<std::vector<size_t>> wanted(slot_count);
+    std::vector<FeaturePoints> projected_queries;
+    projected_queries.reserve(batch);
+    std::vector<QueryEncodings> encodings;
+    encodings.reserve(batch);
+    for (size_t q = 0; q < batch; ++q) {
+        projected_queries.push_back(withProjection(queries[q], database));
+        encodings.emplace_back(projected_queries.back());
+        if (queries[q].keypoints.empty() || queries[q].descriptors.empty()) continue;
+        for (size_t r : selectCandidates(*snapshot, pq.get(), queries[q], params)) {
+            const SnakeFeatures& record = *snapshot->record(r);
+            if (!hasFeatures(record)) continue;
+            wanted[r].push_back(q);
+            encodings[q].get(record.descriptor_format);
+        }
+    }
+
+    // Оценки [запись][запрос]: запись обрабатывается одним потоком для всех
+    // запросов пакета, пока её дескрипторы горячие в кэше. Непроверенные
+    // пары остаются нулевыми и не проходят критерии решения
+    std::vector<CandidateScore> scores(slot_count * batch);
+    parallelFor(slot_count, threads, [&](size_t r) {
+        if (wanted[r].empty()) return;
+        // Дескрипторы с диска читаются один раз на запись для всего пакета
+        std::shared_ptr<const SnakeFeatures> loaded = database.withDescriptors(snapshot->record(r));
+        const SnakeFeatures& record = *loaded;
+        for (size_t q : wanted[r]) {
+            scores[r * batch + q] = scoreCandidate(
+                encodings[q].get(record.descriptor_format), record, params);
+        }
+        });
+
+    // Сведение в порядке снимка - тот же выбор, что и у match()
+    for (size_t r = 0; r < slot_count; ++r) {
+        for (size_t q : wanted[r]) {
+            considerCandidate(results[q], *snapshot->record(r), scores[r * batch + q], params);
+        }
+    }
+
+    if (read_matched_images) {
+        SNAKE_TRACE_SCOPE("db.read_image");
+        // Выбор окончательный: фоновый поток декодирует следующие фото,
+        // пока здесь читают первое (ещё не начатое чтение read() забирает себе)
+        std::vector<std::string> paths;
+        for (const auto& r : results) {
+            if (r.found) paths.push_back(r.matched_image_path);
+        }
+        database.prefetchImages(paths, params.matched_image_side);
+        for (size_t q = 0; q < batch; ++q) {
+            results[q].matched_image = database.readImage(results[q].matched_image_path,
+                params.matched_image_side);
+        }
+    }
+    return results;
+}
@@ -0,0 +1,102 @@
+﻿#ifndef SNAKE_IDENTIFIER_H
+#define SNAKE_IDENTIFIER_H
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include "image_comparison.h"
+#include "image_preprocessing.h"
+#include "snake_database.h"
+
+// Параметры поиска змеи в базе
+struct IdentificationParams {
+    bool enhance_scales = true;
+    bool remove_background = true;
+    int preprocessing_level = 3;
+
+    int min_good_matches = 8;           // Минимальное количество совпадений
+    float min_match_ratio = 0.1f;       // Минимальная доля совпадений
+    float good_match_threshold = 0.7f;  // Порог для соотношения расстояний
+    bool use_homography = true;         // Фильтр выбросов RANSAC
+    double ransac_threshold = RANSAC_THRESHOLD;
+
+    // Полное сопоставление только с ближайшими по глобальной сигнатуре
+    // записями (global_signature.h); 0 - сравнивать со всей базой. По
+    // умолчанию выключено: отбор может потерять верную запись, включать
+    // его - после проверки полноты на своих данных (snake_sweep --prefilter-k)
+    size_t prefilter_candidates = 0;
+
+    // Если у базы построен индекс PQ (SnakeDatabase::buildPQIndex), кандидаты -
+    // pq_candidates записей, за которые проголосовало больше всего
+    // дескрипторов запроса; отбор по сигнатуре тогда не используется.
+    // 0 - индекс не использовать
+    size_t pq_candidates = 16;
+    int pq_probes = 8;          // просматриваемых списков индекса на дескриптор
+    int pq_neighbours = 4;      // соседей, за владельцев которых голосует дескриптор
+
+    // Большая сторона matched_image: читается наименьшая достаточная
+    // уменьшенная копия из хранилища фото (image_store.h); 0 - оригинал
+    int matched_image_side = 0;
+};
+
+struct IdentificationResult {
+    bool found = false;
+    bool cancelled = false;
+    // База ещё прогревается (SnakeDatabase::startLoad): поиск не выполнялся,
+    // found == false ничего не говорит о змее
+    bool warming = false;
+    std::string name;
+    int good_matches = 0;
+    float match_ratio = 0;
+
+    cv::Mat processed_image;
+    FeaturePoints features;
+    std::string matched_image_path;     // снимок записи, давший лучшее совпадение
+    cv::Mat matched_image;
+};
+
+enum class IdentificationStage {
+    Preprocessing,
+    Extraction,
+    Matching,
+    Done
+};
+
+// done/total - прогресс внутри этапа (для Matching - число проверенных змей)
+using IdentificationProgress =
+    std::function<void(IdentificationStage stage, size_t done, size_t total)>;
+
+class SnakeIdentifier {
+public:
+    // Полный цикл: предобработка, извлечение SIFT, поиск по базе.
+    // cancel проверяется между этапами и после каждой змеи.
+    static IdentificationResult identify(const cv::Mat& image,
+        const SnakeDatabase& database,
+        const IdentificationParams& params = IdentificationParams(),
+        const IdentificationProgress& progress = nullptr,
+        const std::atomic<bool>* cancel = nullptr);
+
+    // Только поиск по базе для уже извлечённых признаков.
+    // read_matched_image == false - matched_image не читается (пакетная
+    // обработка, где нужен только ответ, а не фото)
+    static IdentificationResult match(const FeaturePoints& query,
+        const SnakeDatabase& database,
+        const IdentificationParams& params = IdentificationParams(),
+        const IdentificationProgress& progress = nullptr,
+        const std::atomic<bool>* cancel = nullptr,
+        bool read_matched_image = true);
+
+    // Поиск пакета запросов за один проход по снимку базы: каждая запись
+    // сравнивается со всеми запросами подряд. Результат i - для queries[i],
+    // выбор кандидата совпадает с match(). threads <= 0 - все ядра.
+    static std::vector<IdentificationResult> matchBatch(
+        const std::vector<FeaturePoints>& queries,
+        const SnakeDatabase& database,
+        const IdentificationParams& params = IdentificationParams(),
+        int threads = 0,
+        bool read_matched_images = true);
+};
+
+#endif // SNAKE_IDENTIFIER_H
@@ -0,0 +1,313 @@
+﻿#include "snake_index.h"
+#include "snake_database.h"
+#include "tracing.h"
+#include <algorithm>
+
+// FNV-1a, 64 бита
+static uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 1469598103934665603ULL) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64_t recordStamp(const SnakeFeatures& record) {
+    uint64_t points = record.points.size();
+    uint64_t hash = fnv1a(&points, sizeof(points));
+    for (const auto& path : record.image_paths) {
+        // Длина перед строкой: ("ab", "c") и ("a", "bc") различаются
+        uint64_t length = path.size();
+        hash = fnv1a(&length, sizeof(length), hash);
+        hash = fnv1a(path.data(), path.size(), hash);
+    }
+    return hash != 0 ? hash : 1;
+}
+
+NameTable::NameTable(size_t capacity)
+    : capacity_(capacity)
+    , entries_(new Entry[capacity])
+    , names_(std::make_shared<std::deque<std::string>>()) {
+}
+
+SnakeId NameTable::find(const std::string& name) const {
+    size_t mask = capacity_ - 1;
+    for (size_t i = std::hash<std::string>()(name) & mask;; i = (i + 1) & mask) {
+        const std::string* stored = entries_[i].name.load(std::memory_order_acquire);
+        if (!stored) return NO_SNAKE;
+        if (*stored == name) return entries_[i].id;
+    }
+}
+
+void NameTable::place(const std::string* name, SnakeId id) {
+    size_t mask = capacity_ - 1;
+    size_t i = std::hash<std::string>()(*name) & mask;
+    while (entries_[i].name.load(std::memory_order_relaxed)) i = (i + 1) & mask;
+    entries_[i].id = id;
+    entries_[i].name.store(name, std::memory_order_release);
+}
+
+SnakeId NameTable::insert(const std::string& name) {
+    SnakeId id = static_cast<SnakeId>(names_->size());
+    // Элементы deque при дописывании не переезжают
+    names_->push_back(name);
+    name_bytes_ += sizeof(std::string) + names_->back().capacity();
+    place(&names_->back(), id);
+    return id;
+}
+
+std::shared_ptr<NameTable> NameTable::grown() const {
+    auto table = std::make_shared<NameTable>(capacity_ * 2);
+    table->names_ = names_;
+    table->name_bytes_ = name_bytes_;
+    for (size_t id = 0; id < names_->size(); ++id) {
+        table->place(&(*names_)[id], static_cast<SnakeId>(id));
+    }
+    return table;
+}
+
+SnakeSnapshot::SnakeSnapshot()
+    : segments_(std::make_shared<const SegmentList>())
+    , id_slots_(std::make_shared<const IdSlotList>())
+    , names_(std::make_shared<const NameTable>()) {
+}
+
+SnakeSnapshot::SnakeSnapshot(std::shared_ptr<const SegmentList> segments,
+    std::shared_ptr<const IdSlotList> id_slots, std::shared_ptr<const NameTable> names,
+    size_t names_bytes, size_t slots, size_t live, uint64_t version)
+    : segments_(std::move(segments))
+    , id_slots_(std::move(id_slots))
+    , names_(std::move(names))
+    , names_bytes_(names_bytes)
+    , slots_(slots)
+    , live_(live)
+    , version_(version) {
+}
+
+// Таблица имён общая с писателем и может знать имена новее снимка: их
+// номерам в снимке не найдётся живого слота
+std::shared_ptr<const SnakeFeatures> SnakeSnapshot::find(const std::string& name) const {
+    SnakeId id = names_->find(name);
+    return id == NO_SNAKE ? nullptr : find(id);
+}
+
+// Слоты одного номера только дописываются, и прежний слот получает
+// надгробие с версией публикации нового. Поэтому если latest попал в
+// снимок, более ранние слоты в нём уже мертвы, и ответ - latest или ничего
+size_t SnakeSnapshot::slotOf(SnakeId id) const {
+    if (id / IdSlots::CAPACITY >= id_slots_->size()) return NO_SLOT;
+    const IdSlots& slots = *(*id_slots_)[id / IdSlots::CAPACITY];
+    size_t offset = id % IdSlots::CAPACITY;
+    size_t latest = slots.latest[offset].load(std::memory_order_acquire);
+    if (latest == NO_SLOT) return NO_SLOT;
+    if (latest < slots_) return alive(latest) ? latest : NO_SLOT;
+
+    // Запись переписана после публикации снимка
+    size_t previous = slots.previous[offset].load(std::memory_order_acquire);
+    if (previous == NO_SLOT) return NO_SLOT;
+    if (previous < slots_) return alive(previous) ? previous : NO_SLOT;
+    return scanSlot(id);
+}
+
+size_t SnakeSnapshot::scanSlot(SnakeId id) const {
+    for (size_t first = 0; first < slots_; first += IndexSegment::CAPACITY) {
+        const IndexSegment& current = segment(first);
+        size_t count = std::min(IndexSegment::CAPACITY, slots_ - first);
+        for (size_t i = 0; i < count; ++i) {
+            if (current.ids[i] == id && alive(first + i)) return first + i;
+        }
+    }
+    return NO_SLOT;
+}
+
+std::shared_ptr<const SnakeFeatures> SnakeSnapshot::find(SnakeId id) const {
+    size_t slot = slotOf(id);
+    return slot == NO_SLOT ? nullptr : record(slot);
+}
+
+std::vector<size_t> SnakeSnapshot::shortlist(const PooledSignature& query, size_t k) const {
+    std::vector<int> distances(slots_);
+    bool rank = k > 0 && k < live_ && (query[0] != 0 || query[1] != 0);
+    if (rank) {
+        SNAKE_TRACE_SCOPE("signature.scan");
+        for (size_t first = 0; first < slots_; first += IndexSegment::CAPACITY) {
+            size_t count = std::min(IndexSegment::CAPACITY, slots_ - first);
+            scanSignatures(segment(first).words, count, query, &distances[first]);
+        }
+    }
+
+    for (size_t slot = 0; slot < slots_; ++slot) {
+        if (!alive(slot)) {
+            distances[slot] = SIGNATURE_SKIP;
+        }
+        else if (rank && !record(slot)->signature.hasPooled()) {
+            // Записи из старой базы без сигнатуры ранжировать не по чему
+            distances[slot] = SIGNATURE_UNRANKED;
+        }
+    }
+
+    std::vector<size_t> selected = selectNearest(distances, rank ? k : 0);
+    SNAKE_TRACE_COUNTER("signature.shortlisted", selected.size());
+    return selected;
+}
+
+size_t SnakeSnapshot::memoryBytes() const {
+    return segments_->size() * sizeof(IndexSegment) +
+        segments_->capacity() * sizeof(std::shared_ptr<IndexSegment>) +
+        id_slots_->size() * sizeof(IdSlots) +
+        id_slots_->capacity() * sizeof(std::shared_ptr<IdSlots>) +
+        names_bytes_;
+}
+
+SnakeIndex::SnakeIndex()
+    : segments_(std::make_shared<SegmentList>())
+    , id_slots_(std::make_shared<IdSlotList>())
+    , names_(std::make_shared<NameTable>())
+    , snapshot_(std::make_shared<const SnakeSnapshot>()) {
+}
+
+SnakeSnapshotPtr SnakeIndex::snapshot() const {
+    return std::atomic_load(&snapshot_);
+}
+
+std::shared_ptr<const SnakeFeatures> SnakeIndex::find(const std::string& name) const {
+    SnakeId found = id(name);
+    size_t slot = found == NO_SNAKE ? NO_SLOT : liveSlot(found);
+    if (slot == NO_SLOT) return nullptr;
+    return (*segments_)[slot / IndexSegment::CAPACITY]->records[slot % IndexSegment::CAPACITY];
+}
+
+SnakeId SnakeIndex::id(const std::string& name) const {
+    return names_->find(name);
+}
+
+SnakeId SnakeIndex::intern(const std::string& name) {
+    SnakeId id = names_->find(name);
+    if (id != NO_SNAKE) return id;
+    if (names_->full()) names_ = names_->grown();
+    id = names_->insert(name);
+    reserveIds(names_->size());
+    return id;
+}
+
+// Новый блок номеров - копия списка указателей, как в append()
+void SnakeIndex::reserveIds(size_t count) {
+    if (id_slots_->size() * IdSlots::CAPACITY >= count) return;
+    auto grown = std::make_shared<IdSlotList>(*id_slots_);
+    while (grown->size() * IdSlots::CAPACITY < count) {
+        grown->push_back(std::make_shared<IdSlots>());
+    }
+    id_slots_ = std::move(grown);
+}
+
+size_t SnakeIndex::liveSlot(SnakeId id) const {
+    size_t slot = (*id_slots_)[id / IdSlots::CAPACITY]->latest[id % IdSlots::CAPACITY]
+        .load(std::memory_order_relaxed);
+    if (slot == NO_SLOT) return NO_SLOT;
+    uint64_t removed_at = (*segments_)[slot / IndexSegment::CAPACITY]
+        ->removed_at[slot % IndexSegment::CAPACITY].load(std::memory_order_relaxed);
+    return removed_at == IndexSegment::ALIVE ? slot : NO_SLOT;
+}
+
+// Надгробие на текущем слоте записи с номером id, если она есть
+void SnakeIndex::tombstone(SnakeId id, uint64_t removed_at) {
+    size_t slot = liveSlot(id);
+    if (slot == NO_SLOT) return;
+    (*segments_)[slot / IndexSegment::CAPACITY]
+        ->removed_at[slot % IndexSegment::CAPACITY]
+        .store(removed_at, std::memory_order_release);
+    --live_;
+}
+
+void SnakeIndex::put(std::shared_ptr<const SnakeFeatures> record) {
+    SNAKE_TRACE_SCOPE("index.put");
+    // Надгробие ставится с версией следующей публикации: уже выданные
+    // снимки продолжают видеть старую запись
+    tombstone(intern(record->name), version_ + 1);
+    append(std::move(record));
+    publish();
+}
+
+bool SnakeIndex::remove(const std::string& name) {
+    SNAKE_TRACE_SCOPE("index.remove");
+    SnakeId found = id(name);
+    if (found == NO_SNAKE || liveSlot(found) == NO_SLOT) return false;
+
+    tombstone(found, version_ + 1);
+    publish();
+    return true;
+}
+
+void SnakeIndex::reset(const std::vector<std::shared_ptr<const SnakeFeatures>>& records) {
+    SNAKE_TRACE_SCOPE("index.reset");
+    rebuild(records);
+    publish();
+}
+
+void SnakeIndex::relayout(const std::vector<std::shared_ptr<const SnakeFeatures>>& records) {
+    SNAKE_TRACE_SCOPE("index.relayout");
+    rebuild(records);
+    publish(false);
+}
+
+void SnakeIndex::bumpVersion() {
+    publish();
+}
+
+void SnakeIndex::rebuild(const std::vector<std::shared_ptr<const SnakeFeatures>>& records) {
+    segments_ = std::make_shared<SegmentList>();
+    id_slots_ = std::make_shared<IdSlotList>();
+    reserveIds(names_->size());
+    slots_ = 0;
+    live_ = 0;
+    for (const auto& record : records) {
+        // Повтор имени в загружаемых данных: побеждает последняя запись
+        tombstone(intern(record->name), 0);
+        append(record);
+    }
+}
+
+void SnakeIndex::compact() {
+    SNAKE_TRACE_SCOPE("index.compact");
+    SnakeSnapshotPtr current = snapshot();
+    std::vector<std::shared_ptr<const SnakeFeatures>> live;
+    live.reserve(current->size());
+    current->forEach([&](size_t slot, const SnakeFeatures&) {
+        live.push_back(current->record(slot));
+        });
+    relayout(live);
+}
+
+// Новый сегмент - копия списка указателей на сегменты (не самих данных):
+// список, который держат выданные снимки, не меняется
+void SnakeIndex::append(std::shared_ptr<const SnakeFeatures> record) {
+    size_t segment_index = slots_ / IndexSegment::CAPACITY;
+    if (segment_index == segments_->size()) {
+        auto grown = std::make_shared<SegmentList>(*segments_);
+        grown->push_back(std::make_shared<IndexSegment>());
+        segments_ = std::move(grown);
+    }
+
+    IndexSegment& segment = *(*segments_)[segment_index];
+    size_t offset = slots_ % IndexSegment::CAPACITY;
+    std::copy(record->signature.pooled.begin(), record->signature.pooled.end(),
+        segment.words + offset * POOLED_SIGNATURE_WORDS);
+    SnakeId id = intern(record->name);
+    segment.ids[offset] = id;
+    segment.stamps[offset] = recordStamp(*record);
+    IdSlots& slots = idSlots(id);
+    size_t id_offset = id % IdSlots::CAPACITY;
+    slots.previous[id_offset].store(slots.latest[id_offset].load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
+    slots.latest[id_offset].store(slots_, std::memory_order_release);
+    ++live_;
+    segment.records[offset] = std::move(record);
+    ++slots_;
+}
+
+void SnakeIndex::publish(bool changed) {
+    if (changed) ++version_;
+    std::atomic_store(&snapshot_, std::make_shared<const SnakeSnapshot>(
+        segments_, id_slots_, names_, names_->memoryBytes(), slots_, live_, version_));
+}
@@ -0,0 +1,234 @@
+﻿#ifndef SNAKE_INDEX_H
+#define SNAKE_INDEX_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "global_signature.h"
+
+struct SnakeFeatures;
+
+// Плотный номер змеи: имя получает номер при первом появлении в индексе
+// и сохраняет его после обновлений, удаления и уплотнения
+using SnakeId = uint32_t;
+const SnakeId NO_SNAKE = UINT32_MAX;
+const size_t NO_SLOT = SIZE_MAX;
+
+// Отпечаток содержимого записи: пути её фото и число точек. Меняется,
+// когда под именем оказываются другие признаки (добавлен снимок, запись
+// удалена и добавлена по другому фото), и не зависит от процесса -
+// индекс PQ хранит его, чтобы не верить кодам прежней записи. Не 0
+uint64_t recordStamp(const SnakeFeatures& record);
+
+// Сегмент хранилища записей базы. Слоты только дописываются, поэтому уже
+// опубликованные слоты читаются без блокировок, пока писатель заполняет
+// следующие. Удаление - надгробие: номер версии, с которой запись не видна.
+struct IndexSegment {
+    static constexpr size_t CAPACITY = 1024;
+    static constexpr uint64_t ALIVE = UINT64_MAX;
+
+    // Глобальные сигнатуры слотов подряд - для просмотра scanSignatures
+    uint64_t words[CAPACITY * POOLED_SIGNATURE_WORDS] = {};
+    SnakeId ids[CAPACITY] = {};
+    uint64_t stamps[CAPACITY] = {};     // recordStamp() записей
+    std::shared_ptr<const SnakeFeatures> records[CAPACITY];
+    std::atomic<uint64_t> removed_at[CAPACITY];
+
+    IndexSegment() {
+        for (auto& r : removed_at) r.store(ALIVE, std::memory_order_relaxed);
+    }
+};
+
+using SegmentList = std::vector<std::shared_ptr<IndexSegment>>;
+
+// Слоты номеров змей, блоками по CAPACITY номеров. latest - последний
+// слот, куда писалась запись с этим номером (после удаления - тот же, с
+// надгробием), previous - слот до него. Писатель меняет значения на месте,
+// поэтому снимок, опубликованный раньше изменения, видит latest за своими
+// слотами и берёт previous (см. SnakeSnapshot::slotOf)
+struct IdSlots {
+    static constexpr size_t CAPACITY = 1024;
+
+    std::atomic<size_t> latest[CAPACITY];
+    std::atomic<size_t> previous[CAPACITY];
+
+    IdSlots() {
+        for (auto& s : latest) s.store(NO_SLOT, std::memory_order_relaxed);
+        for (auto& s : previous) s.store(NO_SLOT, std::memory_order_relaxed);
+    }
+};
+
+using IdSlotList = std::vector<std::shared_ptr<IdSlots>>;
+
+// Номера имён для поиска без блокировок: открытая адресация, имена только
+// добавляются. Пишет один поток (писатель SnakeIndex); заполненную
+// наполовину таблицу он заменяет вдвое большей (grown), а прежнюю
+// дочитывают снимки, которые её держат. Строки имён общие у всех
+// поколений таблицы и не переезжают. Читателям доступен только find():
+// список имён писатель в это время дописывает
+class NameTable {
+public:
+    explicit NameTable(size_t capacity = 1024);
+
+    SnakeId find(const std::string& name) const;    // NO_SNAKE, если нет
+
+    // Только писатель; снимок запоминает memoryBytes() при публикации
+    size_t size() const { return names_->size(); }
+    size_t memoryBytes() const { return capacity_ * sizeof(Entry) + name_bytes_; }
+
+    // Только писатель. Новое имя получает номер size(); при full() -
+    // сначала grown()
+    SnakeId insert(const std::string& name);
+    bool full() const { return (names_->size() + 1) * 2 > capacity_; }
+    std::shared_ptr<NameTable> grown() const;
+
+private:
+    struct Entry {
+        std::atomic<const std::string*> name{ nullptr };   // публикуется последним
+        SnakeId id = NO_SNAKE;
+    };
+
+    void place(const std::string* name, SnakeId id);
+
+    size_t capacity_;       // степень двойки
+    std::unique_ptr<Entry[]> entries_;
+    std::shared_ptr<std::deque<std::string>> names_;    // по номерам
+    size_t name_bytes_ = 0;     // строки names_, считаются при insert
+};
+
+// Неизменяемый снимок базы версии version(): первые slotCount() слотов
+// сегментов, из них видны записи, не удалённые к этой версии. Порядок
+// слотов - порядок добавления.
+class SnakeSnapshot {
+public:
+    SnakeSnapshot();
+    SnakeSnapshot(std::shared_ptr<const SegmentList> segments,
+        std::shared_ptr<const IdSlotList> id_slots, std::shared_ptr<const NameTable> names,
+        size_t names_bytes, size_t slots, size_t live, uint64_t version);
+
+    uint64_t version() const { return version_; }
+    size_t slotCount() const { return slots_; }     // вместе с надгробиями
+    size_t size() const { return live_; }       // живые записи
+    bool empty() const { return live_ == 0; }
+
+    bool alive(size_t slot) const {
+        return segment(slot).removed_at[slot % IndexSegment::CAPACITY]
+            .load(std::memory_order_acquire) > version_;
+    }
+    const std::shared_ptr<const SnakeFeatures>& record(size_t slot) const {
+        return segment(slot).records[slot % IndexSegment::CAPACITY];
+    }
+    SnakeId id(size_t slot) const {
+        return segment(slot).ids[slot % IndexSegment::CAPACITY];
+    }
+    uint64_t stamp(size_t slot) const {
+        return segment(slot).stamps[slot % IndexSegment::CAPACITY];
+    }
+
+    // Поиск по имени - номер по таблице имён, слот по таблице номеров
+    std::shared_ptr<const SnakeFeatures> find(const std::string& name) const;
+    // Слот живой записи с номером id или NO_SLOT - по таблице номеров
+    size_t slotOf(SnakeId id) const;
+    std::shared_ptr<const SnakeFeatures> find(SnakeId id) const;
+
+    // fn(slot, const SnakeFeatures&) для каждой живой записи
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (size_t slot = 0; slot < slots_; ++slot) {
+            if (alive(slot)) fn(slot, *record(slot));
+        }
+    }
+
+    // Слоты живых записей, ближайших к query по глобальной сигнатуре
+    // (selectNearest); k == 0 - все живые
+    std::vector<size_t> shortlist(const PooledSignature& query, size_t k) const;
+
+    size_t memoryBytes() const;
+
+private:
+    const IndexSegment& segment(size_t slot) const {
+        return *(*segments_)[slot / IndexSegment::CAPACITY];
+    }
+    // Просмотр массивов номеров сегментов - если номер обновлялся
+    // несколько раз после публикации снимка
+    size_t scanSlot(SnakeId id) const;
+
+    std::shared_ptr<const SegmentList> segments_;
+    std::shared_ptr<const IdSlotList> id_slots_;
+    std::shared_ptr<const NameTable> names_;
+    size_t names_bytes_ = 0;    // names_->memoryBytes() на момент публикации
+    size_t slots_ = 0;
+    size_t live_ = 0;
+    uint64_t version_ = 0;
+};
+
+using SnakeSnapshotPtr = std::shared_ptr<const SnakeSnapshot>;
+
+// Сторона писателя: вставка и удаление за O(1) без перестройки, новый
+// снимок публикуется атомарной заменой указателя. Методы изменения
+// вызываются только под мьютексом писателей SnakeDatabase.
+class SnakeIndex {
+public:
+    SnakeIndex();
+
+    // Текущий снимок; можно вызывать из любого потока
+    SnakeSnapshotPtr snapshot() const;
+
+    std::shared_ptr<const SnakeFeatures> find(const std::string& name) const;
+    // Номер имени; NO_SNAKE, если имя не встречалось
+    SnakeId id(const std::string& name) const;
+    // Номер имени; новое имя получает следующий свободный
+    SnakeId intern(const std::string& name);
+
+    // Добавление; запись с тем же именем получает надгробие
+    void put(std::shared_ptr<const SnakeFeatures> record);
+    bool remove(const std::string& name);
+
+    // Полная замена содержимого (загрузка базы, уплотнение): записи
+    // ложатся в новые сегменты без надгробий. Снимки, взятые раньше,
+    // продолжают ссылаться на старые сегменты. Номера имён сохраняются
+    void reset(const std::vector<std::shared_ptr<const SnakeFeatures>>& records);
+
+    // Те же записи (или их копии) в новых сегментах - уплотнение. Как
+    // reset(), но версия снимка не меняется: содержимое базы то же, и
+    // кэши по версии не устаревают
+    void relayout(const std::vector<std::shared_ptr<const SnakeFeatures>>& records);
+    // relayout() по живым записям без их копирования
+    void compact();
+    // Те же записи под новой версией: изменилось не содержимое, а то, от
+    // чего зависит результат поиска (индекс PQ), и кэши по версии устаревают
+    void bumpVersion();
+
+    size_t slotCount() const { return slots_; }
+    size_t live() const { return live_; }
+    size_t names() const { return names_->size(); }    // все когда-либо виденные
+    double tombstoneRatio() const {
+        return slots_ > 0 ? 1.0 - static_cast<double>(live()) / slots_ : 0.0;
+    }
+
+private:
+    IdSlots& idSlots(SnakeId id) { return *(*id_slots_)[id / IdSlots::CAPACITY]; }
+    // Слот живой записи с номером id или NO_SLOT
+    size_t liveSlot(SnakeId id) const;
+    void reserveIds(size_t count);
+    void append(std::shared_ptr<const SnakeFeatures> record);
+    void tombstone(SnakeId id, uint64_t removed_at);
+    void rebuild(const std::vector<std::shared_ptr<const SnakeFeatures>>& records);
+    // changed == false - новая раскладка тех же записей, версия прежняя
+    void publish(bool changed = true);
+
+    std::shared_ptr<SegmentList> segments_;
+    size_t slots_ = 0;
+    size_t live_ = 0;
+    uint64_t version_ = 0;
+    // Блоки дописываются копией списка, как сегменты; reset() начинает
+    // новый список - слоты старых сегментов в нём не нужны
+    std::shared_ptr<IdSlotList> id_slots_;
+    std::shared_ptr<NameTable> names_;  // общая со снимками, см. NameTable
+    SnakeSnapshotPtr snapshot_;     // только через std::atomic_load/atomic_store
+};
+
+#endif // SNAKE_INDEX_H
@@ -0,0 +1,223 @@
+﻿// Генератор нагрузки для snake_daemon.
+//
+//   snake_loadgen --input photos/ [--socket /tmp/snake_eater.sock]
+//                 [--connections N] [--requests N] [--output report.json]
+//
+// Каждое соединение отправляет запросы по одному и ждёт ответа (замкнутый
+// цикл), изображения папки берутся по кругу. Итог - одна JSON-строка:
+// пропускная способность, p50/p90/p99 задержки успешных ответов (мс,
+// измерено клиентом), число отказов по правилам приёма и статистика сервиса.
+#include "file_utils.h"
+#include "line_socket.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+namespace fs = std::filesystem;
+
+namespace {
+
+struct LoadgenOptions {
+    std::string socket_path = "/tmp/snake_eater.sock";
+    std::string input;
+    std::string output;
+    int connections = 4;
+    size_t requests = 200;
+};
+
+struct Totals {
+    std::vector<double> latency_ms;     // только успешные ответы
+    size_t ok = 0;
+    size_t found = 0;
+    size_t overloaded = 0;
+    size_t expired = 0;
+    size_t warming = 0;                 // база демона ещё прогревалась
+    size_t errors = 0;
+    double batch_size_sum = 0;
+    double queue_ms_sum = 0;
+};
+
+void printUsage() {
+    std::cerr <<
+        "Usage: snake_loadgen --input <dir> [--socket <path>]\n"
+        "                     [--connections N] [--requests N] [--output <file>]\n";
+}
+
+bool parseArgs(int argc, char* argv[], LoadgenOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::invalid_argument("missing value for " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--socket") options.socket_path = next();
+        else if (arg == "--input") options.input = next();
+        else if (arg == "--output") options.output = next();
+        else if (arg == "--connections") options.connections = std::max(1, std::stoi(next()));
+        else if (arg == "--requests") options.requests = std::stoul(next());
+        else if (arg == "--help" || arg == "-h") return false;
+        else throw std::invalid_argument("unknown option " + arg);
+    }
+    if (options.input.empty()) {
+        throw std::invalid_argument("--input is required");
+    }
+    return true;
+}
+
+double percentile(const std::vector<double>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t index = static_cast<size_t>(q * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+// Один запрос-ответ по уже открытому соединению
+json roundTrip(int fd, LineReader& reader, const json& request) {
+    std::string line;
+    if (!writeLine(fd, request.dump()) || !reader.readLine(line)) {
+        return { {"status", "error"}, {"error", "connection lost"} };
+    }
+    try {
+        return json::parse(line);
+    }
+    catch (const json::exception& e) {
+        return { {"status", "error"}, {"error", e.what()} };
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    LoadgenOptions options;
+    try {
+        if (!parseArgs(argc, argv, options)) {
+            printUsage();
+            return 0;
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        printUsage();
+        return 2;
+    }
+
+    std::vector<std::string> files = FileUtils::findImageFiles(options.input);
+    if (files.empty()) {
+        std::cerr << "No images found in " << options.input << "\n";
+        return 1;
+    }
+    // Демон открывает путь от своего рабочего каталога, а не от нашего
+    for (auto& file : files) {
+        file = fs::absolute(file).string();
+    }
+
+    Totals totals;
+    std::mutex totals_mutex;
+    std::atomic<size_t> next_request{ 0 };
+    std::atomic<bool> connect_failed{ false };
+
+    auto start = Clock::now();
+    std::vector<std::thread> clients;
+    for (int c = 0; c < options.connections; ++c) {
+        clients.emplace_back([&]() {
+            int fd = connectUnixSocket(options.socket_path);
+            if (fd < 0) {
+                connect_failed = true;
+                return;
+            }
+            LineReader reader(fd);
+            Totals local;
+
+            for (size_t i = next_request.fetch_add(1); i < options.requests; i = next_request.fetch_add(1)) {
+                auto sent = Clock::now();
+                json response = roundTrip(fd, reader, { {"id", i}, {"path", files[i % files.size()]} });
+                double ms = std::chrono::duration<double, std::milli>(Clock::now() - sent).count();
+
+                std::string status = response.value("status", std::string("error"));
+                if (status == "ok") {
+                    local.latency_ms.push_back(ms);
+                    ++local.ok;
+                    if (response.value("found", false)) ++local.found;
+                    local.batch_size_sum += response.value("batch_size", 0.0);
+                    local.queue_ms_sum += response.value("queue_ms", 0.0);
+                }
+                else if (status == "overloaded") ++local.overloaded;
+                else if (status == "expired") ++local.expired;
+                else if (status == "warming") ++local.warming;
+                else ++local.errors;
+            }
+            close(fd);
+
+            std::lock_guard<std::mutex> lock(totals_mutex);
+            totals.latency_ms.insert(totals.latency_ms.end(), local.latency_ms.begin(), local.latency_ms.end());
+            totals.ok += local.ok;
+            totals.found += local.found;
+            totals.overloaded += local.overloaded;
+            totals.expired += local.expired;
+            totals.warming += local.warming;
+            totals.errors += local.errors;
+            totals.batch_size_sum += local.batch_size_sum;
+            totals.queue_ms_sum += local.queue_ms_sum;
+            });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (connect_failed) {
+        std::cerr << "Cannot connect to " << options.socket_path << "\n";
+        return 1;
+    }
+
+    std::sort(totals.latency_ms.begin(), totals.latency_ms.end());
+    json report = {
+        {"connections", options.connections},
+        {"requests", options.requests},
+        {"seconds", seconds},
+        {"throughput_rps", seconds > 0 ? totals.ok / seconds : 0},
+        {"ok", totals.ok},
+        {"found", totals.found},
+        {"overloaded", totals.overloaded},
+        {"expired", totals.expired},
+        {"warming", totals.warming},
+        {"errors", totals.errors},
+        {"p50_ms", percentile(totals.latency_ms, 0.5)},
+        {"p90_ms", percentile(totals.latency_ms, 0.9)},
+        {"p99_ms", percentile(totals.latency_ms, 0.99)},
+        {"max_ms", totals.latency_ms.empty() ? 0 : totals.latency_ms.back()},
+        {"mean_batch_size", totals.ok > 0 ? totals.batch_size_sum / totals.ok : 0},
+        {"mean_queue_ms", totals.ok > 0 ? totals.queue_ms_sum / totals.ok : 0}
+    };
+
+    // Счётчики самого сервиса (с учётом других клиентов)
+    int fd = connectUnixSocket(options.socket_path);
+    if (fd >= 0) {
+        LineReader reader(fd);
+        report["server"] = roundTrip(fd, reader, { {"cmd", "stats"} });
+        close(fd);
+    }
+
+    if (!options.output.empty()) {
+        std::ofstream out(options.output);
+        out << report.dump() << std::endl;
+    }
+    std::cout << report.dump() << std::endl;
+
+    std::cerr << "ok " << totals.ok << "/" << options.requests
+        << ", overloaded " << totals.overloaded << ", expired " << totals.expired
+        << ", errors " << totals.errors << "\n"
+        << "throughput " << report["throughput_rps"].get<double>() << " req/s, "
+        << "p50 " << report["p50_ms"].get<double>() << " ms, "
+        << "p99 " << report["p99_ms"].get<double>() << " ms\n";
+    return 0;
+}
@@ -0,0 +1,579 @@
+﻿// Перебор параметров сопоставления и предобработки: точность/полнота
+// идентификации против задержки, с выводом фронта Парето.
+//
+//   snake_sweep --dataset <dir> [--output sweep.csv] [--threads N]
+//               [--holdout-every K] [--target-precision P] [--target-recall R]
+//   snake_sweep --synthetic <snakes> [--shots N] ...
+//
+// Разметка - FileUtils::isSameSource: файлы "<имя>_<номер>.jpg" одной особи.
+// Первое фото каждой особи заносится в галерею, остальные - запросы.
+// Каждая K-я особь в галерею не заносится: её запросы должны давать
+// "не найдено", иначе это ложное срабатывание.
+//
+//   --prefilter-k 1,2,4,8,16,32 [--prefilter-output prefilter.csv]
+//
+// Оценка отбора по глобальной сигнатуре (global_signature.h) при параметрах
+// по умолчанию: доля запросов, у которых верная особь попала в список из K
+// кандидатов, точность/полнота идентификации с отбором и доля
+// сопоставлений, которую отбор убирает.
+//
+//   --descriptor-formats f32,u8,f16,u8-root [--formats-output formats.csv]
+//
+// Точность/полнота идентификации при параметрах по умолчанию для каждого
+// формата хранения дескрипторов (descriptor_quantization.h) против float.
+#include "descriptor_quantization.h"
+#include "file_utils.h"
+#include "global_signature.h"
+#include "image_comparison.h"
+#include "image_preprocessing.h"
+#include "parallel_for.h"
+#include "snake_identifier.h"
+#include "synthetic_dataset.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct SweepOptions {
+    std::string dataset;
+    int synthetic_snakes = 0;
+    int synthetic_shots = 4;
+    std::string output = "sweep_results.csv";
+    int threads = 0;
+    int holdout_every = 4;
+    double target_precision = 0.95;
+    double target_recall = 0.8;
+
+    std::vector<int> levels = { 1, 3, 5 };
+    std::vector<bool> masks = { false, true };
+    std::vector<float> ratios = { 0.6f, 0.7f, 0.8f };
+    std::vector<double> ransac = { 0, 1.0, 3.0, 6.0 };   // 0 - без гомографии
+    std::vector<int> min_good = { 4, 8, 16 };
+    std::vector<float> min_ratio = { 0.05f, 0.1f, 0.2f };
+
+    std::vector<int> prefilter_k;   // пусто - оценка отбора не выполняется
+    std::string prefilter_output = "prefilter_results.csv";
+
+    std::vector<std::string> descriptor_formats;    // пусто - оценка не выполняется
+    std::string formats_output = "descriptor_formats.csv";
+};
+
+struct LabeledImage {
+    std::string path;
+    std::string label;
+    cv::Mat image;
+};
+
+struct ConfigResult {
+    IdentificationParams params;
+    int tp = 0, fp = 0, fn = 0;
+    double precision = 0;
+    double recall = 0;
+    double f1 = 0;
+    double latency_ms = 0;      // предобработка + SIFT + поиск по галерее на запрос
+    bool pareto = false;
+};
+
+// Результат сопоставления запроса с одной записью галереи
+struct PairScore {
+    int good_matches = 0;
+    float match_ratio = 0;
+};
+
+double msSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+template <typename T>
+std::vector<T> parseList(const std::string& text) {
+    std::vector<T> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        values.push_back(static_cast<T>(std::stod(item)));
+    }
+    return values;
+}
+
+bool parseArgs(int argc, char* argv[], SweepOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::invalid_argument("missing value for " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--dataset") options.dataset = next();
+        else if (arg == "--synthetic") options.synthetic_snakes = std::stoi(next());
+        else if (arg == "--shots") options.synthetic_shots = std::stoi(next());
+        else if (arg == "--output") options.output = next();
+        else if (arg == "--threads") options.threads = std::stoi(next());
+        else if (arg == "--holdout-every") options.holdout_every = std::stoi(next());
+        else if (arg == "--target-precision") options.target_precision = std::stod(next());
+        else if (arg == "--target-recall") options.target_recall = std::stod(next());
+        else if (arg == "--levels") options.levels = parseList<int>(next());
+        else if (arg == "--ratios") options.ratios = parseList<float>(next());
+        else if (arg == "--ransac") options.ransac = parseList<double>(next());
+        else if (arg == "--min-good") options.min_good = parseList<int>(next());
+        else if (arg == "--min-ratio") options.min_ratio = parseList<float>(next());
+        else if (arg == "--prefilter-k") options.prefilter_k = parseList<int>(next());
+        else if (arg == "--prefilter-output") options.prefilter_output = next();
+        else if (arg == "--descriptor-formats") {
+            std::stringstream ss(next());
+            std::string name;
+            DescriptorFormat format;
+            while (std::getline(ss, name, ',')) {
+                if (!parseDescriptorFormat(name, format)) {
+                    throw std::invalid_argument("unknown descriptor format " + name);
+                }
+                options.descriptor_formats.push_back(name);
+            }
+        }
+        else if (arg == "--formats-output") options.formats_output = next();
+        else if (arg == "--help" || arg == "-h") return false;
+        else throw std::invalid_argument("unknown option " + arg);
+    }
+    if (options.dataset.empty() && options.synthetic_snakes <= 0) {
+        throw std::invalid_argument("--dataset or --synthetic is required");
+    }
+    return true;
+}
+
+// Признаки и время предобработки + извлечения для каждого изображения
+struct ExtractedSet {
+    std::vector<FeaturePoints> features;
+    std::vector<double> extract_ms;
+};
+
+ExtractedSet extractWith(const std::vector<LabeledImage>& images, int level, bool mask, int threads) {
+    ExtractedSet set;
+    set.features.resize(images.size());
+    set.extract_ms.resize(images.size());
+
+    parallelFor(images.size(), threads, [&](size_t i) {
+        auto start = Clock::now();
+        cv::Mat foreground;
+        cv::Mat processed = ImagePreprocessor::preprocess(images[i].image, true, mask, level,
+            mask ? &foreground : nullptr);
+        set.features[i] = detectSIFTFeatures(processed, foreground);
+        set.extract_ms[i] = msSince(start);
+        });
+    return set;
+}
+
+// Решение SnakeIdentifier::match по заранее посчитанным парам
+int decide(const std::vector<PairScore>& scores, int min_good, float min_ratio) {
+    int best = -1;
+    float best_ratio = 0;
+    for (size_t g = 0; g < scores.size(); ++g) {
+        const PairScore& s = scores[g];
+        if (s.good_matches >= min_good && s.match_ratio >= min_ratio && s.match_ratio > best_ratio) {
+            best_ratio = s.match_ratio;
+            best = static_cast<int>(g);
+        }
+    }
+    return best;
+}
+
+void markPareto(std::vector<ConfigResult>& results) {
+    for (auto& a : results) {
+        a.pareto = true;
+        for (const auto& b : results) {
+            bool no_worse = b.latency_ms <= a.latency_ms &&
+                b.precision >= a.precision && b.recall >= a.recall;
+            bool better = b.latency_ms < a.latency_ms ||
+                b.precision > a.precision || b.recall > a.recall;
+            if (no_worse && better) {
+                a.pareto = false;
+                break;
+            }
+        }
+    }
+}
+
+void writeResults(const std::string& filename, const std::vector<ConfigResult>& results) {
+    std::vector<std::string> headers = {
+        "Level", "BackgroundMask", "RatioThreshold", "UseHomography", "RansacThreshold",
+        "MinGoodMatches", "MinMatchRatio", "TP", "FP", "FN",
+        "Precision", "Recall", "F1", "LatencyMs", "Pareto"
+    };
+    std::vector<std::vector<std::string>> data;
+    for (const auto& r : results) {
+        data.push_back({
+            std::to_string(r.params.preprocessing_level),
+            r.params.remove_background ? "YES" : "NO",
+            std::to_string(r.params.good_match_threshold),
+            r.params.use_homography ? "YES" : "NO",
+            std::to_string(r.params.ransac_threshold),
+            std::to_string(r.params.min_good_matches),
+            std::to_string(r.params.min_match_ratio),
+            std::to_string(r.tp), std::to_string(r.fp), std::to_string(r.fn),
+            std::to_string(r.precision), std::to_string(r.recall), std::to_string(r.f1),
+            std::to_string(r.latency_ms),
+            r.pareto ? "YES" : "NO"
+            });
+    }
+    FileUtils::writeCSV(filename, headers, data);
+}
+
+void printConfig(const ConfigResult& r) {
+    std::cout << std::fixed << std::setprecision(3)
+        << "  level=" << r.params.preprocessing_level
+        << " mask=" << (r.params.remove_background ? "on" : "off")
+        << " ratio=" << r.params.good_match_threshold
+        << " ransac=" << (r.params.use_homography ? std::to_string(r.params.ransac_threshold) : "off")
+        << " min_good=" << r.params.min_good_matches
+        << " min_ratio=" << r.params.min_match_ratio
+        << " | P=" << r.precision << " R=" << r.recall
+        << " latency=" << r.latency_ms << "ms\n";
+}
+
+// Отбор кандидатов по сигнатуре при параметрах по умолчанию
+void evaluatePrefilter(const SweepOptions& options, const std::vector<LabeledImage>& images,
+    const std::vector<size_t>& gallery, const std::vector<size_t>& queries,
+    const std::vector<bool>& query_enrolled) {
+    IdentificationParams params;
+    ExtractedSet set = extractWith(images, params.preprocessing_level,
+        params.remove_background, options.threads);
+
+    std::vector<uint64_t> words;
+    for (size_t g : gallery) {
+        PooledSignature pooled = computePooledSignature(set.features[g].descriptors);
+        words.insert(words.end(), pooled.begin(), pooled.end());
+    }
+
+    // Полное сопоставление один раз, отбор только маскирует пары
+    std::vector<std::vector<PairScore>> scores(queries.size(), std::vector<PairScore>(gallery.size()));
+    parallelFor(queries.size(), options.threads, [&](size_t qi) {
+        const FeaturePoints& query = set.features[queries[qi]];
+        for (size_t gi = 0; gi < gallery.size(); ++gi) {
+            const FeaturePoints& entry = set.features[gallery[gi]];
+            MatchResult m = matchFeatures(query, entry, cv::NORM_L2, params.good_match_threshold,
+                params.use_homography, params.ransac_threshold);
+            size_t min_features = std::min(query.keypoints.size(), entry.keypoints.size());
+            scores[qi][gi].good_matches = m.good_matches;
+            scores[qi][gi].match_ratio = min_features > 0 ?
+                static_cast<float>(m.good_matches) / min_features : 0;
+        }
+        });
+
+    std::vector<int> ks = options.prefilter_k;
+    ks.push_back(0);    // без отбора - базовая строка
+    std::vector<std::vector<std::string>> rows;
+    std::cout << "Prefilter (gallery " << gallery.size() << "):\n";
+    for (int k : ks) {
+        size_t enrolled = 0, shortlisted = 0, compared = 0;
+        int tp = 0, fp = 0, fn = 0;
+        double scan_us = 0;
+
+        for (size_t qi = 0; qi < queries.size(); ++qi) {
+            const LabeledImage& query = images[queries[qi]];
+            auto start = Clock::now();
+            PooledSignature pooled = computePooledSignature(set.features[queries[qi]].descriptors);
+            std::vector<int> distances(gallery.size());
+            scanSignatures(words.data(), gallery.size(), pooled, distances.data());
+            for (size_t gi = 0; gi < gallery.size(); ++gi) {
+                if (words[gi * POOLED_SIGNATURE_WORDS] == 0 && words[gi * POOLED_SIGNATURE_WORDS + 1] == 0) {
+                    distances[gi] = SIGNATURE_UNRANKED;
+                }
+            }
+            std::vector<size_t> candidates = selectNearest(distances, k);
+            scan_us += msSince(start) * 1000.0;
+            compared += candidates.size();
+
+            std::vector<PairScore> masked(gallery.size());
+            bool hit = false;
+            for (size_t c : candidates) {
+                masked[c] = scores[qi][c];
+                hit = hit || images[gallery[c]].label == query.label;
+            }
+            if (query_enrolled[qi]) {
+                ++enrolled;
+                if (hit) ++shortlisted;
+            }
+
+            int best = decide(masked, params.min_good_matches, params.min_match_ratio);
+            bool correct = best >= 0 && images[gallery[best]].label == query.label;
+            if (correct) tp++;
+            else if (best >= 0) fp++;
+            if (!correct && query_enrolled[qi]) fn++;
+        }
+
+        double shortlist_recall = enrolled > 0 ? double(shortlisted) / enrolled : 1.0;
+        double precision = (tp + fp) > 0 ? double(tp) / (tp + fp) : 1.0;
+        double recall = (tp + fn) > 0 ? double(tp) / (tp + fn) : 0.0;
+        double work_removed = 1.0 - double(compared) / (double(queries.size()) * gallery.size());
+
+        std::cout << std::fixed << std::setprecision(3)
+            << "  k=" << (k > 0 ? std::to_string(k) : std::string("all"))
+            << " shortlist_recall=" << shortlist_recall
+            << " P=" << precision << " R=" << recall
+            << " work_removed=" << work_removed
+            << " scan=" << scan_us / queries.size() << "us\n";
+        rows.push_back({
+            std::to_string(k), std::to_string(gallery.size()),
+            std::to_string(shortlist_recall), std::to_string(precision), std::to_string(recall),
+            std::to_string(work_removed), std::to_string(scan_us / queries.size())
+            });
+    }
+    FileUtils::writeCSV(options.prefilter_output,
+        { "Candidates", "Gallery", "ShortlistRecall", "Precision", "Recall", "WorkRemoved", "ScanUs" },
+        rows);
+    std::cout << "Prefilter results saved to " << options.prefilter_output << "\n";
+}
+
+// Идентификация при параметрах по умолчанию с галереей в каждом формате
+// хранения; запрос кодируется в тот же формат, как это делает SnakeIdentifier
+void evaluateDescriptorFormats(const SweepOptions& options, const std::vector<LabeledImage>& images,
+    const std::vector<size_t>& gallery, const std::vector<size_t>& queries,
+    const std::vector<bool>& query_enrolled) {
+    IdentificationParams params;
+    ExtractedSet set = extractWith(images, params.preprocessing_level,
+        params.remove_background, options.threads);
+
+    std::vector<std::vector<std::string>> rows;
+    std::cout << "Descriptor formats (gallery " << gallery.size() << "):\n";
+    for (const std::string& name : options.descriptor_formats) {
+        DescriptorFormat format;
+        parseDescriptorFormat(name, format);
+        auto encode = [&](size_t i) {
+            FeaturePoints encoded = set.features[i];
+            encoded.descriptors = encodeDescriptors(encoded.descriptors, format);
+            return encoded;
+        };
+
+        std::vector<FeaturePoints> encoded_gallery;
+        size_t gallery_bytes = 0;
+        for (size_t g : gallery) {
+            encoded_gallery.push_back(encode(g));
+            const cv::Mat& d = encoded_gallery.back().descriptors;
+            gallery_bytes += d.empty() ? 0 : d.total() * d.elemSize();
+        }
+
+        std::vector<std::vector<PairScore>> scores(queries.size(), std::vector<PairScore>(gallery.size()));
+        std::vector<double> match_ms(queries.size());
+        parallelFor(queries.size(), options.threads, [&](size_t qi) {
+            FeaturePoints query = encode(queries[qi]);
+            auto start = Clock::now();
+            for (size_t gi = 0; gi < gallery.size(); ++gi) {
+                const FeaturePoints& entry = encoded_gallery[gi];
+                MatchResult m = matchFeatures(query, entry, cv::NORM_L2, params.good_match_threshold,
+                    params.use_homography, params.ransac_threshold);
+                size_t min_features = std::min(query.keypoints.size(), entry.keypoints.size());
+                scores[qi][gi].good_matches = m.good_matches;
+                scores[qi][gi].match_ratio = min_features > 0 ?
+                    static_cast<float>(m.good_matches) / min_features : 0;
+            }
+            match_ms[qi] = msSince(start);
+            });
+
+        int tp = 0, fp = 0, fn = 0;
+        double total_ms = 0;
+        for (size_t qi = 0; qi < queries.size(); ++qi) {
+            const LabeledImage& query = images[queries[qi]];
+            int best = decide(scores[qi], params.min_good_matches, params.min_match_ratio);
+            bool correct = best >= 0 && images[gallery[best]].label == query.label;
+            if (correct) tp++;
+            else if (best >= 0) fp++;
+            if (!correct && query_enrolled[qi]) fn++;
+            total_ms += match_ms[qi];
+        }
+
+        double precision = (tp + fp) > 0 ? double(tp) / (tp + fp) : 1.0;
+        double recall = (tp + fn) > 0 ? double(tp) / (tp + fn) : 0.0;
+        double latency = total_ms / queries.size();
+        std::cout << std::fixed << std::setprecision(3)
+            << "  " << name << " P=" << precision << " R=" << recall
+            << " gallery=" << gallery_bytes / 1024 << "KB match=" << latency << "ms\n";
+        rows.push_back({
+            name, std::to_string(gallery.size()), std::to_string(precision),
+            std::to_string(recall), std::to_string(gallery_bytes), std::to_string(latency)
+            });
+    }
+    FileUtils::writeCSV(options.formats_output,
+        { "Format", "Gallery", "Precision", "Recall", "GalleryBytes", "MatchMs" }, rows);
+    std::cout << "Descriptor format results saved to " << options.formats_output << "\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    SweepOptions options;
+    try {
+        if (!parseArgs(argc, argv, options)) {
+            std::cerr << "Usage: snake_sweep --dataset <dir> | --synthetic <snakes> [--shots N]\n"
+                "                   [--output <file>] [--threads N] [--holdout-every K]\n"
+                "                   [--target-precision P] [--target-recall R]\n"
+                "                   [--levels 1,3,5] [--ratios 0.6,0.7] [--ransac 0,3]\n"
+                "                   [--min-good 4,8] [--min-ratio 0.05,0.1]\n"
+                "                   [--prefilter-k 1,4,16] [--prefilter-output <file>]\n"
+                "                   [--descriptor-formats f32,u8,f16,u8-root] [--formats-output <file>]\n";
+            return 0;
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+
+    std::string dataset = options.dataset;
+    if (dataset.empty()) {
+        dataset = (fs::temp_directory_path() / "snake_sweep_synthetic").string();
+        SyntheticDataset::writeLabeledFolder(dataset, options.synthetic_snakes,
+            options.synthetic_shots, 640, 480);
+    }
+
+    // Загрузка и разметка
+    std::vector<std::string> files = FileUtils::findImageFiles(dataset);
+    std::sort(files.begin(), files.end());
+    std::vector<LabeledImage> images;
+    for (const auto& path : files) {
+        cv::Mat image = cv::imread(path);
+        if (image.empty()) {
+            std::cerr << "Failed to load image: " << path << "\n";
+            continue;
+        }
+        images.push_back({ path, FileUtils::getBaseName(path), image });
+    }
+
+    // Галерея: первое фото каждой особи, кроме отложенных
+    std::map<std::string, int> label_order;
+    std::vector<size_t> gallery, queries;
+    std::vector<bool> query_enrolled;
+    for (size_t i = 0; i < images.size(); ++i) {
+        auto inserted = label_order.emplace(images[i].label, static_cast<int>(label_order.size()));
+        bool held_out = options.holdout_every > 0 &&
+            inserted.first->second % options.holdout_every == options.holdout_every - 1;
+        if (inserted.second && !held_out) {
+            gallery.push_back(i);
+        }
+        else {
+            queries.push_back(i);
+        }
+    }
+    for (size_t q : queries) {
+        bool enrolled = std::any_of(gallery.begin(), gallery.end(),
+            [&](size_t g) { return FileUtils::isSameSource(images[q].path, images[g].path); });
+        query_enrolled.push_back(enrolled);
+    }
+
+    if (gallery.empty() || queries.empty()) {
+        std::cerr << "Dataset needs several photos per snake (<name>_<n>.jpg)\n";
+        return 1;
+    }
+    std::cerr << images.size() << " images, " << gallery.size() << " enrolled, "
+        << queries.size() << " queries\n";
+
+    if (!options.prefilter_k.empty()) {
+        evaluatePrefilter(options, images, gallery, queries, query_enrolled);
+    }
+    if (!options.descriptor_formats.empty()) {
+        evaluateDescriptorFormats(options, images, gallery, queries, query_enrolled);
+    }
+
+    std::vector<ConfigResult> results;
+
+    for (int level : options.levels) {
+        for (bool mask : options.masks) {
+            ExtractedSet set = extractWith(images, level, mask, options.threads);
+
+            double extract_ms = 0;
+            for (size_t q : queries) extract_ms += set.extract_ms[q];
+            extract_ms /= queries.size();
+
+            for (float ratio : options.ratios) {
+                for (double ransac : options.ransac) {
+                    // Все пары запрос x галерея для этих параметров сопоставления
+                    std::vector<std::vector<PairScore>> scores(queries.size(),
+                        std::vector<PairScore>(gallery.size()));
+                    std::vector<double> match_ms(queries.size());
+
+                    parallelFor(queries.size(), options.threads, [&](size_t qi) {
+                        const FeaturePoints& query = set.features[queries[qi]];
+                        auto start = Clock::now();
+                        for (size_t gi = 0; gi < gallery.size(); ++gi) {
+                            const FeaturePoints& entry = set.features[gallery[gi]];
+                            MatchResult m = matchFeatures(query, entry, cv::NORM_L2, ratio,
+                                ransac > 0, ransac);
+                            size_t min_features = std::min(query.keypoints.size(), entry.keypoints.size());
+                            scores[qi][gi].good_matches = m.good_matches;
+                            scores[qi][gi].match_ratio = min_features > 0 ?
+                                static_cast<float>(m.good_matches) / min_features : 0;
+                        }
+                        match_ms[qi] = msSince(start);
+                        });
+
+                    double latency = extract_ms;
+                    for (double ms : match_ms) latency += ms / queries.size();
+
+                    // Пороги решения не требуют повторного сопоставления
+                    for (int min_good : options.min_good) {
+                        for (float min_ratio : options.min_ratio) {
+                            ConfigResult r;
+                            r.params.preprocessing_level = level;
+                            r.params.remove_background = mask;
+                            r.params.good_match_threshold = ratio;
+                            r.params.use_homography = ransac > 0;
+                            r.params.ransac_threshold = ransac > 0 ? ransac : RANSAC_THRESHOLD;
+                            r.params.min_good_matches = min_good;
+                            r.params.min_match_ratio = min_ratio;
+                            r.latency_ms = latency;
+
+                            for (size_t qi = 0; qi < queries.size(); ++qi) {
+                                int best = decide(scores[qi], min_good, min_ratio);
+                                bool correct = best >= 0 &&
+                                    images[gallery[best]].label == images[queries[qi]].label;
+                                if (correct) r.tp++;
+                                else if (best >= 0) r.fp++;
+                                if (!correct && query_enrolled[qi]) r.fn++;
+                            }
+
+                            r.precision = (r.tp + r.fp) > 0 ? double(r.tp) / (r.tp + r.fp) : 1.0;
+                            r.recall = (r.tp + r.fn) > 0 ? double(r.tp) / (r.tp + r.fn) : 0.0;
+                            r.f1 = (r.precision + r.recall) > 0 ?
+                                2 * r.precision * r.recall / (r.precision + r.recall) : 0;
+                            results.push_back(r);
+                        }
+                    }
+                }
+            }
+            std::cerr << "level=" << level << " mask=" << (mask ? "on" : "off") << " done\n";
+        }
+    }
+
+    markPareto(results);
+    writeResults(options.output, results);
+
+    std::vector<ConfigResult> frontier;
+    for (const auto& r : results) {
+        if (r.pareto) frontier.push_back(r);
+    }
+    std::sort(frontier.begin(), frontier.end(),
+        [](const ConfigResult& a, const ConfigResult& b) { return a.latency_ms < b.latency_ms; });
+
+    std::cout << "Pareto frontier (" << frontier.size() << " of " << results.size() << " configurations):\n";
+    for (const auto& r : frontier) printConfig(r);
+
+    auto fastest = std::find_if(frontier.begin(), frontier.end(), [&](const ConfigResult& r) {
+        return r.precision >= options.target_precision && r.recall >= options.target_recall;
+        });
+    if (fastest != frontier.end()) {
+        std::cout << "Fastest configuration with precision >= " << options.target_precision
+            << " and recall >= " << options.target_recall << ":\n";
+        printConfig(*fastest);
+    }
+    else {
+        std::cout << "No configuration meets precision >= " << options.target_precision
+            << " and recall >= " << options.target_recall << "\n";
+    }
+    std::cout << "All results saved to " << options.output << "\n";
+    return 0;
+}
@@ -0,0 +1,290 @@
+﻿#include "startup_snapshot.h"
+#include "snake_database.h"
+#include "tracing.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+static const char SNAPSHOT_MAGIC[8] = { 'S', 'N', 'A', 'K', 'E', 'S', 'N', 'P' };
+static const uint32_t SNAPSHOT_VERSION = 1;
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+static const uint64_t SECTION_ALIGN = 64;
+
+// Раскладка файла: заголовок, таблица записей, описания записей (строки и
+// границы снимков), координаты всех точек (сначала все x, затем все y, как
+// в feature_slab.h), дескрипторы записей с выравниванием на SECTION_ALIGN
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t meta_size;
+    int64_t meta_mtime;
+    uint64_t record_count;
+    uint64_t records_offset;
+    uint64_t total_points;
+    uint64_t points_offset;
+    uint64_t file_size;
+};
+
+struct SnapshotRecord {
+    uint64_t info_offset;
+    uint64_t info_size;
+    uint64_t first_point;
+    uint64_t point_count;
+    uint64_t descriptors_offset;
+    int32_t descriptor_rows;
+    int32_t descriptor_cols;
+    int32_t descriptor_type;
+    int32_t reserved;
+    uint64_t phash;
+    uint64_t pooled[POOLED_SIGNATURE_WORDS];
+};
+
+static uint64_t alignUp(uint64_t offset, uint64_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+SnapshotStamp metaStamp(const std::string& meta_path) {
+    SnapshotStamp stamp;
+    std::error_code ec;
+    uintmax_t size = fs::file_size(meta_path, ec);
+    if (ec) return stamp;
+    auto mtime = fs::last_write_time(meta_path, ec);
+    if (ec) return stamp;
+    stamp.meta_size = static_cast<uint64_t>(size);
+    stamp.meta_mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+    return stamp;
+}
+
+// Описание записи: имя, формат дескрипторов, пути фото, границы снимков.
+// Строки - длина (uint32) и байты, массивы - число элементов и элементы
+static void appendU32(std::string& out, uint32_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void appendString(std::string& out, const std::string& value) {
+    appendU32(out, static_cast<uint32_t>(value.size()));
+    out += value;
+}
+
+static std::string recordInfo(const SnakeFeatures& record) {
+    std::string info;
+    appendString(info, record.name);
+    appendString(info, descriptorFormatName(record.descriptor_format));
+    appendU32(info, static_cast<uint32_t>(record.image_paths.size()));
+    for (const auto& path : record.image_paths) appendString(info, path);
+    appendU32(info, static_cast<uint32_t>(record.image_starts.size()));
+    for (int start : record.image_starts) appendU32(info, static_cast<uint32_t>(start));
+    return info;
+}
+
+// Чтение описания с проверкой границ
+class InfoReader {
+public:
+    InfoReader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+    bool readU32(uint32_t& value) {
+        if (size_ - offset_ < sizeof(value)) return false;
+        std::memcpy(&value, data_ + offset_, sizeof(value));
+        offset_ += sizeof(value);
+        return true;
+    }
+    bool readString(std::string& value) {
+        uint32_t length;
+        if (!readU32(length) || size_ - offset_ < length) return false;
+        value.assign(reinterpret_cast<const char*>(data_ + offset_), length);
+        offset_ += length;
+        return true;
+    }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t offset_ = 0;
+};
+
+static void writePadding(std::ofstream& out, uint64_t& offset, uint64_t target) {
+    static const char zeros[SECTION_ALIGN] = {};
+    while (offset < target) {
+        uint64_t chunk = std::min<uint64_t>(target - offset, SECTION_ALIGN);
+        out.write(zeros, static_cast<std::streamsize>(chunk));
+        offset += chunk;
+    }
+}
+
+bool writeStartupSnapshot(const std::string& path,
+    const std::vector<const SnakeFeatures*>& records, const SnapshotStamp& stamp) {
+    SNAKE_TRACE_SCOPE("db.write_snapshot");
+    // Раскладка считается заранее - файл пишется за один проход
+    SnapshotHeader header = {};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.meta_size = stamp.meta_size;
+    header.meta_mtime = stamp.meta_mtime;
+    header.record_count = records.size();
+    header.records_offset = sizeof(SnapshotHeader);
+
+    std::vector<SnapshotRecord> table(records.size());
+    std::vector<std::string> infos(records.size());
+    uint64_t offset = header.records_offset + records.size() * sizeof(SnapshotRecord);
+    uint64_t points = 0;
+    for (size_t i = 0; i < records.size(); ++i) {
+        const SnakeFeatures& record = *records[i];
+        infos[i] = recordInfo(record);
+        SnapshotRecord& entry = table[i];
+        entry.info_offset = offset;
+        entry.info_size = infos[i].size();
+        entry.first_point = points;
+        entry.point_count = record.points.size();
+        entry.descriptor_rows = record.descriptors.rows;
+        entry.descriptor_cols = record.descriptors.cols;
+        entry.descriptor_type = record.descriptors.type();
+        entry.phash = record.signature.phash;
+        for (int w = 0; w < POOLED_SIGNATURE_WORDS; ++w) {
+            entry.pooled[w] = record.signature.pooled[w];
+        }
+        offset += entry.info_size;
+        points += entry.point_count;
+    }
+    header.total_points = points;
+    header.points_offset = alignUp(offset, SECTION_ALIGN);
+    offset = header.points_offset + 2 * points * sizeof(float);
+    for (size_t i = 0; i < records.size(); ++i) {
+        const cv::Mat& descriptors = records[i]->descriptors;
+        offset = alignUp(offset, SECTION_ALIGN);
+        table[i].descriptors_offset = offset;
+        offset += descriptors.total() * descriptors.elemSize();
+    }
+    header.file_size = offset;
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        return false;
+    }
+    uint64_t written = 0;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()),
+        static_cast<std::streamsize>(table.size() * sizeof(SnapshotRecord)));
+    written = header.records_offset + table.size() * sizeof(SnapshotRecord);
+    for (const auto& info : infos) {
+        out.write(info.data(), static_cast<std::streamsize>(info.size()));
+        written += info.size();
+    }
+    writePadding(out, written, header.points_offset);
+    for (int axis = 0; axis < 2; ++axis) {
+        for (const SnakeFeatures* record : records) {
+            ArrayView<float> values = axis == 0 ? record->points.x() : record->points.y();
+            out.write(reinterpret_cast<const char*>(values.data()),
+                static_cast<std::streamsize>(values.size() * sizeof(float)));
+            written += values.size() * sizeof(float);
+        }
+    }
+    for (size_t i = 0; i < records.size(); ++i) {
+        const cv::Mat& descriptors = records[i]->descriptors;
+        writePadding(out, written, table[i].descriptors_offset);
+        size_t row_bytes = descriptors.cols * descriptors.elemSize();
+        for (int r = 0; r < descriptors.rows; ++r) {
+            out.write(reinterpret_cast<const char*>(descriptors.ptr(r)),
+                static_cast<std::streamsize>(row_bytes));
+        }
+        written += descriptors.rows * row_bytes;
+    }
+    return static_cast<bool>(out);
+}
+
+std::shared_ptr<const StartupSnapshot> StartupSnapshot::open(const std::string& path,
+    const SnapshotStamp& stamp) {
+    std::shared_ptr<const MappedFile> file = MappedFile::open(path);
+    if (!file || file->size() < sizeof(SnapshotHeader)) {
+        return nullptr;
+    }
+    SnapshotHeader header;
+    std::memcpy(&header, file->data(), sizeof(header));
+    bool valid = std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == SNAPSHOT_VERSION && header.byte_order == BYTE_ORDER_MARK &&
+        header.file_size == file->size() &&
+        header.meta_size == stamp.meta_size && header.meta_mtime == stamp.meta_mtime &&
+        header.records_offset <= file->size() &&
+        header.record_count <= (file->size() - header.records_offset) / sizeof(SnapshotRecord) &&
+        header.points_offset <= file->size() &&
+        header.total_points <= (file->size() - header.points_offset) / (2 * sizeof(float));
+    if (!valid) {
+        return nullptr;
+    }
+
+    auto snapshot = std::make_shared<StartupSnapshot>();
+    snapshot->file_ = std::move(file);
+    snapshot->record_count_ = static_cast<size_t>(header.record_count);
+    return snapshot;
+}
+
+bool StartupSnapshot::readRecords(std::vector<std::shared_ptr<SnakeFeatures>>& records) const {
+    SNAKE_TRACE_SCOPE("db.read_snapshot");
+    const uint8_t* data = file_->data();
+    const size_t size = file_->size();
+    SnapshotHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    const float* x = reinterpret_cast<const float*>(data + header.points_offset);
+    const float* y = x + header.total_points;
+    size_t points_bytes = 2 * header.total_points * sizeof(float);
+
+    records.clear();
+    records.reserve(record_count_);
+    for (size_t i = 0; i < record_count_; ++i) {
+        SnapshotRecord entry;
+        std::memcpy(&entry, data + header.records_offset + i * sizeof(SnapshotRecord), sizeof(entry));
+        if (entry.info_offset > size || entry.info_size > size - entry.info_offset ||
+            entry.first_point > header.total_points ||
+            entry.point_count > header.total_points - entry.first_point) {
+            return false;
+        }
+
+        auto record = std::make_shared<SnakeFeatures>();
+        InfoReader info(data + entry.info_offset, static_cast<size_t>(entry.info_size));
+        std::string format_name;
+        uint32_t paths = 0, starts = 0;
+        if (!info.readString(record->name) || !info.readString(format_name) ||
+            !parseDescriptorFormat(format_name, record->descriptor_format) ||
+            !info.readU32(paths)) {
+            return false;
+        }
+        record->image_paths.resize(paths);
+        for (auto& path : record->image_paths) {
+            if (!info.readString(path)) return false;
+        }
+        if (!info.readU32(starts)) return false;
+        record->image_starts.resize(starts);
+        for (int& start : record->image_starts) {
+            uint32_t value;
+            if (!info.readU32(value)) return false;
+            start = static_cast<int>(value);
+        }
+
+        if (entry.point_count > 0) {
+            record->points = PointSet(file_, points_bytes,
+                x + entry.first_point, y + entry.first_point,
+                static_cast<size_t>(entry.point_count));
+        }
+        if (entry.descriptor_rows > 0 && entry.descriptor_cols > 0) {
+            size_t bytes = static_cast<size_t>(entry.descriptor_rows) * entry.descriptor_cols *
+                CV_ELEM_SIZE(entry.descriptor_type);
+            if (entry.descriptors_offset > size || bytes > size - entry.descriptors_offset) {
+                return false;
+            }
+            // Отображение копируемое при записи - снятие const безопасно
+            record->descriptors = cv::Mat(entry.descriptor_rows, entry.descriptor_cols,
+                entry.descriptor_type, const_cast<uint8_t*>(data + entry.descriptors_offset));
+            record->mapping = file_;
+        }
+        record->signature.phash = entry.phash;
+        for (int w = 0; w < POOLED_SIGNATURE_WORDS; ++w) {
+            record->signature.pooled[w] = entry.pooled[w];
+        }
+        records.push_back(std::move(record));
+    }
+    return true;
+}
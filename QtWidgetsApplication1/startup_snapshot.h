@@ -0,0 +1,59 @@
+﻿#ifndef STARTUP_SNAPSHOT_H
+#define STARTUP_SNAPSHOT_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mapped_file.h"
+
+struct SnakeFeatures;
+
+// Файл быстрого запуска (snapshot.bin рядом с meta.json): все записи базы
+// одним файлом в готовом для памяти виде. Файл отображается в память, и
+// точки и дескрипторы записей ссылаются прямо в отображение - без разбора
+// JSON и без копирования. Это кэш: источник правды - meta.json и файлы
+// точек. Файл пишет SnakeDatabase::save(), в заголовке - размер и время
+// изменения meta.json, записанного тем же save(); если meta.json с тех пор
+// изменился, файл устарел и база читается по-старому. Формат - родной
+// порядок байтов машины, перенос на другую архитектуру отвергается
+// проверкой заголовка
+
+// Отметка meta.json, с которым согласован файл; нули - meta.json нет
+struct SnapshotStamp {
+    uint64_t meta_size = 0;
+    int64_t meta_mtime = 0;
+
+    bool operator==(const SnapshotStamp& other) const {
+        return meta_size == other.meta_size && meta_mtime == other.meta_mtime;
+    }
+};
+
+SnapshotStamp metaStamp(const std::string& meta_path);
+
+// Записи с дескрипторами в памяти; false - не удалось записать файл
+bool writeStartupSnapshot(const std::string& path,
+    const std::vector<const SnakeFeatures*>& records, const SnapshotStamp& stamp);
+
+class StartupSnapshot {
+public:
+    // Отображение файла и проверка заголовка - O(1), данные не читаются.
+    // nullptr - файла нет, он другой версии, повреждён или устарел
+    static std::shared_ptr<const StartupSnapshot> open(const std::string& path,
+        const SnapshotStamp& stamp);
+
+    size_t recordCount() const { return record_count_; }
+
+    // Записи поверх отображения: его держат PointSet записи и поле mapping
+    // (для заголовков cv::Mat дескрипторов) - отображение освобождается
+    // вместе с последней записью. false - описание записи выходит за файл
+    bool readRecords(std::vector<std::shared_ptr<SnakeFeatures>>& records) const;
+
+    const std::shared_ptr<const MappedFile>& file() const { return file_; }
+
+private:
+    std::shared_ptr<const MappedFile> file_;
+    size_t record_count_ = 0;
+};
+
+#endif // STARTUP_SNAPSHOT_H
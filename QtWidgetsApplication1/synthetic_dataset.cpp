@@ -0,0 +1,94 @@
+﻿#include "synthetic_dataset.h"
+#include <filesystem>
+
+using namespace cv;
+namespace fs = std::filesystem;
+
+// Гауссов шум вокруг 128, чтобы в 8-битном изображении он был в обе стороны
+static void addNoise(Mat& image, RNG& rng, double sigma) {
+    Mat noise(image.size(), image.type());
+    rng.fill(noise, RNG::NORMAL, Scalar::all(128), Scalar::all(sigma));
+    addWeighted(image, 1.0, noise, 1.0, -128.0, image);
+}
+
+Mat SyntheticDataset::generateScaleTexture(int width, int height, uint64_t seed) {
+    RNG rng(seed);
+
+    // Фон - плавный градиент с шумом
+    Mat image(height, width, CV_8UC3, Scalar(90, 110, 100));
+    addNoise(image, rng, 12);
+
+    // Тело змеи - полоса посередине кадра
+    int body_top = height / 5;
+    int body_bottom = height - height / 5;
+    int scale_w = std::max(6, width / 40);
+    int scale_h = std::max(4, scale_w * 2 / 3);
+
+    for (int row = 0, y = body_top; y < body_bottom; ++row, y += scale_h) {
+        int shift = (row % 2) * scale_w / 2;
+        for (int x = width / 10 + shift; x < width - width / 10; x += scale_w) {
+            int jitter_x = rng.uniform(-scale_w / 6, scale_w / 6 + 1);
+            int jitter_y = rng.uniform(-scale_h / 6, scale_h / 6 + 1);
+            int base = rng.uniform(40, 200);
+            Scalar color(base, base + rng.uniform(-20, 20), base + rng.uniform(-30, 30));
+
+            Point center(x + jitter_x, y + jitter_y);
+            Size axes(scale_w / 2, scale_h / 2);
+            ellipse(image, center, axes, rng.uniform(-15, 15), 0, 360, color, -1, LINE_AA);
+            ellipse(image, center, axes, 0, 0, 360, Scalar::all(base / 3), 1, LINE_AA);
+        }
+    }
+
+    // Крупные пятна - индивидуальный рисунок особи
+    int blotches = 6 + rng.uniform(0, 6);
+    for (int i = 0; i < blotches; ++i) {
+        Point center(rng.uniform(width / 10, width - width / 10),
+            rng.uniform(body_top, body_bottom));
+        Size axes(rng.uniform(scale_w, scale_w * 4), rng.uniform(scale_h, scale_h * 3));
+        ellipse(image, center, axes, rng.uniform(0, 180), 0, 360,
+            Scalar::all(rng.uniform(10, 60)), -1, LINE_AA);
+    }
+
+    return image;
+}
+
+Mat SyntheticDataset::perturb(const Mat& image, uint64_t seed, double strength) {
+    RNG rng(seed);
+
+    Point2f center(image.cols / 2.0f, image.rows / 2.0f);
+    double angle = rng.uniform(-10.0, 10.0) * strength;
+    double scale = 1.0 + rng.uniform(-0.1, 0.1) * strength;
+    Mat transform = getRotationMatrix2D(center, angle, scale);
+    transform.at<double>(0, 2) += rng.uniform(-0.05, 0.05) * image.cols * strength;
+    transform.at<double>(1, 2) += rng.uniform(-0.05, 0.05) * image.rows * strength;
+
+    Mat warped;
+    warpAffine(image, warped, transform, image.size(), INTER_LINEAR, BORDER_REFLECT);
+
+    double gain = 1.0 + rng.uniform(-0.2, 0.2) * strength;
+    double bias = rng.uniform(-20.0, 20.0) * strength;
+    warped.convertTo(warped, -1, gain, bias);
+
+    addNoise(warped, rng, 6 * strength);
+
+    return warped;
+}
+
+std::vector<std::string> SyntheticDataset::writeLabeledFolder(const std::string& directory,
+    int snakes, int shots_per_snake, int width, int height, uint64_t seed) {
+    fs::create_directories(directory);
+
+    std::vector<std::string> paths;
+    for (int s = 0; s < snakes; ++s) {
+        Mat base = generateScaleTexture(width, height, seed * 1000003 + s);
+        for (int shot = 0; shot < shots_per_snake; ++shot) {
+            Mat image = shot == 0 ? base : perturb(base, seed * 7919 + s * 131 + shot);
+            std::string path = directory + "/snake" + std::to_string(s) +
+                "_" + std::to_string(shot) + ".jpg";
+            if (imwrite(path, image)) {
+                paths.push_back(path);
+            }
+        }
+    }
+    return paths;
+}
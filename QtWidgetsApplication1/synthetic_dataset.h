@@ -0,0 +1,26 @@
+﻿#ifndef SYNTHETIC_DATASET_H
+#define SYNTHETIC_DATASET_H
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Процедурные изображения "чешуи" для бенчмарков и проверок без реальных фото.
+// Одинаковый seed даёт одинаковый рисунок - так имитируется одна и та же змея.
+class SyntheticDataset {
+public:
+    // Сетка эллиптических чешуек со случайным смещением, яркостью и пятнами.
+    // Рисунок занимает центральную область, по краям - фон (для маски).
+    static cv::Mat generateScaleTexture(int width, int height, uint64_t seed);
+
+    // Повторный "снимок" той же змеи: поворот, масштаб, сдвиг яркости, шум
+    static cv::Mat perturb(const cv::Mat& image, uint64_t seed, double strength = 1.0);
+
+    // Помеченный набор: snakes * shots_per_snake изображений с именами
+    // "<snake>_<shot>.jpg" (разметка FileUtils::isSameSource)
+    static std::vector<std::string> writeLabeledFolder(const std::string& directory,
+        int snakes, int shots_per_snake, int width, int height, uint64_t seed = 1);
+};
+
+#endif // SYNTHETIC_DATASET_H
@@ -0,0 +1,353 @@
+﻿#include "tracing.h"
+
+#ifdef SNAKE_TRACING
+
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    char phase;         // 'X' - интервал, 'C' - счётчик
+    int64_t ts_ns;
+    int64_t value;      // длительность (нс) или значение счётчика
+};
+
+// Ограничение на поток, чтобы долгий запуск не съел память
+constexpr size_t kMaxEventsPerThread = 1 << 20;
+
+struct ThreadBuffer {
+    uint32_t tid = 0;
+    std::mutex mutex;       // без конкуренции: пишет только свой поток
+    std::vector<TraceEvent> events;
+    uint64_t dropped = 0;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<TraceSite*> sites;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    uint32_t next_tid = 1;
+    std::atomic<bool> recording{ false };
+    Clock::time_point epoch = Clock::now();
+
+    std::mutex periodic_mutex;
+    std::condition_variable periodic_cv;
+    std::thread periodic_thread;
+    bool periodic_stop = false;
+
+    ~Registry() {
+        {
+            std::lock_guard<std::mutex> lock(periodic_mutex);
+            periodic_stop = true;
+        }
+        periodic_cv.notify_all();
+        if (periodic_thread.joinable()) {
+            periodic_thread.join();
+        }
+    }
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+ThreadBuffer& threadBuffer() {
+    thread_local std::shared_ptr<ThreadBuffer> buffer = []() {
+        auto created = std::make_shared<ThreadBuffer>();
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        created->tid = r.next_tid++;
+        r.buffers.push_back(created);
+        return created;
+    }();
+    return *buffer;
+}
+
+void recordEvent(const char* name, char phase, int64_t ts_ns, int64_t value) {
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    if (buffer.events.size() >= kMaxEventsPerThread) {
+        buffer.dropped++;
+        return;
+    }
+    buffer.events.push_back({ name, phase, ts_ns, value });
+}
+
+int64_t sinceEpochNs(Clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t - registry().epoch).count();
+}
+
+void writeJsonString(std::ostream& out, const char* s) {
+    out << '"';
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') out << '\\';
+        out << *s;
+    }
+    out << '"';
+}
+
+void atomicMax(std::atomic<int64_t>& target, int64_t value) {
+    int64_t current = target.load(std::memory_order_relaxed);
+    while (value > current &&
+        !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+} // namespace
+
+TraceSite::TraceSite(const char* name, bool is_counter)
+    : name_(name), is_counter_(is_counter) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.sites.push_back(this);
+}
+
+int TraceSite::bucketFor(uint64_t nanoseconds) {
+    if (nanoseconds < 4) return static_cast<int>(nanoseconds);
+    int msb = 0;
+    for (uint64_t v = nanoseconds; v >>= 1; ) ++msb;
+    int sub = static_cast<int>((nanoseconds >> (msb - 2)) & 3);
+    return msb * 4 + sub;
+}
+
+double TraceSite::bucketUpperMs(int bucket) {
+    if (bucket < 4) return (bucket + 1) / 1e6;
+    int msb = bucket / 4;
+    int sub = bucket % 4;
+    double step = static_cast<double>(1ull << (msb - 2));
+    double lower = static_cast<double>(1ull << msb) + sub * step;
+    return (lower + step) / 1e6;
+}
+
+void TraceSite::recordDuration(int64_t nanoseconds) {
+    count_.fetch_add(1, std::memory_order_relaxed);
+    total_.fetch_add(nanoseconds, std::memory_order_relaxed);
+    atomicMax(max_, nanoseconds);
+    buckets_[bucketFor(static_cast<uint64_t>(std::max<int64_t>(0, nanoseconds)))]
+        .fetch_add(1, std::memory_order_relaxed);
+}
+
+void TraceSite::addCount(int64_t delta) {
+    count_.fetch_add(1, std::memory_order_relaxed);
+    total_.fetch_add(delta, std::memory_order_relaxed);
+}
+
+TraceSummaryRow TraceSite::snapshot() const {
+    TraceSummaryRow row;
+    row.name = name_;
+    row.is_counter = is_counter_;
+    row.count = count_.load(std::memory_order_relaxed);
+    row.total = total_.load(std::memory_order_relaxed);
+    if (is_counter_ || row.count == 0) return row;
+
+    row.mean_ms = row.total / 1e6 / row.count;
+    row.max_ms = max_.load(std::memory_order_relaxed) / 1e6;
+
+    // Перцентили - по верхней границе корзины гистограммы
+    uint64_t seen = 0;
+    double* targets[] = { &row.p50_ms, &row.p90_ms, &row.p99_ms };
+    const double quantiles[] = { 0.5, 0.9, 0.99 };
+    int next = 0;
+    for (int b = 0; b < kBuckets && next < 3; ++b) {
+        seen += buckets_[b].load(std::memory_order_relaxed);
+        while (next < 3 && seen >= quantiles[next] * row.count) {
+            *targets[next] = std::min(bucketUpperMs(b), row.max_ms);
+            ++next;
+        }
+    }
+    return row;
+}
+
+void TraceSite::reset() {
+    count_ = 0;
+    total_ = 0;
+    max_ = 0;
+    for (auto& bucket : buckets_) bucket = 0;
+}
+
+TraceSpan::~TraceSpan() {
+    auto end = Clock::now();
+    int64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start_).count();
+    site_.recordDuration(duration);
+    if (registry().recording.load(std::memory_order_relaxed)) {
+        recordEvent(site_.name(), 'X', sinceEpochNs(start_), duration);
+    }
+}
+
+void traceCounter(TraceSite& site, int64_t delta) {
+    site.addCount(delta);
+    if (registry().recording.load(std::memory_order_relaxed)) {
+        recordEvent(site.name(), 'C', sinceEpochNs(Clock::now()), delta);
+    }
+}
+
+void Tracer::setRecording(bool enabled) {
+    registry().recording = enabled;
+}
+
+bool Tracer::isRecording() {
+    return registry().recording;
+}
+
+bool Tracer::writeChromeTrace(const std::string& path) {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        std::cerr << "Error opening file: " << path << std::endl;
+        return false;
+    }
+
+    Registry& r = registry();
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        buffers = r.buffers;
+    }
+
+    // Счётчики в trace-event - текущее значение, поэтому накапливаем сумму
+    std::vector<std::pair<const char*, int64_t>> counter_totals;
+
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+    uint64_t dropped = 0;
+    for (const auto& buffer : buffers) {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        dropped += buffer->dropped;
+        for (const TraceEvent& e : buffer->events) {
+            if (!first) out << ",\n";
+            first = false;
+
+            out << "{\"name\":";
+            writeJsonString(out, e.name);
+            out << ",\"ph\":\"" << e.phase << "\",\"pid\":1,\"tid\":" << buffer->tid
+                << ",\"ts\":" << std::fixed << std::setprecision(3) << e.ts_ns / 1000.0;
+            if (e.phase == 'X') {
+                out << ",\"dur\":" << e.value / 1000.0 << "}";
+            }
+            else {
+                auto it = std::find_if(counter_totals.begin(), counter_totals.end(),
+                    [&](const auto& c) { return c.first == e.name; });
+                if (it == counter_totals.end()) {
+                    counter_totals.push_back({ e.name, 0 });
+                    it = counter_totals.end() - 1;
+                }
+                it->second += e.value;
+                out << ",\"args\":{\"value\":" << it->second << "}}";
+            }
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":" << dropped << "}}\n";
+    return true;
+}
+
+std::vector<TraceSummaryRow> Tracer::summary() {
+    Registry& r = registry();
+    std::vector<TraceSummaryRow> rows;
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (const TraceSite* site : r.sites) {
+        TraceSummaryRow row = site->snapshot();
+        if (row.count == 0) continue;
+
+        // Одно имя может встречаться в нескольких местах кода
+        auto it = std::find_if(rows.begin(), rows.end(),
+            [&](const TraceSummaryRow& existing) { return existing.name == row.name; });
+        if (it == rows.end()) {
+            rows.push_back(row);
+        }
+        else {
+            it->count += row.count;
+            it->total += row.total;
+            it->mean_ms = it->is_counter ? 0 : it->total / 1e6 / it->count;
+            it->p50_ms = std::max(it->p50_ms, row.p50_ms);
+            it->p90_ms = std::max(it->p90_ms, row.p90_ms);
+            it->p99_ms = std::max(it->p99_ms, row.p99_ms);
+            it->max_ms = std::max(it->max_ms, row.max_ms);
+        }
+    }
+    std::sort(rows.begin(), rows.end(),
+        [](const TraceSummaryRow& a, const TraceSummaryRow& b) { return a.name < b.name; });
+    return rows;
+}
+
+void Tracer::printSummary(std::ostream& out) {
+    out << std::left << std::setw(28) << "name" << std::right
+        << std::setw(10) << "count" << std::setw(12) << "total_ms"
+        << std::setw(10) << "mean" << std::setw(10) << "p50"
+        << std::setw(10) << "p90" << std::setw(10) << "p99"
+        << std::setw(10) << "max" << "\n";
+    out << std::fixed << std::setprecision(3);
+    for (const auto& row : summary()) {
+        out << std::left << std::setw(28) << row.name << std::right
+            << std::setw(10) << row.count;
+        if (row.is_counter) {
+            out << std::setw(12) << row.total << "  (counter)\n";
+            continue;
+        }
+        out << std::setw(12) << row.total / 1e6
+            << std::setw(10) << row.mean_ms << std::setw(10) << row.p50_ms
+            << std::setw(10) << row.p90_ms << std::setw(10) << row.p99_ms
+            << std::setw(10) << row.max_ms << "\n";
+    }
+    out.flush();
+}
+
+void Tracer::startPeriodicSummary(std::ostream& out, double interval_seconds) {
+    stopPeriodicSummary();
+    if (interval_seconds <= 0) return;
+
+    Registry& r = registry();
+    r.periodic_stop = false;
+    r.periodic_thread = std::thread([&r, &out, interval_seconds]() {
+        std::unique_lock<std::mutex> lock(r.periodic_mutex);
+        auto interval = std::chrono::duration<double>(interval_seconds);
+        while (!r.periodic_cv.wait_for(lock, interval, [&r]() { return r.periodic_stop; })) {
+            printSummary(out);
+        }
+        });
+}
+
+void Tracer::stopPeriodicSummary() {
+    Registry& r = registry();
+    {
+        std::lock_guard<std::mutex> lock(r.periodic_mutex);
+        r.periodic_stop = true;
+    }
+    r.periodic_cv.notify_all();
+    if (r.periodic_thread.joinable()) {
+        r.periodic_thread.join();
+    }
+}
+
+void Tracer::reset() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (TraceSite* site : r.sites) site->reset();
+    for (auto& buffer : r.buffers) {
+        std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+        buffer->events.clear();
+        buffer->dropped = 0;
+    }
+}
+
+#else // SNAKE_TRACING
+
+void Tracer::setRecording(bool) {}
+bool Tracer::isRecording() { return false; }
+bool Tracer::writeChromeTrace(const std::string&) { return false; }
+std::vector<TraceSummaryRow> Tracer::summary() { return {}; }
+void Tracer::printSummary(std::ostream&) {}
+void Tracer::startPeriodicSummary(std::ostream&, double) {}
+void Tracer::stopPeriodicSummary() {}
+void Tracer::reset() {}
+
+#endif // SNAKE_TRACING
@@ -0,0 +1,135 @@
+﻿#ifndef TRACING_H
+#define TRACING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Лёгкая трассировка горячих путей: интервалы (spans), счётчики и
+// гистограммы задержек с экспортом в формат Chrome trace-event
+// (chrome://tracing, Perfetto).
+//
+// Включается определением SNAKE_TRACING при сборке (опция CMake
+// SNAKE_ENABLE_TRACING). Без него макросы раскрываются в пустоту,
+// а методы Tracer ничего не делают.
+//
+//   SNAKE_TRACE_SCOPE("extract.sift");          // интервал до конца блока
+//   SNAKE_TRACE_COUNTER("extract.keypoints", n); // прибавить n к счётчику
+//
+// Статистика (число вызовов, сумма, p50/p90/p99) собирается всегда, когда
+// трассировка собрана; запись отдельных событий для Chrome trace включается
+// Tracer::setRecording(true).
+
+struct TraceSummaryRow {
+    std::string name;
+    bool is_counter = false;
+    uint64_t count = 0;         // число интервалов / обновлений счётчика
+    int64_t total = 0;          // сумма длительностей (нс) / значение счётчика
+    double mean_ms = 0;
+    double p50_ms = 0;
+    double p90_ms = 0;
+    double p99_ms = 0;
+    double max_ms = 0;
+};
+
+class Tracer {
+public:
+    static constexpr bool compiledIn() {
+#ifdef SNAKE_TRACING
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Запись событий для Chrome trace (статистика собирается и без неё)
+    static void setRecording(bool enabled);
+    static bool isRecording();
+
+    // Все записанные события в формате trace-event JSON
+    static bool writeChromeTrace(const std::string& path);
+
+    static std::vector<TraceSummaryRow> summary();
+    static void printSummary(std::ostream& out);
+
+    // Печатать сводку раз в interval_seconds из фонового потока (0 - остановить)
+    static void startPeriodicSummary(std::ostream& out, double interval_seconds);
+    static void stopPeriodicSummary();
+
+    // Сбросить статистику и события
+    static void reset();
+};
+
+#ifdef SNAKE_TRACING
+
+// Точка трассировки: создаётся один раз на место вызова (static),
+// хранит гистограмму длительностей. Обновления - relaxed атомики.
+class TraceSite {
+public:
+    // 4 линейных поддиапазона на каждую степень двойки наносекунд
+    static constexpr int kBuckets = 64 * 4;
+
+    TraceSite(const char* name, bool is_counter = false);
+
+    void recordDuration(int64_t nanoseconds);
+    void addCount(int64_t delta);
+
+    const char* name() const { return name_; }
+    bool isCounter() const { return is_counter_; }
+
+    TraceSummaryRow snapshot() const;
+    void reset();
+
+    static int bucketFor(uint64_t nanoseconds);
+    static double bucketUpperMs(int bucket);
+
+private:
+    const char* name_;
+    bool is_counter_;
+    std::atomic<uint64_t> count_{ 0 };
+    std::atomic<int64_t> total_{ 0 };
+    std::atomic<int64_t> max_{ 0 };
+    std::atomic<uint64_t> buckets_[kBuckets] = {};
+};
+
+class TraceSpan {
+public:
+    explicit TraceSpan(TraceSite& site)
+        : site_(site), start_(std::chrono::steady_clock::now()) {
+    }
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    TraceSite& site_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+void traceCounter(TraceSite& site, int64_t delta);
+
+#define SNAKE_TRACE_CONCAT_INNER(a, b) a##b
+#define SNAKE_TRACE_CONCAT(a, b) SNAKE_TRACE_CONCAT_INNER(a, b)
+
+#define SNAKE_TRACE_SCOPE(name) \
+    static TraceSite SNAKE_TRACE_CONCAT(snake_trace_site_, __LINE__)(name); \
+    TraceSpan SNAKE_TRACE_CONCAT(snake_trace_span_, __LINE__)(SNAKE_TRACE_CONCAT(snake_trace_site_, __LINE__))
+
+#define SNAKE_TRACE_COUNTER(name, delta) \
+    do { \
+        static TraceSite snake_trace_counter_site(name, true); \
+        traceCounter(snake_trace_counter_site, static_cast<int64_t>(delta)); \
+    } while (0)
+
+#else
+
+#define SNAKE_TRACE_SCOPE(name) do {} while (0)
+#define SNAKE_TRACE_COUNTER(name, delta) do {} while (0)
+
+#endif // SNAKE_TRACING
+
+#endif // TRACING_H